@@ -28,6 +28,7 @@
 
 #include "csm-app.h"
 #include "csm-exported-app.h"
+#include "csm-timeline.h"
 
 #define CSM_APP_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), CSM_TYPE_APP, CsmAppPrivate))
 
@@ -123,6 +124,28 @@ csm_app_get_phase (CsmExportedApp        *skeleton,
         return TRUE;
 }
 
+static gboolean
+csm_app_get_scheduling_hints (CsmExportedApp        *skeleton,
+                              GDBusMethodInvocation *invocation,
+                              CsmApp                *app)
+{
+        GVariant *hints;
+
+        hints = NULL;
+        if (CSM_APP_GET_CLASS (app)->impl_get_scheduling_hints) {
+                hints = CSM_APP_GET_CLASS (app)->impl_get_scheduling_hints (app);
+        }
+
+        if (hints == NULL) {
+                hints = g_variant_new ("a{sv}", NULL);
+        }
+
+        csm_exported_app_complete_get_scheduling_hints (skeleton,
+                                                        invocation,
+                                                        hints);
+        return TRUE;
+}
+
 static guint32
 get_next_app_serial (void)
 {
@@ -175,6 +198,8 @@ register_app (CsmApp *app)
                           G_CALLBACK (csm_app_get_startup_id), app);
         g_signal_connect (skeleton, "handle-get-phase",
                           G_CALLBACK (csm_app_get_phase), app);
+        g_signal_connect (skeleton, "handle-get-scheduling-hints",
+                          G_CALLBACK (csm_app_get_scheduling_hints), app);
 
         return TRUE;
 }
@@ -327,6 +352,9 @@ csm_app_class_init (CsmAppClass *klass)
         klass->impl_get_provides = NULL;
         klass->impl_is_running = NULL;
         klass->impl_peek_autostart_delay = NULL;
+        klass->impl_peek_after = NULL;
+        klass->impl_peek_requires = NULL;
+        klass->impl_get_scheduling_hints = NULL;
 
         g_object_class_install_property (object_class,
                                          PROP_PHASE,
@@ -543,6 +571,8 @@ csm_app_registered (CsmApp *app)
 {
         g_return_if_fail (CSM_IS_APP (app));
 
+        csm_timeline_record (CSM_TIMELINE_APP_REGISTER, csm_app_peek_app_id (app));
+
         g_signal_emit (app, signals[REGISTERED], 0);
 }
 
@@ -558,12 +588,53 @@ csm_app_peek_autostart_delay (CsmApp *app)
         }
 }
 
+const char * const *
+csm_app_peek_after (CsmApp *app)
+{
+        g_return_val_if_fail (CSM_IS_APP (app), NULL);
+
+        if (CSM_APP_GET_CLASS (app)->impl_peek_after) {
+                return CSM_APP_GET_CLASS (app)->impl_peek_after (app);
+        } else {
+                return NULL;
+        }
+}
+
+const char * const *
+csm_app_peek_requires (CsmApp *app)
+{
+        g_return_val_if_fail (CSM_IS_APP (app), NULL);
+
+        if (CSM_APP_GET_CLASS (app)->impl_peek_requires) {
+                return CSM_APP_GET_CLASS (app)->impl_peek_requires (app);
+        } else {
+                return NULL;
+        }
+}
+
+/* Whether the app declares explicit startup ordering, in which case the
+ * dependency scheduler may start it ahead of its legacy phase. */
+gboolean
+csm_app_has_ordering (CsmApp *app)
+{
+        const char * const *after;
+        const char * const *requires;
+
+        after = csm_app_peek_after (app);
+        requires = csm_app_peek_requires (app);
+
+        return (after != NULL && after[0] != NULL) ||
+               (requires != NULL && requires[0] != NULL);
+}
+
 void
 csm_app_exited (CsmApp *app,
                 guchar  exit_code)
 {
         g_return_if_fail (CSM_IS_APP (app));
 
+        csm_timeline_record (CSM_TIMELINE_APP_EXIT, csm_app_peek_app_id (app));
+
         g_signal_emit (app, signals[EXITED], 0, exit_code);
 }
 
@@ -573,5 +644,7 @@ csm_app_died (CsmApp *app,
 {
         g_return_if_fail (CSM_IS_APP (app));
 
+        csm_timeline_record (CSM_TIMELINE_APP_EXIT, csm_app_peek_app_id (app));
+
         g_signal_emit (app, signals[DIED], 0, signal);
 }
@@ -77,6 +77,9 @@ struct _CsmAppClass
         const char *(*impl_get_app_id)                (CsmApp     *app);
         gboolean    (*impl_is_disabled)               (CsmApp     *app);
         gboolean    (*impl_is_conditionally_disabled) (CsmApp     *app);
+        const char * const *(*impl_peek_after)        (CsmApp     *app);
+        const char * const *(*impl_peek_requires)     (CsmApp     *app);
+        GVariant *  (*impl_get_scheduling_hints)      (CsmApp     *app);
 };
 
 typedef enum
@@ -122,6 +125,9 @@ gboolean         csm_app_has_autostart_condition        (CsmApp     *app,
                                                          const char *condition);
 void             csm_app_registered                     (CsmApp     *app);
 int              csm_app_peek_autostart_delay           (CsmApp     *app);
+const char * const *csm_app_peek_after                  (CsmApp     *app);
+const char * const *csm_app_peek_requires               (CsmApp     *app);
+gboolean         csm_app_has_ordering                   (CsmApp     *app);
 
 G_END_DECLS
 
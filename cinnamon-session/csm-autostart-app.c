@@ -21,8 +21,10 @@
 
 #include <config.h>
 
-#include <ctype.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <errno.h>
 
@@ -32,43 +34,67 @@
 
 #include "csm-autostart-app.h"
 #include "csm-util.h"
+#include "csm-timeline.h"
+#include "csm-autostart-cache.h"
+#include "csm-readahead.h"
+#include "csm-launcher.h"
+#include "csm-autostart-condition.h"
+#include "csm-scheduling-hints.h"
 
 enum {
         AUTOSTART_LAUNCH_SPAWN = 0,
         AUTOSTART_LAUNCH_ACTIVATE
 };
 
-enum {
-        CSM_CONDITION_NONE           = 0,
-        CSM_CONDITION_IF_EXISTS      = 1,
-        CSM_CONDITION_UNLESS_EXISTS  = 2,
-        CSM_CONDITION_GSETTINGS      = 4,
-        CSM_CONDITION_IF_SESSION     = 5,
-        CSM_CONDITION_UNLESS_SESSION = 6,
-        CSM_CONDITION_UNKNOWN        = 7
-};
-
 #define CSM_SESSION_CLIENT_DBUS_INTERFACE "org.cinnamon.SessionClient"
 
+/* Everything load_desktop_file() needs, so a cached copy can stand in for
+ * parsing the file: phase, X-GNOME-DBus-Name, X-GNOME-Autostart-startup-id,
+ * AutostartCondition, X-GNOME-AutoRestart, X-GNOME-Autostart-Delay,
+ * X-GNOME-Provides, X-Cinnamon-After, X-Cinnamon-Requires,
+ * X-GNOME-Autostart-enabled, Hidden, OnlyShowIn, NotShowIn, the
+ * programs from TryExec and Exec that have to be found in $PATH and
+ * X-Cinnamon-Nice, X-Cinnamon-IOSchedulingClass,
+ * X-Cinnamon-IOSchedulingPriority and X-Cinnamon-CPUAffinity */
+#define AUTOSTART_RECORD_TYPE "(isssbsasasasbbmasmasas(ssss))"
+
 struct _CsmAutostartAppPrivate {
         char                 *desktop_filename;
         char                 *desktop_id;
         char                 *startup_id;
 
+        /* only parsed when needed if the rest came from the cache */
         GDesktopAppInfo      *app_info;
+        /* parsed ahead of construction, see csm_autostart_app_new_for_app_info() */
+        GDesktopAppInfo      *preparsed_app_info;
+        GVariant             *preparsed_record;
         /* provides defined in session definition */
         GSList               *session_provides;
 
         /* desktop file state */
-        char                 *condition_string;
+        CsmAutostartCondition *autostart_condition;
         gboolean              condition;
         gboolean              autorestart;
         int                   autostart_delay;
         char                 *working_dir;
+        char                **provides;
 
-        GFileMonitor         *condition_monitor;
-        guint                 condition_notify_id;
-        GSettings            *condition_settings;
+        /* inputs of is_disabled () */
+        gboolean              enabled;
+        gboolean              hidden;
+        char                **only_show_in;
+        char                **not_show_in;
+
+        /* startup ordering, app ids or provides names */
+        char                **after;
+        char                **requires;
+
+        /* scheduling hints, see apply_scheduling_hints () */
+        gboolean              has_nice;
+        int                   nice;
+        int                   ioprio;
+        gulong               *cpu_mask;
+        gsize                 cpu_mask_size;
 
         int                   launch_type;
         GPid                  pid;
@@ -82,11 +108,16 @@ enum {
 
 enum {
         PROP_0,
-        PROP_DESKTOP_FILENAME
+        PROP_DESKTOP_FILENAME,
+        PROP_APP_INFO,
+        PROP_RECORD
 };
 
 static guint signals[LAST_SIGNAL] = { 0 };
 
+/* put each spawned app in its own systemd scope */
+static gboolean use_systemd_scopes = FALSE;
+
 #define CSM_AUTOSTART_APP_GET_PRIVATE(object) (G_TYPE_INSTANCE_GET_PRIVATE ((object), CSM_TYPE_AUTOSTART_APP, CsmAutostartAppPrivate))
 
 static void csm_autostart_app_initable_iface_init (GInitableIface *iface);
@@ -100,12 +131,29 @@ csm_autostart_app_init (CsmAutostartApp *app)
         app->priv = CSM_AUTOSTART_APP_GET_PRIVATE (app);
 
         app->priv->pid = -1;
-        app->priv->condition_monitor = NULL;
         app->priv->condition = FALSE;
         app->priv->autostart_delay = -1;
         app->priv->working_dir = NULL;
 }
 
+/* Same as g_desktop_app_info_get_show_in () */
+static gboolean
+get_show_in (CsmAutostartApp *app,
+             const char      *desktop)
+{
+        if (app->priv->only_show_in != NULL &&
+            g_strv_contains ((const char * const *) app->priv->only_show_in, desktop)) {
+                return TRUE;
+        }
+
+        if (app->priv->not_show_in != NULL &&
+            g_strv_contains ((const char * const *) app->priv->not_show_in, desktop)) {
+                return FALSE;
+        }
+
+        return app->priv->only_show_in == NULL;
+}
+
 static gboolean
 is_disabled (CsmApp *app)
 {
@@ -121,17 +169,14 @@ is_disabled (CsmApp *app)
         priv = CSM_AUTOSTART_APP (app)->priv;
 
         /* CSM_AUTOSTART_APP_ENABLED_KEY key, used by old  */
-        if (g_desktop_app_info_has_key (priv->app_info,
-                                        CSM_AUTOSTART_APP_ENABLED_KEY) &&
-            !g_desktop_app_info_get_boolean (priv->app_info,
-                                             CSM_AUTOSTART_APP_ENABLED_KEY)) {
+        if (!priv->enabled) {
                 g_debug ("app %s is disabled by " CSM_AUTOSTART_APP_ENABLED_KEY,
                          csm_app_peek_id (app));
                 return TRUE;
         }
 
         /* Hidden key, used by autostart spec */
-        if (g_desktop_app_info_get_is_hidden (priv->app_info)) {
+        if (priv->hidden) {
                 g_debug ("app %s is disabled by Hidden",
                          csm_app_peek_id (app));
                 return TRUE;
@@ -139,12 +184,9 @@ is_disabled (CsmApp *app)
 
         /* Check OnlyShowIn/NotShowIn/TryExec */
         current_desktop = csm_util_get_current_desktop ();
-        g_desktop_app_info_set_desktop_env (current_desktop);
         if (current_desktop != NULL &&
-            !g_desktop_app_info_get_show_in (G_DESKTOP_APP_INFO (priv->app_info),
-                                             "GNOME") &&
-            !g_desktop_app_info_get_show_in (G_DESKTOP_APP_INFO (priv->app_info),
-                                             current_desktop)) {
+            !get_show_in (CSM_AUTOSTART_APP (app), "GNOME") &&
+            !get_show_in (CSM_AUTOSTART_APP (app), current_desktop)) {
                         g_debug ("app %s not for %s",
                                  csm_app_peek_id (app), current_desktop);
                 return TRUE;
@@ -156,418 +198,199 @@ is_disabled (CsmApp *app)
         return FALSE;
 }
 
-static gboolean
-parse_condition_string (const char *condition_string,
-                        guint      *condition_kindp,
-                        char      **keyp)
-{
-        const char *space;
-        const char *key;
-        int         len;
-        guint       kind;
-
-        space = condition_string + strcspn (condition_string, " ");
-        len = space - condition_string;
-        key = space;
-        while (isspace ((unsigned char)*key)) {
-                key++;
-        }
-
-        kind = CSM_CONDITION_UNKNOWN;
-
-        if (!g_ascii_strncasecmp (condition_string, "if-exists", len) && key) {
-                kind = CSM_CONDITION_IF_EXISTS;
-        } else if (!g_ascii_strncasecmp (condition_string, "unless-exists", len) && key) {
-                kind = CSM_CONDITION_UNLESS_EXISTS;
-        } else if (!g_ascii_strncasecmp (condition_string, "GSettings", len)) {
-                kind = CSM_CONDITION_GSETTINGS;
-        } else if (!g_ascii_strncasecmp (condition_string, "GNOME3", len)) {
-                condition_string = key;
-                space = condition_string + strcspn (condition_string, " ");
-                len = space - condition_string;
-                key = space;
-                while (isspace ((unsigned char)*key)) {
-                        key++;
-                }
-                if (!g_ascii_strncasecmp (condition_string, "if-session", len) && key) {
-                        kind = CSM_CONDITION_IF_SESSION;
-                } else if (!g_ascii_strncasecmp (condition_string, "unless-session", len) && key) {
-                        kind = CSM_CONDITION_UNLESS_SESSION;
-                }
-        }
-
-        if (kind == CSM_CONDITION_UNKNOWN) {
-                key = NULL;
-        }
-
-        if (keyp != NULL) {
-                *keyp = g_strdup (key);
-        }
-
-        if (condition_kindp != NULL) {
-                *condition_kindp = kind;
-        }
-
-        return (kind != CSM_CONDITION_UNKNOWN);
-}
-
 static void
-if_exists_condition_cb (GFileMonitor     *monitor,
-                        GFile            *file,
-                        GFile            *other_file,
-                        GFileMonitorEvent event,
-                        CsmApp           *app)
+on_condition_changed (CsmAutostartCondition *autostart_condition,
+                      CsmAutostartApp       *app)
 {
-        CsmAutostartAppPrivate *priv;
-        gboolean                condition = FALSE;
+        gboolean condition;
 
-        priv = CSM_AUTOSTART_APP (app)->priv;
+        condition = csm_autostart_condition_evaluate (autostart_condition);
 
-        switch (event) {
-        case G_FILE_MONITOR_EVENT_CREATED:
-                condition = TRUE;
-                break;
-        case G_FILE_MONITOR_EVENT_DELETED:
-                condition = FALSE;
-                break;
-        default:
-                /* Ignore any other monitor event */
-                return;
-        }
+        g_debug ("CsmAutostartApp: app:%s condition changed condition:%d",
+                 csm_app_peek_id (CSM_APP (app)),
+                 condition);
 
         /* Emit only if the condition actually changed */
-        if (condition != priv->condition) {
-                priv->condition = condition;
+        if (condition != app->priv->condition) {
+                app->priv->condition = condition;
                 g_signal_emit (app, signals[CONDITION_CHANGED], 0, condition);
         }
 }
 
 static void
-unless_exists_condition_cb (GFileMonitor     *monitor,
-                            GFile            *file,
-                            GFile            *other_file,
-                            GFileMonitorEvent event,
-                            CsmApp           *app)
+setup_condition_monitor (CsmAutostartApp *app,
+                         const char      *condition_string)
 {
-        CsmAutostartAppPrivate *priv;
-        gboolean                condition = FALSE;
-
-        priv = CSM_AUTOSTART_APP (app)->priv;
+        g_clear_pointer (&app->priv->autostart_condition, csm_autostart_condition_free);
 
-        switch (event) {
-        case G_FILE_MONITOR_EVENT_CREATED:
-                condition = FALSE;
-                break;
-        case G_FILE_MONITOR_EVENT_DELETED:
-                condition = TRUE;
-                break;
-        default:
-                /* Ignore any other monitor event */
+        if (condition_string == NULL) {
                 return;
         }
 
-        /* Emit only if the condition actually changed */
-        if (condition != priv->condition) {
-                priv->condition = condition;
-                g_signal_emit (app, signals[CONDITION_CHANGED], 0, condition);
+        app->priv->autostart_condition = csm_autostart_condition_new (condition_string);
+
+        /* if it is disabled outright there is no point in monitoring */
+        if (is_disabled (CSM_APP (app))) {
+                return;
         }
+
+        csm_autostart_condition_watch (app->priv->autostart_condition,
+                                       (CsmAutostartConditionFunc) on_condition_changed,
+                                       app);
 }
 
-static void
-gsettings_condition_cb (GSettings  *settings,
-                        const char *key,
-                        gpointer    user_data)
+static char **
+get_string_list (GDesktopAppInfo *app_info,
+                 const char      *key)
 {
-        CsmApp                 *app;
-        CsmAutostartAppPrivate *priv;
-        gboolean                condition;
+        char      *str;
+        char     **items;
+        GPtrArray *list;
+        int        i;
 
-        g_return_if_fail (CSM_IS_APP (user_data));
-
-        app = CSM_APP (user_data);
-
-        priv = CSM_AUTOSTART_APP (app)->priv;
+        str = g_desktop_app_info_get_string (app_info, key);
+        if (str == NULL) {
+                return NULL;
+        }
 
-        condition = g_settings_get_boolean (settings, key);
+        items = g_strsplit (str, ";", -1);
+        g_free (str);
 
-        g_debug ("CsmAutostartApp: app:%s condition changed condition:%d",
-                 csm_app_peek_id (app),
-                 condition);
+        list = g_ptr_array_new ();
+        for (i = 0; items[i] != NULL; i++) {
+                g_strstrip (items[i]);
+                if (items[i][0] != '\0') {
+                        g_ptr_array_add (list, g_strdup (items[i]));
+                }
+        }
+        g_strfreev (items);
 
-        /* Emit only if the condition actually changed */
-        if (condition != priv->condition) {
-                priv->condition = condition;
-                g_signal_emit (app, signals[CONDITION_CHANGED], 0, condition);
+        if (list->len == 0) {
+                g_ptr_array_free (list, TRUE);
+                return NULL;
         }
-}
 
-static gboolean
-contained (const gchar * const *items,
-           const gchar         *item)
-{
-        while (*items)
-                if (strcmp (*items++, item) == 0)
-                        return TRUE;
-        return FALSE;
+        g_ptr_array_add (list, NULL);
+
+        return (char **) g_ptr_array_free (list, FALSE);
 }
 
-static gboolean
-check_gsettings_schema_has_key (GSettingsSchema   *schema,
-                                const gchar *key)
+static GVariant *
+get_string_list_variant (GDesktopAppInfo *app_info,
+                         const char      *key)
 {
-        gboolean good;
-        gchar **keys;
+        char    **list;
+        GVariant *value;
 
-        keys = g_settings_schema_list_keys (schema);
-        good = contained ((const gchar **) keys, key);
-        g_strfreev (keys);
+        list = get_string_list (app_info, key);
+        value = g_variant_new_strv ((const char * const *) list, list != NULL ? -1 : 0);
+        g_strfreev (list);
 
-        return good;
+        return value;
 }
 
-static gboolean
-setup_gsettings_condition_monitor (CsmAutostartApp *app,
-                                   const char      *key)
+/* OnlyShowIn= with no desktops is not the same as no OnlyShowIn */
+static GVariant *
+get_show_in_variant (GDesktopAppInfo *app_info,
+                     const char      *key)
 {
-        GSettingsSchemaSource *source;
-        GSettingsSchema *schema;
-        GSettings *settings;
-        char **elems;
-        gboolean retval;
-        char *signal;
-
-        retval = FALSE;
-
-        elems = g_strsplit (key, " ", 2);
-
-        if (elems == NULL)
-                goto out;
+        GVariant *list;
 
-        if (elems[0] == NULL || elems[1] == NULL)
-                goto out;
-
-        source = g_settings_schema_source_get_default ();
-
-        schema = g_settings_schema_source_lookup (source, elems[0], TRUE);
-
-        if (schema == NULL)
-                goto out;
-
-        if (!check_gsettings_schema_has_key(schema, elems[1])) {
-                g_warning ("Gsettings key %s %s could not be found!",
-                           elems[0],
-                           elems[1]);
-                goto out;
+        list = NULL;
+        if (g_desktop_app_info_has_key (app_info, key)) {
+                list = get_string_list_variant (app_info, key);
         }
 
-        settings = g_settings_new_full (schema, NULL, NULL);
-        retval = g_settings_get_boolean (settings, elems[1]);
-        g_settings_schema_unref (schema);
-
-        signal = g_strdup_printf ("changed::%s", elems[1]);
-        g_signal_connect (G_OBJECT (settings), signal,
-                          G_CALLBACK (gsettings_condition_cb), app);
-        g_free (signal);
-
-        app->priv->condition_settings = settings;
-
-out:
-        g_strfreev (elems);
-
-        return retval;
+        return g_variant_new_maybe (G_VARIANT_TYPE_STRING_ARRAY, list);
 }
 
-static void
-if_session_condition_cb (GObject    *object,
-                         GParamSpec *pspec,
-                         gpointer    user_data)
+static char *
+get_string_or_empty (GDesktopAppInfo *app_info,
+                     const char      *key)
 {
-        CsmApp                 *app;
-        CsmAutostartAppPrivate *priv;
-        char                   *session_name;
-        char                   *key;
-        gboolean                condition;
-
-        g_return_if_fail (CSM_IS_APP (user_data));
-
-        app = CSM_APP (user_data);
-
-        priv = CSM_AUTOSTART_APP (app)->priv;
-
-        parse_condition_string (priv->condition_string, NULL, &key);
+        char *str;
 
-        g_object_get (object, "session-name", &session_name, NULL);
-        condition = strcmp (session_name, key) == 0;
-        g_free (session_name);
+        str = g_desktop_app_info_get_string (app_info, key);
 
-        g_free (key);
-
-        g_debug ("CsmAutostartApp: app:%s condition changed condition:%d",
-                 csm_app_peek_id (app),
-                 condition);
-
-        /* Emit only if the condition actually changed */
-        if (condition != priv->condition) {
-                priv->condition = condition;
-                g_signal_emit (app, signals[CONDITION_CHANGED], 0, condition);
-        }
+        return str != NULL ? str : g_strdup ("");
 }
 
-static void
-unless_session_condition_cb (GObject    *object,
-                             GParamSpec *pspec,
-                             gpointer    user_data)
+/* GDesktopAppInfo refuses files whose TryExec or Exec binary is missing,
+ * so a cached record is only good while those can still be found */
+static GVariant *
+get_required_programs (GDesktopAppInfo *app_info)
 {
-        CsmApp                 *app;
-        CsmAutostartAppPrivate *priv;
-        char                   *session_name;
-        char                   *key;
-        gboolean                condition;
-
-        g_return_if_fail (CSM_IS_APP (user_data));
-
-        app = CSM_APP (user_data);
-
-        priv = CSM_AUTOSTART_APP (app)->priv;
-
-        parse_condition_string (priv->condition_string, NULL, &key);
-
-        g_object_get (object, "session-name", &session_name, NULL);
-        condition = strcmp (session_name, key) != 0;
-        g_free (session_name);
+        GPtrArray *programs;
+        char      *str;
+        char     **argv;
+        GVariant  *value;
 
-        g_free (key);
+        programs = g_ptr_array_new_with_free_func (g_free);
 
-        g_debug ("CsmAutostartApp: app:%s condition changed condition:%d",
-                 csm_app_peek_id (app),
-                 condition);
-
-        /* Emit only if the condition actually changed */
-        if (condition != priv->condition) {
-                priv->condition = condition;
-                g_signal_emit (app, signals[CONDITION_CHANGED], 0, condition);
+        str = g_desktop_app_info_get_string (app_info, G_KEY_FILE_DESKTOP_KEY_TRY_EXEC);
+        if (!IS_STRING_EMPTY (str)) {
+                g_ptr_array_add (programs, g_steal_pointer (&str));
         }
-}
+        g_free (str);
 
-static void
-setup_condition_monitor (CsmAutostartApp *app)
-{
-        guint    kind;
-        char    *key;
-        gboolean res;
-        gboolean disabled;
-
-        if (app->priv->condition_monitor != NULL) {
-                g_file_monitor_cancel (app->priv->condition_monitor);
+        str = g_desktop_app_info_get_string (app_info, G_KEY_FILE_DESKTOP_KEY_EXEC);
+        if (!IS_STRING_EMPTY (str) && g_shell_parse_argv (str, NULL, &argv, NULL)) {
+                g_ptr_array_add (programs, g_strdup (argv[0]));
+                g_strfreev (argv);
         }
+        g_free (str);
 
-        if (app->priv->condition_string == NULL) {
-                return;
-        }
+        g_ptr_array_add (programs, NULL);
+        value = g_variant_new_strv ((const char * const *) programs->pdata, -1);
+        g_ptr_array_unref (programs);
 
-        /* if it is disabled outright there is no point in monitoring */
-        if (is_disabled (CSM_APP (app))) {
-                return;
-        }
-
-        key = NULL;
-        res = parse_condition_string (app->priv->condition_string, &kind, &key);
-        if (! res) {
-                g_free (key);
-                return;
-        }
-
-        if (key == NULL) {
-                return;
-        }
-
-        if (kind == CSM_CONDITION_IF_EXISTS) {
-                char  *file_path;
-                GFile *file;
-
-                file_path = g_build_filename (g_get_user_config_dir (), key, NULL);
-
-                disabled = !g_file_test (file_path, G_FILE_TEST_EXISTS);
-
-                file = g_file_new_for_path (file_path);
-                app->priv->condition_monitor = g_file_monitor_file (file, 0, NULL, NULL);
-
-                g_signal_connect (app->priv->condition_monitor, "changed",
-                                  G_CALLBACK (if_exists_condition_cb),
-                                  app);
-
-                g_object_unref (file);
-                g_free (file_path);
-        } else if (kind == CSM_CONDITION_UNLESS_EXISTS) {
-                char  *file_path;
-                GFile *file;
-
-                file_path = g_build_filename (g_get_user_config_dir (), key, NULL);
-
-                disabled = g_file_test (file_path, G_FILE_TEST_EXISTS);
-
-                file = g_file_new_for_path (file_path);
-                app->priv->condition_monitor = g_file_monitor_file (file, 0, NULL, NULL);
-
-                g_signal_connect (app->priv->condition_monitor, "changed",
-                                  G_CALLBACK (unless_exists_condition_cb),
-                                  app);
-
-                g_object_unref (file);
-                g_free (file_path);
-        } else if (kind == CSM_CONDITION_GSETTINGS) {
-                disabled = !setup_gsettings_condition_monitor (app, key);
-        } else if (kind == CSM_CONDITION_IF_SESSION) {
-                CsmManager *manager;
-                char *session_name;
-
-                /* get the singleton */
-                manager = csm_manager_get ();
-
-                g_object_get (manager, "session-name", &session_name, NULL);
-                disabled = strcmp (session_name, key) != 0;
+        return value;
+}
 
-                g_signal_connect (manager, "notify::session-name",
-                                  G_CALLBACK (if_session_condition_cb), app);
-                g_free (session_name);
-        } else if (kind == CSM_CONDITION_UNLESS_SESSION) {
-                CsmManager *manager;
-                char *session_name;
+static gboolean
+programs_are_available (GVariant *record)
+{
+        const char  *program;
+        GVariantIter iter;
+        GVariant    *programs;
+        gboolean     res;
 
-                /* get the singleton */
-                manager = csm_manager_get ();
+        g_variant_get_child (record, 13, "@as", &programs);
 
-                g_object_get (manager, "session-name", &session_name, NULL);
-                disabled = strcmp (session_name, key) == 0;
+        res = TRUE;
+        g_variant_iter_init (&iter, programs);
+        while (res && g_variant_iter_next (&iter, "&s", &program)) {
+                char *path;
 
-                g_signal_connect (manager, "notify::session-name",
-                                  G_CALLBACK (unless_session_condition_cb), app);
-                g_free (session_name);
-        } else {
-                disabled = TRUE;
+                path = g_find_program_in_path (program);
+                res = path != NULL;
+                g_free (path);
         }
 
-        g_free (key);
+        g_variant_unref (programs);
 
-        if (disabled) {
-                /* FIXME: cache the disabled value? */
-        }
+        return res;
 }
 
-static gboolean
-load_desktop_file (CsmAutostartApp *app)
+/* Only uses @app_info, so this is safe to call from any thread */
+static GVariant *
+parse_desktop_file (GDesktopAppInfo *app_info)
 {
-        char    *dbus_name;
-        char    *startup_id;
-        char    *phase_str;
-        int      phase;
-        gboolean res;
-
-        if (app->priv->app_info == NULL) {
-                return FALSE;
-        }
-
-        phase_str = g_desktop_app_info_get_string (app->priv->app_info,
+        char     *phase_str;
+        int       phase;
+        char     *dbus_name;
+        char     *startup_id;
+        char     *condition;
+        char     *delay;
+        char     *nice;
+        char     *io_class;
+        char     *io_priority;
+        char     *cpu_affinity;
+        gboolean  enabled;
+        gboolean  autorestart;
+        GVariant *record;
+
+        phase_str = g_desktop_app_info_get_string (app_info,
                                                    CSM_AUTOSTART_APP_PHASE_KEY);
         if (phase_str != NULL) {
                 if (strcmp (phase_str, "EarlyInitialization") == 0) {
@@ -593,9 +416,186 @@ load_desktop_file (CsmAutostartApp *app)
                 phase = CSM_MANAGER_PHASE_APPLICATION;
         }
 
-        dbus_name = g_desktop_app_info_get_string (app->priv->app_info,
-                                                   CSM_AUTOSTART_APP_DBUS_NAME_KEY);
-        if (dbus_name != NULL) {
+        enabled = !g_desktop_app_info_has_key (app_info, CSM_AUTOSTART_APP_ENABLED_KEY) ||
+                  g_desktop_app_info_get_boolean (app_info, CSM_AUTOSTART_APP_ENABLED_KEY);
+
+        autorestart = g_desktop_app_info_has_key (app_info, CSM_AUTOSTART_APP_AUTORESTART_KEY) &&
+                      g_desktop_app_info_get_boolean (app_info, CSM_AUTOSTART_APP_AUTORESTART_KEY);
+
+        dbus_name = get_string_or_empty (app_info, CSM_AUTOSTART_APP_DBUS_NAME_KEY);
+        startup_id = get_string_or_empty (app_info, CSM_AUTOSTART_APP_STARTUP_ID_KEY);
+        condition = get_string_or_empty (app_info, "AutostartCondition");
+        delay = get_string_or_empty (app_info, CSM_AUTOSTART_APP_DELAY_KEY);
+        nice = get_string_or_empty (app_info, CSM_AUTOSTART_APP_NICE_KEY);
+        io_class = get_string_or_empty (app_info, CSM_AUTOSTART_APP_IO_CLASS_KEY);
+        io_priority = get_string_or_empty (app_info, CSM_AUTOSTART_APP_IO_PRIORITY_KEY);
+        cpu_affinity = get_string_or_empty (app_info, CSM_AUTOSTART_APP_CPU_AFFINITY_KEY);
+
+        record = g_variant_new ("(isssbs@as@as@asbb@mas@mas@as(ssss))",
+                                phase,
+                                dbus_name,
+                                startup_id,
+                                condition,
+                                autorestart,
+                                delay,
+                                get_string_list_variant (app_info, CSM_AUTOSTART_APP_PROVIDES_KEY),
+                                get_string_list_variant (app_info, CSM_AUTOSTART_APP_AFTER_KEY),
+                                get_string_list_variant (app_info, CSM_AUTOSTART_APP_REQUIRES_KEY),
+                                enabled,
+                                g_desktop_app_info_get_is_hidden (app_info),
+                                get_show_in_variant (app_info, G_KEY_FILE_DESKTOP_KEY_ONLY_SHOW_IN),
+                                get_show_in_variant (app_info, G_KEY_FILE_DESKTOP_KEY_NOT_SHOW_IN),
+                                get_required_programs (app_info),
+                                nice,
+                                io_class,
+                                io_priority,
+                                cpu_affinity);
+
+        g_free (dbus_name);
+        g_free (startup_id);
+        g_free (condition);
+        g_free (delay);
+        g_free (nice);
+        g_free (io_class);
+        g_free (io_priority);
+        g_free (cpu_affinity);
+
+        return record;
+}
+
+static char **
+strv_or_null (char **strv)
+{
+        if (strv != NULL && strv[0] == NULL) {
+                g_strfreev (strv);
+                return NULL;
+        }
+
+        return strv;
+}
+
+static char **
+get_show_in_from_variant (GVariant *maybe)
+{
+        GVariant *list;
+        char    **strv;
+
+        list = g_variant_get_maybe (maybe);
+        if (list == NULL) {
+                return NULL;
+        }
+
+        strv = g_variant_dup_strv (list, NULL);
+        g_variant_unref (list);
+
+        return strv;
+}
+
+static void
+load_nice (CsmAutostartApp *app,
+           const char      *str)
+{
+        app->priv->has_nice = FALSE;
+
+        if (str[0] == '\0') {
+                return;
+        }
+
+        if (!csm_scheduling_hints_parse_nice (str, &app->priv->nice)) {
+                g_warning ("Invalid %s=%s in %s",
+                           CSM_AUTOSTART_APP_NICE_KEY, str, app->priv->desktop_id);
+                return;
+        }
+
+        app->priv->has_nice = TRUE;
+}
+
+static void
+load_ioprio (CsmAutostartApp *app,
+             const char      *class_str,
+             const char      *priority_str)
+{
+        if (!csm_scheduling_hints_parse_ioprio (class_str, priority_str, &app->priv->ioprio)) {
+                g_warning ("Invalid %s=%s or %s=%s in %s",
+                           CSM_AUTOSTART_APP_IO_CLASS_KEY, class_str,
+                           CSM_AUTOSTART_APP_IO_PRIORITY_KEY, priority_str,
+                           app->priv->desktop_id);
+                app->priv->ioprio = 0;
+        }
+}
+
+static void
+load_cpu_affinity (CsmAutostartApp *app,
+                   const char      *str)
+{
+        g_clear_pointer (&app->priv->cpu_mask, g_free);
+        app->priv->cpu_mask_size = 0;
+
+        if (str[0] == '\0') {
+                return;
+        }
+
+        if (!csm_scheduling_hints_parse_cpu_affinity (str,
+                                                      &app->priv->cpu_mask,
+                                                      &app->priv->cpu_mask_size)) {
+                g_warning ("Invalid %s=%s in %s",
+                           CSM_AUTOSTART_APP_CPU_AFFINITY_KEY, str, app->priv->desktop_id);
+        }
+}
+
+static void
+load_desktop_file (CsmAutostartApp *app,
+                   GVariant        *record)
+{
+        const char *dbus_name;
+        const char *startup_id_key;
+        const char *condition;
+        const char *delay;
+        const char *nice;
+        const char *io_class;
+        const char *io_priority;
+        const char *cpu_affinity;
+        char       *startup_id;
+        int         phase;
+        GVariant   *only_show_in;
+        GVariant   *not_show_in;
+
+        g_strfreev (app->priv->provides);
+        g_strfreev (app->priv->after);
+        g_strfreev (app->priv->requires);
+
+        g_variant_get (record, "(i&s&s&sb&s^as^as^asbb@mas@mas@as(&s&s&s&s))",
+                       &phase,
+                       &dbus_name,
+                       &startup_id_key,
+                       &condition,
+                       &app->priv->autorestart,
+                       &delay,
+                       &app->priv->provides,
+                       &app->priv->after,
+                       &app->priv->requires,
+                       &app->priv->enabled,
+                       &app->priv->hidden,
+                       &only_show_in,
+                       &not_show_in,
+                       NULL,
+                       &nice,
+                       &io_class,
+                       &io_priority,
+                       &cpu_affinity);
+
+        app->priv->provides = strv_or_null (app->priv->provides);
+        app->priv->after = strv_or_null (app->priv->after);
+        app->priv->requires = strv_or_null (app->priv->requires);
+
+        g_strfreev (app->priv->only_show_in);
+        app->priv->only_show_in = get_show_in_from_variant (only_show_in);
+        g_strfreev (app->priv->not_show_in);
+        app->priv->not_show_in = get_show_in_from_variant (not_show_in);
+        g_variant_unref (only_show_in);
+        g_variant_unref (not_show_in);
+
+        if (dbus_name[0] != '\0') {
                 app->priv->launch_type = AUTOSTART_LAUNCH_ACTIVATE;
         } else {
                 app->priv->launch_type = AUTOSTART_LAUNCH_SPAWN;
@@ -604,11 +604,9 @@ load_desktop_file (CsmAutostartApp *app)
         /* this must only be done on first load */
         switch (app->priv->launch_type) {
         case AUTOSTART_LAUNCH_SPAWN:
-                startup_id =
-                        g_desktop_app_info_get_string (app->priv->app_info,
-                                                       CSM_AUTOSTART_APP_STARTUP_ID_KEY);
-
-                if (startup_id == NULL) {
+                if (startup_id_key[0] != '\0') {
+                        startup_id = g_strdup (startup_id_key);
+                } else {
                         startup_id = csm_util_generate_startup_id ();
                 }
                 break;
@@ -619,27 +617,15 @@ load_desktop_file (CsmAutostartApp *app)
                 g_assert_not_reached ();
         }
 
-        res = g_desktop_app_info_has_key (app->priv->app_info,
-                                          CSM_AUTOSTART_APP_AUTORESTART_KEY);
-        if (res) {
-                app->priv->autorestart = g_desktop_app_info_get_boolean (app->priv->app_info,
-                                                                         CSM_AUTOSTART_APP_AUTORESTART_KEY);
-        } else {
-                app->priv->autorestart = FALSE;
-        }
+        setup_condition_monitor (app, condition[0] != '\0' ? condition : NULL);
 
-        g_free (app->priv->condition_string);
-        app->priv->condition_string = g_desktop_app_info_get_string (app->priv->app_info,
-                                                                   "AutostartCondition");
-        setup_condition_monitor (app);
+        load_nice (app, nice);
+        load_ioprio (app, io_class, io_priority);
+        load_cpu_affinity (app, cpu_affinity);
 
         if (phase == CSM_MANAGER_PHASE_APPLICATION) {
             /* Only accept an autostart delay for the application phase */
-            const char *delay;
-            delay = g_desktop_app_info_get_string (app->priv->app_info,
-                                                   CSM_AUTOSTART_APP_DELAY_KEY);
-
-            if (delay != NULL) {
+            if (delay[0] != '\0') {
                     app->priv->autostart_delay = strtol (delay, NULL, 10);
 
                     if (app->priv->autostart_delay < 0) {
@@ -657,9 +643,22 @@ load_desktop_file (CsmAutostartApp *app)
                       NULL);
 
         g_free (startup_id);
-        g_free (dbus_name);
+}
 
-        return TRUE;
+static GDesktopAppInfo *
+get_app_info (CsmAutostartApp *app,
+              GError         **error)
+{
+        if (app->priv->app_info == NULL) {
+                app->priv->app_info = g_desktop_app_info_new_from_filename (app->priv->desktop_filename);
+        }
+
+        if (app->priv->app_info == NULL) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                             "Could not parse desktop file %s or it references a not found TryExec binary", app->priv->desktop_id);
+        }
+
+        return app->priv->app_info;
 }
 
 static gboolean
@@ -667,20 +666,43 @@ csm_autostart_app_initable_init (GInitable *initable,
                                  GCancellable *cancellable,
                                  GError  **error)
 {
-        CsmAutostartApp *app = CSM_AUTOSTART_APP (initable);
+        CsmAutostartApp      *app = CSM_AUTOSTART_APP (initable);
+        CsmAutostartCacheKey  key;
+        GVariant             *record;
 
         g_return_val_if_fail (app->priv->desktop_filename != NULL, FALSE);
 
         g_clear_object (&app->priv->app_info);
 
-        app->priv->app_info = g_desktop_app_info_new_from_filename (app->priv->desktop_filename);
-        if (app->priv->app_info == NULL) {
-                g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                             "Could not parse desktop file %s or it references a not found TryExec binary", app->priv->desktop_id);
-                return FALSE;
+        /* csm_autostart_app_preparse() did all of the below already, off
+         * the main thread */
+        record = g_steal_pointer (&app->priv->preparsed_record);
+        if (record != NULL) {
+                app->priv->app_info = g_steal_pointer (&app->priv->preparsed_app_info);
+        } else {
+                g_clear_object (&app->priv->preparsed_app_info);
+
+                record = csm_autostart_cache_lookup (app->priv->desktop_filename,
+                                                    G_VARIANT_TYPE (AUTOSTART_RECORD_TYPE),
+                                                    &key);
+
+                if (record != NULL && !programs_are_available (record)) {
+                        /* leave it to GDesktopAppInfo to decide */
+                        g_clear_pointer (&record, g_variant_unref);
+                }
+
+                if (record == NULL) {
+                        if (get_app_info (app, error) == NULL) {
+                                return FALSE;
+                        }
+
+                        record = g_variant_ref_sink (parse_desktop_file (app->priv->app_info));
+                        csm_autostart_cache_store (app->priv->desktop_filename, &key, record);
+                }
         }
 
-        load_desktop_file (app);
+        load_desktop_file (app, record);
+        g_variant_unref (record);
 
         return TRUE;
 }
@@ -689,7 +711,7 @@ static void
 csm_autostart_app_set_desktop_filename (CsmAutostartApp *app,
                                         const char      *desktop_filename)
 {
-        if (app->priv->app_info != NULL) {
+        if (app->priv->desktop_filename != NULL) {
                 g_clear_object (&app->priv->app_info);
                 g_clear_pointer (&app->priv->desktop_id, g_free);
                 g_clear_pointer (&app->priv->desktop_filename, g_free);
@@ -717,6 +739,14 @@ csm_autostart_app_set_property (GObject      *object,
         case PROP_DESKTOP_FILENAME:
                 csm_autostart_app_set_desktop_filename (self, g_value_get_string (value));
                 break;
+        case PROP_APP_INFO:
+                g_clear_object (&self->priv->preparsed_app_info);
+                self->priv->preparsed_app_info = g_value_dup_object (value);
+                break;
+        case PROP_RECORD:
+                g_clear_pointer (&self->priv->preparsed_record, g_variant_unref);
+                self->priv->preparsed_record = g_value_dup_variant (value);
+                break;
         default:
                 G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
                 break;
@@ -735,11 +765,7 @@ csm_autostart_app_get_property (GObject    *object,
 
         switch (prop_id) {
         case PROP_DESKTOP_FILENAME:
-                if (self->priv->app_info != NULL) {
-                        g_value_set_string (value, g_desktop_app_info_get_filename (self->priv->app_info));
-                } else {
-                        g_value_set_string (value, NULL);
-                }
+                g_value_set_string (value, self->priv->desktop_filename);
                 break;
         default:
                 G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -764,17 +790,11 @@ csm_autostart_app_dispose (GObject *object)
                 priv->session_provides = NULL;
         }
 
-        if (priv->condition_string) {
-                g_free (priv->condition_string);
-                priv->condition_string = NULL;
-        }
-
-        if (priv->condition_settings) {
-                g_object_unref (priv->condition_settings);
-                priv->condition_settings = NULL;
-        }
+        g_clear_pointer (&priv->autostart_condition, csm_autostart_condition_free);
 
         g_clear_object (&priv->app_info);
+        g_clear_object (&priv->preparsed_app_info);
+        g_clear_pointer (&priv->preparsed_record, g_variant_unref);
 
         if (priv->desktop_id) {
                 g_free (priv->desktop_id);
@@ -782,14 +802,18 @@ csm_autostart_app_dispose (GObject *object)
         }
 
         g_clear_pointer (&priv->working_dir, g_free);
+        g_clear_pointer (&priv->after, g_strfreev);
+        g_clear_pointer (&priv->requires, g_strfreev);
+        g_clear_pointer (&priv->provides, g_strfreev);
+        g_clear_pointer (&priv->only_show_in, g_strfreev);
+        g_clear_pointer (&priv->not_show_in, g_strfreev);
+        g_clear_pointer (&priv->cpu_mask, g_free);
 
         if (priv->child_watch_id > 0) {
                 g_source_remove (priv->child_watch_id);
                 priv->child_watch_id = 0;
-        }
-
-        if (priv->condition_monitor) {
-                g_file_monitor_cancel (priv->condition_monitor);
+                /* nothing tells us when it is gone any more */
+                csm_readahead_untrack_pid (priv->pid);
         }
 
         G_OBJECT_CLASS (csm_autostart_app_parent_class)->dispose (object);
@@ -816,77 +840,18 @@ static gboolean
 is_conditionally_disabled (CsmApp *app)
 {
         CsmAutostartAppPrivate *priv;
-        gboolean                res;
-        gboolean                disabled;
-        char                   *key;
-        guint                   kind;
 
         priv = CSM_AUTOSTART_APP (app)->priv;
 
         /* Check AutostartCondition */
-        if (priv->condition_string == NULL) {
+        if (priv->autostart_condition == NULL) {
                 return FALSE;
         }
 
-        key = NULL;
-        res = parse_condition_string (priv->condition_string, &kind, &key);
-        if (! res) {
-                g_free (key);
-                return TRUE;
-        }
-
-        if (key == NULL) {
-                return TRUE;
-        }
-
-        if (kind == CSM_CONDITION_IF_EXISTS) {
-                char *file_path;
-
-                file_path = g_build_filename (g_get_user_config_dir (), key, NULL);
-                disabled = !g_file_test (file_path, G_FILE_TEST_EXISTS);
-                g_free (file_path);
-        } else if (kind == CSM_CONDITION_UNLESS_EXISTS) {
-                char *file_path;
-
-                file_path = g_build_filename (g_get_user_config_dir (), key, NULL);
-                disabled = g_file_test (file_path, G_FILE_TEST_EXISTS);
-                g_free (file_path);
-        } else if (kind == CSM_CONDITION_GSETTINGS &&
-                   priv->condition_settings != NULL) {
-                char **elems;
-                elems = g_strsplit (key, " ", 2);
-                disabled = !g_settings_get_boolean (priv->condition_settings, elems[1]);
-                g_strfreev (elems);
-        } else if (kind == CSM_CONDITION_IF_SESSION) {
-                CsmManager *manager;
-                char *session_name;
-
-                /* get the singleton */
-                manager = csm_manager_get ();
-
-                g_object_get (manager, "session-name", &session_name, NULL);
-                disabled = strcmp (session_name, key) != 0;
-                g_free (session_name);
-        } else if (kind == CSM_CONDITION_UNLESS_SESSION) {
-                CsmManager *manager;
-                char *session_name;
-
-                /* get the singleton */
-                manager = csm_manager_get ();
-
-                g_object_get (manager, "session-name", &session_name, NULL);
-                disabled = strcmp (session_name, key) == 0;
-                g_free (session_name);
-        } else {
-                disabled = TRUE;
-        }
-
         /* Set initial condition */
-        priv->condition = !disabled;
-
-        g_free (key);
+        priv->condition = csm_autostart_condition_evaluate (priv->autostart_condition);
 
-        return disabled;
+        return !priv->condition;
 }
 
 static void
@@ -903,6 +868,7 @@ app_exited (GPid             pid,
                  : WIFSIGNALED (status) ? WTERMSIG (status)
                  : -1);
 
+        csm_readahead_untrack_pid (app->priv->pid);
         g_spawn_close_pid (app->priv->pid);
         app->priv->pid = -1;
         app->priv->child_watch_id = 0;
@@ -984,7 +950,7 @@ csm_autostart_app_stop (CsmApp  *app,
 
         aapp = CSM_AUTOSTART_APP (app);
 
-        g_return_val_if_fail (aapp->priv->app_info != NULL, FALSE);
+        g_return_val_if_fail (aapp->priv->desktop_filename != NULL, FALSE);
 
         switch (aapp->priv->launch_type) {
         case AUTOSTART_LAUNCH_SPAWN:
@@ -1021,6 +987,319 @@ app_launched (GAppLaunchContext *ctx,
         priv->startup_id = sn_id;
 }
 
+/* Expands the field codes of an argument the way GDesktopAppInfo does
+ * when launching without files or URIs */
+static void
+expand_exec_arg (GDesktopAppInfo *app_info,
+                 const char      *arg,
+                 GPtrArray       *argv)
+{
+        GString    *str;
+        const char *p;
+
+        if (strcmp (arg, "%i") == 0) {
+                char *icon;
+
+                icon = g_desktop_app_info_get_string (app_info, G_KEY_FILE_DESKTOP_KEY_ICON);
+                if (!IS_STRING_EMPTY (icon)) {
+                        g_ptr_array_add (argv, g_strdup ("--icon"));
+                        g_ptr_array_add (argv, icon);
+                } else {
+                        g_free (icon);
+                }
+                return;
+        }
+
+        /* %f, %F, %u, %U... standing alone expand to nothing at all */
+        if (arg[0] == '%' && arg[1] != '\0' && arg[1] != '%' && arg[2] == '\0' &&
+            strchr ("cik", arg[1]) == NULL) {
+                return;
+        }
+
+        str = g_string_new (NULL);
+
+        for (p = arg; *p != '\0'; p++) {
+                if (*p != '%' || p[1] == '\0') {
+                        g_string_append_c (str, *p);
+                        continue;
+                }
+
+                p++;
+                switch (*p) {
+                case '%':
+                        g_string_append_c (str, '%');
+                        break;
+                case 'c':
+                        g_string_append (str, g_app_info_get_name (G_APP_INFO (app_info)));
+                        break;
+                case 'k':
+                        g_string_append (str, g_desktop_app_info_get_filename (app_info));
+                        break;
+                default:
+                        break;
+                }
+        }
+
+        g_ptr_array_add (argv, g_string_free (str, FALSE));
+}
+
+static char **
+get_exec_argv (GDesktopAppInfo *app_info,
+               GError         **error)
+{
+        const char *exec;
+        char      **args;
+        GPtrArray  *argv;
+        int         i;
+
+        exec = g_app_info_get_commandline (G_APP_INFO (app_info));
+        if (exec == NULL || !g_shell_parse_argv (exec, NULL, &args, error)) {
+                return NULL;
+        }
+
+        argv = g_ptr_array_new ();
+        for (i = 0; args[i] != NULL; i++) {
+                expand_exec_arg (app_info, args[i], argv);
+        }
+        g_ptr_array_add (argv, NULL);
+
+        g_strfreev (args);
+
+        return (char **) g_ptr_array_free (argv, FALSE);
+}
+
+static gboolean
+has_scheduling_hints (CsmAutostartApp *app)
+{
+        return app->priv->has_nice ||
+               app->priv->ioprio != 0 ||
+               app->priv->cpu_mask != NULL;
+}
+
+/* Runs in the child between fork and exec, so only system calls. Hints
+ * that can't be applied, like a negative nice value without the
+ * privilege for it, leave what the session has in place. */
+static void
+apply_scheduling_hints (gpointer user_data)
+{
+        CsmAutostartAppPrivate *priv = user_data;
+
+        if (priv->has_nice) {
+                setpriority (PRIO_PROCESS, 0, priv->nice);
+        }
+#ifdef SYS_ioprio_set
+        if (priv->ioprio != 0) {
+                syscall (SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, priv->ioprio);
+        }
+#endif
+        if (priv->cpu_mask != NULL) {
+                syscall (SYS_sched_setaffinity, 0, priv->cpu_mask_size, priv->cpu_mask);
+        }
+}
+
+/* Launches the app with csm_launcher_spawn(), which is a lot cheaper than
+ * GDesktopAppInfo forking the whole session. The environment comes from
+ * @ctx, with a startup notification id when the app wants one, as
+ * g_desktop_app_info_launch_uris_as_manager() would set up.
+ *
+ * With @release_fd, the app is held before its exec instead, until that
+ * is closed, see csm_launcher_spawn_held(). */
+static gboolean
+autostart_app_spawn_direct (CsmAutostartApp   *app,
+                            GAppLaunchContext *ctx,
+                            int               *release_fd,
+                            GError           **error)
+{
+        char   **argv;
+        char   **envp;
+        char    *working_dir;
+        char    *sn_id;
+        GPid     pid;
+        gboolean res;
+
+        argv = get_exec_argv (app->priv->app_info, error);
+        if (argv == NULL) {
+                return FALSE;
+        }
+
+        if (argv[0] == NULL) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                             "Empty command line in %s", app->priv->desktop_id);
+                g_strfreev (argv);
+                return FALSE;
+        }
+
+        envp = g_app_launch_context_get_environment (ctx);
+        envp = g_environ_setenv (envp, "GIO_LAUNCHED_DESKTOP_FILE",
+                                 app->priv->desktop_filename, TRUE);
+
+        sn_id = NULL;
+        if (g_desktop_app_info_get_boolean (app->priv->app_info,
+                                            G_KEY_FILE_DESKTOP_KEY_STARTUP_NOTIFY)) {
+                sn_id = g_app_launch_context_get_startup_notify_id (ctx,
+                                                                    G_APP_INFO (app->priv->app_info),
+                                                                    NULL);
+                if (sn_id != NULL) {
+                        envp = g_environ_setenv (envp, "DESKTOP_STARTUP_ID", sn_id, TRUE);
+                }
+        }
+
+        working_dir = g_desktop_app_info_get_string (app->priv->app_info,
+                                                     G_KEY_FILE_DESKTOP_KEY_PATH);
+        if (IS_STRING_EMPTY (working_dir)) {
+                g_clear_pointer (&working_dir, g_free);
+        }
+
+        if (release_fd != NULL) {
+                res = csm_launcher_spawn_held ((const char * const *) argv,
+                                               (const char * const *) envp,
+                                               working_dir,
+                                               has_scheduling_hints (app) ? apply_scheduling_hints : NULL,
+                                               app->priv,
+                                               &pid,
+                                               release_fd,
+                                               error);
+        } else {
+                res = csm_launcher_spawn ((const char * const *) argv,
+                                          (const char * const *) envp,
+                                          working_dir,
+                                          &pid,
+                                          error);
+        }
+        if (res) {
+                app->priv->pid = pid;
+                app->priv->startup_id = sn_id;
+        } else {
+                if (sn_id != NULL) {
+                        g_app_launch_context_launch_failed (ctx, sn_id);
+                }
+                g_free (sn_id);
+        }
+
+        g_free (working_dir);
+        g_strfreev (envp);
+        g_strfreev (argv);
+
+        return res;
+}
+
+/* CPUWeight and IOWeight, 1 to 10000 */
+static gboolean
+get_weight_key (GDesktopAppInfo *app_info,
+                const char      *key,
+                guint64         *weight)
+{
+        char    *str;
+        char    *end;
+        guint64  value;
+
+        str = g_desktop_app_info_get_string (app_info, key);
+        if (IS_STRING_EMPTY (str)) {
+                g_free (str);
+                return FALSE;
+        }
+
+        value = g_ascii_strtoull (str, &end, 10);
+        if (*end != '\0' || value < 1 || value > 10000) {
+                g_warning ("Invalid %s=%s in %s",
+                           key, str, g_desktop_app_info_get_filename (app_info));
+                g_free (str);
+                return FALSE;
+        }
+
+        g_free (str);
+        *weight = value;
+
+        return TRUE;
+}
+
+/* MemoryHigh, bytes with an optional K, M, G or T suffix, or infinity */
+static gboolean
+get_memory_key (GDesktopAppInfo *app_info,
+                const char      *key,
+                guint64         *bytes)
+{
+        char    *str;
+        char    *end;
+        guint64  value;
+        int      shift;
+
+        str = g_desktop_app_info_get_string (app_info, key);
+        if (IS_STRING_EMPTY (str)) {
+                g_free (str);
+                return FALSE;
+        }
+
+        if (strcmp (str, "infinity") == 0) {
+                g_free (str);
+                *bytes = G_MAXUINT64;
+                return TRUE;
+        }
+
+        value = g_ascii_strtoull (str, &end, 10);
+        switch (*end) {
+        case 'K': shift = 10; end++; break;
+        case 'M': shift = 20; end++; break;
+        case 'G': shift = 30; end++; break;
+        case 'T': shift = 40; end++; break;
+        default:  shift = 0; break;
+        }
+
+        if (end == str || *end != '\0' || value == 0 || value > (G_MAXUINT64 >> shift)) {
+                g_warning ("Invalid %s=%s in %s",
+                           key, str, g_desktop_app_info_get_filename (app_info));
+                g_free (str);
+                return FALSE;
+        }
+
+        g_free (str);
+        *bytes = value << shift;
+
+        return TRUE;
+}
+
+static void
+release_held_app (gpointer data)
+{
+        close (GPOINTER_TO_INT (data));
+}
+
+/* With @release_fd, the app is held before its exec and let go once
+ * systemd answered, so nothing it runs escapes the scope. Otherwise it
+ * is moved there while it is already running. */
+static void
+autostart_app_start_scope (CsmAutostartApp *app,
+                           int              release_fd)
+{
+        GVariantBuilder builder;
+        guint64         value;
+        char           *description;
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sv)"));
+
+        if (get_weight_key (app->priv->app_info, CSM_AUTOSTART_APP_CPU_WEIGHT_KEY, &value)) {
+                g_variant_builder_add (&builder, "(sv)", "CPUWeight", g_variant_new_uint64 (value));
+        }
+        if (get_memory_key (app->priv->app_info, CSM_AUTOSTART_APP_MEMORY_HIGH_KEY, &value)) {
+                g_variant_builder_add (&builder, "(sv)", "MemoryHigh", g_variant_new_uint64 (value));
+        }
+        if (get_weight_key (app->priv->app_info, CSM_AUTOSTART_APP_IO_WEIGHT_KEY, &value)) {
+                g_variant_builder_add (&builder, "(sv)", "IOWeight", g_variant_new_uint64 (value));
+        }
+
+        description = g_strdup_printf ("Application launched by cinnamon-session: %s",
+                                       g_app_info_get_name (G_APP_INFO (app->priv->app_info)));
+
+        csm_util_start_systemd_scope (csm_app_peek_app_id (CSM_APP (app)),
+                                      app->priv->pid,
+                                      description,
+                                      g_variant_builder_end (&builder),
+                                      release_fd >= 0 ? release_held_app : NULL,
+                                      GINT_TO_POINTER (release_fd));
+
+        g_free (description);
+}
+
 static gboolean
 autostart_app_start_spawn (CsmAutostartApp *app,
                            GError         **error)
@@ -1030,6 +1309,8 @@ autostart_app_start_spawn (CsmAutostartApp *app,
         const char      *startup_id;
         GAppLaunchContext *ctx;
         guint            handler;
+        gboolean         terminal;
+        int              release_fd;
 
         startup_id = csm_app_peek_startup_id (CSM_APP (app));
         g_assert (startup_id != NULL);
@@ -1037,7 +1318,10 @@ autostart_app_start_spawn (CsmAutostartApp *app,
         g_debug ("CsmAutostartApp: starting %s: command=%s startup-id=%s", app->priv->desktop_id, g_app_info_get_commandline (G_APP_INFO (app->priv->app_info)), startup_id);
 
         g_free (app->priv->startup_id);
+        app->priv->startup_id = NULL;
         local_error = NULL;
+        success = FALSE;
+        release_fd = -1;
 
         ctx = g_app_launch_context_new ();
 
@@ -1045,22 +1329,52 @@ autostart_app_start_spawn (CsmAutostartApp *app,
             g_app_launch_context_setenv (ctx, "DESKTOP_AUTOSTART_ID", startup_id);
         }
 
-        handler = g_signal_connect (ctx, "launched", G_CALLBACK (app_launched), app);
-        success = g_desktop_app_info_launch_uris_as_manager (app->priv->app_info,
-                                                             NULL,
-                                                             ctx,
-                                                             G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_SEARCH_PATH,
-                                                             NULL, NULL,
-                                                             NULL, NULL,
-                                                             &local_error);
-        g_signal_handler_disconnect (ctx, handler);
+        terminal = g_desktop_app_info_get_boolean (app->priv->app_info,
+                                                   G_KEY_FILE_DESKTOP_KEY_TERMINAL);
+
+        /* Only GDesktopAppInfo knows how to find a terminal, and
+         * posix_spawn() can't run apply_scheduling_hints(), but a held
+         * app can */
+        if (!terminal && use_systemd_scopes) {
+                success = autostart_app_spawn_direct (app, ctx, &release_fd, &local_error);
+        } else if (!terminal && !has_scheduling_hints (app)) {
+                success = autostart_app_spawn_direct (app, ctx, NULL, &local_error);
+
+                if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED)) {
+                        g_debug ("CsmAutostartApp: %s, launching %s through GDesktopAppInfo",
+                                 local_error->message, app->priv->desktop_id);
+                        g_clear_error (&local_error);
+                }
+        }
+
+        if (!success && local_error == NULL) {
+                handler = g_signal_connect (ctx, "launched", G_CALLBACK (app_launched), app);
+                success = g_desktop_app_info_launch_uris_as_manager (app->priv->app_info,
+                                                                     NULL,
+                                                                     ctx,
+                                                                     G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_SEARCH_PATH,
+                                                                     has_scheduling_hints (app) ? apply_scheduling_hints : NULL,
+                                                                     app->priv,
+                                                                     NULL, NULL,
+                                                                     &local_error);
+                g_signal_handler_disconnect (ctx, handler);
+        }
+
+        g_object_unref (ctx);
 
         if (success) {
+                csm_timeline_record (CSM_TIMELINE_APP_SPAWN,
+                                     csm_app_peek_app_id (CSM_APP (app)));
+
                 if (app->priv->pid > 0) {
                         g_debug ("CsmAutostartApp: started pid:%d", app->priv->pid);
-                        app->priv->child_watch_id = g_child_watch_add (app->priv->pid,
-                                                                       (GChildWatchFunc)app_exited,
-                                                                       app);
+                        csm_readahead_track_pid (app->priv->pid);
+                        if (use_systemd_scopes) {
+                                autostart_app_start_scope (app, release_fd);
+                        }
+                        app->priv->child_watch_id = csm_launcher_watch (app->priv->pid,
+                                                                        (GChildWatchFunc)app_exited,
+                                                                        app);
                 }
         } else {
                 g_set_error (error,
@@ -1074,24 +1388,19 @@ autostart_app_start_spawn (CsmAutostartApp *app,
 }
 
 static void
-start_notify (GObject *source,
-              GAsyncResult *result,
-              CsmAutostartApp *app)
+start_notify (GVariant     *reply,
+              const GError *error,
+              gpointer      user_data)
 {
-        GError  *error;
-
-        error = NULL;
-
-        g_dbus_connection_call_finish (G_DBUS_CONNECTION (source),
-                                       result,
-                                       &error);
+        CsmAutostartApp *app = user_data;
 
         if (error != NULL) {
                 g_warning ("CsmAutostartApp: Error starting application: %s", error->message);
-                g_error_free (error);
         } else {
                 g_debug ("CsmAutostartApp: Started application %s", app->priv->desktop_id);
         }
+
+        g_object_unref (app);
 }
 
 static gboolean
@@ -1101,12 +1410,10 @@ autostart_app_start_activate (CsmAutostartApp  *app,
         const char      *name;
         char            *path;
         char            *arguments;
-        GDBusConnection *bus;
         GError          *local_error;
 
         local_error = NULL;
-        bus = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &local_error);
-        if (bus == NULL) {
+        if (csm_util_get_session_bus (&local_error) == NULL) {
                 if (local_error != NULL) {
                         g_warning ("error getting session bus: %s", local_error->message);
                 }
@@ -1127,18 +1434,23 @@ autostart_app_start_activate (CsmAutostartApp  *app,
         arguments = g_desktop_app_info_get_string (app->priv->app_info,
                                                    CSM_AUTOSTART_APP_DBUS_ARGS_KEY);
 
-        g_dbus_connection_call (bus,
-                                name,
-                                path,
-                                CSM_SESSION_CLIENT_DBUS_INTERFACE,
-                                "Start",
-                                g_variant_new ("(s)", arguments),
-                                NULL,
-                                G_DBUS_CALL_FLAGS_NONE,
-                                -1, NULL,
-                                (GAsyncReadyCallback) start_notify, app);
-
-        g_object_unref (bus);
+        /* The peer may be activated by this call, so give it the usual
+         * D-Bus timeout rather than our shorter one */
+        csm_util_call_session_bus_full (name,
+                                        path,
+                                        CSM_SESSION_CLIENT_DBUS_INTERFACE,
+                                        "Start",
+                                        g_variant_new ("(s)", arguments),
+                                        NULL,
+                                        G_DBUS_CALL_FLAGS_NONE,
+                                        -1,
+                                        start_notify,
+                                        g_object_ref (app));
+        g_free (path);
+        g_free (arguments);
+
+        csm_timeline_record (CSM_TIMELINE_APP_SPAWN,
+                             csm_app_peek_app_id (CSM_APP (app)));
 
         return TRUE;
 }
@@ -1152,7 +1464,9 @@ csm_autostart_app_start (CsmApp  *app,
 
         aapp = CSM_AUTOSTART_APP (app);
 
-        g_return_val_if_fail (aapp->priv->app_info != NULL, FALSE);
+        if (get_app_info (aapp, error) == NULL) {
+                return FALSE;
+        }
 
         switch (aapp->priv->launch_type) {
         case AUTOSTART_LAUNCH_SPAWN:
@@ -1197,9 +1511,6 @@ static gboolean
 csm_autostart_app_provides (CsmApp     *app,
                             const char *service)
 {
-        gchar           *provides_str;
-        char           **provides;
-        gsize            i;
         GSList          *l;
         CsmAutostartApp *aapp;
 
@@ -1207,7 +1518,7 @@ csm_autostart_app_provides (CsmApp     *app,
 
         aapp = CSM_AUTOSTART_APP (app);
 
-        if (aapp->priv->app_info == NULL) {
+        if (aapp->priv->desktop_filename == NULL) {
                 return FALSE;
         }
 
@@ -1216,33 +1527,17 @@ csm_autostart_app_provides (CsmApp     *app,
                         return TRUE;
         }
 
-        provides_str = g_desktop_app_info_get_string (aapp->priv->app_info,
-                                                      CSM_AUTOSTART_APP_PROVIDES_KEY);
-        if (!provides_str) {
+        if (aapp->priv->provides == NULL) {
                 return FALSE;
         }
-        provides = g_strsplit (provides_str, ";", -1);
-        g_free (provides_str);
-
-        for (i = 0; provides[i]; i++) {
-                if (!strcmp (provides[i], service)) {
-                        g_strfreev (provides);
-                        return TRUE;
-                }
-        }
 
-        g_strfreev (provides);
-
-        return FALSE;
+        return g_strv_contains ((const char * const *) aapp->priv->provides, service);
 }
 
 static char **
 csm_autostart_app_get_provides (CsmApp *app)
 {
         CsmAutostartApp  *aapp;
-        gchar            *provides_str;
-        char            **provides;
-        gsize             provides_len;
         char            **result;
         gsize             result_len;
         int               i;
@@ -1252,31 +1547,18 @@ csm_autostart_app_get_provides (CsmApp *app)
 
         aapp = CSM_AUTOSTART_APP (app);
 
-        if (aapp->priv->app_info == NULL) {
-                return NULL;
-        }
-
-        provides_str = g_desktop_app_info_get_string (aapp->priv->app_info,
-                                                      CSM_AUTOSTART_APP_PROVIDES_KEY);
-
-        if (provides_str == NULL) {
-                return NULL;
-        }
-
-        provides = g_strsplit (provides_str, ";", -1);
-        provides_len = g_strv_length (provides);
-        g_free (provides_str);
-
         if (!aapp->priv->session_provides) {
-                return provides;
+                return g_strdupv (aapp->priv->provides);
         }
 
-        result_len = provides_len + g_slist_length (aapp->priv->session_provides);
+        result_len = g_slist_length (aapp->priv->session_provides);
+        if (aapp->priv->provides != NULL)
+                result_len += g_strv_length (aapp->priv->provides);
         result = g_new (char *, result_len + 1); /* including last NULL */
 
-        for (i = 0; provides[i] != NULL; i++)
-                result[i] = provides[i];
-        g_free (provides);
+        i = 0;
+        for (; aapp->priv->provides != NULL && aapp->priv->provides[i] != NULL; i++)
+                result[i] = g_strdup (aapp->priv->provides[i]);
 
         for (l = aapp->priv->session_provides; l != NULL; l = l->next, i++)
                 result[i] = g_strdup (l->data);
@@ -1288,6 +1570,23 @@ csm_autostart_app_get_provides (CsmApp *app)
         return result;
 }
 
+/**
+ * csm_autostart_app_set_use_systemd_scopes:
+ * @use_scopes: whether to use scopes
+ *
+ * Whether apps started from now on get their own transient systemd scope,
+ * limited by the X-Cinnamon-CPUWeight, X-Cinnamon-MemoryHigh and
+ * X-Cinnamon-IOWeight keys of their desktop file. Apps wait before their
+ * exec until systemd answered, which takes a fork() of the session
+ * rather than posix_spawn(); only apps run in a terminal are moved into
+ * their scope once running.
+ */
+void
+csm_autostart_app_set_use_systemd_scopes (gboolean use_scopes)
+{
+        use_systemd_scopes = use_scopes;
+}
+
 void
 csm_autostart_app_add_provides (CsmAutostartApp *aapp,
                                 const char      *provides)
@@ -1298,6 +1597,27 @@ csm_autostart_app_add_provides (CsmAutostartApp *aapp,
                                                         g_strdup (provides));
 }
 
+/* What csm_autostart_app_add_provides() added, in that order */
+char **
+csm_autostart_app_get_session_provides (CsmAutostartApp *aapp)
+{
+        char   **result;
+        GSList  *l;
+        guint    i;
+
+        g_return_val_if_fail (CSM_IS_AUTOSTART_APP (aapp), NULL);
+
+        i = g_slist_length (aapp->priv->session_provides);
+        result = g_new (char *, i + 1);
+        result[i] = NULL;
+
+        for (l = aapp->priv->session_provides; l != NULL; l = l->next) {
+                result[--i] = g_strdup (l->data);
+        }
+
+        return result;
+}
+
 static gboolean
 csm_autostart_app_has_autostart_condition (CsmApp     *app,
                                            const char *condition)
@@ -1309,11 +1629,11 @@ csm_autostart_app_has_autostart_condition (CsmApp     *app,
 
         aapp = CSM_AUTOSTART_APP (app);
 
-        if (aapp->priv->condition_string == NULL) {
+        if (aapp->priv->autostart_condition == NULL) {
                 return FALSE;
         }
 
-        if (strcmp (aapp->priv->condition_string, condition) == 0) {
+        if (strcmp (csm_autostart_condition_peek_string (aapp->priv->autostart_condition), condition) == 0) {
                 return TRUE;
         }
 
@@ -1323,51 +1643,127 @@ csm_autostart_app_has_autostart_condition (CsmApp     *app,
 static gboolean
 csm_autostart_app_get_autorestart (CsmApp *app)
 {
-        gboolean res;
-        gboolean autorestart;
+        return CSM_AUTOSTART_APP (app)->priv->autorestart;
+}
 
-        if (CSM_AUTOSTART_APP (app)->priv->app_info == NULL) {
-                return FALSE;
-        }
+static const char *
+csm_autostart_app_get_app_id (CsmApp *app)
+{
+        return CSM_AUTOSTART_APP (app)->priv->desktop_id;
+}
+
+static int
+csm_autostart_app_peek_autostart_delay (CsmApp *app)
+{
+        CsmAutostartApp *aapp = CSM_AUTOSTART_APP (app);
 
-        autorestart = FALSE;
+        return aapp->priv->autostart_delay;
+}
 
-        res = g_desktop_app_info_has_key (CSM_AUTOSTART_APP (app)->priv->app_info,
-                                          CSM_AUTOSTART_APP_AUTORESTART_KEY);
-        if (res) {
-                autorestart = g_desktop_app_info_get_boolean (CSM_AUTOSTART_APP (app)->priv->app_info,
-                                                              CSM_AUTOSTART_APP_AUTORESTART_KEY);
-        }
+static const char * const *
+csm_autostart_app_peek_after (CsmApp *app)
+{
+        CsmAutostartApp *aapp = CSM_AUTOSTART_APP (app);
 
-        return autorestart;
+        return (const char * const *) aapp->priv->after;
 }
 
-static const char *
-csm_autostart_app_get_app_id (CsmApp *app)
+static const char * const *
+csm_autostart_app_peek_requires (CsmApp *app)
 {
-        const char *location;
-        const char *slash;
+        CsmAutostartApp *aapp = CSM_AUTOSTART_APP (app);
 
-        if (CSM_AUTOSTART_APP (app)->priv->app_info == NULL) {
-                return NULL;
-        }
+        return (const char * const *) aapp->priv->requires;
+}
 
-        location = g_desktop_app_info_get_filename (CSM_AUTOSTART_APP (app)->priv->app_info);
+static void
+add_cpu_list (GVariantBuilder *builder,
+              const gulong    *mask,
+              gsize            size)
+{
+        GVariantBuilder cpus;
+        guint           bits;
+        guint           cpu;
 
-        slash = strrchr (location, '/');
-        if (slash != NULL) {
-                return slash + 1;
-        } else {
-                return location;
+        g_variant_builder_init (&cpus, G_VARIANT_TYPE ("au"));
+
+        bits = size * 8;
+        for (cpu = 0; cpu < bits; cpu++) {
+                if (mask[cpu / (8 * sizeof (gulong))] & (1UL << (cpu % (8 * sizeof (gulong))))) {
+                        g_variant_builder_add (&cpus, "u", cpu);
+                }
         }
+
+        g_variant_builder_add (builder, "{sv}", "CPUAffinity", g_variant_builder_end (&cpus));
 }
 
-static int
-csm_autostart_app_peek_autostart_delay (CsmApp *app)
+/* The hints from the desktop file, as read back from the process while
+ * it runs, since the kernel may have refused some of them */
+static GVariant *
+csm_autostart_app_get_scheduling_hints (CsmApp *app)
 {
-        CsmAutostartApp *aapp = CSM_AUTOSTART_APP (app);
+        CsmAutostartAppPrivate *priv = CSM_AUTOSTART_APP (app)->priv;
+        GVariantBuilder         builder;
+        gboolean                running;
 
-        return aapp->priv->autostart_delay;
+        g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+
+        running = priv->pid > 0;
+
+        if (priv->has_nice) {
+                int nice;
+                int value;
+
+                nice = priv->nice;
+                if (running) {
+                        errno = 0;
+                        value = getpriority (PRIO_PROCESS, priv->pid);
+                        if (errno == 0) {
+                                nice = value;
+                        }
+                }
+
+                g_variant_builder_add (&builder, "{sv}", "Nice", g_variant_new_int32 (nice));
+        }
+
+        if (priv->ioprio != 0) {
+                int ioprio;
+
+                ioprio = priv->ioprio;
+#ifdef SYS_ioprio_get
+                if (running) {
+                        int value;
+
+                        value = syscall (SYS_ioprio_get, IOPRIO_WHO_PROCESS, priv->pid);
+                        if (value >= 0) {
+                                ioprio = value;
+                        }
+                }
+#endif
+                g_variant_builder_add (&builder, "{sv}", "IOSchedulingClass",
+                                       g_variant_new_string (csm_scheduling_hints_io_class_name (ioprio)));
+                g_variant_builder_add (&builder, "{sv}", "IOSchedulingPriority",
+                                       g_variant_new_int32 (ioprio & IOPRIO_PRIO_MASK));
+        }
+
+        if (priv->cpu_mask != NULL) {
+                gulong mask[CSM_SCHEDULING_HINTS_MAX_CPUS / (8 * sizeof (gulong))];
+                long   size;
+
+                size = -1;
+                if (running) {
+                        /* the raw syscall returns how much of @mask it filled */
+                        size = syscall (SYS_sched_getaffinity, priv->pid, sizeof (mask), mask);
+                }
+
+                if (size > 0) {
+                        add_cpu_list (&builder, mask, size);
+                } else {
+                        add_cpu_list (&builder, priv->cpu_mask, priv->cpu_mask_size);
+                }
+        }
+
+        return g_variant_builder_end (&builder);
 }
 
 static void
@@ -1398,6 +1794,9 @@ csm_autostart_app_class_init (CsmAutostartAppClass *klass)
         app_class->impl_get_app_id = csm_autostart_app_get_app_id;
         app_class->impl_get_autorestart = csm_autostart_app_get_autorestart;
         app_class->impl_peek_autostart_delay = csm_autostart_app_peek_autostart_delay;
+        app_class->impl_peek_after = csm_autostart_app_peek_after;
+        app_class->impl_peek_requires = csm_autostart_app_peek_requires;
+        app_class->impl_get_scheduling_hints = csm_autostart_app_get_scheduling_hints;
 
         g_object_class_install_property (object_class,
                                          PROP_DESKTOP_FILENAME,
@@ -1406,6 +1805,21 @@ csm_autostart_app_class_init (CsmAutostartAppClass *klass)
                                                               "Freedesktop .desktop file",
                                                               NULL,
                                                               G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
+        g_object_class_install_property (object_class,
+                                         PROP_APP_INFO,
+                                         g_param_spec_object ("app-info",
+                                                              "App info",
+                                                              "Already parsed desktop file",
+                                                              G_TYPE_DESKTOP_APP_INFO,
+                                                              G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY));
+        g_object_class_install_property (object_class,
+                                         PROP_RECORD,
+                                         g_param_spec_variant ("record",
+                                                               "Record",
+                                                               "Already checked record of the desktop file",
+                                                               G_VARIANT_TYPE (AUTOSTART_RECORD_TYPE),
+                                                               NULL,
+                                                               G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY));
         signals[CONDITION_CHANGED] =
                 g_signal_new ("condition-changed",
                               G_OBJECT_CLASS_TYPE (object_class),
@@ -1422,6 +1836,55 @@ csm_autostart_app_class_init (CsmAutostartAppClass *klass)
 
 CsmApp *
 csm_autostart_app_new (const char *desktop_file)
+{
+        return csm_autostart_app_new_for_app_info (desktop_file, NULL, NULL);
+}
+
+/* Called from the desktop file parser threads, so that the cache lookup,
+ * the search for the programs of a cached record and any parsing stay
+ * off the main thread. Sets @record to what
+ * csm_autostart_app_new_for_app_info() needs, or to %NULL if the file
+ * can't be used, and returns the parsed file if there was no usable
+ * cached record. The key is taken before parsing so that a file changing
+ * in between is never cached with stale contents. */
+GDesktopAppInfo *
+csm_autostart_app_preparse (const char  *desktop_file,
+                            GVariant   **record)
+{
+        CsmAutostartCacheKey  key;
+        GDesktopAppInfo      *app_info;
+
+        *record = csm_autostart_cache_lookup (desktop_file,
+                                             G_VARIANT_TYPE (AUTOSTART_RECORD_TYPE),
+                                             &key);
+        if (*record != NULL) {
+                if (programs_are_available (*record)) {
+                        return NULL;
+                }
+
+                /* leave it to GDesktopAppInfo to decide */
+                g_clear_pointer (record, g_variant_unref);
+        }
+
+        app_info = g_desktop_app_info_new_from_filename (desktop_file);
+        if (app_info == NULL) {
+                return NULL;
+        }
+
+        *record = g_variant_ref_sink (parse_desktop_file (app_info));
+        csm_autostart_cache_store (desktop_file, &key, *record);
+
+        return app_info;
+}
+
+/* @app_info and @record, if not %NULL, are what
+ * csm_autostart_app_preparse() returned for @desktop_file, since parsing
+ * is safe to do from a worker thread, unlike constructing the app
+ * itself. */
+CsmApp *
+csm_autostart_app_new_for_app_info (const char      *desktop_file,
+                                    GDesktopAppInfo *app_info,
+                                    GVariant        *record)
 {
         CsmAutostartApp *app;
         GError *error;
@@ -1431,6 +1894,8 @@ csm_autostart_app_new (const char *desktop_file)
         app = g_initable_new (CSM_TYPE_AUTOSTART_APP,
                               NULL, &error,
                               "desktop-filename", desktop_file,
+                              "app-info", app_info,
+                              "record", record,
                               NULL);
 
         if (error != NULL) {
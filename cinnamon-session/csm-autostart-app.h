@@ -25,6 +25,7 @@
 #include "csm-app.h"
 
 #include <X11/SM/SMlib.h>
+#include <gio/gdesktopappinfo.h>
 
 G_BEGIN_DECLS
 
@@ -58,9 +59,17 @@ struct _CsmAutostartAppClass
 GType   csm_autostart_app_get_type           (void) G_GNUC_CONST;
 
 CsmApp *csm_autostart_app_new                (const char *desktop_file);
+CsmApp *csm_autostart_app_new_for_app_info   (const char      *desktop_file,
+                                              GDesktopAppInfo *app_info,
+                                              GVariant        *record);
+GDesktopAppInfo *csm_autostart_app_preparse (const char      *desktop_file,
+                                             GVariant       **record);
 
 void    csm_autostart_app_add_provides       (CsmAutostartApp *aapp,
                                               const char      *provides);
+char  **csm_autostart_app_get_session_provides (CsmAutostartApp *aapp);
+
+void    csm_autostart_app_set_use_systemd_scopes (gboolean use_scopes);
 
 #define CSM_AUTOSTART_APP_ENABLED_KEY     "X-GNOME-Autostart-enabled"
 #define CSM_AUTOSTART_APP_PHASE_KEY       "X-GNOME-Autostart-Phase"
@@ -72,6 +81,15 @@ void    csm_autostart_app_add_provides       (CsmAutostartApp *aapp,
 #define CSM_AUTOSTART_APP_DBUS_ARGS_KEY   "X-GNOME-DBus-Start-Arguments"
 #define CSM_AUTOSTART_APP_DISCARD_KEY     "X-GNOME-Autostart-discard-exec"
 #define CSM_AUTOSTART_APP_DELAY_KEY       "X-GNOME-Autostart-Delay"
+#define CSM_AUTOSTART_APP_AFTER_KEY       "X-Cinnamon-After"
+#define CSM_AUTOSTART_APP_REQUIRES_KEY    "X-Cinnamon-Requires"
+#define CSM_AUTOSTART_APP_CPU_WEIGHT_KEY  "X-Cinnamon-CPUWeight"
+#define CSM_AUTOSTART_APP_MEMORY_HIGH_KEY "X-Cinnamon-MemoryHigh"
+#define CSM_AUTOSTART_APP_IO_WEIGHT_KEY   "X-Cinnamon-IOWeight"
+#define CSM_AUTOSTART_APP_NICE_KEY        "X-Cinnamon-Nice"
+#define CSM_AUTOSTART_APP_IO_CLASS_KEY    "X-Cinnamon-IOSchedulingClass"
+#define CSM_AUTOSTART_APP_IO_PRIORITY_KEY "X-Cinnamon-IOSchedulingPriority"
+#define CSM_AUTOSTART_APP_CPU_AFFINITY_KEY "X-Cinnamon-CPUAffinity"
 
 G_END_DECLS
 
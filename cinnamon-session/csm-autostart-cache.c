@@ -0,0 +1,310 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * csm-autostart-cache.c
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "csm-autostart-cache.h"
+#include "csm-util.h"
+
+#define CSM_AUTOSTART_CACHE_FILENAME "autostart.cache"
+
+/* Bump whenever the layout of the file or of the records changes */
+#define CSM_AUTOSTART_CACHE_VERSION 2
+
+/* version, then path => (mtime, size, record) */
+#define CSM_AUTOSTART_CACHE_TYPE "(ua{s(xtv)})"
+
+typedef struct {
+        GVariant *value;
+        /* seen during this login, anything else is dropped on save */
+        gboolean  used;
+} CacheEntry;
+
+static GMutex      cache_lock;
+static GHashTable *entries = NULL;
+static gboolean    dirty = FALSE;
+
+static void
+cache_entry_free (CacheEntry *entry)
+{
+        g_variant_unref (entry->value);
+        g_free (entry);
+}
+
+static char *
+get_cache_filename (void)
+{
+        const char *cache_dir;
+
+        cache_dir = csm_util_get_cache_dir ();
+        if (cache_dir == NULL) {
+                return NULL;
+        }
+
+        return g_build_filename (cache_dir, CSM_AUTOSTART_CACHE_FILENAME, NULL);
+}
+
+static gboolean
+get_file_key (const char           *path,
+              CsmAutostartCacheKey *key)
+{
+        GStatBuf buf;
+
+        if (g_stat (path, &buf) != 0) {
+                return FALSE;
+        }
+
+        key->mtime = (gint64) buf.st_mtim.tv_sec * G_GINT64_CONSTANT (1000000000) + buf.st_mtim.tv_nsec;
+        key->size = (guint64) buf.st_size;
+
+        return TRUE;
+}
+
+static void
+load_cache (void)
+{
+        char         *filename;
+        GMappedFile  *mapped;
+        GBytes       *bytes;
+        GVariant     *cache;
+        GVariant     *dict;
+        GVariantIter  iter;
+        const char   *path;
+        GVariant     *value;
+        guint32       version;
+
+        entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                         g_free, (GDestroyNotify) cache_entry_free);
+
+        filename = get_cache_filename ();
+        if (filename == NULL) {
+                return;
+        }
+
+        mapped = g_mapped_file_new (filename, FALSE, NULL);
+        g_free (filename);
+        if (mapped == NULL) {
+                return;
+        }
+
+        bytes = g_mapped_file_get_bytes (mapped);
+        g_mapped_file_unref (mapped);
+
+        cache = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (CSM_AUTOSTART_CACHE_TYPE),
+                                                              bytes,
+                                                              FALSE));
+        g_bytes_unref (bytes);
+
+        /* A truncated or otherwise corrupt file is the same as no file */
+        if (!g_variant_is_normal_form (cache)) {
+                g_debug ("CsmAutostartCache: ignoring corrupt cache");
+                g_variant_unref (cache);
+                return;
+        }
+
+        g_variant_get (cache, "(u@a{s(xtv)})", &version, &dict);
+        g_variant_unref (cache);
+
+        if (version != CSM_AUTOSTART_CACHE_VERSION) {
+                g_debug ("CsmAutostartCache: ignoring cache version %u", version);
+                g_variant_unref (dict);
+                return;
+        }
+
+        g_variant_iter_init (&iter, dict);
+        while (g_variant_iter_next (&iter, "{&s@(xtv)}", &path, &value)) {
+                CacheEntry *entry;
+
+                entry = g_new0 (CacheEntry, 1);
+                entry->value = value;
+                g_hash_table_replace (entries, g_strdup (path), entry);
+        }
+
+        g_debug ("CsmAutostartCache: loaded %u entries",
+                 g_hash_table_size (entries));
+
+        g_variant_unref (dict);
+}
+
+/**
+ * csm_autostart_cache_lookup:
+ * @path: the desktop file
+ * @type: (allow-none): the expected type of the record
+ * @key: (allow-none): filled with the current key of @path, to pass to
+ *     csm_autostart_cache_store() if the file has to be parsed
+ *
+ * Returns: the record stored for @path, or %NULL if there is none or the
+ *     file has changed since. Free with g_variant_unref().
+ */
+GVariant *
+csm_autostart_cache_lookup (const char           *path,
+                            const GVariantType   *type,
+                            CsmAutostartCacheKey *key)
+{
+        CsmAutostartCacheKey  file_key;
+        CacheEntry           *entry;
+        GVariant             *record;
+        gint64                mtime;
+        guint64               size;
+
+        g_return_val_if_fail (path != NULL, NULL);
+
+        if (!get_file_key (path, &file_key)) {
+                if (key != NULL) {
+                        memset (key, 0, sizeof (CsmAutostartCacheKey));
+                }
+                return NULL;
+        }
+
+        if (key != NULL) {
+                *key = file_key;
+        }
+
+        g_mutex_lock (&cache_lock);
+
+        if (entries == NULL) {
+                load_cache ();
+        }
+
+        record = NULL;
+
+        entry = g_hash_table_lookup (entries, path);
+        if (entry != NULL) {
+                g_variant_get (entry->value, "(xtv)", &mtime, &size, &record);
+
+                if (mtime != file_key.mtime ||
+                    size != file_key.size ||
+                    (type != NULL && !g_variant_is_of_type (record, type))) {
+                        g_clear_pointer (&record, g_variant_unref);
+                } else {
+                        entry->used = TRUE;
+                }
+        }
+
+        g_mutex_unlock (&cache_lock);
+
+        return record;
+}
+
+void
+csm_autostart_cache_store (const char                 *path,
+                           const CsmAutostartCacheKey *key,
+                           GVariant                   *record)
+{
+        CacheEntry *entry;
+
+        g_return_if_fail (path != NULL);
+        g_return_if_fail (key != NULL);
+        g_return_if_fail (record != NULL);
+
+        entry = g_new0 (CacheEntry, 1);
+        entry->value = g_variant_ref_sink (g_variant_new ("(xtv)",
+                                                          key->mtime,
+                                                          key->size,
+                                                          record));
+        entry->used = TRUE;
+
+        g_mutex_lock (&cache_lock);
+
+        if (entries == NULL) {
+                load_cache ();
+        }
+
+        g_hash_table_replace (entries, g_strdup (path), entry);
+        dirty = TRUE;
+
+        g_mutex_unlock (&cache_lock);
+}
+
+static gboolean
+entry_is_unused (gpointer key,
+                 gpointer value,
+                 gpointer user_data)
+{
+        return !((CacheEntry *) value)->used;
+}
+
+gboolean
+csm_autostart_cache_save (GError **error)
+{
+        GVariantBuilder  builder;
+        GHashTableIter   iter;
+        gpointer         path;
+        CacheEntry      *entry;
+        GVariant        *cache;
+        char            *filename;
+        gboolean         res;
+
+        g_mutex_lock (&cache_lock);
+
+        if (entries == NULL) {
+                g_mutex_unlock (&cache_lock);
+                return TRUE;
+        }
+
+        /* Only keep what was seen this time, so removed files go away */
+        if (g_hash_table_foreach_remove (entries, entry_is_unused, NULL) > 0) {
+                dirty = TRUE;
+        }
+
+        if (!dirty) {
+                g_mutex_unlock (&cache_lock);
+                return TRUE;
+        }
+
+        filename = get_cache_filename ();
+        if (filename == NULL) {
+                g_mutex_unlock (&cache_lock);
+                return TRUE;
+        }
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{s(xtv)}"));
+
+        g_hash_table_iter_init (&iter, entries);
+        while (g_hash_table_iter_next (&iter, &path, (gpointer *) &entry)) {
+                g_variant_builder_add (&builder, "{s@(xtv)}", path, entry->value);
+        }
+
+        cache = g_variant_ref_sink (g_variant_new ("(u@a{s(xtv)})",
+                                                   CSM_AUTOSTART_CACHE_VERSION,
+                                                   g_variant_builder_end (&builder)));
+
+        res = g_file_set_contents (filename,
+                                   g_variant_get_data (cache),
+                                   g_variant_get_size (cache),
+                                   error);
+        if (res) {
+                g_debug ("CsmAutostartCache: wrote %u entries to %s",
+                         g_hash_table_size (entries), filename);
+                dirty = FALSE;
+        }
+
+        g_variant_unref (cache);
+        g_free (filename);
+
+        g_mutex_unlock (&cache_lock);
+
+        return res;
+}
@@ -0,0 +1,48 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * csm-autostart-cache.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#ifndef __CSM_AUTOSTART_CACHE_H__
+#define __CSM_AUTOSTART_CACHE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Records parsed from autostart desktop files, persisted across logins
+ * and keyed on the file's path, mtime and size. Safe to use from the
+ * desktop file parser threads. */
+
+typedef struct {
+        gint64  mtime;
+        guint64 size;
+} CsmAutostartCacheKey;
+
+GVariant   *csm_autostart_cache_lookup  (const char                 *path,
+                                         const GVariantType         *type,
+                                         CsmAutostartCacheKey       *key);
+
+void        csm_autostart_cache_store   (const char                 *path,
+                                         const CsmAutostartCacheKey *key,
+                                         GVariant                   *record);
+
+gboolean    csm_autostart_cache_save    (GError                    **error);
+
+G_END_DECLS
+
+#endif /* __CSM_AUTOSTART_CACHE_H__ */
@@ -0,0 +1,503 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * csm-autostart-condition.c
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#include "config.h"
+
+#include <ctype.h>
+#include <string.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "csm-autostart-condition.h"
+#include "csm-manager.h"
+
+struct _CsmAutostartCondition
+{
+        char                      *string;
+        CsmConditionKind           kind;
+        /* the file, the GSettings key or the session name */
+        char                      *key;
+
+        /* file conditions */
+        char                      *path;
+        char                      *dirname;
+        char                      *basename;
+
+        /* GSettings conditions, pooled */
+        GSettings                 *settings;
+
+        CsmAutostartConditionFunc  func;
+        gpointer                   user_data;
+        /* on settings or the manager */
+        gulong                     handler_id;
+};
+
+/* All file conditions on entries of one directory */
+typedef struct {
+        char         *dirname;
+        GFileMonitor *monitor;
+        /* basename => GSList of CsmAutostartCondition */
+        GHashTable   *conditions;
+} DirWatch;
+
+/* dirname => DirWatch */
+static GHashTable *dir_watches = NULL;
+/* schema id => GSettings */
+static GHashTable *settings_pool = NULL;
+
+static CsmConditionKind
+parse_condition_string (const char  *condition_string,
+                        char       **keyp)
+{
+        const char *space;
+        const char *key;
+        int         len;
+        guint       kind;
+
+        space = condition_string + strcspn (condition_string, " ");
+        len = space - condition_string;
+        key = space;
+        while (isspace ((unsigned char)*key)) {
+                key++;
+        }
+
+        kind = CSM_CONDITION_UNKNOWN;
+
+        if (!g_ascii_strncasecmp (condition_string, "if-exists", len) && key) {
+                kind = CSM_CONDITION_IF_EXISTS;
+        } else if (!g_ascii_strncasecmp (condition_string, "unless-exists", len) && key) {
+                kind = CSM_CONDITION_UNLESS_EXISTS;
+        } else if (!g_ascii_strncasecmp (condition_string, "GSettings", len)) {
+                kind = CSM_CONDITION_GSETTINGS;
+        } else if (!g_ascii_strncasecmp (condition_string, "GNOME3", len)) {
+                condition_string = key;
+                space = condition_string + strcspn (condition_string, " ");
+                len = space - condition_string;
+                key = space;
+                while (isspace ((unsigned char)*key)) {
+                        key++;
+                }
+                if (!g_ascii_strncasecmp (condition_string, "if-session", len) && key) {
+                        kind = CSM_CONDITION_IF_SESSION;
+                } else if (!g_ascii_strncasecmp (condition_string, "unless-session", len) && key) {
+                        kind = CSM_CONDITION_UNLESS_SESSION;
+                }
+        }
+
+        *keyp = kind != CSM_CONDITION_UNKNOWN ? g_strdup (key) : NULL;
+
+        return kind;
+}
+
+static gboolean
+check_gsettings_schema_has_key (GSettingsSchema *schema,
+                                const gchar     *key)
+{
+        gboolean good;
+        gchar  **keys;
+
+        keys = g_settings_schema_list_keys (schema);
+        good = g_strv_contains ((const gchar * const *) keys, key);
+        g_strfreev (keys);
+
+        return good;
+}
+
+/* "schema key", where the schema must be installed and have the key */
+static GSettings *
+get_pooled_settings (const char  *key,
+                     char       **settings_key)
+{
+        GSettingsSchemaSource *source;
+        GSettingsSchema       *schema;
+        GSettings             *settings;
+        char                 **elems;
+
+        settings = NULL;
+
+        elems = g_strsplit (key, " ", 2);
+        if (elems[0] == NULL || elems[1] == NULL) {
+                goto out;
+        }
+
+        source = g_settings_schema_source_get_default ();
+        schema = g_settings_schema_source_lookup (source, elems[0], TRUE);
+        if (schema == NULL) {
+                goto out;
+        }
+
+        if (!check_gsettings_schema_has_key (schema, elems[1])) {
+                g_warning ("Gsettings key %s %s could not be found!",
+                           elems[0],
+                           elems[1]);
+                g_settings_schema_unref (schema);
+                goto out;
+        }
+
+        if (settings_pool == NULL) {
+                settings_pool = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                       g_free, g_object_unref);
+        }
+
+        settings = g_hash_table_lookup (settings_pool, elems[0]);
+        if (settings == NULL) {
+                settings = g_settings_new_full (schema, NULL, NULL);
+                g_hash_table_insert (settings_pool, g_strdup (elems[0]), settings);
+        }
+        g_settings_schema_unref (schema);
+
+        *settings_key = g_strdup (elems[1]);
+
+out:
+        g_strfreev (elems);
+
+        return settings;
+}
+
+/**
+ * csm_autostart_condition_new:
+ * @condition_string: the value of AutostartCondition
+ *
+ * Returns: (transfer full): the parsed condition. Conditions that can't
+ *     be parsed are of kind %CSM_CONDITION_UNKNOWN and never met.
+ */
+CsmAutostartCondition *
+csm_autostart_condition_new (const char *condition_string)
+{
+        CsmAutostartCondition *condition;
+        char                  *key;
+
+        g_return_val_if_fail (condition_string != NULL, NULL);
+
+        condition = g_new0 (CsmAutostartCondition, 1);
+        condition->string = g_strdup (condition_string);
+        condition->kind = parse_condition_string (condition_string, &key);
+
+        switch (condition->kind) {
+        case CSM_CONDITION_IF_EXISTS:
+        case CSM_CONDITION_UNLESS_EXISTS:
+                condition->key = key;
+                condition->path = g_build_filename (g_get_user_config_dir (), key, NULL);
+                condition->dirname = g_path_get_dirname (condition->path);
+                condition->basename = g_path_get_basename (condition->path);
+                break;
+        case CSM_CONDITION_GSETTINGS:
+                condition->settings = get_pooled_settings (key, &condition->key);
+                g_free (key);
+                break;
+        default:
+                condition->key = key;
+                break;
+        }
+
+        return condition;
+}
+
+const char *
+csm_autostart_condition_peek_string (CsmAutostartCondition *condition)
+{
+        return condition->string;
+}
+
+CsmConditionKind
+csm_autostart_condition_get_kind (CsmAutostartCondition *condition)
+{
+        return condition->kind;
+}
+
+/* Returns TRUE if the app may run */
+gboolean
+csm_autostart_condition_evaluate (CsmAutostartCondition *condition)
+{
+        const char *session_name;
+
+        g_return_val_if_fail (condition != NULL, FALSE);
+
+        switch (condition->kind) {
+        case CSM_CONDITION_IF_EXISTS:
+                return g_file_test (condition->path, G_FILE_TEST_EXISTS);
+        case CSM_CONDITION_UNLESS_EXISTS:
+                return !g_file_test (condition->path, G_FILE_TEST_EXISTS);
+        case CSM_CONDITION_GSETTINGS:
+                return condition->settings != NULL &&
+                       g_settings_get_boolean (condition->settings, condition->key);
+        case CSM_CONDITION_IF_SESSION:
+                session_name = csm_manager_peek_session_name (csm_manager_get ());
+                return g_strcmp0 (session_name, condition->key) == 0;
+        case CSM_CONDITION_UNLESS_SESSION:
+                session_name = csm_manager_peek_session_name (csm_manager_get ());
+                return g_strcmp0 (session_name, condition->key) != 0;
+        default:
+                return FALSE;
+        }
+}
+
+static GSList *
+lookup_watched_conditions (const char *dirname,
+                           const char *basename)
+{
+        DirWatch *watch;
+
+        watch = g_hash_table_lookup (dir_watches, dirname);
+        if (watch == NULL) {
+                return NULL;
+        }
+
+        return g_hash_table_lookup (watch->conditions, basename);
+}
+
+static void
+notify_conditions (const char *dirname,
+                   GFile      *file)
+{
+        GSList *list;
+        GSList *l;
+        char   *basename;
+
+        if (file == NULL) {
+                return;
+        }
+
+        /* The callbacks may free other conditions, and with the last of
+         * them the DirWatch, so look both up again before each call */
+        basename = g_file_get_basename (file);
+        list = g_slist_copy (lookup_watched_conditions (dirname, basename));
+
+        for (l = list; l != NULL; l = l->next) {
+                CsmAutostartCondition *condition = l->data;
+
+                if (g_slist_find (lookup_watched_conditions (dirname, basename), condition) == NULL) {
+                        continue;
+                }
+
+                condition->func (condition, condition->user_data);
+        }
+        g_slist_free (list);
+        g_free (basename);
+}
+
+static void
+on_dir_changed (GFileMonitor      *monitor,
+                GFile             *file,
+                GFile             *other_file,
+                GFileMonitorEvent  event,
+                DirWatch          *watch)
+{
+        char *dirname;
+
+        /* @watch may be gone once the first condition has been notified */
+        dirname = g_strdup (watch->dirname);
+
+        switch (event) {
+        case G_FILE_MONITOR_EVENT_CREATED:
+        case G_FILE_MONITOR_EVENT_DELETED:
+        case G_FILE_MONITOR_EVENT_MOVED_IN:
+        case G_FILE_MONITOR_EVENT_MOVED_OUT:
+                notify_conditions (dirname, file);
+                break;
+        case G_FILE_MONITOR_EVENT_MOVED:
+        case G_FILE_MONITOR_EVENT_RENAMED:
+                notify_conditions (dirname, file);
+                notify_conditions (dirname, other_file);
+                break;
+        default:
+                /* Ignore any other monitor event */
+                break;
+        }
+
+        g_free (dirname);
+}
+
+static void
+dir_watch_free (DirWatch *watch)
+{
+        if (watch->monitor != NULL) {
+                g_signal_handlers_disconnect_by_func (watch->monitor, on_dir_changed, watch);
+                g_file_monitor_cancel (watch->monitor);
+                g_object_unref (watch->monitor);
+        }
+        g_hash_table_destroy (watch->conditions);
+        g_free (watch->dirname);
+        g_free (watch);
+}
+
+static void
+watch_file (CsmAutostartCondition *condition)
+{
+        DirWatch *watch;
+        GSList   *list;
+
+        if (dir_watches == NULL) {
+                dir_watches = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                     g_free, (GDestroyNotify) dir_watch_free);
+        }
+
+        watch = g_hash_table_lookup (dir_watches, condition->dirname);
+        if (watch == NULL) {
+                GFile *dir;
+
+                watch = g_new0 (DirWatch, 1);
+                watch->dirname = g_strdup (condition->dirname);
+                watch->conditions = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                           g_free, (GDestroyNotify) g_slist_free);
+
+                dir = g_file_new_for_path (condition->dirname);
+                watch->monitor = g_file_monitor_directory (dir, G_FILE_MONITOR_WATCH_MOVES, NULL, NULL);
+                g_object_unref (dir);
+
+                if (watch->monitor != NULL) {
+                        g_signal_connect (watch->monitor, "changed",
+                                          G_CALLBACK (on_dir_changed), watch);
+                }
+
+                g_hash_table_insert (dir_watches, g_strdup (condition->dirname), watch);
+        }
+
+        list = g_hash_table_lookup (watch->conditions, condition->basename);
+        g_hash_table_steal (watch->conditions, condition->basename);
+        list = g_slist_prepend (list, condition);
+        g_hash_table_insert (watch->conditions, g_strdup (condition->basename), list);
+}
+
+static void
+unwatch_file (CsmAutostartCondition *condition)
+{
+        DirWatch *watch;
+        GSList   *list;
+
+        watch = g_hash_table_lookup (dir_watches, condition->dirname);
+        if (watch == NULL) {
+                return;
+        }
+
+        list = g_hash_table_lookup (watch->conditions, condition->basename);
+        g_hash_table_steal (watch->conditions, condition->basename);
+        list = g_slist_remove (list, condition);
+        if (list != NULL) {
+                g_hash_table_insert (watch->conditions, g_strdup (condition->basename), list);
+        }
+
+        if (g_hash_table_size (watch->conditions) == 0) {
+                g_hash_table_remove (dir_watches, condition->dirname);
+        }
+}
+
+static void
+on_settings_changed (GSettings             *settings,
+                     const char            *key,
+                     CsmAutostartCondition *condition)
+{
+        condition->func (condition, condition->user_data);
+}
+
+static void
+on_session_name_changed (GObject               *object,
+                         GParamSpec            *pspec,
+                         CsmAutostartCondition *condition)
+{
+        condition->func (condition, condition->user_data);
+}
+
+/**
+ * csm_autostart_condition_watch:
+ * @condition: a #CsmAutostartCondition
+ * @func: called whenever what @condition depends on changes
+ * @user_data: data for @func
+ *
+ * Can only be called once per condition.
+ */
+void
+csm_autostart_condition_watch (CsmAutostartCondition     *condition,
+                               CsmAutostartConditionFunc  func,
+                               gpointer                   user_data)
+{
+        char *signal;
+
+        g_return_if_fail (condition != NULL);
+        g_return_if_fail (condition->func == NULL);
+
+        condition->func = func;
+        condition->user_data = user_data;
+
+        switch (condition->kind) {
+        case CSM_CONDITION_IF_EXISTS:
+        case CSM_CONDITION_UNLESS_EXISTS:
+                watch_file (condition);
+                break;
+        case CSM_CONDITION_GSETTINGS:
+                if (condition->settings == NULL) {
+                        break;
+                }
+                /* changes are only reported for keys that have been read */
+                g_settings_get_boolean (condition->settings, condition->key);
+                signal = g_strdup_printf ("changed::%s", condition->key);
+                condition->handler_id = g_signal_connect (condition->settings, signal,
+                                                          G_CALLBACK (on_settings_changed),
+                                                          condition);
+                g_free (signal);
+                break;
+        case CSM_CONDITION_IF_SESSION:
+        case CSM_CONDITION_UNLESS_SESSION:
+                condition->handler_id = g_signal_connect (csm_manager_get (),
+                                                          "notify::session-name",
+                                                          G_CALLBACK (on_session_name_changed),
+                                                          condition);
+                break;
+        default:
+                break;
+        }
+}
+
+void
+csm_autostart_condition_free (CsmAutostartCondition *condition)
+{
+        if (condition == NULL) {
+                return;
+        }
+
+        if (condition->func != NULL) {
+                switch (condition->kind) {
+                case CSM_CONDITION_IF_EXISTS:
+                case CSM_CONDITION_UNLESS_EXISTS:
+                        unwatch_file (condition);
+                        break;
+                case CSM_CONDITION_GSETTINGS:
+                        if (condition->handler_id != 0) {
+                                g_signal_handler_disconnect (condition->settings,
+                                                             condition->handler_id);
+                        }
+                        break;
+                case CSM_CONDITION_IF_SESSION:
+                case CSM_CONDITION_UNLESS_SESSION:
+                        g_signal_handler_disconnect (csm_manager_get (),
+                                                     condition->handler_id);
+                        break;
+                default:
+                        break;
+                }
+        }
+
+        g_free (condition->string);
+        g_free (condition->key);
+        g_free (condition->path);
+        g_free (condition->dirname);
+        g_free (condition->basename);
+        g_free (condition);
+}
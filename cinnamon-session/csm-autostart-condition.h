@@ -0,0 +1,63 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * csm-autostart-condition.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#ifndef __CSM_AUTOSTART_CONDITION_H__
+#define __CSM_AUTOSTART_CONDITION_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* An AutostartCondition, parsed once. Conditions on files in the config
+ * dir share one monitor per directory, GSettings conditions share one
+ * settings object per schema. */
+
+typedef enum {
+        CSM_CONDITION_NONE           = 0,
+        CSM_CONDITION_IF_EXISTS      = 1,
+        CSM_CONDITION_UNLESS_EXISTS  = 2,
+        CSM_CONDITION_GSETTINGS      = 4,
+        CSM_CONDITION_IF_SESSION     = 5,
+        CSM_CONDITION_UNLESS_SESSION = 6,
+        CSM_CONDITION_UNKNOWN        = 7
+} CsmConditionKind;
+
+typedef struct _CsmAutostartCondition CsmAutostartCondition;
+
+/* Called when the condition may have changed */
+typedef void (* CsmAutostartConditionFunc) (CsmAutostartCondition *condition,
+                                            gpointer               user_data);
+
+CsmAutostartCondition *csm_autostart_condition_new         (const char                *condition_string);
+
+const char *           csm_autostart_condition_peek_string (CsmAutostartCondition     *condition);
+
+CsmConditionKind       csm_autostart_condition_get_kind    (CsmAutostartCondition     *condition);
+
+gboolean               csm_autostart_condition_evaluate    (CsmAutostartCondition     *condition);
+
+void                   csm_autostart_condition_watch       (CsmAutostartCondition     *condition,
+                                                            CsmAutostartConditionFunc  func,
+                                                            gpointer                   user_data);
+
+void                   csm_autostart_condition_free        (CsmAutostartCondition     *condition);
+
+G_END_DECLS
+
+#endif /* __CSM_AUTOSTART_CONDITION_H__ */
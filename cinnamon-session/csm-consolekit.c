@@ -694,7 +694,7 @@ csm_consolekit_suspend (CsmSystem *system, gboolean suspend_then_hibernate)
         CsmConsolekit *manager = CSM_CONSOLEKIT (system);
 
 	gchar *method = "Suspend";
-	if (suspend_then_hibernate && csm_consolekit_can_suspend (system) && csm_consolekit_can_hibernate (system)) {
+	if (suspend_then_hibernate && csm_system_can_suspend (system) && csm_system_can_hibernate (system)) {
 		method = "SuspendThenHibernate";
 	}
 	g_debug ("Suspend using: %s", method);
@@ -817,6 +817,24 @@ csm_consolekit_get_login_session_id (CsmSystem *system)
         return NULL;
 }
 
+static GDBusProxy *
+csm_consolekit_get_capability_query (CsmSystem            *system,
+                                     CsmSystemCapability   capability,
+                                     const char          **method)
+{
+        CsmConsolekit *manager = CSM_CONSOLEKIT (system);
+        static const char *methods[CSM_SYSTEM_N_CAPABILITIES] = {
+                [CSM_SYSTEM_CAPABILITY_STOP] = "CanStop",
+                [CSM_SYSTEM_CAPABILITY_RESTART] = "CanRestart",
+                [CSM_SYSTEM_CAPABILITY_SUSPEND] = "CanSuspend",
+                [CSM_SYSTEM_CAPABILITY_HIBERNATE] = "CanHibernate",
+        };
+
+        *method = methods[capability];
+
+        return manager->priv->ck_proxy;
+}
+
 static void
 csm_consolekit_system_init (CsmSystemInterface *iface)
 {
@@ -835,6 +853,7 @@ csm_consolekit_system_init (CsmSystemInterface *iface)
         iface->remove_inhibitor = csm_consolekit_remove_inhibitor;
         iface->is_last_session_for_user = csm_consolekit_is_last_session_for_user;
         iface->get_login_session_id = csm_consolekit_get_login_session_id;
+        iface->get_capability_query = csm_consolekit_get_capability_query;
 }
 
 CsmConsolekit *
@@ -864,6 +883,9 @@ ck_proxy_signal_cb (GDBusProxy  *proxy,
                 return;
         }
 
+        /* What CanStop and friends answer may change either way */
+        g_signal_emit_by_name (consolekit, "capabilities-changed");
+
         g_variant_get (parameters, "(b)", &is_about_to_shutdown);
         if (!is_about_to_shutdown) {
                 g_debug ("CsmConsolekit: ignoring %s signal since about-to-shutdown is FALSE", signal_name);
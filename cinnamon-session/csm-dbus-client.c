@@ -135,90 +135,160 @@ csm_dbus_client_init (CsmDBusClient *client)
         client->priv = CSM_DBUS_CLIENT_GET_PRIVATE (client);
 }
 
-/* adapted from PolicyKit */
-static gboolean
-get_caller_info (CsmDBusClient *client,
-                 const char    *sender,
-                 uid_t         *calling_uid_out,
-                 pid_t         *calling_pid_out)
-{
-        GDBusConnection *connection;
-        gboolean         retval;
-        GError          *error;
-        GVariant        *uid_variant, *pid_variant;
-        uid_t            uid;
+/* The credentials of each sender, asked for once with
+ * GetConnectionCredentials and forgotten when the name goes away. Unique
+ * names are never reused, so a cached answer can't go stale. */
+typedef struct {
+        gboolean         known;
         pid_t            pid;
+        /* CsmDBusClients waiting for the answer */
+        GSList          *waiters;
+        GDBusConnection *connection;
+        guint            subscription_id;
+} CallerInfo;
 
-        retval = FALSE;
-        connection = NULL;
-        uid_variant = pid_variant = NULL;
+static GHashTable *caller_infos = NULL;
 
-        if (sender == NULL) {
-                goto out;
-        }
+static void
+caller_info_free (CallerInfo *info)
+{
+        g_dbus_connection_signal_unsubscribe (info->connection, info->subscription_id);
+        g_object_unref (info->connection);
+        g_slist_free_full (info->waiters, g_object_unref);
+        g_free (info);
+}
 
-        error = NULL;
-        connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error);
+static void
+on_caller_name_owner_changed (GDBusConnection *connection,
+                              const char      *sender_name,
+                              const char      *object_path,
+                              const char      *interface_name,
+                              const char      *signal_name,
+                              GVariant        *parameters,
+                              gpointer         user_data)
+{
+        const char *name;
+        const char *new_owner;
 
-        if (error != NULL) {
-                g_warning ("error getting session bus: %s", error->message);
-                g_error_free (error);
-                goto out;
+        g_variant_get (parameters, "(&s&s&s)", &name, NULL, &new_owner);
+
+        if (new_owner[0] == '\0') {
+                g_debug ("CsmDBusClient: forgetting credentials of %s", name);
+                g_hash_table_remove (caller_infos, name);
         }
+}
 
-        uid_variant = g_dbus_connection_call_sync (connection,
-                                                   "org.freedesktop.DBus",
-                                                   "/org/freedesktop/DBus",
-                                                   "org.freedesktop.DBus",
-                                                   "GetConnectionUnixUser",
-                                                   g_variant_new ("(s)", sender),
-                                                   G_VARIANT_TYPE ("(u)"),
-                                                   G_DBUS_CALL_FLAGS_NONE,
-                                                   -1, NULL, &error);
+static void
+on_get_connection_credentials (GObject      *source,
+                               GAsyncResult *result,
+                               gpointer      user_data)
+{
+        char       *sender = user_data;
+        CallerInfo *info;
+        GVariant   *res;
+        GVariant   *credentials;
+        GError     *error;
+        guint32     uid;
+        guint32     pid;
+        GSList     *l;
 
-        if (error != NULL) {
-                g_debug ("GetConnectionUnixUser() failed: %s", error->message);
-                g_error_free (error);
+        info = g_hash_table_lookup (caller_infos, sender);
+
+        error = NULL;
+        res = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, &error);
+
+        if (info == NULL) {
+                /* vanished in the meantime */
                 goto out;
         }
 
-        pid_variant = g_dbus_connection_call_sync (connection,
-                                                   "org.freedesktop.DBus",
-                                                   "/org/freedesktop/DBus",
-                                                   "org.freedesktop.DBus",
-                                                   "GetConnectionUnixProcessID",
-                                                   g_variant_new ("(s)", sender),
-                                                   G_VARIANT_TYPE ("(u)"),
-                                                   G_DBUS_CALL_FLAGS_NONE,
-                                                   -1, NULL, &error);
+        uid = (guint32) -1;
+        pid = 0;
 
-        if (error != NULL) {
-                g_debug ("GetConnectionUnixProcessID() failed: %s", error->message);
-                g_error_free (error);
-                goto out;
+        if (res == NULL) {
+                g_debug ("GetConnectionCredentials() failed: %s", error->message);
+        } else {
+                credentials = g_variant_get_child_value (res, 0);
+                g_variant_lookup (credentials, "UnixUserID", "u", &uid);
+                g_variant_lookup (credentials, "ProcessID", "u", &pid);
+                g_variant_unref (credentials);
+
+                g_debug ("uid = %d", (int) uid);
+                g_debug ("pid = %d", (int) pid);
         }
 
-        g_variant_get (uid_variant, "(u)", &uid);
-        g_variant_get (pid_variant, "(u)", &pid);
+        info->known = TRUE;
+        info->pid = pid;
 
-        if (calling_uid_out != NULL) {
-                *calling_uid_out = uid;
+        for (l = info->waiters; l != NULL; l = l->next) {
+                CSM_DBUS_CLIENT (l->data)->priv->caller_pid = pid;
         }
-        if (calling_pid_out != NULL) {
-                *calling_pid_out = pid;
+        g_slist_free_full (info->waiters, g_object_unref);
+        info->waiters = NULL;
+
+        /* The sender most likely left before we subscribed to
+         * NameOwnerChanged, so nothing else would ever drop the entry */
+        if (res == NULL) {
+                g_hash_table_remove (caller_infos, sender);
         }
 
-        retval = TRUE;
+out:
+        g_clear_pointer (&res, g_variant_unref);
+        g_clear_error (&error);
+        g_free (sender);
+}
 
-        g_debug ("uid = %d", uid);
-        g_debug ("pid = %d", pid);
+/* Sets the caller pid of @client from the credentials of @sender, now
+ * if they are known already or once the bus answers. */
+static void
+lookup_caller_info (CsmDBusClient *client,
+                    const char    *sender)
+{
+        CallerInfo *info;
 
-out:
-        g_clear_pointer (&uid_variant, (GDestroyNotify) g_variant_unref);
-        g_clear_pointer (&pid_variant, (GDestroyNotify) g_variant_unref);
-        g_clear_object (&connection);
+        if (caller_infos == NULL) {
+                caller_infos = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                      g_free, (GDestroyNotify) caller_info_free);
+        }
 
-        return retval;
+        info = g_hash_table_lookup (caller_infos, sender);
+        if (info != NULL) {
+                if (info->known) {
+                        client->priv->caller_pid = info->pid;
+                } else {
+                        info->waiters = g_slist_prepend (info->waiters, g_object_ref (client));
+                }
+                return;
+        }
+
+        info = g_new0 (CallerInfo, 1);
+        info->connection = g_object_ref (client->priv->connection);
+        info->waiters = g_slist_prepend (NULL, g_object_ref (client));
+        info->subscription_id =
+                g_dbus_connection_signal_subscribe (info->connection,
+                                                    "org.freedesktop.DBus",
+                                                    "org.freedesktop.DBus",
+                                                    "NameOwnerChanged",
+                                                    "/org/freedesktop/DBus",
+                                                    sender,
+                                                    G_DBUS_SIGNAL_FLAGS_NONE,
+                                                    on_caller_name_owner_changed,
+                                                    NULL,
+                                                    NULL);
+        g_hash_table_insert (caller_infos, g_strdup (sender), info);
+
+        g_dbus_connection_call (info->connection,
+                                "org.freedesktop.DBus",
+                                "/org/freedesktop/DBus",
+                                "org.freedesktop.DBus",
+                                "GetConnectionCredentials",
+                                g_variant_new ("(s)", sender),
+                                G_VARIANT_TYPE ("(a{sv})"),
+                                G_DBUS_CALL_FLAGS_NONE,
+                                -1,
+                                NULL,
+                                on_get_connection_credentials,
+                                g_strdup (sender));
 }
 
 static void
@@ -245,8 +315,11 @@ csm_dbus_client_set_bus_name (CsmDBusClient  *client,
         client->priv->bus_name = g_strdup (bus_name);
         g_object_notify (G_OBJECT (client), "bus-name");
 
-        if (!get_caller_info (client, bus_name, NULL, &client->priv->caller_pid)) {
-                client->priv->caller_pid = 0;
+        /* filled in by lookup_caller_info() */
+        client->priv->caller_pid = 0;
+
+        if (bus_name != NULL && setup_connection (client)) {
+                lookup_caller_info (client, bus_name);
         }
 
         client->priv->watch_id = g_bus_watch_name (G_BUS_TYPE_SESSION,
@@ -0,0 +1,285 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * csm-latency.c
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "csm-latency.h"
+#include "csm-util.h"
+
+#define CSM_LATENCY_FILENAME   "app-latency"
+#define CSM_LATENCY_GROUP      "Latency"
+#define CSM_LATENCY_MISS_GROUP "Misses"
+
+/* Only the most recent logins are kept, so the history follows
+ * upgrades and hardware changes. */
+#define CSM_LATENCY_MAX_SAMPLES 20
+
+/* Apps are launched slowest first, going by this percentile of how long
+ * they took to register during earlier logins */
+#define CSM_LATENCY_LAUNCH_ORDER_PERCENTILE 50
+
+static GKeyFile *history = NULL;
+static gboolean  dirty = FALSE;
+
+static char *
+get_history_filename (void)
+{
+        const char *cache_dir;
+
+        cache_dir = csm_util_get_cache_dir ();
+        if (cache_dir == NULL) {
+                return NULL;
+        }
+
+        return g_build_filename (cache_dir, CSM_LATENCY_FILENAME, NULL);
+}
+
+static GKeyFile *
+get_history (void)
+{
+        char *filename;
+
+        if (history != NULL) {
+                return history;
+        }
+
+        history = g_key_file_new ();
+
+        filename = get_history_filename ();
+        if (filename != NULL) {
+                /* A missing or broken file just means no history yet */
+                g_key_file_load_from_file (history, filename, G_KEY_FILE_NONE, NULL);
+                g_free (filename);
+        }
+
+        return history;
+}
+
+/* With @replace_last, @msec takes the place of the most recent sample */
+static void
+add_sample (const char *app_id,
+            guint       msec,
+            gboolean    replace_last)
+{
+        GKeyFile *keyfile;
+        gint     *samples;
+        gsize     length;
+        gint     *new_samples;
+        gsize     new_length;
+        gsize     skip;
+
+        keyfile = get_history ();
+
+        samples = g_key_file_get_integer_list (keyfile, CSM_LATENCY_GROUP, app_id, &length, NULL);
+        if (samples == NULL) {
+                length = 0;
+        }
+
+        if (replace_last && length > 0) {
+                length--;
+        }
+
+        skip = (length >= CSM_LATENCY_MAX_SAMPLES) ? length - CSM_LATENCY_MAX_SAMPLES + 1 : 0;
+        new_length = length - skip + 1;
+
+        new_samples = g_new (gint, new_length);
+        if (length > skip) {
+                memcpy (new_samples, samples + skip, (length - skip) * sizeof (gint));
+        }
+        new_samples[new_length - 1] = (gint) MIN (msec, G_MAXINT);
+
+        g_key_file_set_integer_list (keyfile, CSM_LATENCY_GROUP, app_id, new_samples, new_length);
+        dirty = TRUE;
+
+        g_free (new_samples);
+        g_free (samples);
+}
+
+void
+csm_latency_record (const char *app_id,
+                    guint       msec)
+{
+        if (IS_STRING_EMPTY (app_id)) {
+                return;
+        }
+
+        add_sample (app_id, msec, FALSE);
+        g_key_file_remove_key (get_history (), CSM_LATENCY_MISS_GROUP, app_id, NULL);
+}
+
+/* @app_id didn't register within @msec. That is recorded as a sample too,
+ * as a lower bound, or the deadlines derived from the history could only
+ * ever shrink. */
+void
+csm_latency_record_miss (const char *app_id,
+                         guint       msec)
+{
+        GKeyFile *keyfile;
+
+        if (IS_STRING_EMPTY (app_id)) {
+                return;
+        }
+
+        add_sample (app_id, msec, FALSE);
+
+        keyfile = get_history ();
+        g_key_file_set_integer (keyfile, CSM_LATENCY_MISS_GROUP, app_id,
+                                csm_latency_get_misses (app_id) + 1);
+}
+
+/* @app_id registered after all, once csm_latency_record_miss() was
+ * called for it; @msec replaces the lower bound recorded then */
+void
+csm_latency_record_late (const char *app_id,
+                         guint       msec)
+{
+        if (IS_STRING_EMPTY (app_id)) {
+                return;
+        }
+
+        add_sample (app_id, msec, TRUE);
+        g_key_file_remove_key (get_history (), CSM_LATENCY_MISS_GROUP, app_id, NULL);
+}
+
+guint
+csm_latency_get_misses (const char *app_id)
+{
+        int misses;
+
+        misses = g_key_file_get_integer (get_history (), CSM_LATENCY_MISS_GROUP, app_id, NULL);
+
+        return MAX (misses, 0);
+}
+
+static int
+compare_samples (gconstpointer a,
+                 gconstpointer b)
+{
+        return *(const gint *) a - *(const gint *) b;
+}
+
+gboolean
+csm_latency_get_percentile (const char *app_id,
+                            guint       percentile,
+                            guint      *msec)
+{
+        gint  *samples;
+        gsize  length;
+        gsize  rank;
+
+        samples = g_key_file_get_integer_list (get_history (), CSM_LATENCY_GROUP, app_id, &length, NULL);
+        if (samples == NULL || length == 0) {
+                g_free (samples);
+                return FALSE;
+        }
+
+        qsort (samples, length, sizeof (gint), compare_samples);
+
+        /* nearest-rank */
+        rank = (length * MIN (percentile, 100) + 99) / 100;
+        rank = CLAMP (rank, 1, length) - 1;
+
+        *msec = (guint) MAX (samples[rank], 0);
+
+        g_free (samples);
+
+        return TRUE;
+}
+
+/* Returns: (transfer full): the apps there is a history for */
+char **
+csm_latency_get_app_ids (void)
+{
+        char **app_ids;
+
+        app_ids = g_key_file_get_keys (get_history (), CSM_LATENCY_GROUP, NULL, NULL);
+        if (app_ids == NULL) {
+                app_ids = g_new0 (char *, 1);
+        }
+
+        return app_ids;
+}
+
+static int
+compare_launch_order (const CsmLatencyLaunch *a,
+                      const CsmLatencyLaunch *b)
+{
+        if (a->required != b->required) {
+                return a->required ? -1 : 1;
+        }
+
+        if (a->msec != b->msec) {
+                return a->msec > b->msec ? -1 : 1;
+        }
+
+        return g_strcmp0 (a->app_id, b->app_id);
+}
+
+/* Required apps first, then the slowest to register first. An app that
+ * missed its last deadline took at least that long, which its history
+ * holds as the largest sample. */
+void
+csm_latency_sort_launch_order (CsmLatencyLaunch *launches,
+                               guint             n_launches)
+{
+        guint i;
+
+        for (i = 0; i < n_launches; i++) {
+                guint percentile;
+
+                percentile = csm_latency_get_misses (launches[i].app_id) > 0
+                        ? 100 : CSM_LATENCY_LAUNCH_ORDER_PERCENTILE;
+                if (!csm_latency_get_percentile (launches[i].app_id, percentile, &launches[i].msec)) {
+                        launches[i].msec = 0;
+                }
+        }
+
+        qsort (launches, n_launches, sizeof (CsmLatencyLaunch),
+               (int (*) (const void *, const void *)) compare_launch_order);
+}
+
+gboolean
+csm_latency_save (GError **error)
+{
+        char     *filename;
+        gboolean  res;
+
+        if (history == NULL || !dirty) {
+                return TRUE;
+        }
+
+        filename = get_history_filename ();
+        if (filename == NULL) {
+                return TRUE;
+        }
+
+        res = g_key_file_save_to_file (history, filename, error);
+        if (res) {
+                dirty = FALSE;
+        }
+
+        g_free (filename);
+
+        return res;
+}
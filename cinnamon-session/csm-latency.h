@@ -0,0 +1,61 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * csm-latency.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#ifndef __CSM_LATENCY_H__
+#define __CSM_LATENCY_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Per-app registration latency history, persisted across logins */
+
+typedef struct {
+        gpointer    data;
+        const char *app_id;
+        gboolean    required;
+        /* set by csm_latency_sort_launch_order() */
+        guint       msec;
+} CsmLatencyLaunch;
+
+void        csm_latency_record          (const char *app_id,
+                                         guint       msec);
+
+void        csm_latency_record_miss     (const char *app_id,
+                                         guint       msec);
+
+void        csm_latency_record_late     (const char *app_id,
+                                         guint       msec);
+
+gboolean    csm_latency_get_percentile  (const char *app_id,
+                                         guint       percentile,
+                                         guint      *msec);
+
+guint       csm_latency_get_misses      (const char *app_id);
+
+char      **csm_latency_get_app_ids     (void);
+
+void        csm_latency_sort_launch_order (CsmLatencyLaunch *launches,
+                                           guint             n_launches);
+
+gboolean    csm_latency_save            (GError    **error);
+
+G_END_DECLS
+
+#endif /* __CSM_LATENCY_H__ */
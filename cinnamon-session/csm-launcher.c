@@ -0,0 +1,410 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * csm-launcher.c
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include <glib.h>
+#include <glib-unix.h>
+#include <gio/gio.h>
+
+#include "csm-launcher.h"
+
+typedef struct {
+        GPid            pid;
+        int             pidfd;
+        GChildWatchFunc function;
+        gpointer        data;
+} PidfdWatch;
+
+#ifndef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP
+/* Closes everything but stdio that is open now. Descriptors other threads
+ * open before the spawn are missed, but GLib opens its own close-on-exec,
+ * and closing one that went away in between is ignored by the child. */
+static gboolean
+add_close_inherited_fds (posix_spawn_file_actions_t *actions)
+{
+        GDir       *dir;
+        const char *name;
+        int         fd;
+
+        dir = g_dir_open ("/proc/self/fd", 0, NULL);
+        if (dir == NULL) {
+                return FALSE;
+        }
+
+        while ((name = g_dir_read_name (dir)) != NULL) {
+                fd = atoi (name);
+                if (fd > STDERR_FILENO) {
+                        posix_spawn_file_actions_addclose (actions, fd);
+                }
+        }
+
+        /* that closes the descriptor of @dir too, which is harmless */
+        g_dir_close (dir);
+
+        return TRUE;
+}
+#endif
+
+/**
+ * csm_launcher_spawn:
+ * @argv: the program and its arguments, searched for in $PATH
+ * @envp: the complete environment of the child
+ * @working_dir: (allow-none): the directory to run the child in
+ * @child_pid: the child, which must be reaped, see csm_launcher_watch()
+ * @error: a #GError
+ *
+ * Like g_spawn_async() with %G_SPAWN_SEARCH_PATH and
+ * %G_SPAWN_DO_NOT_REAP_CHILD, but using posix_spawn(), which the C
+ * library implements with a vfork-style clone that doesn't copy the
+ * page tables of the session process.
+ *
+ * Nothing runs in the child before the exec, so unlike GDesktopAppInfo
+ * this can't set GIO_LAUNCHED_DESKTOP_FILE_PID; the child is the process
+ * that was spawned, so its own pid is that value.
+ *
+ * Returns: %TRUE on success. Fails with %G_IO_ERROR_NOT_SUPPORTED when
+ *     the inherited file descriptors can't be closed in the child, or
+ *     this C library can't honour @working_dir; use g_spawn_async() then.
+ */
+gboolean
+csm_launcher_spawn (const char * const  *argv,
+                    const char * const  *envp,
+                    const char          *working_dir,
+                    GPid                *child_pid,
+                    GError             **error)
+{
+        posix_spawn_file_actions_t actions;
+        posix_spawnattr_t          attr;
+        sigset_t                   signals;
+        pid_t                      pid;
+        int                        res;
+
+        g_return_val_if_fail (argv != NULL && argv[0] != NULL, FALSE);
+        g_return_val_if_fail (envp != NULL, FALSE);
+
+#ifndef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP
+        if (working_dir != NULL) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                             "Cannot change the working directory of %s", argv[0]);
+                return FALSE;
+        }
+#endif
+
+        posix_spawn_file_actions_init (&actions);
+        posix_spawn_file_actions_addopen (&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+        /* g_spawn_async() closes everything but stdio in the child, so
+         * must we */
+#ifdef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP
+        posix_spawn_file_actions_addclosefrom_np (&actions, STDERR_FILENO + 1);
+#else
+        if (!add_close_inherited_fds (&actions)) {
+                posix_spawn_file_actions_destroy (&actions);
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                             "Cannot close the inherited file descriptors of %s", argv[0]);
+                return FALSE;
+        }
+#endif
+#ifdef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP
+        if (working_dir != NULL) {
+                posix_spawn_file_actions_addchdir_np (&actions, working_dir);
+        }
+#endif
+
+        /* Don't pass on what the session blocks or ignores */
+        posix_spawnattr_init (&attr);
+        sigemptyset (&signals);
+        posix_spawnattr_setsigmask (&attr, &signals);
+        sigfillset (&signals);
+        posix_spawnattr_setsigdefault (&attr, &signals);
+        posix_spawnattr_setflags (&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+        res = posix_spawnp (&pid, argv[0], &actions, &attr,
+                            (char * const *) argv, (char * const *) envp);
+
+        posix_spawnattr_destroy (&attr);
+        posix_spawn_file_actions_destroy (&actions);
+
+        if (res != 0) {
+                g_set_error (error, G_IO_ERROR, g_io_error_from_errno (res),
+                             "Failed to execute child process “%s” (%s)",
+                             argv[0], g_strerror (res));
+                return FALSE;
+        }
+
+        *child_pid = pid;
+
+        return TRUE;
+}
+
+/* Runs in the child between fork and exec, so only system calls */
+static void
+run_held_child (const char           *path,
+                char * const         *argv,
+                char * const         *envp,
+                const char           *working_dir,
+                GSpawnChildSetupFunc  child_setup,
+                gpointer              user_data,
+                int                   release_fd,
+                int                   max_fd)
+{
+        struct sigaction action;
+        sigset_t         signals;
+        gboolean         closed;
+        char             buf;
+        int              fd;
+        int              sig;
+
+        /* Nothing but the release pipe, or the copies held here would
+         * keep other held children waiting */
+        closed = FALSE;
+#ifdef SYS_close_range
+        closed = (release_fd == STDERR_FILENO + 1 ||
+                  syscall (SYS_close_range, STDERR_FILENO + 1, release_fd - 1, 0) == 0) &&
+                 syscall (SYS_close_range, release_fd + 1, ~0U, 0) == 0;
+#endif
+        if (!closed) {
+                for (fd = STDERR_FILENO + 1; fd < max_fd; fd++) {
+                        if (fd != release_fd) {
+                                close (fd);
+                        }
+                }
+        }
+
+        while (read (release_fd, &buf, 1) < 0 && errno == EINTR)
+                ;
+        close (release_fd);
+
+        fd = open ("/dev/null", O_RDONLY);
+        if (fd >= 0 && fd != STDIN_FILENO) {
+                dup2 (fd, STDIN_FILENO);
+                close (fd);
+        }
+
+        if (working_dir != NULL && chdir (working_dir) < 0) {
+                _exit (127);
+        }
+
+        if (child_setup != NULL) {
+                child_setup (user_data);
+        }
+
+        /* Don't pass on what the session blocks or ignores */
+        memset (&action, 0, sizeof (action));
+        action.sa_handler = SIG_DFL;
+        for (sig = 1; sig < NSIG; sig++) {
+                sigaction (sig, &action, NULL);
+        }
+        sigemptyset (&signals);
+        sigprocmask (SIG_SETMASK, &signals, NULL);
+
+        execve (path, argv, envp);
+        _exit (127);
+}
+
+/**
+ * csm_launcher_spawn_held:
+ * @argv: the program and its arguments, searched for in the $PATH of
+ *     the session
+ * @envp: the complete environment of the child
+ * @working_dir: (allow-none): the directory to run the child in
+ * @child_setup: (allow-none): run in the child right before the exec
+ * @user_data: data for @child_setup
+ * @child_pid: the child, which must be reaped, see csm_launcher_watch()
+ * @release_fd: the descriptor to close to let the child go on
+ * @error: a #GError
+ *
+ * Like csm_launcher_spawn(), but the child waits before the exec until
+ * @release_fd is closed, so it can be moved into another cgroup before
+ * it runs anything of its own. That takes a fork(), like g_spawn_async()
+ * does, whose own child setup can't wait since it reports exec failures
+ * synchronously.
+ *
+ * Errors after the fork, like a failing exec, only show as the child
+ * exiting with status 127.
+ *
+ * Returns: %TRUE on success
+ */
+gboolean
+csm_launcher_spawn_held (const char * const    *argv,
+                         const char * const    *envp,
+                         const char            *working_dir,
+                         GSpawnChildSetupFunc   child_setup,
+                         gpointer               user_data,
+                         GPid                  *child_pid,
+                         int                   *release_fd,
+                         GError               **error)
+{
+        char  *path;
+        int    fds[2];
+        int    max_fd;
+        pid_t  pid;
+
+        g_return_val_if_fail (argv != NULL && argv[0] != NULL, FALSE);
+        g_return_val_if_fail (envp != NULL, FALSE);
+
+        if (strchr (argv[0], '/') != NULL) {
+                path = g_strdup (argv[0]);
+        } else {
+                path = g_find_program_in_path (argv[0]);
+        }
+        if (path == NULL) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                             "Failed to execute child process “%s” (%s)",
+                             argv[0], g_strerror (ENOENT));
+                return FALSE;
+        }
+
+        if (working_dir != NULL && !g_file_test (working_dir, G_FILE_TEST_IS_DIR)) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                             "Failed to change to directory “%s” (%s)",
+                             working_dir, g_strerror (ENOENT));
+                g_free (path);
+                return FALSE;
+        }
+
+        if (!g_unix_open_pipe (fds, FD_CLOEXEC, error)) {
+                g_free (path);
+                return FALSE;
+        }
+
+        max_fd = (int) MIN (sysconf (_SC_OPEN_MAX), G_MAXINT);
+
+        pid = fork ();
+        if (pid == 0) {
+                run_held_child (path,
+                                (char * const *) argv,
+                                (char * const *) envp,
+                                working_dir,
+                                child_setup,
+                                user_data,
+                                fds[0],
+                                max_fd);
+        }
+
+        close (fds[0]);
+        g_free (path);
+
+        if (pid < 0) {
+                int errsv = errno;
+
+                close (fds[1]);
+                g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                             "Failed to fork (%s)", g_strerror (errsv));
+                return FALSE;
+        }
+
+        *child_pid = pid;
+        *release_fd = fds[1];
+
+        return TRUE;
+}
+
+static gboolean
+pidfd_ready (int           fd,
+             GIOCondition  condition,
+             PidfdWatch   *watch)
+{
+        int   status;
+        pid_t res;
+
+        do {
+                res = waitpid (watch->pid, &status, WNOHANG);
+        } while (res < 0 && errno == EINTR);
+
+        if (res == 0) {
+                /* not yet */
+                return TRUE;
+        }
+
+        if (res < 0) {
+                g_warning ("CsmLauncher: unable to get the status of pid %d: %s",
+                           (int) watch->pid, g_strerror (errno));
+                status = 0;
+        }
+
+        watch->function (watch->pid, status, watch->data);
+
+        return FALSE;
+}
+
+static void
+pidfd_watch_free (PidfdWatch *watch)
+{
+        close (watch->pidfd);
+        g_free (watch);
+}
+
+/**
+ * csm_launcher_watch:
+ * @pid: a child process that hasn't been reaped
+ * @function: called with the wait status once @pid is gone
+ * @data: data for @function
+ *
+ * Like g_child_watch_add(), but driven by a pidfd, so no SIGCHLD handling
+ * and no races with pid reuse are involved. Falls back to
+ * g_child_watch_add() on kernels without pidfd_open().
+ *
+ * Returns: the ID of the watch, for g_source_remove()
+ */
+guint
+csm_launcher_watch (GPid            pid,
+                    GChildWatchFunc function,
+                    gpointer        data)
+{
+        PidfdWatch *watch;
+        GSource    *source;
+        guint       id;
+        int         pidfd;
+
+        pidfd = -1;
+#ifdef SYS_pidfd_open
+        /* An unreaped child can't be replaced by another process */
+        pidfd = syscall (SYS_pidfd_open, pid, 0);
+#endif
+        if (pidfd < 0) {
+                return g_child_watch_add (pid, function, data);
+        }
+
+        watch = g_new0 (PidfdWatch, 1);
+        watch->pid = pid;
+        watch->pidfd = pidfd;
+        watch->function = function;
+        watch->data = data;
+
+        source = g_unix_fd_source_new (pidfd, G_IO_IN);
+        g_source_set_callback (source,
+                               (GSourceFunc) pidfd_ready,
+                               watch,
+                               (GDestroyNotify) pidfd_watch_free);
+        id = g_source_attach (source, NULL);
+        g_source_unref (source);
+
+        return id;
+}
@@ -0,0 +1,51 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * csm-launcher.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#ifndef __CSM_LAUNCHER_H__
+#define __CSM_LAUNCHER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* posix_spawn() based replacement for g_spawn_async(), which has to fork
+ * the whole session process, and pidfd based child watches */
+
+gboolean    csm_launcher_spawn      (const char * const  *argv,
+                                     const char * const  *envp,
+                                     const char          *working_dir,
+                                     GPid                *child_pid,
+                                     GError             **error);
+
+gboolean    csm_launcher_spawn_held (const char * const    *argv,
+                                     const char * const    *envp,
+                                     const char            *working_dir,
+                                     GSpawnChildSetupFunc   child_setup,
+                                     gpointer               user_data,
+                                     GPid                  *child_pid,
+                                     int                   *release_fd,
+                                     GError               **error);
+
+guint       csm_launcher_watch      (GPid                 pid,
+                                     GChildWatchFunc      function,
+                                     gpointer             data);
+
+G_END_DECLS
+
+#endif /* __CSM_LAUNCHER_H__ */
@@ -53,6 +53,11 @@
 #include "csm-autostart-app.h"
 
 #include "csm-util.h"
+#include "csm-timeline.h"
+#include "csm-latency.h"
+#include "csm-autostart-cache.h"
+#include "csm-readahead.h"
+#include "csm-substring-matcher.h"
 #include "mdm.h"
 #include "csm-system.h"
 #include "csm-session-save.h"
@@ -73,6 +78,38 @@
  */
 #define CSM_MANAGER_PHASE_TIMEOUT 30 /* seconds */
 
+/* Startup phases wait for the slowest pending app's historical p99
+ * registration time times this factor, within the bounds below.  Apps
+ * without any history get the full CSM_MANAGER_PHASE_TIMEOUT, apps that
+ * failed to register the last few times only the minimum.  Required apps
+ * always get the full CSM_MANAGER_PHASE_TIMEOUT, see
+ * wait_for_required_apps(). */
+#define CSM_MANAGER_PHASE_TIMEOUT_FACTOR     2
+#define CSM_MANAGER_PHASE_TIMEOUT_MIN        3 /* seconds */
+#define CSM_MANAGER_PHASE_TIMEOUT_MAX_MISSES 3
+
+/* Ordered apps of the Application phase keep waiting for their
+ * dependencies this long into the running session */
+#define CSM_MANAGER_DAG_FLUSH_DELAY 30 /* seconds */
+
+/* Worker threads used to parse autostart desktop files */
+#define CSM_MANAGER_MAX_PARSE_THREADS 8
+
+/* How long into the running session apps are sampled for the readahead
+ * profile, so the Application phase apps get to load too */
+#define CSM_MANAGER_READAHEAD_RECORD_TIME 15 /* seconds */
+
+/* Application phase launch admission, see launch_queue_admit() */
+#define CSM_MANAGER_LAUNCH_POLL_INTERVAL 250  /* milliseconds */
+#define CSM_MANAGER_LAUNCH_SETTLE_TIME   2000 /* milliseconds */
+
+/* Inhibitor changes are published at most this often */
+#define CSM_MANAGER_INHIBITOR_COALESCE_TIME 250 /* milliseconds */
+
+/* Quiet time after the last change to an autostart dir before it's
+ * applied, see reload_autostart_apps() */
+#define CSM_MANAGER_AUTOSTART_RELOAD_DELAY 1000 /* milliseconds */
+
 #define MDM_FLEXISERVER_COMMAND "mdmflexiserver"
 #define MDM_FLEXISERVER_ARGS    "--startnew Standard"
 
@@ -91,6 +128,10 @@
 #define KEY_PREFER_HYBRID_SLEEP   "prefer-hybrid-sleep"
 #define KEY_SUSPEND_HIBERNATE     "suspend-then-hibernate"
 #define KEY_DEBUG                 "debug"
+#define KEY_DEPENDENCY_STARTUP    "dependency-ordered-startup"
+#define KEY_LAUNCH_CONCURRENCY    "launch-concurrency"
+#define KEY_STARTUP_READAHEAD     "startup-readahead"
+#define KEY_SYSTEMD_SCOPES        "systemd-scopes"
 
 #define POWER_SETTINGS_SCHEMA     "org.cinnamon.settings-daemon.plugins.power"
 #define KEY_LOCK_ON_SUSPEND       "lock-on-suspend"
@@ -104,6 +145,24 @@
 #define POLKIT_MATE_AGENT_ID      "polkit-mate-authentication-agent-1"
 
 static void app_registered (CsmApp     *app, CsmManager *manager);
+static void dag_flush_phase (CsmManager *manager);
+static gboolean on_dag_flush_timeout (CsmManager *manager);
+static gboolean on_phase_timeout (CsmManager *manager);
+static void launch_queue_admit (CsmManager *manager);
+static void launch_app_registered (CsmApp *app, CsmManager *manager);
+static void launch_app_exited (CsmApp *app, guchar exit_code, CsmManager *manager);
+static void launch_app_died (CsmApp *app, int signal, CsmManager *manager);
+
+/* No more apps are admitted while tasks are stalled on any of these for
+ * more than the given share of the time */
+static const struct {
+        const char *resource;
+        guint       percent;
+} launch_pressure_limits[] = {
+        { "cpu",    80 },
+        { "io",     40 },
+        { "memory", 10 }
+};
 
 typedef enum
 {
@@ -117,12 +176,23 @@ typedef enum
         CSM_MANAGER_LOGOUT_SHUTDOWN_MDM
 } CsmManagerLogoutType;
 
+#define CSM_MANAGER_N_INHIBITOR_FLAGS 5
+
 struct CsmManagerPrivate
 {
         gboolean                failsafe;
         CsmStore               *clients;
         CsmStore               *inhibitors;
         CsmInhibitorFlag        inhibited_actions;
+        /* inhibitor id => flags, flags are gone from the store on removal */
+        GHashTable             *inhibitor_flags;
+        /* number of inhibitors per CsmInhibitorFlag bit */
+        guint                   inhibitor_counts[CSM_MANAGER_N_INHIBITOR_FLAGS];
+        /* changes not passed on yet, see flush_inhibitor_changes () */
+        guint                   inhibitor_flush_id;
+
+        GHashTable             *system_inhibitors_added;
+        GPtrArray              *system_inhibitors_removed;
         CsmStore               *apps;
         CsmPresence            *presence;
         CsmXsmpServer          *xsmp_server;
@@ -130,12 +200,43 @@ struct CsmManagerPrivate
         char                   *session_name;
         gboolean                is_fallback_session : 1;
 
+        /* Setenv calls not passed on to the bus and systemd yet, see
+         * commit_pending_environment () */
+        CsmEnvTransaction      *pending_env;
+        guint                   pending_env_id;
+
         /* Current status */
         CsmManagerPhase         phase;
         guint                   phase_timeout_id;
         GSList                 *required_apps;
         GSList                 *pending_apps;
         CsmManagerLogoutMode    logout_mode;
+
+        /* Dependency-ordered startup */
+        gboolean                dag_enabled;
+        GSList                 *dag_waiting;
+        GHashTable             *dag_visited;
+        GHashTable             *dag_settled;
+        guint                   dag_flush_id;
+
+        /* app -> monotonic launch time, for the latency history */
+        GHashTable             *launch_times;
+        /* apps given up on at a phase timeout, see give_up_on_app () */
+        GHashTable             *late_apps;
+        gint64                  phase_start_time;
+        /* ends the readahead recording, see on_readahead_record_timeout () */
+        guint                   readahead_record_id;
+
+        /* Application phase launch admission */
+        int                     launch_concurrency;
+        GQueue                  launch_queue;
+        guint                   launch_queue_required;
+        GHashTable             *launch_in_flight;
+        guint                   launch_poll_id;
+        guint64                 launch_stall[G_N_ELEMENTS (launch_pressure_limits)];
+        gint64                  launch_stall_time;
+        gboolean                launch_pressure;
+
         GSList                 *query_clients;
         guint                   query_timeout_id;
         /* This is used for CSM_MANAGER_PHASE_END_SESSION only at the moment,
@@ -154,6 +255,20 @@ struct CsmManagerPrivate
         GSettings              *power_settings;
         GSettings              *lockdown_settings;
 
+        /* autostart-blacklist, recompiled whenever it changes */
+        CsmSubstringMatcher    *blacklist;
+        /* org.cinnamon, only needed once the MATE polkit agent turns up */
+        GSettings              *cinnamon_settings;
+        gboolean                internal_polkit_agent;
+
+        /* Autostart dir hot-reload, see csm_manager_watch_autostart_dirs () */
+        char                  **autostart_dirs;
+        GPtrArray              *autostart_monitors;
+        /* desktop file => mtime when it was last applied */
+        GHashTable             *autostart_mtimes;
+        guint                   autostart_reload_id;
+        gboolean                autostart_reload_pending;
+
         CsmSystem              *system;
 
         GDBusProxy             *bus_proxy;
@@ -219,6 +334,11 @@ static void     _handle_client_end_session_response (CsmManager *manager,
                                                      gboolean    do_last,
                                                      gboolean    cancel,
                                                      const char *reason);
+static void     reload_autostart_apps (CsmManager *manager);
+static void     queue_autostart_reload (CsmManager *manager);
+static void     flush_inhibitor_changes_now (CsmManager *manager);
+static gboolean commit_pending_environment (CsmManager *manager);
+
 static gpointer manager_object = NULL;
 
 G_DEFINE_TYPE (CsmManager, csm_manager, G_TYPE_OBJECT)
@@ -257,11 +377,22 @@ start_app_or_warn (CsmManager *manager,
 
         g_debug ("CsmManager: starting app '%s'", csm_app_peek_id (app));
 
+        commit_pending_environment (manager);
+
         res = csm_app_start (app, &error);
         if (error != NULL) {
                 g_warning ("Failed to start app: %s", error->message);
                 g_clear_error (&error);
         }
+
+        if (res) {
+                gint64 *launch_time;
+
+                launch_time = g_new (gint64, 1);
+                *launch_time = g_get_monotonic_time ();
+                g_hash_table_replace (manager->priv->launch_times, app, launch_time);
+        }
+
         return res;
 }
 
@@ -331,31 +462,154 @@ debug_inhibitors (CsmManager *manager)
                            manager);
 }
 
-static gboolean
-_find_by_cookie (const char   *id,
-                 CsmInhibitor *inhibitor,
-                 guint        *cookie_ap)
+/* Store indexes, see csm_store_add_index() */
+#define INDEX_APP_ID     "app-id"
+#define INDEX_STARTUP_ID "startup-id"
+#define INDEX_PROVIDES   "provides"
+#define INDEX_BUS_NAME   "bus-name"
+#define INDEX_CLIENT_ID  "client-id"
+#define INDEX_COOKIE     "cookie"
+
+static char **
+index_key (const char *key)
 {
-        guint cookie_b;
+        char **keys;
+
+        if (IS_STRING_EMPTY (key)) {
+                return NULL;
+        }
 
-        cookie_b = csm_inhibitor_peek_cookie (inhibitor);
+        keys = g_new (char *, 2);
+        keys[0] = g_strdup (key);
+        keys[1] = NULL;
 
-        return (*cookie_ap == cookie_b);
+        return keys;
 }
 
-static gboolean
-_client_has_startup_id (const char *id,
-                        CsmClient  *client,
-                        const char *startup_id_a)
+static char **
+app_app_id_keys (CsmApp *app)
 {
-        const char *startup_id_b;
+        return index_key (csm_app_peek_app_id (app));
+}
 
-        startup_id_b = csm_client_peek_startup_id (client);
-        if (IS_STRING_EMPTY (startup_id_b)) {
-                return FALSE;
+static char **
+app_startup_id_keys (CsmApp *app)
+{
+        return index_key (csm_app_peek_startup_id (app));
+}
+
+static char **
+app_provides_keys (CsmApp *app)
+{
+        return csm_app_get_provides (app);
+}
+
+static char **
+client_startup_id_keys (CsmClient *client)
+{
+        return index_key (csm_client_peek_startup_id (client));
+}
+
+static char **
+client_bus_name_keys (CsmClient *client)
+{
+        if (! CSM_IS_DBUS_CLIENT (client)) {
+                return NULL;
         }
 
-        return (strcmp (startup_id_a, startup_id_b) == 0);
+        return index_key (csm_dbus_client_get_bus_name (CSM_DBUS_CLIENT (client)));
+}
+
+static char **
+inhibitor_bus_name_keys (CsmInhibitor *inhibitor)
+{
+        return index_key (csm_inhibitor_peek_bus_name (inhibitor));
+}
+
+static char **
+inhibitor_client_id_keys (CsmInhibitor *inhibitor)
+{
+        return index_key (csm_inhibitor_peek_client_id (inhibitor));
+}
+
+static char **
+inhibitor_cookie_keys (CsmInhibitor *inhibitor)
+{
+        char **keys;
+
+        keys = g_new (char *, 2);
+        keys[0] = g_strdup_printf ("%u", csm_inhibitor_peek_cookie (inhibitor));
+        keys[1] = NULL;
+
+        return keys;
+}
+
+static CsmInhibitor *
+find_inhibitor_for_cookie (CsmManager *manager,
+                           guint       cookie)
+{
+        CsmInhibitor *inhibitor;
+        char          key[16];
+
+        g_snprintf (key, sizeof (key), "%u", cookie);
+        inhibitor = (CsmInhibitor *)csm_store_lookup_index (manager->priv->inhibitors,
+                                                            INDEX_COOKIE,
+                                                            key);
+        return inhibitor;
+}
+
+static CsmClient *
+find_client_for_startup_id (CsmManager *manager,
+                            const char *startup_id)
+{
+        CsmClient *client;
+        client = (CsmClient *)csm_store_lookup_index (manager->priv->clients,
+                                                      INDEX_STARTUP_ID,
+                                                      startup_id);
+        return client;
+}
+
+/* Stops @app, or @client if it was launched by @app, and makes sure it
+ * won't be restarted automatically */
+static void
+stop_app_or_client (CsmManager *manager,
+                    CsmApp     *app,
+                    CsmClient  *client)
+{
+        GError  *error;
+        gboolean res;
+
+        if (client != NULL) {
+                /* Kill client in case condition if false and make sure it won't
+                 * be automatically restarted by adding the client to
+                 * condition_clients */
+                manager->priv->condition_clients =
+                        g_slist_prepend (manager->priv->condition_clients, client);
+
+                g_debug ("CsmManager: stopping client %s for app", csm_client_peek_id (client));
+
+                error = NULL;
+                res = csm_client_stop (client, &error);
+                if (! res) {
+                        g_warning ("Not able to stop app client from its condition: %s",
+                                   error->message);
+                        g_error_free (error);
+                }
+        } else {
+                g_debug ("CsmManager: stopping app %s", csm_app_peek_id (app));
+
+                /* If we don't have a client then we should try to kill the app ,
+                 * if it is running */
+                error = NULL;
+                if (csm_app_is_running (app)) {
+                        res = csm_app_stop (app, &error);
+                        if (! res) {
+                                 g_warning ("Not able to stop app from its condition: %s",
+                                            error->message);
+                                 g_error_free (error);
+                        }
+                }
+        }
 }
 
 static void
@@ -369,9 +623,7 @@ app_condition_changed (CsmApp     *app,
                  csm_app_peek_id (app),
                  condition);
 
-        client = (CsmClient *)csm_store_find (manager->priv->clients,
-                                              (CsmStoreFunc)_client_has_startup_id,
-                                              (char *)csm_app_peek_startup_id (app));
+        client = find_client_for_startup_id (manager, csm_app_peek_startup_id (app));
 
         if (condition) {
                 if (!csm_app_is_running (app) && client == NULL) {
@@ -380,40 +632,7 @@ app_condition_changed (CsmApp     *app,
                         g_debug ("CsmManager: not starting - app still running '%s'", csm_app_peek_id (app));
                 }
         } else {
-                GError  *error;
-                gboolean res;
-
-                if (client != NULL) {
-                        /* Kill client in case condition if false and make sure it won't
-                         * be automatically restarted by adding the client to
-                         * condition_clients */
-                        manager->priv->condition_clients =
-                                g_slist_prepend (manager->priv->condition_clients, client);
-
-                        g_debug ("CsmManager: stopping client %s for app", csm_client_peek_id (client));
-
-                        error = NULL;
-                        res = csm_client_stop (client, &error);
-                        if (! res) {
-                                g_warning ("Not able to stop app client from its condition: %s",
-                                           error->message);
-                                g_error_free (error);
-                        }
-                } else {
-                        g_debug ("CsmManager: stopping app %s", csm_app_peek_id (app));
-
-                        /* If we don't have a client then we should try to kill the app ,
-                         * if it is running */
-                        error = NULL;
-                        if (csm_app_is_running (app)) {
-                                res = csm_app_stop (app, &error);
-                                if (! res) {
-                                         g_warning ("Not able to stop app from its condition: %s",
-                                                    error->message);
-                                         g_error_free (error);
-                                }
-                        }
-                }
+                stop_app_or_client (manager, app, client);
         }
 }
 
@@ -490,6 +709,8 @@ csm_manager_quit (CsmManager *manager)
          * this works. */
 
         csm_store_clear (manager->priv->inhibitors);
+        /* or our own locks would block the shutdown */
+        flush_inhibitor_changes_now (manager);
 
         switch (manager->priv->logout_type) {
         case CSM_MANAGER_LOGOUT_LOGOUT:
@@ -537,6 +758,11 @@ end_phase (CsmManager *manager)
         g_debug ("CsmManager: ending phase %s",
                  phase_num_to_name (manager->priv->phase));
 
+        if (manager->priv->phase != CSM_MANAGER_PHASE_RUNNING) {
+                csm_timeline_record (CSM_TIMELINE_PHASE_END,
+                                     phase_num_to_name (manager->priv->phase));
+        }
+
         g_slist_free (manager->priv->pending_apps);
         manager->priv->pending_apps = NULL;
 
@@ -565,6 +791,19 @@ end_phase (CsmManager *manager)
         case CSM_MANAGER_PHASE_PANEL:
         case CSM_MANAGER_PHASE_DESKTOP:
         case CSM_MANAGER_PHASE_APPLICATION:
+                if (!manager->priv->dag_enabled) {
+                        break;
+                }
+
+                /* Application phase apps are never waited for, so their
+                 * ordering has to be honoured from the running session */
+                if (manager->priv->phase == CSM_MANAGER_PHASE_APPLICATION) {
+                        manager->priv->dag_flush_id = g_timeout_add_seconds (CSM_MANAGER_DAG_FLUSH_DELAY,
+                                                                             (GSourceFunc)on_dag_flush_timeout,
+                                                                             manager);
+                } else {
+                        dag_flush_phase (manager);
+                }
                 break;
         case CSM_MANAGER_PHASE_RUNNING:
                 if (_log_out_is_locked_down (manager)) {
@@ -597,9 +836,17 @@ static void
 app_event_during_startup (CsmManager *manager,
                           CsmApp     *app)
 {
+        gint64 *launch_time;
+
         if (!(manager->priv->phase < CSM_MANAGER_PHASE_APPLICATION))
                 return;
 
+        launch_time = g_hash_table_lookup (manager->priv->launch_times, app);
+        if (launch_time != NULL && g_slist_find (manager->priv->pending_apps, app) != NULL) {
+                csm_latency_record (csm_app_peek_app_id (app),
+                                    (g_get_monotonic_time () - *launch_time) / 1000);
+        }
+
         manager->priv->pending_apps = g_slist_remove (manager->priv->pending_apps, app);
 
         if (manager->priv->pending_apps == NULL) {
@@ -630,6 +877,8 @@ _restart_app (CsmManager *manager,
                 return;
         }
 
+        commit_pending_environment (manager);
+
         if (!csm_app_restart (app, &error)) {
                 if (is_app_required (manager, app)) {
                         on_required_app_failure (manager, app);
@@ -688,15 +937,113 @@ app_exited (CsmApp     *app,
         }
 }
 
+static void
+record_late_registration (CsmManager *manager,
+                          CsmApp     *app)
+{
+        gint64 *launch_time;
+        GError *error = NULL;
+
+        launch_time = g_hash_table_lookup (manager->priv->launch_times, app);
+        if (launch_time == NULL) {
+                return;
+        }
+
+        csm_latency_record_late (csm_app_peek_app_id (app),
+                                 (g_get_monotonic_time () - *launch_time) / 1000);
+
+        /* the history was already saved when the session started running */
+        if (manager->priv->phase >= CSM_MANAGER_PHASE_RUNNING &&
+            !csm_latency_save (&error)) {
+                g_warning ("Unable to save app latency history: %s", error->message);
+                g_clear_error (&error);
+        }
+}
+
 static void
 app_registered (CsmApp     *app,
                 CsmManager *manager)
 {
         g_debug ("App %s registered", csm_app_peek_app_id (app));
 
+        if (g_hash_table_remove (manager->priv->late_apps, app)) {
+                record_late_registration (manager, app);
+        }
+
         app_event_during_startup (manager, app);
 }
 
+/* Stops waiting for @app in this phase, and records how long it was
+ * waited for, to be corrected should it still register */
+static void
+give_up_on_app (CsmManager *manager,
+                CsmApp     *app)
+{
+        gint64 *launch_time;
+        gint64  since;
+
+        g_warning ("Application '%s' failed to register before timeout",
+                   csm_app_peek_app_id (app));
+
+        launch_time = g_hash_table_lookup (manager->priv->launch_times, app);
+        since = launch_time != NULL ? *launch_time : manager->priv->phase_start_time;
+
+        csm_latency_record_miss (csm_app_peek_app_id (app),
+                                 (g_get_monotonic_time () - since) / 1000);
+        g_hash_table_add (manager->priv->late_apps, app);
+}
+
+/* The adaptive deadline only gives up on optional apps, required ones
+ * count as failed after the full CSM_MANAGER_PHASE_TIMEOUT.  Returns
+ * TRUE if the phase keeps waiting for them. */
+static gboolean
+wait_for_required_apps (CsmManager *manager)
+{
+        GSList  *l;
+        GSList  *next;
+        gint64   remaining;
+        gboolean has_required;
+
+        remaining = manager->priv->phase_start_time
+                    + CSM_MANAGER_PHASE_TIMEOUT * G_USEC_PER_SEC
+                    - g_get_monotonic_time ();
+        if (remaining <= 0) {
+                return FALSE;
+        }
+
+        has_required = FALSE;
+        for (l = manager->priv->pending_apps; l != NULL; l = l->next) {
+                if (is_app_required (manager, l->data)) {
+                        has_required = TRUE;
+                        break;
+                }
+        }
+
+        if (!has_required) {
+                return FALSE;
+        }
+
+        for (l = manager->priv->pending_apps; l != NULL; l = next) {
+                CsmApp *app = l->data;
+
+                next = l->next;
+
+                if (!is_app_required (manager, app)) {
+                        give_up_on_app (manager, app);
+                        manager->priv->pending_apps = g_slist_delete_link (manager->priv->pending_apps, l);
+                }
+        }
+
+        g_debug ("CsmManager: phase %s waits %" G_GINT64_FORMAT " ms more for required apps",
+                 phase_num_to_name (manager->priv->phase), remaining / 1000);
+
+        manager->priv->phase_timeout_id = g_timeout_add (remaining / 1000 + 1,
+                                                         (GSourceFunc)on_phase_timeout,
+                                                         manager);
+
+        return TRUE;
+}
+
 static gboolean
 on_phase_timeout (CsmManager *manager)
 {
@@ -714,10 +1061,13 @@ on_phase_timeout (CsmManager *manager)
         case CSM_MANAGER_PHASE_PANEL:
         case CSM_MANAGER_PHASE_DESKTOP:
         case CSM_MANAGER_PHASE_APPLICATION:
+                if (wait_for_required_apps (manager)) {
+                        return FALSE;
+                }
+
                 for (a = manager->priv->pending_apps; a; a = a->next) {
                         CsmApp *app = a->data;
-                        g_warning ("Application '%s' failed to register before timeout",
-                                   csm_app_peek_app_id (app));
+                        give_up_on_app (manager, app);
                         if (is_app_required (manager, app))
                                 on_required_app_failure (manager, app);
                 }
@@ -747,6 +1097,10 @@ _autostart_delay_timeout (CsmApp *app)
 
         if (!csm_app_peek_is_disabled (app)
             && !csm_app_peek_is_conditionally_disabled (app)) {
+                if (manager_object != NULL) {
+                        commit_pending_environment (CSM_MANAGER (manager_object));
+                }
+
                 res = csm_app_start (app, &error);
                 if (!res) {
                         if (error != NULL) {
@@ -763,709 +1117,962 @@ _autostart_delay_timeout (CsmApp *app)
         return FALSE;
 }
 
-static gboolean
-_start_app (const char *id,
-            CsmApp     *app,
-            CsmManager *manager)
+/* Application phase launch admission.
+ *
+ * Rather than launching every application at once, at most
+ * launch-concurrency of them are starting at any time, and while the
+ * kernel reports CPU, I/O or memory pressure only one is.  An app counts
+ * as starting until it registers, exits or has had
+ * CSM_MANAGER_LAUNCH_SETTLE_TIME to get going, since many never register.
+ * Required apps go first; delayed apps keep their own timers.
+ */
+
+static void
+update_launch_pressure (CsmManager *manager)
 {
-        int      delay;
+        gint64 now;
+        gint64 elapsed;
+        guint  i;
 
-        if (csm_app_peek_phase (app) != manager->priv->phase) {
-                goto out;
-        }
+        now = g_get_monotonic_time ();
+        elapsed = now - manager->priv->launch_stall_time;
 
-        /* Keep track of app autostart condition in order to react
-         * accordingly in the future. */
-        g_signal_connect (app,
-                          "condition-changed",
-                          G_CALLBACK (app_condition_changed),
-                          manager);
+        manager->priv->launch_pressure = FALSE;
 
-        if (csm_app_peek_is_disabled (app)
-            || csm_app_peek_is_conditionally_disabled (app)) {
-                g_debug ("CsmManager: Skipping disabled app: %s", id);
-                goto out;
-        }
+        for (i = 0; i < G_N_ELEMENTS (launch_pressure_limits); i++) {
+                guint64 total;
 
-        delay = csm_app_peek_autostart_delay (app);
-        if (delay > 0) {
-                g_timeout_add_seconds (delay,
-                                       (GSourceFunc)_autostart_delay_timeout,
-                                       g_object_ref (app));
-                g_debug ("CsmManager: %s is scheduled to start in %d seconds", id, delay);
-                goto out;
-        }
+                if (!csm_util_get_pressure_stall (launch_pressure_limits[i].resource, &total)) {
+                        continue;
+                }
 
-        if (!start_app_or_warn (manager, app))
-                goto out;
+                /* the first sample only sets the baseline */
+                if (manager->priv->launch_stall_time > 0 &&
+                    total > manager->priv->launch_stall[i] &&
+                    (total - manager->priv->launch_stall[i]) * 100 > (guint64) elapsed * launch_pressure_limits[i].percent) {
+                        g_debug ("CsmManager: %s pressure, holding back launches",
+                                 launch_pressure_limits[i].resource);
+                        manager->priv->launch_pressure = TRUE;
+                }
 
-        if (manager->priv->phase < CSM_MANAGER_PHASE_APPLICATION) {
-                /* Historical note - apparently,
-                 * e.g. gnome-settings-daemon used to "daemonize", and
-                 * so cinnamon-session assumes process exit means "ok
-                 * we're done".  Of course this is broken, we don't
-                 * even distinguish between exit code 0 versus not-0,
-                 * nor do we have any metadata which tells us a
-                 * process is going to "daemonize" or not (and
-                 * basically nothing should be anyways).
-                 */
-                g_signal_connect (app,
-                                  "exited",
-                                  G_CALLBACK (app_exited),
-                                  manager);
-                g_signal_connect (app,
-                                  "registered",
-                                  G_CALLBACK (app_registered),
-                                  manager);
-                g_signal_connect (app,
-                                  "died",
-                                  G_CALLBACK (app_died),
-                                  manager);
-                manager->priv->pending_apps = g_slist_prepend (manager->priv->pending_apps, app);
+                manager->priv->launch_stall[i] = total;
         }
- out:
-        return FALSE;
+
+        manager->priv->launch_stall_time = now;
 }
 
 static void
-do_phase_startup (CsmManager *manager)
+launch_forget_app (CsmManager *manager,
+                   CsmApp     *app)
 {
-        csm_store_foreach (manager->priv->apps,
-                           (CsmStoreFunc)_start_app,
-                           manager);
+        g_signal_handlers_disconnect_by_func (app, launch_app_registered, manager);
+        g_signal_handlers_disconnect_by_func (app, launch_app_exited, manager);
+        g_signal_handlers_disconnect_by_func (app, launch_app_died, manager);
+}
 
-        if (manager->priv->pending_apps != NULL) {
-                if (manager->priv->phase < CSM_MANAGER_PHASE_APPLICATION) {
-                        manager->priv->phase_timeout_id = g_timeout_add_seconds (CSM_MANAGER_PHASE_TIMEOUT,
-                                                                                 (GSourceFunc)on_phase_timeout,
-                                                                                 manager);
-                }
-        } else {
-                end_phase (manager);
+static void
+launch_app_settled (CsmManager *manager,
+                    CsmApp     *app)
+{
+        if (!g_hash_table_remove (manager->priv->launch_in_flight, app)) {
+                return;
         }
+
+        launch_forget_app (manager, app);
+        launch_queue_admit (manager);
 }
 
-typedef struct {
-        CsmManager *manager;
-        guint       flags;
-} ClientEndSessionData;
+static void
+launch_app_registered (CsmApp     *app,
+                       CsmManager *manager)
+{
+        launch_app_settled (manager, app);
+}
 
+static void
+launch_app_exited (CsmApp     *app,
+                   guchar      exit_code,
+                   CsmManager *manager)
+{
+        launch_app_settled (manager, app);
+}
 
-static gboolean
-_client_end_session (CsmClient            *client,
-                     ClientEndSessionData *data)
+static void
+launch_app_died (CsmApp     *app,
+                 int         signal,
+                 CsmManager *manager)
 {
-        gboolean ret;
-        GError  *error;
+        launch_app_settled (manager, app);
+}
 
-        error = NULL;
-        ret = csm_client_end_session (client, data->flags, &error);
-        if (! ret) {
-                g_warning ("Unable to query client: %s", error->message);
-                g_error_free (error);
-                /* FIXME: what should we do if we can't communicate with client? */
-        } else {
-                g_debug ("CsmManager: adding client to end-session clients: %s", csm_client_peek_id (client));
-                data->manager->priv->query_clients = g_slist_prepend (data->manager->priv->query_clients,
-                                                                      client);
+static void
+expire_launches (CsmManager *manager)
+{
+        GHashTableIter iter;
+        gpointer       app;
+        gint64         now;
+
+        now = g_get_monotonic_time ();
+
+        g_hash_table_iter_init (&iter, manager->priv->launch_in_flight);
+        while (g_hash_table_iter_next (&iter, &app, NULL)) {
+                gint64 *launch_time;
+
+                launch_time = g_hash_table_lookup (manager->priv->launch_times, app);
+                if (launch_time == NULL ||
+                    now - *launch_time >= CSM_MANAGER_LAUNCH_SETTLE_TIME * 1000) {
+                        launch_forget_app (manager, app);
+                        g_hash_table_iter_remove (&iter);
+                }
         }
+}
 
-        return FALSE;
+static void
+launch_queue_clear (CsmManager *manager)
+{
+        GHashTableIter iter;
+        gpointer       app;
+
+        while ((app = g_queue_pop_head (&manager->priv->launch_queue)) != NULL) {
+                g_object_unref (app);
+        }
+        manager->priv->launch_queue_required = 0;
+
+        if (manager->priv->launch_in_flight != NULL) {
+                g_hash_table_iter_init (&iter, manager->priv->launch_in_flight);
+                while (g_hash_table_iter_next (&iter, &app, NULL)) {
+                        launch_forget_app (manager, app);
+                        g_hash_table_iter_remove (&iter);
+                }
+        }
+
+        if (manager->priv->launch_poll_id > 0) {
+                g_source_remove (manager->priv->launch_poll_id);
+                manager->priv->launch_poll_id = 0;
+        }
 }
 
 static gboolean
-_client_end_session_helper (const char           *id,
-                            CsmClient            *client,
-                            ClientEndSessionData *data)
+launch_queue_poll (CsmManager *manager)
 {
-        return _client_end_session (client, data);
+        manager->priv->launch_poll_id = 0;
+
+        update_launch_pressure (manager);
+        expire_launches (manager);
+        launch_queue_admit (manager);
+
+        return FALSE;
 }
 
 static void
-do_phase_end_session (CsmManager *manager)
+launch_queue_admit (CsmManager *manager)
 {
-        ClientEndSessionData data;
+        /* Logging out, forget about the rest */
+        if (manager->priv->phase > CSM_MANAGER_PHASE_RUNNING) {
+                launch_queue_clear (manager);
+                return;
+        }
 
-        data.manager = manager;
-        data.flags = 0;
+        while (!g_queue_is_empty (&manager->priv->launch_queue)) {
+                CsmApp *app;
+                guint   in_flight;
 
-        close_end_session_dialog (manager);
+                in_flight = g_hash_table_size (manager->priv->launch_in_flight);
+
+                /* one at a time under pressure, but never none */
+                if (in_flight >= (guint) manager->priv->launch_concurrency ||
+                    (in_flight > 0 && manager->priv->launch_pressure)) {
+                        break;
+                }
 
-        csm_util_stop_systemd_unit ("cinnamon-session.target", "replace", NULL);
+                app = g_queue_pop_head (&manager->priv->launch_queue);
+                if (manager->priv->launch_queue_required > 0) {
+                        manager->priv->launch_queue_required--;
+                }
 
-        if (manager->priv->logout_mode == CSM_MANAGER_LOGOUT_MODE_FORCE) {
-                data.flags |= CSM_CLIENT_END_SESSION_FLAG_FORCEFUL;
-        }
-        if (csm_manager_get_autosave_enabled (manager)) {
-                data.flags |= CSM_CLIENT_END_SESSION_FLAG_SAVE;
+                /* a condition change or the autostart reload may have
+                 * started it while it was queued */
+                if (csm_app_is_running (app)) {
+                        g_debug ("CsmManager: %s is already running, not launching it again",
+                                 csm_app_peek_id (app));
+                        g_object_unref (app);
+                        continue;
+                }
+
+                /* the condition may have changed while it was queued */
+                if (!csm_app_peek_is_disabled (app)
+                    && !csm_app_peek_is_conditionally_disabled (app)
+                    && start_app_or_warn (manager, app)) {
+                        g_hash_table_add (manager->priv->launch_in_flight, app);
+
+                        g_signal_connect (app,
+                                          "registered",
+                                          G_CALLBACK (launch_app_registered),
+                                          manager);
+                        g_signal_connect (app,
+                                          "exited",
+                                          G_CALLBACK (launch_app_exited),
+                                          manager);
+                        g_signal_connect (app,
+                                          "died",
+                                          G_CALLBACK (launch_app_died),
+                                          manager);
+                }
+
+                g_object_unref (app);
         }
 
-        if (manager->priv->phase_timeout_id > 0) {
-                g_source_remove (manager->priv->phase_timeout_id);
-                manager->priv->phase_timeout_id = 0;
+        if (g_queue_is_empty (&manager->priv->launch_queue)) {
+                g_debug ("CsmManager: all queued apps have been launched");
+                launch_queue_clear (manager);
+        } else if (manager->priv->launch_poll_id == 0) {
+                manager->priv->launch_poll_id = g_timeout_add (CSM_MANAGER_LAUNCH_POLL_INTERVAL,
+                                                               (GSourceFunc)launch_queue_poll,
+                                                               manager);
         }
+}
 
-        if (csm_store_size (manager->priv->clients) > 0) {
-                manager->priv->phase_timeout_id = g_timeout_add_seconds (CSM_MANAGER_PHASE_TIMEOUT,
-                                                                         (GSourceFunc)on_phase_timeout,
-                                                                         manager);
+static void
+launch_queue_add (CsmManager *manager,
+                  CsmApp     *app)
+{
+        g_debug ("CsmManager: queueing %s for launch", csm_app_peek_id (app));
 
-                csm_store_foreach (manager->priv->clients,
-                                   (CsmStoreFunc)_client_end_session_helper,
-                                   &data);
+        if (is_app_required (manager, app)) {
+                g_queue_push_nth (&manager->priv->launch_queue,
+                                  g_object_ref (app),
+                                  manager->priv->launch_queue_required++);
         } else {
-                end_phase (manager);
+                g_queue_push_tail (&manager->priv->launch_queue, g_object_ref (app));
         }
 }
 
-static void
-do_phase_end_session_part_2 (CsmManager *manager)
+static gboolean
+_start_app (const char *id,
+            CsmApp     *app,
+            CsmManager *manager)
 {
-        ClientEndSessionData data;
+        int      delay;
 
-        data.manager = manager;
-        data.flags = 0;
+        if (csm_app_peek_phase (app) != manager->priv->phase) {
+                goto out;
+        }
 
-        if (manager->priv->logout_mode == CSM_MANAGER_LOGOUT_MODE_FORCE) {
-                data.flags |= CSM_CLIENT_END_SESSION_FLAG_FORCEFUL;
+        /* Keep track of app autostart condition in order to react
+         * accordingly in the future. */
+        g_signal_connect (app,
+                          "condition-changed",
+                          G_CALLBACK (app_condition_changed),
+                          manager);
+
+        if (csm_app_peek_is_disabled (app)
+            || csm_app_peek_is_conditionally_disabled (app)) {
+                g_debug ("CsmManager: Skipping disabled app: %s", id);
+                goto out;
         }
-        if (csm_manager_get_autosave_enabled (manager)) {
-                data.flags |= CSM_CLIENT_END_SESSION_FLAG_SAVE;
+
+        delay = csm_app_peek_autostart_delay (app);
+        if (delay > 0) {
+                g_timeout_add_seconds (delay,
+                                       (GSourceFunc)_autostart_delay_timeout,
+                                       g_object_ref (app));
+                g_debug ("CsmManager: %s is scheduled to start in %d seconds", id, delay);
+                goto out;
         }
-        data.flags |= CSM_CLIENT_END_SESSION_FLAG_LAST;
 
-        /* keep the timeout that was started at the beginning of the
-         * CSM_MANAGER_PHASE_END_SESSION phase */
+        if (manager->priv->phase == CSM_MANAGER_PHASE_APPLICATION
+            && manager->priv->launch_concurrency > 0) {
+                launch_queue_add (manager, app);
+                goto out;
+        }
 
-        if (g_slist_length (manager->priv->next_query_clients) > 0) {
-                g_slist_foreach (manager->priv->next_query_clients,
-                                 (GFunc)_client_end_session,
-                                 &data);
+        if (!start_app_or_warn (manager, app))
+                goto out;
 
-                g_slist_free (manager->priv->next_query_clients);
-                manager->priv->next_query_clients = NULL;
-        } else {
-                end_phase (manager);
+        if (manager->priv->phase < CSM_MANAGER_PHASE_APPLICATION) {
+                /* Historical note - apparently,
+                 * e.g. gnome-settings-daemon used to "daemonize", and
+                 * so cinnamon-session assumes process exit means "ok
+                 * we're done".  Of course this is broken, we don't
+                 * even distinguish between exit code 0 versus not-0,
+                 * nor do we have any metadata which tells us a
+                 * process is going to "daemonize" or not (and
+                 * basically nothing should be anyways).
+                 */
+                g_signal_connect (app,
+                                  "exited",
+                                  G_CALLBACK (app_exited),
+                                  manager);
+                g_signal_connect (app,
+                                  "registered",
+                                  G_CALLBACK (app_registered),
+                                  manager);
+                g_signal_connect (app,
+                                  "died",
+                                  G_CALLBACK (app_died),
+                                  manager);
+                manager->priv->pending_apps = g_slist_prepend (manager->priv->pending_apps, app);
         }
+ out:
+        return FALSE;
 }
 
+/* Dependency-ordered startup.
+ *
+ * When enabled, autostart apps may list app ids (with or without the
+ * .desktop suffix) or provides names in X-Cinnamon-After and
+ * X-Cinnamon-Requires.  Such an app is started as soon as everything it
+ * names has registered or exited, even if its own phase has not been
+ * reached yet.  Apps without ordering keys keep the phases as their
+ * default edges.  Nothing jumps ahead of the Initialization phase, since
+ * that is where the session environment gets set up.  An app waiting for
+ * something from a later phase waits for that phase instead of holding up
+ * its own, and Application phase apps are only given up on
+ * CSM_MANAGER_DAG_FLUSH_DELAY into the running session.
+ */
+
 static gboolean
-_client_stop (const char *id,
-              CsmClient  *client,
-              gpointer    user_data)
+dag_app_is_active (CsmApp *app)
 {
-        gboolean ret;
-        GError  *error;
+        return !csm_app_peek_is_disabled (app)
+                && !csm_app_peek_is_conditionally_disabled (app);
+}
 
-        error = NULL;
-        ret = csm_client_stop (client, &error);
-        if (! ret) {
-                g_warning ("Unable to stop client: %s", error->message);
-                g_error_free (error);
-                /* FIXME: what should we do if we can't communicate with client? */
-        } else {
-                g_debug ("CsmManager: stopped client: %s", csm_client_peek_id (client));
+static gboolean
+dag_app_may_start (CsmManager *manager,
+                   CsmApp     *app)
+{
+        if (csm_app_peek_phase (app) <= manager->priv->phase) {
+                return TRUE;
         }
 
-        return FALSE;
+        return manager->priv->phase > CSM_MANAGER_PHASE_INITIALIZATION
+                && csm_app_has_ordering (app);
 }
 
 static void
-do_phase_exit (CsmManager *manager)
+dag_mark_settled (CsmManager *manager,
+                  CsmApp     *app,
+                  gboolean    ok)
 {
-        if (csm_store_size (manager->priv->clients) > 0) {
-                csm_store_foreach (manager->priv->clients,
-                                   (CsmStoreFunc)_client_stop,
-                                   NULL);
-        }
-        end_phase (manager);
+        g_hash_table_insert (manager->priv->dag_settled, app, GINT_TO_POINTER (ok));
 }
 
+typedef struct {
+        const char *name;
+        CsmApp     *self;
+        GSList     *apps;
+} DagResolveData;
+
 static gboolean
-_client_query_end_session (const char           *id,
-                           CsmClient            *client,
-                           ClientEndSessionData *data)
+_dag_collect_app (const char     *id,
+                  CsmApp         *app,
+                  DagResolveData *data)
 {
-        gboolean ret;
-        GError  *error;
+        const char *app_id;
+        gsize       len;
 
-        error = NULL;
-        ret = csm_client_query_end_session (client, data->flags, &error);
-        if (! ret) {
-                g_warning ("Unable to query client: %s", error->message);
-                g_error_free (error);
-                /* FIXME: what should we do if we can't communicate with client? */
-        } else {
-                g_debug ("CsmManager: adding client to query clients: %s", csm_client_peek_id (client));
-                data->manager->priv->query_clients = g_slist_prepend (data->manager->priv->query_clients,
-                                                                      client);
+        if (app == data->self) {
+                return FALSE;
+        }
+
+        app_id = csm_app_peek_app_id (app);
+        len = strlen (data->name);
+
+        if (app_id != NULL
+            && strncmp (app_id, data->name, len) == 0
+            && (app_id[len] == '\0' || strcmp (app_id + len, ".desktop") == 0)) {
+                data->apps = g_slist_prepend (data->apps, app);
+        } else if (csm_app_provides (app, data->name)) {
+                data->apps = g_slist_prepend (data->apps, app);
         }
 
         return FALSE;
 }
 
+/* Returns TRUE when every active app matching @names has settled, or as
+ * soon as a required name turns out to be missing, disabled or failed, in
+ * which case @missing is set. */
 static gboolean
-inhibitor_has_flag (gpointer      key,
-                    CsmInhibitor *inhibitor,
-                    gpointer      data)
+dag_names_settled (CsmManager         *manager,
+                   CsmApp             *app,
+                   const char * const *names,
+                   gboolean            required,
+                   gboolean           *missing)
 {
-        guint flag;
-        guint flags;
+        DagResolveData data;
+        gboolean       settled;
+        int            i;
+
+        if (names == NULL) {
+                return TRUE;
+        }
+
+        settled = TRUE;
+        for (i = 0; names[i] != NULL && settled && !*missing; i++) {
+                GSList  *l;
+                gboolean found;
+
+                data.name = names[i];
+                data.self = app;
+                data.apps = NULL;
+                csm_store_foreach (manager->priv->apps,
+                                   (CsmStoreFunc)_dag_collect_app,
+                                   &data);
+
+                found = FALSE;
+                for (l = data.apps; l != NULL; l = l->next) {
+                        CsmApp  *dep = l->data;
+                        gpointer ok;
+
+                        if (!dag_app_is_active (dep)) {
+                                continue;
+                        }
+
+                        found = TRUE;
+
+                        if (!g_hash_table_lookup_extended (manager->priv->dag_settled, dep, NULL, &ok)) {
+                                settled = FALSE;
+                                break;
+                        }
 
-        flag = GPOINTER_TO_UINT (data);
+                        if (required && !GPOINTER_TO_INT (ok)) {
+                                *missing = TRUE;
+                        }
+                }
+                g_slist_free (data.apps);
 
-        flags = csm_inhibitor_peek_flags (inhibitor);
+                if (required && !found) {
+                        *missing = TRUE;
+                }
+        }
 
-        return (flags & flag);
+        return settled || *missing;
 }
 
 static gboolean
-csm_manager_is_logout_inhibited (CsmManager *manager)
+dag_names_in_later_phase (CsmManager         *manager,
+                          CsmApp             *app,
+                          const char * const *names)
 {
-        CsmInhibitor *inhibitor;
+        DagResolveData data;
+        gboolean       later;
+        GSList        *l;
+        int            i;
 
-        if (manager->priv->logout_mode == CSM_MANAGER_LOGOUT_MODE_FORCE) {
+        if (names == NULL) {
                 return FALSE;
         }
 
-        if (manager->priv->inhibitors == NULL) {
-                return FALSE;
-        }
+        later = FALSE;
+        for (i = 0; names[i] != NULL && !later; i++) {
+                data.name = names[i];
+                data.self = app;
+                data.apps = NULL;
+                csm_store_foreach (manager->priv->apps,
+                                   (CsmStoreFunc)_dag_collect_app,
+                                   &data);
 
-        inhibitor = (CsmInhibitor *)csm_store_find (manager->priv->inhibitors,
-                                                    (CsmStoreFunc)inhibitor_has_flag,
-                                                    GUINT_TO_POINTER (CSM_INHIBITOR_FLAG_LOGOUT));
-        if (inhibitor == NULL) {
-                return FALSE;
+                for (l = data.apps; l != NULL; l = l->next) {
+                        CsmApp *dep = l->data;
+
+                        if (dag_app_is_active (dep)
+                            && !g_hash_table_contains (manager->priv->dag_visited, dep)
+                            && !dag_app_may_start (manager, dep)) {
+                                later = TRUE;
+                                break;
+                        }
+                }
+                g_slist_free (data.apps);
         }
-        return TRUE;
+
+        return later;
 }
 
+/* Whether @app waits for something that can't start before a later phase,
+ * in which case it neither holds up nor ends with the current one */
 static gboolean
-csm_manager_is_idle_inhibited (CsmManager *manager)
+dag_waits_for_later_phase (CsmManager *manager,
+                           CsmApp     *app)
 {
-        CsmInhibitor *inhibitor;
+        return dag_names_in_later_phase (manager, app, csm_app_peek_requires (app))
+                || dag_names_in_later_phase (manager, app, csm_app_peek_after (app));
+}
 
-        if (manager->priv->inhibitors == NULL) {
+static gboolean
+dag_deps_settled (CsmManager *manager,
+                  CsmApp     *app,
+                  gboolean   *missing)
+{
+        *missing = FALSE;
+
+        if (!dag_names_settled (manager, app, csm_app_peek_requires (app), TRUE, missing)) {
                 return FALSE;
         }
 
-        inhibitor = (CsmInhibitor *)csm_store_find (manager->priv->inhibitors,
-                                                    (CsmStoreFunc)inhibitor_has_flag,
-                                                    GUINT_TO_POINTER (CSM_INHIBITOR_FLAG_IDLE));
-        if (inhibitor == NULL) {
-                return FALSE;
+        if (*missing) {
+                return TRUE;
         }
-        return TRUE;
+
+        return dag_names_settled (manager, app, csm_app_peek_after (app), FALSE, missing);
 }
 
-static gboolean
-_client_cancel_end_session (const char *id,
-                            CsmClient  *client,
-                            CsmManager *manager)
-{
-        gboolean res;
-        GError  *error;
+static void dag_schedule (CsmManager *manager);
 
-        error = NULL;
-        res = csm_client_cancel_end_session (client, &error);
-        if (! res) {
-                g_warning ("Unable to cancel end session: %s", error->message);
-                g_error_free (error);
-        }
+static void
+dag_app_registered (CsmApp     *app,
+                    CsmManager *manager)
+{
+        dag_mark_settled (manager, app, TRUE);
+        dag_schedule (manager);
 
-        return FALSE;
+        app_registered (app, manager);
+}
+
+static void
+dag_app_exited (CsmApp     *app,
+                guchar      exit_code,
+                CsmManager *manager)
+{
+        dag_mark_settled (manager, app, exit_code == 0);
+        dag_schedule (manager);
+
+        if (csm_app_peek_phase (app) < CSM_MANAGER_PHASE_APPLICATION) {
+                app_exited (app, exit_code, manager);
+        } else {
+                app_event_during_startup (manager, app);
+        }
+}
+
+static void
+dag_app_died (CsmApp     *app,
+              int         signal,
+              CsmManager *manager)
+{
+        dag_mark_settled (manager, app, FALSE);
+        dag_schedule (manager);
+
+        if (csm_app_peek_phase (app) < CSM_MANAGER_PHASE_APPLICATION) {
+                app_died (app, signal, manager);
+        } else {
+                app_event_during_startup (manager, app);
+        }
 }
 
 static gboolean
-inhibitor_is_jit (gpointer      key,
-                  CsmInhibitor *inhibitor,
-                  CsmManager   *manager)
+dag_launch_app (CsmManager *manager,
+                CsmApp     *app)
 {
-        gboolean    matches;
-        const char *id;
+        int delay;
 
-        id = csm_inhibitor_peek_client_id (inhibitor);
+        delay = csm_app_peek_autostart_delay (app);
+        if (delay > 0) {
+                g_timeout_add_seconds (delay,
+                                       (GSourceFunc)_autostart_delay_timeout,
+                                       g_object_ref (app));
+                g_debug ("CsmManager: %s is scheduled to start in %d seconds",
+                         csm_app_peek_id (app), delay);
 
-        matches = (id != NULL && id[0] != '\0');
+                /* Delayed apps never hold anybody back */
+                dag_mark_settled (manager, app, TRUE);
+                return TRUE;
+        }
 
-        return matches;
+        if (!start_app_or_warn (manager, app)) {
+                return FALSE;
+        }
+
+        /* These chain up to the phase handlers, see _start_app() */
+        g_signal_connect (app,
+                          "exited",
+                          G_CALLBACK (dag_app_exited),
+                          manager);
+        g_signal_connect (app,
+                          "registered",
+                          G_CALLBACK (dag_app_registered),
+                          manager);
+        g_signal_connect (app,
+                          "died",
+                          G_CALLBACK (dag_app_died),
+                          manager);
+
+        return TRUE;
 }
 
 static void
-cancel_end_session (CsmManager *manager)
+dag_app_failed (CsmManager *manager,
+                CsmApp     *app)
 {
-        /* just ignore if received outside of shutdown */
-        if (manager->priv->phase < CSM_MANAGER_PHASE_QUERY_END_SESSION) {
+        dag_mark_settled (manager, app, FALSE);
+        manager->priv->pending_apps = g_slist_remove (manager->priv->pending_apps, app);
+}
+
+/* Starts every waiting app whose dependencies have settled.  Apps that
+ * fail to start or lack a required dependency are dropped from the
+ * pending list; the caller is responsible for ending the phase if that
+ * leaves it empty. */
+static void
+dag_schedule (CsmManager *manager)
+{
+        gboolean progress;
+        GSList  *l;
+        GSList  *next;
+
+        /* nothing new gets started while logging out */
+        if (manager->priv->phase > CSM_MANAGER_PHASE_RUNNING) {
                 return;
         }
 
-        /* switch back to running phase */
-        g_debug ("CsmManager: Cancelling the end of session");
+        do {
+                progress = FALSE;
 
-        /* remove the dialog before we remove the inhibitors, else the dialog
-         * will activate itself automatically when the last inhibitor will be
-         * removed */
-        close_end_session_dialog (manager);
+                for (l = manager->priv->dag_waiting; l != NULL; l = next) {
+                        CsmApp  *app = l->data;
+                        gboolean missing;
 
-        /* clear all JIT inhibitors */
-        csm_store_foreach_remove (manager->priv->inhibitors,
-                                  (CsmStoreFunc)inhibitor_is_jit,
-                                  (gpointer)manager);
+                        next = l->next;
 
-        csm_store_foreach (manager->priv->clients,
-                           (CsmStoreFunc)_client_cancel_end_session,
-                           NULL);
+                        if (!dag_deps_settled (manager, app, &missing)) {
+                                continue;
+                        }
 
-        csm_manager_set_phase (manager, CSM_MANAGER_PHASE_RUNNING);
-        manager->priv->logout_mode = CSM_MANAGER_LOGOUT_MODE_NORMAL;
+                        manager->priv->dag_waiting = g_slist_delete_link (manager->priv->dag_waiting, l);
 
-        manager->priv->logout_type = CSM_MANAGER_LOGOUT_NONE;
-        mdm_set_logout_action (MDM_LOGOUT_ACTION_NONE);
+                        if (missing) {
+                                g_warning ("Not starting '%s': a required dependency is missing or failed",
+                                           csm_app_peek_app_id (app));
+                        } else if (dag_launch_app (manager, app)) {
+                                continue;
+                        }
 
-        manager->priv->dialog_action = CSM_LOGOUT_ACTION_UNDEFINED;
+                        dag_app_failed (manager, app);
+                        progress = TRUE;
+                }
+        } while (progress);
+}
 
-        start_phase (manager);
+/* The end of a phase is the default edge for anything still waiting in
+ * it: soft ordering is dropped, hard requirements are not. */
+static void
+dag_flush_phase (CsmManager *manager)
+{
+        GSList *l;
+        GSList *next;
+
+        for (l = manager->priv->dag_waiting; l != NULL; l = next) {
+                CsmApp  *app = l->data;
+                gboolean missing = FALSE;
+
+                next = l->next;
+
+                if (csm_app_peek_phase (app) > manager->priv->phase
+                    || dag_waits_for_later_phase (manager, app)) {
+                        continue;
+                }
+
+                manager->priv->dag_waiting = g_slist_delete_link (manager->priv->dag_waiting, l);
+
+                if (!dag_names_settled (manager, app, csm_app_peek_requires (app), TRUE, &missing)
+                    || missing) {
+                        g_warning ("Not starting '%s': a required dependency did not come up",
+                                   csm_app_peek_app_id (app));
+                        dag_mark_settled (manager, app, FALSE);
+                        continue;
+                }
+
+                g_debug ("CsmManager: starting '%s' at the end of its phase",
+                         csm_app_peek_app_id (app));
+
+                if (!dag_launch_app (manager, app)) {
+                        dag_mark_settled (manager, app, FALSE);
+                }
+        }
 }
 
 static gboolean
-process_is_running (const char * name)
+on_dag_flush_timeout (CsmManager *manager)
 {
-        int num_processes;
-        gchar *command = g_strdup_printf ("pidof %s | wc -l", name);
-        FILE *fp = popen(command, "r");
-        fscanf(fp, "%d", &num_processes);
-        pclose(fp);
-        g_free (command);
+        manager->priv->dag_flush_id = 0;
 
-        if (num_processes > 0) {
-                return TRUE;
-        } else {
-                return FALSE;
+        if (manager->priv->phase == CSM_MANAGER_PHASE_RUNNING) {
+                dag_flush_phase (manager);
         }
+
+        return FALSE;
 }
 
 static gboolean
-sleep_lock_is_enabled (CsmManager *manager)
+_dag_visit_app (const char *id,
+                CsmApp     *app,
+                CsmManager *manager)
 {
-        return g_settings_get_boolean (manager->priv->power_settings,
-                                       KEY_LOCK_ON_SUSPEND);
+        if (g_hash_table_contains (manager->priv->dag_visited, app)
+            || !dag_app_may_start (manager, app)) {
+                goto out;
+        }
+
+        g_hash_table_add (manager->priv->dag_visited, app);
+
+        g_signal_connect (app,
+                          "condition-changed",
+                          G_CALLBACK (app_condition_changed),
+                          manager);
+
+        if (!dag_app_is_active (app)) {
+                g_debug ("CsmManager: Skipping disabled app: %s", id);
+                dag_mark_settled (manager, app, FALSE);
+                goto out;
+        }
+
+        manager->priv->dag_waiting = g_slist_append (manager->priv->dag_waiting, app);
+ out:
+        return FALSE;
 }
 
-static void
-manager_perhaps_lock (CsmManager *manager)
+static gboolean
+_dag_collect_pending (const char *id,
+                      CsmApp     *app,
+                      CsmManager *manager)
 {
-        GError   *error;
-        gboolean  ret;
-
-        /* only lock if the user has selected 'lock-on-suspend' in power prefs */
-        if (!sleep_lock_is_enabled (manager)) {
-                return;
+        if (csm_app_peek_phase (app) != manager->priv->phase
+            || manager->priv->phase >= CSM_MANAGER_PHASE_APPLICATION) {
+                goto out;
         }
 
-        /* do this sync to ensure it's on the screen when we start suspending */
-        error = NULL;
-        ret = g_spawn_command_line_sync ("cinnamon-screensaver-command --lock", NULL, NULL, NULL, &error);
-        if (!ret) {
-                g_warning ("Couldn't lock screen: %s", error->message);
-                g_error_free (error);
+        /* Started ahead of this phase, or still waiting for dependencies */
+        if (g_hash_table_contains (manager->priv->dag_visited, app)
+            && !g_hash_table_contains (manager->priv->dag_settled, app)
+            && !(g_slist_find (manager->priv->dag_waiting, app) != NULL
+                 && dag_waits_for_later_phase (manager, app))) {
+                manager->priv->pending_apps = g_slist_prepend (manager->priv->pending_apps, app);
         }
+ out:
+        return FALSE;
 }
 
-static void
-flexiserver_launch (const gchar **argv)
+static guint
+get_startup_phase_timeout (CsmManager *manager)
 {
-        GError  *error;
+        GSList *l;
+        guint   timeout;
 
-        if (!g_spawn_async (NULL,
-                            (gchar **) argv,
-                            NULL,
-                            G_SPAWN_SEARCH_PATH,
-                            NULL,
-                            NULL,
-                            NULL,
-                            &error)) {
-                if (error) {
-                        g_debug ("CsmManager: Unable to start MDM greeter: %s", error->message);
-                        g_error_free (error);
+        timeout = CSM_MANAGER_PHASE_TIMEOUT_MIN;
+
+        for (l = manager->priv->pending_apps; l != NULL; l = l->next) {
+                const char *app_id;
+                guint       msec;
+                guint       app_timeout;
+
+                app_id = csm_app_peek_app_id (CSM_APP (l->data));
+
+                if (csm_latency_get_misses (app_id) >= CSM_MANAGER_PHASE_TIMEOUT_MAX_MISSES) {
+                        app_timeout = CSM_MANAGER_PHASE_TIMEOUT_MIN;
+                } else if (csm_latency_get_percentile (app_id, 99, &msec)) {
+                        app_timeout = (msec * CSM_MANAGER_PHASE_TIMEOUT_FACTOR + 999) / 1000;
+                } else {
+                        app_timeout = CSM_MANAGER_PHASE_TIMEOUT;
                 }
+
+                timeout = MAX (timeout, app_timeout);
         }
+
+        return MIN (timeout, CSM_MANAGER_PHASE_TIMEOUT);
 }
 
-static void
-manager_switch_user (CsmManager *manager)
+static gboolean
+_collect_app (const char *id,
+              CsmApp     *app,
+              GSList    **apps)
 {
-        close_end_session_dialog (manager);
+        *apps = g_slist_prepend (*apps, g_object_ref (app));
 
-        /* We have to do this here and in request_switch_user() because this
-         * function can be called at a later time, not just directly after
-         * request_switch_user(). */
-        if (_switch_user_is_locked_down (manager)) {
-                g_warning ("Unable to switch user: User switching has been locked down");
-                return;
-        }
+        return FALSE;
+}
 
-        if (process_is_running ("mdm")) {
-                const gchar *command[] = {
-                     MDM_FLEXISERVER_COMMAND,
-                     MDM_FLEXISERVER_ARGS,
-                     NULL
-                };
+/* Launch ordering.
+ *
+ * The phase ends when its slowest app has registered, so required apps
+ * go first, then the apps that historically took longest from launch to
+ * registration, counting the apps that missed their deadline.  Apps
+ * without any history go last, in app id order.
+ */
 
-                flexiserver_launch (command);
-        } else if (process_is_running("gdm") || process_is_running("gdm3")) {
-                const gchar *command[] = {
-                     GDM_FLEXISERVER_COMMAND,
-                     GDM_FLEXISERVER_ARGS,
-                     NULL
-                };
+static GSList *
+sort_launch_order (CsmManager *manager,
+                   GSList     *apps)
+{
+        CsmLatencyLaunch *launches;
+        GSList           *l;
+        guint             n_launches;
+        guint             i;
 
-                manager_perhaps_lock (manager);
-                flexiserver_launch (command);
-        } else if (g_getenv ("XDG_SEAT_PATH")) {
-                GError *error;
-                GDBusProxyFlags flags = G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START;
-                GDBusProxy *proxy = NULL;
+        n_launches = g_slist_length (apps);
+        launches = g_new (CsmLatencyLaunch, n_launches);
 
-                error = NULL;
+        for (l = apps, i = 0; l != NULL; l = l->next, i++) {
+                launches[i].data = l->data;
+                launches[i].app_id = csm_app_peek_app_id (l->data);
+                launches[i].required = g_slist_find (manager->priv->required_apps, l->data) != NULL;
+        }
 
-                proxy = g_dbus_proxy_new_for_bus_sync (G_BUS_TYPE_SYSTEM,
-                                                       flags,
-                                                       NULL,
-                                                       "org.freedesktop.DisplayManager",
-                                                       g_getenv ("XDG_SEAT_PATH"),
-                                                       "org.freedesktop.DisplayManager.Seat",
-                                                       NULL,
-                                                       &error);
-                
+        csm_latency_sort_launch_order (launches, n_launches);
 
-                if (proxy != NULL) {
-                        manager_perhaps_lock (manager);
-                        g_dbus_proxy_call (proxy,
-                                           "SwitchToGreeter",
-                                           g_variant_new ("()"),
-                                           G_DBUS_CALL_FLAGS_NONE,
-                                           -1,
-                                           NULL,
-                                           NULL,
-                                           NULL);
-                        g_object_unref (proxy);
-                } else {
-                        if (error) {
-                                g_debug ("CsmManager: Unable to start LightDM greeter: %s", error->message);
-                                g_error_free (error);
-                        }
-                }
+        for (l = apps, i = 0; l != NULL; l = l->next, i++) {
+                l->data = launches[i].data;
         }
+
+        g_free (launches);
+
+        return apps;
 }
 
-static void
-manager_attempt_hibernate (CsmManager *manager)
+/* Returns: (transfer full): the apps of the current phase */
+static GSList *
+get_phase_apps_in_launch_order (CsmManager *manager)
 {
-        close_end_session_dialog (manager);
+        GSList *apps;
+        GSList *l;
+        GSList *next;
 
-        /* lock the screen before we try anything.  If it all fails, at least the screen is locked
-         * (if preferences dictate it) */
-        manager_perhaps_lock (manager);
+        apps = NULL;
+        csm_store_foreach (manager->priv->apps,
+                           (CsmStoreFunc)_collect_app,
+                           &apps);
 
-        if (csm_system_can_hibernate (manager->priv->system)) {
-                csm_system_hibernate (manager->priv->system);
+        for (l = apps; l != NULL; l = next) {
+                next = l->next;
+
+                if (csm_app_peek_phase (l->data) != manager->priv->phase) {
+                        g_object_unref (l->data);
+                        apps = g_slist_delete_link (apps, l);
+                }
         }
+
+        return sort_launch_order (manager, apps);
 }
 
 static void
-manager_attempt_suspend (CsmManager *manager)
+do_phase_startup (CsmManager *manager)
 {
-        close_end_session_dialog (manager);
+        if (manager->priv->dag_enabled) {
+                csm_store_foreach (manager->priv->apps,
+                                   (CsmStoreFunc)_dag_visit_app,
+                                   manager);
+                manager->priv->dag_waiting = sort_launch_order (manager,
+                                                                manager->priv->dag_waiting);
+                dag_schedule (manager);
+                csm_store_foreach (manager->priv->apps,
+                                   (CsmStoreFunc)_dag_collect_pending,
+                                   manager);
+        } else {
+                GSList *apps;
+                GSList *l;
 
-        /* lock the screen before we try anything.  If it all fails, at least the screen is locked
-         * (if preferences dictate it) */
-        manager_perhaps_lock (manager);
+                apps = get_phase_apps_in_launch_order (manager);
+                for (l = apps; l != NULL; l = l->next) {
+                        _start_app (csm_app_peek_id (l->data), l->data, manager);
+                }
+                g_slist_free_full (apps, g_object_unref);
 
-        if (g_settings_get_boolean (manager->priv->settings, KEY_PREFER_HYBRID_SLEEP) &&
-            csm_system_can_hybrid_sleep (manager->priv->system)) {
-                csm_system_hybrid_sleep (manager->priv->system);
-        } else if (csm_system_can_suspend (manager->priv->system)) {
-                csm_system_suspend (manager->priv->system, g_settings_get_boolean (manager->priv->settings, KEY_SUSPEND_HIBERNATE));
-        }
-}
-
-static void
-do_inhibit_dialog_action (CsmManager *manager)
-{
-        g_debug ("Dialog told us to ignore inhibitors, performing original action: %d", manager->priv->dialog_action);
-
-        switch (manager->priv->dialog_action) {
-        case CSM_LOGOUT_ACTION_SWITCH_USER:
-                manager_switch_user (manager);
-                break;
-        case CSM_LOGOUT_ACTION_HIBERNATE:
-                manager_attempt_hibernate (manager);
-                break;
-        case CSM_LOGOUT_ACTION_SLEEP:
-                manager_attempt_suspend (manager);
-                break;
-        case CSM_LOGOUT_ACTION_SHUTDOWN:
-        case CSM_LOGOUT_ACTION_REBOOT:
-        case CSM_LOGOUT_ACTION_LOGOUT:
-                manager->priv->logout_mode = CSM_MANAGER_LOGOUT_MODE_FORCE;
-                end_phase (manager);
-                break;
-        default:
-                g_assert_not_reached ();
-                break;
+                if (!g_queue_is_empty (&manager->priv->launch_queue)) {
+                        update_launch_pressure (manager);
+                        launch_queue_admit (manager);
+                }
         }
-}
-
-static void
-emit_inhibitor_info_to_dialog (CsmManager *manager, CsmLogoutAction action)
-{
-    if (action == CSM_LOGOUT_ACTION_UNDEFINED) {
-        return;
-    }
-    g_debug ("Sending inhibitor info to end-session dialog");
-    manager->priv->dialog_action = action;
-
-    GVariant *dialog_inhibit_info = build_inhibitor_list_for_dialog (manager->priv->inhibitors,
-                                                                     manager->priv->clients,
-                                                                     action);
 
-    csm_exported_dialog_emit_inhibitors_changed (manager->priv->dialog_skeleton, dialog_inhibit_info);
-}
+        if (manager->priv->pending_apps != NULL) {
+                if (manager->priv->phase < CSM_MANAGER_PHASE_APPLICATION) {
+                        guint timeout;
 
-static void
-end_session_or_report_inhibitors (CsmManager *manager)
-{
-        CsmLogoutAction action;
+                        timeout = get_startup_phase_timeout (manager);
+                        g_debug ("CsmManager: phase %s times out in %u seconds",
+                                 phase_num_to_name (manager->priv->phase), timeout);
 
-        if (! csm_manager_is_logout_inhibited (manager)) {
+                        manager->priv->phase_start_time = g_get_monotonic_time ();
+                        manager->priv->phase_timeout_id = g_timeout_add_seconds (timeout,
+                                                                                 (GSourceFunc)on_phase_timeout,
+                                                                                 manager);
+                }
+        } else {
                 end_phase (manager);
-                return;
-        }
-
-        switch (manager->priv->logout_type) {
-        case CSM_MANAGER_LOGOUT_LOGOUT:
-                action = CSM_LOGOUT_ACTION_LOGOUT;
-                break;
-        case CSM_MANAGER_LOGOUT_REBOOT:
-        case CSM_MANAGER_LOGOUT_REBOOT_INTERACT:
-        case CSM_MANAGER_LOGOUT_REBOOT_MDM:
-                action = CSM_LOGOUT_ACTION_REBOOT;
-                break;
-        case CSM_MANAGER_LOGOUT_SHUTDOWN:
-        case CSM_MANAGER_LOGOUT_SHUTDOWN_INTERACT:
-        case CSM_MANAGER_LOGOUT_SHUTDOWN_MDM:
-                action = CSM_LOGOUT_ACTION_SHUTDOWN;
-                break;
-        default:
-                g_warning ("Unexpected logout type %d when generating inhibit dialog info",
-                           manager->priv->logout_type);
-                action = CSM_LOGOUT_ACTION_LOGOUT;
-                break;
         }
-
-        emit_inhibitor_info_to_dialog (manager, action);
 }
 
+typedef struct {
+        CsmManager *manager;
+        guint       flags;
+} ClientEndSessionData;
 
-static void
-query_end_session_complete (CsmManager *manager)
-{
-
-        g_debug ("CsmManager: query end session complete");
-
-        /* Remove the timeout since this can be called from outside the timer
-         * and we don't want to have it called twice */
-        if (manager->priv->query_timeout_id > 0) {
-                g_source_remove (manager->priv->query_timeout_id);
-                manager->priv->query_timeout_id = 0;
-        }
-
-        end_session_or_report_inhibitors (manager);
-}
 
-static guint32
-generate_cookie (void)
+static gboolean
+_client_end_session (CsmClient            *client,
+                     ClientEndSessionData *data)
 {
-        guint32 cookie;
+        gboolean ret;
+        GError  *error;
 
-        cookie = (guint32)g_random_int_range (1, G_MAXINT32);
+        error = NULL;
+        ret = csm_client_end_session (client, data->flags, &error);
+        if (! ret) {
+                g_warning ("Unable to query client: %s", error->message);
+                g_error_free (error);
+                /* FIXME: what should we do if we can't communicate with client? */
+        } else {
+                g_debug ("CsmManager: adding client to end-session clients: %s", csm_client_peek_id (client));
+                data->manager->priv->query_clients = g_slist_prepend (data->manager->priv->query_clients,
+                                                                      client);
+        }
 
-        return cookie;
+        return FALSE;
 }
 
-static guint32
-_generate_unique_cookie (CsmManager *manager)
+static gboolean
+_client_end_session_helper (const char           *id,
+                            CsmClient            *client,
+                            ClientEndSessionData *data)
 {
-        guint32 cookie;
-
-        do {
-                cookie = generate_cookie ();
-        } while (csm_store_find (manager->priv->inhibitors, (CsmStoreFunc)_find_by_cookie, &cookie) != NULL);
-
-        return cookie;
+        return _client_end_session (client, data);
 }
 
-static gboolean
-_on_query_end_session_timeout (CsmManager *manager)
+static void
+do_phase_end_session (CsmManager *manager)
 {
-        GSList *l;
-
-        manager->priv->query_timeout_id = 0;
-
-        g_debug ("CsmManager: query end session timed out");
-
-        for (l = manager->priv->query_clients; l != NULL; l = l->next) {
-                guint         cookie;
-                CsmInhibitor *inhibitor;
-                const char   *bus_name;
-                char         *app_id;
-
-                g_warning ("Client '%s' failed to reply before timeout",
-                           csm_client_peek_id (l->data));
+        ClientEndSessionData data;
 
-                /* Don't add "not responding" inhibitors if logout is forced
-                 */
-                if (manager->priv->logout_mode == CSM_MANAGER_LOGOUT_MODE_FORCE) {
-                        continue;
-                }
+        data.manager = manager;
+        data.flags = 0;
 
-                /* Add JIT inhibit for unresponsive client */
-                if (CSM_IS_DBUS_CLIENT (l->data)) {
-                        bus_name = csm_dbus_client_get_bus_name (l->data);
-                } else {
-                        bus_name = NULL;
-                }
+        close_end_session_dialog (manager);
 
-                app_id = g_strdup (csm_client_peek_app_id (l->data));
-                if (IS_STRING_EMPTY (app_id)) {
-                        /* XSMP clients don't give us an app id unless we start them */
-                        g_free (app_id);
-                        app_id = csm_client_get_app_name (l->data);
-                }
+        csm_util_stop_systemd_unit ("cinnamon-session.target", "replace");
 
-                cookie = _generate_unique_cookie (manager);
-                inhibitor = csm_inhibitor_new_for_client (csm_client_peek_id (l->data),
-                                                          app_id,
-                                                          CSM_INHIBITOR_FLAG_LOGOUT,
-                                                          _("Not responding"),
-                                                          bus_name,
-                                                          cookie);
-                g_free (app_id);
-                csm_store_add (manager->priv->inhibitors, csm_inhibitor_peek_id (inhibitor), G_OBJECT (inhibitor));
-                g_object_unref (inhibitor);
+        if (manager->priv->logout_mode == CSM_MANAGER_LOGOUT_MODE_FORCE) {
+                data.flags |= CSM_CLIENT_END_SESSION_FLAG_FORCEFUL;
+        }
+        if (csm_manager_get_autosave_enabled (manager)) {
+                data.flags |= CSM_CLIENT_END_SESSION_FLAG_SAVE;
         }
 
-        g_slist_free (manager->priv->query_clients);
-        manager->priv->query_clients = NULL;
+        if (manager->priv->phase_timeout_id > 0) {
+                g_source_remove (manager->priv->phase_timeout_id);
+                manager->priv->phase_timeout_id = 0;
+        }
 
-        query_end_session_complete (manager);
+        if (csm_store_size (manager->priv->clients) > 0) {
+                manager->priv->phase_timeout_id = g_timeout_add_seconds (CSM_MANAGER_PHASE_TIMEOUT,
+                                                                         (GSourceFunc)on_phase_timeout,
+                                                                         manager);
 
-        return FALSE;
+                csm_store_foreach (manager->priv->clients,
+                                   (CsmStoreFunc)_client_end_session_helper,
+                                   &data);
+        } else {
+                end_phase (manager);
+        }
 }
 
 static void
-do_phase_query_end_session (CsmManager *manager)
+do_phase_end_session_part_2 (CsmManager *manager)
 {
         ClientEndSessionData data;
 
@@ -1475,2968 +2082,4387 @@ do_phase_query_end_session (CsmManager *manager)
         if (manager->priv->logout_mode == CSM_MANAGER_LOGOUT_MODE_FORCE) {
                 data.flags |= CSM_CLIENT_END_SESSION_FLAG_FORCEFUL;
         }
-        /* We only query if an app is ready to log out, so we don't use
-         * CSM_CLIENT_END_SESSION_FLAG_SAVE here.
-         */
+        if (csm_manager_get_autosave_enabled (manager)) {
+                data.flags |= CSM_CLIENT_END_SESSION_FLAG_SAVE;
+        }
+        data.flags |= CSM_CLIENT_END_SESSION_FLAG_LAST;
 
-        debug_clients (manager);
-        g_debug ("CsmManager: sending query-end-session to clients (logout mode: %s)",
-                 manager->priv->logout_mode == CSM_MANAGER_LOGOUT_MODE_NORMAL? "normal" :
-                 manager->priv->logout_mode == CSM_MANAGER_LOGOUT_MODE_FORCE? "forceful":
-                 "no confirmation");
-        csm_store_foreach (manager->priv->clients,
-                           (CsmStoreFunc)_client_query_end_session,
-                           &data);
+        /* keep the timeout that was started at the beginning of the
+         * CSM_MANAGER_PHASE_END_SESSION phase */
 
-        /* This phase doesn't time out unless logout is forced. Typically, this
-         * separate timer is only used to show UI. */
-        manager->priv->query_timeout_id = g_timeout_add_seconds (1, (GSourceFunc)_on_query_end_session_timeout, manager);
-}
+        if (g_slist_length (manager->priv->next_query_clients) > 0) {
+                g_slist_foreach (manager->priv->next_query_clients,
+                                 (GFunc)_client_end_session,
+                                 &data);
 
-static void
-update_idle (CsmManager *manager)
-{
-        if (csm_manager_is_idle_inhibited (manager)) {
-                csm_presence_set_idle_enabled (manager->priv->presence, FALSE);
+                g_slist_free (manager->priv->next_query_clients);
+                manager->priv->next_query_clients = NULL;
         } else {
-                csm_presence_set_idle_enabled (manager->priv->presence, TRUE);
+                end_phase (manager);
         }
 }
 
-static void
-start_phase (CsmManager *manager)
+static gboolean
+_client_stop (const char *id,
+              CsmClient  *client,
+              gpointer    user_data)
 {
+        gboolean ret;
+        GError  *error;
 
-        g_debug ("CsmManager: starting phase %s",
-                 phase_num_to_name (manager->priv->phase));
-
-        /* reset state */
-        g_slist_free (manager->priv->pending_apps);
-        manager->priv->pending_apps = NULL;
-        g_slist_free (manager->priv->query_clients);
-        manager->priv->query_clients = NULL;
-        g_slist_free (manager->priv->next_query_clients);
-        manager->priv->next_query_clients = NULL;
-
-        if (manager->priv->query_timeout_id > 0) {
-                g_source_remove (manager->priv->query_timeout_id);
-                manager->priv->query_timeout_id = 0;
-        }
-        if (manager->priv->phase_timeout_id > 0) {
-                g_source_remove (manager->priv->phase_timeout_id);
-                manager->priv->phase_timeout_id = 0;
-        }
-
-        switch (manager->priv->phase) {
-        case CSM_MANAGER_PHASE_STARTUP:
-        case CSM_MANAGER_PHASE_EARLY_INITIALIZATION:
-        case CSM_MANAGER_PHASE_PRE_DISPLAY_SERVER:
-        case CSM_MANAGER_PHASE_DISPLAY_SERVER:
-        case CSM_MANAGER_PHASE_INITIALIZATION:
-        case CSM_MANAGER_PHASE_WINDOW_MANAGER:
-        case CSM_MANAGER_PHASE_PANEL:
-        case CSM_MANAGER_PHASE_DESKTOP:
-        case CSM_MANAGER_PHASE_APPLICATION:
-                do_phase_startup (manager);
-                break;
-        case CSM_MANAGER_PHASE_RUNNING:
-                csm_xsmp_server_start_accepting_new_clients (manager->priv->xsmp_server);
-                csm_exported_manager_emit_session_running (manager->priv->skeleton);
-                update_idle (manager);
-                csm_util_start_systemd_unit ("cinnamon-session.target", "replace", NULL);
-                break;
-        case CSM_MANAGER_PHASE_QUERY_END_SESSION:
-                csm_xsmp_server_stop_accepting_new_clients (manager->priv->xsmp_server);
-                do_phase_query_end_session (manager);
-                break;
-        case CSM_MANAGER_PHASE_END_SESSION:
-                csm_exported_manager_emit_session_over (manager->priv->skeleton);
-                do_phase_end_session (manager);
-                break;
-        case CSM_MANAGER_PHASE_EXIT:
-                do_phase_exit (manager);
-                break;
-        default:
-                g_assert_not_reached ();
-                break;
-        }
-}
-
-static gboolean
-_debug_app_for_phase (const char *id,
-                      CsmApp     *app,
-                      gpointer    data)
-{
-        guint phase;
-
-        phase = GPOINTER_TO_UINT (data);
-
-        if (csm_app_peek_phase (app) != phase) {
-                return FALSE;
+        error = NULL;
+        ret = csm_client_stop (client, &error);
+        if (! ret) {
+                g_warning ("Unable to stop client: %s", error->message);
+                g_error_free (error);
+                /* FIXME: what should we do if we can't communicate with client? */
+        } else {
+                g_debug ("CsmManager: stopped client: %s", csm_client_peek_id (client));
         }
 
-        g_debug ("CsmManager:\tID: %s\tapp-id:%s\tis-disabled:%d\tis-conditionally-disabled:%d\tis-delayed:%d",
-                 csm_app_peek_id (app),
-                 csm_app_peek_app_id (app),
-                 csm_app_peek_is_disabled (app),
-                 csm_app_peek_is_conditionally_disabled (app),
-                 (csm_app_peek_autostart_delay (app) > 0));
-
         return FALSE;
 }
 
 static void
-debug_app_summary (CsmManager *manager)
+do_phase_exit (CsmManager *manager)
 {
-        guint phase;
-
-        g_debug ("CsmManager: App startup summary");
-        for (phase = CSM_MANAGER_PHASE_EARLY_INITIALIZATION; phase < CSM_MANAGER_PHASE_RUNNING; phase++) {
-                g_debug ("CsmManager: Phase %s", phase_num_to_name (phase));
-                csm_store_foreach (manager->priv->apps,
-                                   (CsmStoreFunc)_debug_app_for_phase,
-                                   GUINT_TO_POINTER (phase));
+        if (csm_store_size (manager->priv->clients) > 0) {
+                csm_store_foreach (manager->priv->clients,
+                                   (CsmStoreFunc)_client_stop,
+                                   NULL);
         }
+        end_phase (manager);
 }
 
-void
-csm_manager_start (CsmManager *manager)
+static gboolean
+_client_query_end_session (const char           *id,
+                           CsmClient            *client,
+                           ClientEndSessionData *data)
 {
-        g_debug ("CsmManager: CSM starting to manage");
+        gboolean ret;
+        GError  *error;
 
-        g_return_if_fail (CSM_IS_MANAGER (manager));
+        error = NULL;
+        ret = csm_client_query_end_session (client, data->flags, &error);
+        if (! ret) {
+                g_warning ("Unable to query client: %s", error->message);
+                g_error_free (error);
+                /* FIXME: what should we do if we can't communicate with client? */
+        } else {
+                g_debug ("CsmManager: adding client to query clients: %s", csm_client_peek_id (client));
+                data->manager->priv->query_clients = g_slist_prepend (data->manager->priv->query_clients,
+                                                                      client);
+        }
 
-        csm_xsmp_server_start (manager->priv->xsmp_server);
-        csm_manager_set_phase (manager, CSM_MANAGER_PHASE_EARLY_INITIALIZATION);
-        debug_app_summary (manager);
-        start_phase (manager);
+        return FALSE;
 }
 
-const char *
-_csm_manager_get_default_session (CsmManager     *manager)
+/* inhibited_actions always has the flags of at least one inhibitor */
+static gboolean
+is_flag_inhibited (CsmManager       *manager,
+                   CsmInhibitorFlag  flags)
 {
-        return g_settings_get_string (manager->priv->session_settings,
-                                      KEY_SESSION_NAME);
+        return (manager->priv->inhibited_actions & flags) != 0;
 }
 
-void
-_csm_manager_set_active_session (CsmManager     *manager,
-                                 const char     *session_name,
-                                 gboolean        is_fallback)
+static gboolean
+csm_manager_is_logout_inhibited (CsmManager *manager)
 {
-        g_free (manager->priv->session_name);
-        manager->priv->session_name = g_strdup (session_name);
-        manager->priv->is_fallback_session = is_fallback;
+        if (manager->priv->logout_mode == CSM_MANAGER_LOGOUT_MODE_FORCE) {
+                return FALSE;
+        }
 
-        csm_exported_manager_set_session_name (manager->priv->skeleton,
-                                               session_name);
+        return is_flag_inhibited (manager, CSM_INHIBITOR_FLAG_LOGOUT);
 }
 
-void
-_csm_manager_export_login_session_id (CsmManager *manager)
+static gboolean
+csm_manager_is_idle_inhibited (CsmManager *manager)
 {
-        g_autofree gchar *session_id = NULL;
-
-        session_id = csm_system_get_login_session_id (manager->priv->system);
-
-        csm_exported_manager_set_session_id (manager->priv->skeleton,
-                                             session_id);
+        return is_flag_inhibited (manager, CSM_INHIBITOR_FLAG_IDLE);
 }
 
 static gboolean
-_app_has_app_id (const char   *id,
-                 CsmApp       *app,
-                 const char   *app_id_a)
+_client_cancel_end_session (const char *id,
+                            CsmClient  *client,
+                            CsmManager *manager)
 {
-        const char *app_id_b;
+        gboolean res;
+        GError  *error;
 
-        app_id_b = csm_app_peek_app_id (app);
-        return (app_id_b != NULL && strcmp (app_id_a, app_id_b) == 0);
-}
+        error = NULL;
+        res = csm_client_cancel_end_session (client, &error);
+        if (! res) {
+                g_warning ("Unable to cancel end session: %s", error->message);
+                g_error_free (error);
+        }
 
-static CsmApp *
-find_app_for_app_id (CsmManager *manager,
-                     const char *app_id)
-{
-        CsmApp *app;
-        app = (CsmApp *)csm_store_find (manager->priv->apps,
-                                        (CsmStoreFunc)_app_has_app_id,
-                                        (char *)app_id);
-        return app;
+        return FALSE;
 }
 
 static gboolean
-inhibitor_has_client_id (gpointer      key,
-                         CsmInhibitor *inhibitor,
-                         const char   *client_id_a)
+inhibitor_is_jit (gpointer      key,
+                  CsmInhibitor *inhibitor,
+                  CsmManager   *manager)
 {
         gboolean    matches;
-        const char *client_id_b;
+        const char *id;
 
-        client_id_b = csm_inhibitor_peek_client_id (inhibitor);
+        id = csm_inhibitor_peek_client_id (inhibitor);
 
-        matches = FALSE;
-        if (! IS_STRING_EMPTY (client_id_a) && ! IS_STRING_EMPTY (client_id_b)) {
-                matches = (strcmp (client_id_a, client_id_b) == 0);
-                if (matches) {
-                        g_debug ("CsmManager: removing JIT inhibitor for %s for reason '%s'",
-                                 csm_inhibitor_peek_client_id (inhibitor),
-                                 csm_inhibitor_peek_reason (inhibitor));
-                }
-        }
+        matches = (id != NULL && id[0] != '\0');
 
         return matches;
 }
 
-static gboolean
-_app_has_startup_id (const char *id,
-                     CsmApp     *app,
-                     const char *startup_id_a)
+static void
+cancel_end_session (CsmManager *manager)
 {
-        const char *startup_id_b;
+        /* just ignore if received outside of shutdown */
+        if (manager->priv->phase < CSM_MANAGER_PHASE_QUERY_END_SESSION) {
+                return;
+        }
 
-        startup_id_b = csm_app_peek_startup_id (app);
+        /* switch back to running phase */
+        g_debug ("CsmManager: Cancelling the end of session");
 
-        if (IS_STRING_EMPTY (startup_id_b)) {
-                return FALSE;
-        }
+        /* remove the dialog before we remove the inhibitors, else the dialog
+         * will activate itself automatically when the last inhibitor will be
+         * removed */
+        close_end_session_dialog (manager);
 
-        return (strcmp (startup_id_a, startup_id_b) == 0);
-}
+        /* clear all JIT inhibitors */
+        csm_store_foreach_remove (manager->priv->inhibitors,
+                                  (CsmStoreFunc)inhibitor_is_jit,
+                                  (gpointer)manager);
 
-static CsmApp *
-find_app_for_startup_id (CsmManager *manager,
-                        const char *startup_id)
-{
-        CsmApp *found_app;
-        GSList *a;
+        csm_store_foreach (manager->priv->clients,
+                           (CsmStoreFunc)_client_cancel_end_session,
+                           NULL);
 
-        found_app = NULL;
+        csm_manager_set_phase (manager, CSM_MANAGER_PHASE_RUNNING);
+        manager->priv->logout_mode = CSM_MANAGER_LOGOUT_MODE_NORMAL;
 
-        /* If we're starting up the session, try to match the new client
-         * with one pending apps for the current phase. If not, try to match
-         * with any of the autostarted apps. */
-        if (manager->priv->phase < CSM_MANAGER_PHASE_APPLICATION) {
-                for (a = manager->priv->pending_apps; a != NULL; a = a->next) {
-                        CsmApp *app = CSM_APP (a->data);
+        manager->priv->logout_type = CSM_MANAGER_LOGOUT_NONE;
+        mdm_set_logout_action (MDM_LOGOUT_ACTION_NONE);
 
-                        if (strcmp (startup_id, csm_app_peek_startup_id (app)) == 0) {
-                                found_app = app;
-                                goto out;
-                        }
-                }
-        } else {
-                CsmApp *app;
+        manager->priv->dialog_action = CSM_LOGOUT_ACTION_UNDEFINED;
 
-                app = (CsmApp *)csm_store_find (manager->priv->apps,
-                                                (CsmStoreFunc)_app_has_startup_id,
-                                                (char *)startup_id);
-                if (app != NULL) {
-                        found_app = app;
-                        goto out;
-                }
-        }
- out:
-        return found_app;
+        start_phase (manager);
 }
 
 static gboolean
-restart_cinnamon_launcher (CsmManager *manager)
+process_is_running (const char * name)
 {
-    CsmApp *app;
+        int num_processes;
+        gchar *command = g_strdup_printf ("pidof %s | wc -l", name);
+        FILE *fp = popen(command, "r");
+        fscanf(fp, "%d", &num_processes);
+        pclose(fp);
+        g_free (command);
 
-    app = find_app_for_app_id (manager, "cinnamon.desktop");
+        if (num_processes > 0) {
+                return TRUE;
+        } else {
+                return FALSE;
+        }
+}
 
-    if (app) {
-        GError *error = NULL;
-
-        g_debug ("CsmManager: Restarting cinnamon-launcher");
-
-        if (!csm_app_restart (app, &error)) {
-            g_warning ("CsmManager: Unable to restart cinnamon-launcher: %s", error->message);
-            g_error_free (error);
-        }
-    } else {
-        g_warning ("CsmManager: Unable to find the cinnamon-launcher");
-    }
-
-    return G_SOURCE_REMOVE;
+static gboolean
+sleep_lock_is_enabled (CsmManager *manager)
+{
+        return g_settings_get_boolean (manager->priv->power_settings,
+                                       KEY_LOCK_ON_SUSPEND);
 }
 
-static gboolean
-csm_manager_setenv (CsmExportedManager    *skeleton,
-                    GDBusMethodInvocation *invocation,
-                    const gchar           *variable,
-                    const gchar           *value,
-                    CsmManager            *manager)
+static void
+manager_perhaps_lock (CsmManager *manager)
 {
-        if (!CSM_IS_MANAGER (manager)) {
-                g_dbus_method_invocation_return_error (invocation,
-                                                       CSM_MANAGER_ERROR,
-                                                       CSM_MANAGER_ERROR_GENERAL,
-                                                       "CSM_IS_MANAGER failed on csm_manager_setenv");
+        GError   *error;
+        gboolean  ret;
 
-                return TRUE;
+        /* only lock if the user has selected 'lock-on-suspend' in power prefs */
+        if (!sleep_lock_is_enabled (manager)) {
+                return;
         }
 
-        if (manager->priv->phase > CSM_MANAGER_PHASE_INITIALIZATION) {
-                g_dbus_method_invocation_return_error (invocation,
-                                                       CSM_MANAGER_ERROR,
-                                                       CSM_MANAGER_ERROR_NOT_IN_INITIALIZATION,
-                                                       "Setenv interface is only available during the Initialization phase");
-
-                return TRUE;
+        /* do this sync to ensure it's on the screen when we start suspending */
+        error = NULL;
+        ret = g_spawn_command_line_sync ("cinnamon-screensaver-command --lock", NULL, NULL, NULL, &error);
+        if (!ret) {
+                g_warning ("Couldn't lock screen: %s", error->message);
+                g_error_free (error);
         }
+}
 
-        csm_util_setenv (variable, value);
-
-        csm_exported_manager_complete_setenv (skeleton, invocation);
+static void
+flexiserver_launch (const gchar **argv)
+{
+        GError  *error;
 
-        return TRUE;
+        if (!g_spawn_async (NULL,
+                            (gchar **) argv,
+                            NULL,
+                            G_SPAWN_SEARCH_PATH,
+                            NULL,
+                            NULL,
+                            NULL,
+                            &error)) {
+                if (error) {
+                        g_debug ("CsmManager: Unable to start MDM greeter: %s", error->message);
+                        g_error_free (error);
+                }
+        }
 }
 
-static gboolean
-csm_manager_initialization_error (CsmExportedManager    *skeleton,
-                                  GDBusMethodInvocation *invocation,
-                                  const char            *message,
-                                  gboolean               fatal,
-                                  CsmManager            *manager)
+static void
+manager_switch_user (CsmManager *manager)
 {
-        if (!CSM_IS_MANAGER (manager)) {
-                g_dbus_method_invocation_return_error (invocation,
-                                                       CSM_MANAGER_ERROR,
-                                                       CSM_MANAGER_ERROR_GENERAL,
-                                                       "CSM_IS_MANAGER failed on csm_manager_initialization_error");
+        close_end_session_dialog (manager);
 
-                return TRUE;
+        /* We have to do this here and in request_switch_user() because this
+         * function can be called at a later time, not just directly after
+         * request_switch_user(). */
+        if (_switch_user_is_locked_down (manager)) {
+                g_warning ("Unable to switch user: User switching has been locked down");
+                return;
         }
 
-        if (manager->priv->phase != CSM_MANAGER_PHASE_INITIALIZATION) {
-                g_dbus_method_invocation_return_error (invocation,
-                                                       CSM_MANAGER_ERROR,
-                                                       CSM_MANAGER_ERROR_NOT_IN_INITIALIZATION,
-                                                       "InitializationError interface is only available during the Initialization phase");
+        if (process_is_running ("mdm")) {
+                const gchar *command[] = {
+                     MDM_FLEXISERVER_COMMAND,
+                     MDM_FLEXISERVER_ARGS,
+                     NULL
+                };
 
-                return TRUE;
-        }
+                flexiserver_launch (command);
+        } else if (process_is_running("gdm") || process_is_running("gdm3")) {
+                const gchar *command[] = {
+                     GDM_FLEXISERVER_COMMAND,
+                     GDM_FLEXISERVER_ARGS,
+                     NULL
+                };
 
-        csm_util_init_error (fatal, "%s", message);
+                manager_perhaps_lock (manager);
+                flexiserver_launch (command);
+        } else if (g_getenv ("XDG_SEAT_PATH")) {
+                GError *error;
+                GDBusProxyFlags flags = G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START;
+                GDBusProxy *proxy = NULL;
 
-        csm_exported_manager_complete_initialization_error (skeleton, invocation);
+                error = NULL;
 
-        return TRUE;
+                proxy = g_dbus_proxy_new_for_bus_sync (G_BUS_TYPE_SYSTEM,
+                                                       flags,
+                                                       NULL,
+                                                       "org.freedesktop.DisplayManager",
+                                                       g_getenv ("XDG_SEAT_PATH"),
+                                                       "org.freedesktop.DisplayManager.Seat",
+                                                       NULL,
+                                                       &error);
+                
+
+                if (proxy != NULL) {
+                        manager_perhaps_lock (manager);
+                        g_dbus_proxy_call (proxy,
+                                           "SwitchToGreeter",
+                                           g_variant_new ("()"),
+                                           G_DBUS_CALL_FLAGS_NONE,
+                                           -1,
+                                           NULL,
+                                           NULL,
+                                           NULL);
+                        g_object_unref (proxy);
+                } else {
+                        if (error) {
+                                g_debug ("CsmManager: Unable to start LightDM greeter: %s", error->message);
+                                g_error_free (error);
+                        }
+                }
+        }
 }
 
-static gboolean
-csm_manager_register_client (CsmExportedManager      *skeleton,
-                             GDBusMethodInvocation   *invocation,
-                             const char              *app_id,
-                             const char              *startup_id,
-                             CsmManager              *manager)
+static void
+manager_attempt_hibernate (CsmManager *manager)
 {
-        char      *new_startup_id;
-        const char *sender;
-        CsmClient *client;
-        CsmApp    *app;
+        close_end_session_dialog (manager);
 
-        if (!CSM_IS_MANAGER (manager)) {
-                g_dbus_method_invocation_return_error (invocation,
-                                                       CSM_MANAGER_ERROR,
-                                                       CSM_MANAGER_ERROR_GENERAL,
-                                                       "CSM_IS_MANAGER failed on csm_manager_register_client");
+        /* lock the screen before we try anything.  If it all fails, at least the screen is locked
+         * (if preferences dictate it) */
+        manager_perhaps_lock (manager);
 
-                return TRUE;
+        if (csm_system_can_hibernate (manager->priv->system)) {
+                csm_system_hibernate (manager->priv->system);
         }
+}
 
-        app = NULL;
-        client = NULL;
+static void
+manager_attempt_suspend (CsmManager *manager)
+{
+        close_end_session_dialog (manager);
 
-        g_debug ("CsmManager: RegisterClient %s", startup_id);
+        /* lock the screen before we try anything.  If it all fails, at least the screen is locked
+         * (if preferences dictate it) */
+        manager_perhaps_lock (manager);
 
-        if (manager->priv->phase >= CSM_MANAGER_PHASE_QUERY_END_SESSION) {
-                g_debug ("Unable to register client: shutting down");
+        if (g_settings_get_boolean (manager->priv->settings, KEY_PREFER_HYBRID_SLEEP) &&
+            csm_system_can_hybrid_sleep (manager->priv->system)) {
+                csm_system_hybrid_sleep (manager->priv->system);
+        } else if (csm_system_can_suspend (manager->priv->system)) {
+                csm_system_suspend (manager->priv->system, g_settings_get_boolean (manager->priv->settings, KEY_SUSPEND_HIBERNATE));
+        }
+}
 
-                g_dbus_method_invocation_return_error (invocation,
-                                                       CSM_MANAGER_ERROR,
-                                                       CSM_MANAGER_ERROR_NOT_IN_RUNNING,
-                                                       "Unable to register client");
+static void
+do_inhibit_dialog_action (CsmManager *manager)
+{
+        g_debug ("Dialog told us to ignore inhibitors, performing original action: %d", manager->priv->dialog_action);
 
-                return TRUE;
+        switch (manager->priv->dialog_action) {
+        case CSM_LOGOUT_ACTION_SWITCH_USER:
+                manager_switch_user (manager);
+                break;
+        case CSM_LOGOUT_ACTION_HIBERNATE:
+                manager_attempt_hibernate (manager);
+                break;
+        case CSM_LOGOUT_ACTION_SLEEP:
+                manager_attempt_suspend (manager);
+                break;
+        case CSM_LOGOUT_ACTION_SHUTDOWN:
+        case CSM_LOGOUT_ACTION_REBOOT:
+        case CSM_LOGOUT_ACTION_LOGOUT:
+                manager->priv->logout_mode = CSM_MANAGER_LOGOUT_MODE_FORCE;
+                end_phase (manager);
+                break;
+        default:
+                g_assert_not_reached ();
+                break;
         }
+}
 
-        if (IS_STRING_EMPTY (startup_id)) {
-                new_startup_id = csm_util_generate_startup_id ();
-        } else {
-                client = (CsmClient *)csm_store_find (manager->priv->clients,
-                                                      (CsmStoreFunc)_client_has_startup_id,
-                                                      (char *)startup_id);
-                /* We can't have two clients with the same startup id. */
-                if (client != NULL) {
-                        g_debug ("Unable to register client: already registered");
+static void
+emit_inhibitor_info_to_dialog (CsmManager *manager, CsmLogoutAction action)
+{
+    if (action == CSM_LOGOUT_ACTION_UNDEFINED) {
+        return;
+    }
+    g_debug ("Sending inhibitor info to end-session dialog");
+    manager->priv->dialog_action = action;
 
-                        g_dbus_method_invocation_return_error (invocation,
-                                                               CSM_MANAGER_ERROR,
-                                                               CSM_MANAGER_ERROR_ALREADY_REGISTERED,
-                                                               "Unable to register client");
+    GVariant *dialog_inhibit_info = build_inhibitor_list_for_dialog (manager->priv->inhibitors,
+                                                                     manager->priv->clients,
+                                                                     action);
 
-                        return TRUE;
-                }
+    csm_exported_dialog_emit_inhibitors_changed (manager->priv->dialog_skeleton, dialog_inhibit_info);
+}
 
-                new_startup_id = g_strdup (startup_id);
-        }
+static void
+end_session_or_report_inhibitors (CsmManager *manager)
+{
+        CsmLogoutAction action;
 
-        g_debug ("CsmManager: Adding new client %s to session", new_startup_id);
-
-        if (app == NULL && !IS_STRING_EMPTY (startup_id)) {
-                app = find_app_for_startup_id (manager, startup_id);
+        if (! csm_manager_is_logout_inhibited (manager)) {
+                end_phase (manager);
+                return;
         }
-        if (app == NULL && !IS_STRING_EMPTY (app_id)) {
-                /* try to associate this app id with a known app */
-                app = find_app_for_app_id (manager, app_id);
+
+        switch (manager->priv->logout_type) {
+        case CSM_MANAGER_LOGOUT_LOGOUT:
+                action = CSM_LOGOUT_ACTION_LOGOUT;
+                break;
+        case CSM_MANAGER_LOGOUT_REBOOT:
+        case CSM_MANAGER_LOGOUT_REBOOT_INTERACT:
+        case CSM_MANAGER_LOGOUT_REBOOT_MDM:
+                action = CSM_LOGOUT_ACTION_REBOOT;
+                break;
+        case CSM_MANAGER_LOGOUT_SHUTDOWN:
+        case CSM_MANAGER_LOGOUT_SHUTDOWN_INTERACT:
+        case CSM_MANAGER_LOGOUT_SHUTDOWN_MDM:
+                action = CSM_LOGOUT_ACTION_SHUTDOWN;
+                break;
+        default:
+                g_warning ("Unexpected logout type %d when generating inhibit dialog info",
+                           manager->priv->logout_type);
+                action = CSM_LOGOUT_ACTION_LOGOUT;
+                break;
         }
 
-        sender = g_dbus_method_invocation_get_sender (invocation);
-        client = csm_dbus_client_new (new_startup_id, sender);
+        emit_inhibitor_info_to_dialog (manager, action);
+}
 
-        if (client == NULL) {
-                g_debug ("Unable to create client");
 
-                g_dbus_method_invocation_return_error (invocation,
-                                                       CSM_MANAGER_ERROR,
-                                                       CSM_MANAGER_ERROR_GENERAL,
-                                                       "Unable to register client");
+static void
+query_end_session_complete (CsmManager *manager)
+{
 
-                return TRUE;
+        g_debug ("CsmManager: query end session complete");
+
+        /* Remove the timeout since this can be called from outside the timer
+         * and we don't want to have it called twice */
+        if (manager->priv->query_timeout_id > 0) {
+                g_source_remove (manager->priv->query_timeout_id);
+                manager->priv->query_timeout_id = 0;
         }
 
-        csm_store_add (manager->priv->clients, csm_client_peek_id (client), G_OBJECT (client));
-        /* the store will own the ref */
-        g_object_unref (client);
+        end_session_or_report_inhibitors (manager);
+}
 
-        if (app != NULL) {
-                csm_client_set_app_id (client, csm_app_peek_app_id (app));
-                csm_app_registered (app);
-        } else {
-                /* if an app id is specified store it in the client
-                   so we can save it later */
-                csm_client_set_app_id (client, app_id);
-        }
+static guint32
+generate_cookie (void)
+{
+        guint32 cookie;
 
-        csm_client_set_status (client, CSM_CLIENT_REGISTERED);
+        cookie = (guint32)g_random_int_range (1, G_MAXINT32);
 
-        g_assert (new_startup_id != NULL);
-        g_free (new_startup_id);
+        return cookie;
+}
 
-        csm_exported_manager_complete_register_client (skeleton,
-                                                       invocation,
-                                                       csm_client_peek_id (client));
+static guint32
+_generate_unique_cookie (CsmManager *manager)
+{
+        guint32 cookie;
 
-        return TRUE;
+        do {
+                cookie = generate_cookie ();
+        } while (find_inhibitor_for_cookie (manager, cookie) != NULL);
+
+        return cookie;
 }
 
 static gboolean
-csm_manager_unregister_client (CsmExportedManager     *skeleton,
-                               GDBusMethodInvocation  *invocation,
-                               const char             *client_id,
-                               CsmManager             *manager)
+_on_query_end_session_timeout (CsmManager *manager)
 {
-        CsmClient *client;
+        GSList *l;
 
-        if (!CSM_IS_MANAGER (manager)) {
-                g_dbus_method_invocation_return_error (invocation,
-                                                       CSM_MANAGER_ERROR,
-                                                       CSM_MANAGER_ERROR_GENERAL,
-                                                       "CSM_IS_MANAGER failed on csm_manager_register_client");
+        manager->priv->query_timeout_id = 0;
 
-                return TRUE;
-        }
+        g_debug ("CsmManager: query end session timed out");
 
-        g_debug ("CsmManager: UnregisterClient %s", client_id);
+        for (l = manager->priv->query_clients; l != NULL; l = l->next) {
+                guint         cookie;
+                CsmInhibitor *inhibitor;
+                const char   *bus_name;
+                char         *app_id;
 
-        client = (CsmClient *)csm_store_lookup (manager->priv->clients, client_id);
-        if (client == NULL) {
-                g_debug ("Unable to unregister client: not registered");
+                g_warning ("Client '%s' failed to reply before timeout",
+                           csm_client_peek_id (l->data));
 
-                g_dbus_method_invocation_return_error (invocation,
-                                                       CSM_MANAGER_ERROR,
-                                                       CSM_MANAGER_ERROR_NOT_REGISTERED,
-                                                       "Unable to unregister client");
+                /* Don't add "not responding" inhibitors if logout is forced
+                 */
+                if (manager->priv->logout_mode == CSM_MANAGER_LOGOUT_MODE_FORCE) {
+                        continue;
+                }
 
-                return TRUE;
+                /* Add JIT inhibit for unresponsive client */
+                if (CSM_IS_DBUS_CLIENT (l->data)) {
+                        bus_name = csm_dbus_client_get_bus_name (l->data);
+                } else {
+                        bus_name = NULL;
+                }
+
+                app_id = g_strdup (csm_client_peek_app_id (l->data));
+                if (IS_STRING_EMPTY (app_id)) {
+                        /* XSMP clients don't give us an app id unless we start them */
+                        g_free (app_id);
+                        app_id = csm_client_get_app_name (l->data);
+                }
+
+                cookie = _generate_unique_cookie (manager);
+                inhibitor = csm_inhibitor_new_for_client (csm_client_peek_id (l->data),
+                                                          app_id,
+                                                          CSM_INHIBITOR_FLAG_LOGOUT,
+                                                          _("Not responding"),
+                                                          bus_name,
+                                                          cookie);
+                g_free (app_id);
+                csm_store_add (manager->priv->inhibitors, csm_inhibitor_peek_id (inhibitor), G_OBJECT (inhibitor));
+                g_object_unref (inhibitor);
         }
 
-        /* don't disconnect client here, only change the status.
-           Wait until it leaves the bus before disconnecting it */
-        csm_client_set_status (client, CSM_CLIENT_UNREGISTERED);
+        g_slist_free (manager->priv->query_clients);
+        manager->priv->query_clients = NULL;
 
-        csm_exported_manager_complete_unregister_client (skeleton,
-                                                         invocation);
+        query_end_session_complete (manager);
 
-        return TRUE;
+        return FALSE;
 }
 
-static gboolean
-csm_manager_inhibit (CsmExportedManager      *skeleton,
-                     GDBusMethodInvocation   *invocation,
-                     const char              *app_id,
-                     guint                    toplevel_xid,
-                     const char              *reason,
-                     guint                    flags,
-                     CsmManager              *manager)
+static void
+do_phase_query_end_session (CsmManager *manager)
 {
-        CsmInhibitor *inhibitor;
-        guint         cookie;
+        ClientEndSessionData data;
 
-        g_debug ("CsmManager: Inhibit xid=%u app_id=%s reason=%s flags=%u",
-                 toplevel_xid,
-                 app_id,
-                 reason,
-                 flags);
+        data.manager = manager;
+        data.flags = 0;
 
         if (manager->priv->logout_mode == CSM_MANAGER_LOGOUT_MODE_FORCE) {
-                g_debug ("CsmManager: Unable to inhibit: Forced logout cannot be inhibited");
+                data.flags |= CSM_CLIENT_END_SESSION_FLAG_FORCEFUL;
+        }
+        /* We only query if an app is ready to log out, so we don't use
+         * CSM_CLIENT_END_SESSION_FLAG_SAVE here.
+         */
 
-                g_dbus_method_invocation_return_error (invocation,
-                                                       CSM_MANAGER_ERROR,
-                                                       CSM_MANAGER_ERROR_GENERAL,
-                                                       "Forced logout cannot be inhibited");
+        debug_clients (manager);
+        g_debug ("CsmManager: sending query-end-session to clients (logout mode: %s)",
+                 manager->priv->logout_mode == CSM_MANAGER_LOGOUT_MODE_NORMAL? "normal" :
+                 manager->priv->logout_mode == CSM_MANAGER_LOGOUT_MODE_FORCE? "forceful":
+                 "no confirmation");
+        csm_store_foreach (manager->priv->clients,
+                           (CsmStoreFunc)_client_query_end_session,
+                           &data);
 
-                return TRUE;
+        /* This phase doesn't time out unless logout is forced. Typically, this
+         * separate timer is only used to show UI. */
+        manager->priv->query_timeout_id = g_timeout_add_seconds (1, (GSourceFunc)_on_query_end_session_timeout, manager);
+}
+
+static void
+update_idle (CsmManager *manager)
+{
+        if (csm_manager_is_idle_inhibited (manager)) {
+                csm_presence_set_idle_enabled (manager->priv->presence, FALSE);
+        } else {
+                csm_presence_set_idle_enabled (manager->priv->presence, TRUE);
         }
+}
 
-        if (IS_STRING_EMPTY (app_id)) {
-                g_debug ("CsmManager: Unable to inhibit: Application ID not specified");
+/* The timeline of this login, and what the next one starts from */
+static void
+save_startup_state (void)
+{
+        GError *error = NULL;
 
-                g_dbus_method_invocation_return_error (invocation,
-                                                       CSM_MANAGER_ERROR,
-                                                       CSM_MANAGER_ERROR_GENERAL,
-                                                       "Application ID not specified");
+        if (!csm_timeline_dump (&error)) {
+                g_warning ("Unable to write startup timeline: %s", error->message);
+                g_clear_error (&error);
+        }
 
-                return TRUE;
+        if (!csm_latency_save (&error)) {
+                g_warning ("Unable to save app latency history: %s", error->message);
+                g_clear_error (&error);
         }
 
-        if (IS_STRING_EMPTY (reason)) {
-                g_debug ("CsmManager: Unable to inhibit: Reason not specific");
+        if (!csm_autostart_cache_save (&error)) {
+                g_warning ("Unable to save autostart cache: %s", error->message);
+                g_clear_error (&error);
+        }
+}
 
-                g_dbus_method_invocation_return_error (invocation,
-                                                       CSM_MANAGER_ERROR,
-                                                       CSM_MANAGER_ERROR_GENERAL,
-                                                       "Reason not specified");
+static gboolean
+on_readahead_record_timeout (CsmManager *manager)
+{
+        GError *error = NULL;
 
-                return TRUE;
+        manager->priv->readahead_record_id = 0;
+
+        if (!csm_readahead_finish (&error)) {
+                g_warning ("Unable to save readahead profile: %s", error->message);
+                g_clear_error (&error);
         }
 
-        if (flags == 0) {
-                g_debug ("CsmManager: Unable to inhibit: Invalid inhibit flags");
+        return FALSE;
+}
 
-                g_dbus_method_invocation_return_error (invocation,
-                                                       CSM_MANAGER_ERROR,
-                                                       CSM_MANAGER_ERROR_GENERAL,
-                                                       "Invalid inhibit flags");
+/* Apps may be started through D-Bus activation or as systemd units, so
+ * this has to run before anything is started, not just at phase changes */
+static gboolean
+commit_pending_environment (CsmManager *manager)
+{
+        if (manager->priv->pending_env_id > 0) {
+                g_source_remove (manager->priv->pending_env_id);
+                manager->priv->pending_env_id = 0;
+        }
 
-                return TRUE;
+        if (manager->priv->pending_env != NULL) {
+                csm_util_env_transaction_commit (manager->priv->pending_env);
+                manager->priv->pending_env = NULL;
         }
 
-        cookie = _generate_unique_cookie (manager);
-        inhibitor = csm_inhibitor_new (app_id,
-                                       toplevel_xid,
-                                       flags,
-                                       reason,
-                                       g_dbus_method_invocation_get_sender (invocation),
-                                       cookie);
-        csm_store_add (manager->priv->inhibitors, csm_inhibitor_peek_id (inhibitor), G_OBJECT (inhibitor));
-        g_object_unref (inhibitor);
-
-        csm_exported_manager_complete_inhibit (skeleton,
-                                               invocation,
-                                               cookie);
-
-        return TRUE;
+        return FALSE;
 }
 
 static gboolean
-csm_manager_uninhibit (CsmExportedManager    *skeleton,
-                       GDBusMethodInvocation *invocation,
-                       guint                  cookie,
-                       CsmManager            *manager)
+on_pending_environment_idle (CsmManager *manager)
 {
-        CsmInhibitor *inhibitor;
+        manager->priv->pending_env_id = 0;
 
-        g_debug ("CsmManager: Uninhibit %u", cookie);
+        return commit_pending_environment (manager);
+}
 
-        inhibitor = (CsmInhibitor *)csm_store_find (manager->priv->inhibitors,
-                                                    (CsmStoreFunc)_find_by_cookie,
-                                                    &cookie);
-        if (inhibitor == NULL) {
-                g_debug ("Unable to uninhibit: Invalid cookie");
+static void
+start_phase (CsmManager *manager)
+{
 
-                g_dbus_method_invocation_return_error (invocation,
-                                                       CSM_MANAGER_ERROR,
-                                                       CSM_MANAGER_ERROR_GENERAL,
-                                                       "Unable to uninhibit: Invalid cookie");
+        g_debug ("CsmManager: starting phase %s",
+                 phase_num_to_name (manager->priv->phase));
 
-                return TRUE;
-        }
+        /* anything activated from now on must see it */
+        commit_pending_environment (manager);
 
-        g_debug ("CsmManager: removing inhibitor %s %u reason '%s' %u connection %s",
-                 csm_inhibitor_peek_app_id (inhibitor),
-                 csm_inhibitor_peek_toplevel_xid (inhibitor),
-                 csm_inhibitor_peek_reason (inhibitor),
-                 csm_inhibitor_peek_flags (inhibitor),
-                 csm_inhibitor_peek_bus_name (inhibitor));
+        /* The timeline is written out while running, so that phase is
+         * only a point in it rather than a span that never closes */
+        csm_timeline_record (manager->priv->phase == CSM_MANAGER_PHASE_RUNNING
+                             ? CSM_TIMELINE_PHASE_REACHED : CSM_TIMELINE_PHASE_START,
+                             phase_num_to_name (manager->priv->phase));
 
-        csm_store_remove (manager->priv->inhibitors, csm_inhibitor_peek_id (inhibitor));
+        /* reset state */
+        g_slist_free (manager->priv->pending_apps);
+        manager->priv->pending_apps = NULL;
+        g_slist_free (manager->priv->query_clients);
+        manager->priv->query_clients = NULL;
+        g_slist_free (manager->priv->next_query_clients);
+        manager->priv->next_query_clients = NULL;
 
-        csm_exported_manager_complete_uninhibit (skeleton,
-                                                 invocation);
+        if (manager->priv->query_timeout_id > 0) {
+                g_source_remove (manager->priv->query_timeout_id);
+                manager->priv->query_timeout_id = 0;
+        }
+        if (manager->priv->phase_timeout_id > 0) {
+                g_source_remove (manager->priv->phase_timeout_id);
+                manager->priv->phase_timeout_id = 0;
+        }
 
-        return TRUE;
+        switch (manager->priv->phase) {
+        case CSM_MANAGER_PHASE_STARTUP:
+        case CSM_MANAGER_PHASE_EARLY_INITIALIZATION:
+        case CSM_MANAGER_PHASE_PRE_DISPLAY_SERVER:
+        case CSM_MANAGER_PHASE_DISPLAY_SERVER:
+        case CSM_MANAGER_PHASE_INITIALIZATION:
+        case CSM_MANAGER_PHASE_WINDOW_MANAGER:
+        case CSM_MANAGER_PHASE_PANEL:
+        case CSM_MANAGER_PHASE_DESKTOP:
+        case CSM_MANAGER_PHASE_APPLICATION:
+                do_phase_startup (manager);
+                break;
+        case CSM_MANAGER_PHASE_RUNNING:
+                save_startup_state ();
+                manager->priv->readahead_record_id = g_timeout_add_seconds (CSM_MANAGER_READAHEAD_RECORD_TIME,
+                                                                            (GSourceFunc)on_readahead_record_timeout,
+                                                                            manager);
+                csm_xsmp_server_start_accepting_new_clients (manager->priv->xsmp_server);
+                csm_exported_manager_emit_session_running (manager->priv->skeleton);
+                update_idle (manager);
+                csm_util_start_systemd_unit ("cinnamon-session.target", "replace");
+                if (manager->priv->autostart_reload_pending) {
+                        reload_autostart_apps (manager);
+                }
+                break;
+        case CSM_MANAGER_PHASE_QUERY_END_SESSION:
+                csm_xsmp_server_stop_accepting_new_clients (manager->priv->xsmp_server);
+                do_phase_query_end_session (manager);
+                break;
+        case CSM_MANAGER_PHASE_END_SESSION:
+                csm_exported_manager_emit_session_over (manager->priv->skeleton);
+                do_phase_end_session (manager);
+                break;
+        case CSM_MANAGER_PHASE_EXIT:
+                do_phase_exit (manager);
+                break;
+        default:
+                g_assert_not_reached ();
+                break;
+        }
 }
 
 static gboolean
-csm_manager_is_inhibited (CsmExportedManager    *skeleton,
-                          GDBusMethodInvocation *invocation,
-                          guint                  flags,
-                          CsmManager            *manager)
+_debug_app_for_phase (const char *id,
+                      CsmApp     *app,
+                      gpointer    data)
 {
-        gboolean is_inhibited;
-
-        is_inhibited = FALSE;
-
-        if (manager->priv->inhibitors == NULL
-            || csm_store_size (manager->priv->inhibitors) == 0) {
-                is_inhibited = FALSE;
-        } else {
-                CsmInhibitor *inhibitor;
+        guint phase;
 
-                inhibitor = (CsmInhibitor *) csm_store_find (manager->priv->inhibitors,
-                                                             (CsmStoreFunc)inhibitor_has_flag,
-                                                             GUINT_TO_POINTER (flags));
+        phase = GPOINTER_TO_UINT (data);
 
-                is_inhibited = inhibitor != NULL;
+        if (csm_app_peek_phase (app) != phase) {
+                return FALSE;
         }
 
-        csm_exported_manager_complete_is_inhibited (skeleton,
-                                                    invocation,
-                                                    is_inhibited);
+        g_debug ("CsmManager:\tID: %s\tapp-id:%s\tis-disabled:%d\tis-conditionally-disabled:%d\tis-delayed:%d",
+                 csm_app_peek_id (app),
+                 csm_app_peek_app_id (app),
+                 csm_app_peek_is_disabled (app),
+                 csm_app_peek_is_conditionally_disabled (app),
+                 (csm_app_peek_autostart_delay (app) > 0));
 
-        return TRUE;
+        return FALSE;
 }
 
-static gboolean
-listify_store_ids (char       *id,
-                   GObject    *object,
-                   GPtrArray **array)
+static void
+debug_app_summary (CsmManager *manager)
 {
-        g_ptr_array_add (*array, g_strdup (id));
-        return FALSE;
+        guint phase;
+
+        g_debug ("CsmManager: App startup summary");
+        for (phase = CSM_MANAGER_PHASE_EARLY_INITIALIZATION; phase < CSM_MANAGER_PHASE_RUNNING; phase++) {
+                g_debug ("CsmManager: Phase %s", phase_num_to_name (phase));
+                csm_store_foreach (manager->priv->apps,
+                                   (CsmStoreFunc)_debug_app_for_phase,
+                                   GUINT_TO_POINTER (phase));
+        }
 }
 
-static gboolean
-csm_manager_get_clients (CsmExportedManager     *skeleton,
-                         GDBusMethodInvocation  *invocation,
-                         CsmManager             *manager)
+void
+csm_manager_start (CsmManager *manager)
 {
-        GPtrArray *clients;
+        g_debug ("CsmManager: CSM starting to manage");
 
-        clients = g_ptr_array_new_with_free_func (g_free);
+        g_return_if_fail (CSM_IS_MANAGER (manager));
 
-        csm_store_foreach (manager->priv->clients,
-                           (CsmStoreFunc)listify_store_ids,
-                           &clients);
+        /* before anything gets started, so it can run ahead of the apps */
+        if (g_settings_get_boolean (manager->priv->settings, KEY_STARTUP_READAHEAD)) {
+                csm_readahead_start (manager->priv->session_name);
+        }
 
-        g_ptr_array_add (clients, NULL);
+        manager->priv->dag_enabled = g_settings_get_boolean (manager->priv->settings,
+                                                             KEY_DEPENDENCY_STARTUP);
+        if (manager->priv->dag_enabled) {
+                g_debug ("CsmManager: using dependency-ordered startup");
+        }
 
-        csm_exported_manager_complete_get_clients (skeleton,
-                                                   invocation,
-                                                   (const gchar * const *) clients->pdata);
-        g_ptr_array_unref (clients);
+        manager->priv->launch_concurrency = g_settings_get_int (manager->priv->settings,
+                                                                KEY_LAUNCH_CONCURRENCY);
 
-        return TRUE;
+        csm_autostart_app_set_use_systemd_scopes (g_settings_get_boolean (manager->priv->settings,
+                                                                          KEY_SYSTEMD_SCOPES));
+
+        csm_xsmp_server_start (manager->priv->xsmp_server);
+        csm_manager_set_phase (manager, CSM_MANAGER_PHASE_EARLY_INITIALIZATION);
+        debug_app_summary (manager);
+        start_phase (manager);
 }
 
-static gboolean
-csm_manager_get_inhibitors (CsmExportedManager     *skeleton,
-                            GDBusMethodInvocation  *invocation,
-                            CsmManager             *manager)
+const char *
+_csm_manager_get_default_session (CsmManager     *manager)
 {
-        GPtrArray *inhibitors;
+        return g_settings_get_string (manager->priv->session_settings,
+                                      KEY_SESSION_NAME);
+}
 
-        inhibitors = g_ptr_array_new_with_free_func (g_free);
+void
+_csm_manager_set_active_session (CsmManager     *manager,
+                                 const char     *session_name,
+                                 gboolean        is_fallback)
+{
+        g_free (manager->priv->session_name);
+        manager->priv->session_name = g_strdup (session_name);
+        manager->priv->is_fallback_session = is_fallback;
 
-        csm_store_foreach (manager->priv->inhibitors,
-                           (CsmStoreFunc)listify_store_ids,
-                           &inhibitors);
+        csm_exported_manager_set_session_name (manager->priv->skeleton,
+                                               session_name);
+}
 
-        g_ptr_array_add (inhibitors, NULL);
+void
+_csm_manager_export_login_session_id (CsmManager *manager)
+{
+        g_autofree gchar *session_id = NULL;
 
-        csm_exported_manager_complete_get_inhibitors (skeleton,
-                                                      invocation,
-                                                      (const gchar * const *) inhibitors->pdata);
-        g_ptr_array_unref (inhibitors);
+        session_id = csm_system_get_login_session_id (manager->priv->system);
 
-        return TRUE;
+        csm_exported_manager_set_session_id (manager->priv->skeleton,
+                                             session_id);
 }
 
-static gboolean
-_app_has_autostart_condition (const char *id,
-                              CsmApp     *app,
-                              const char *condition)
+static CsmApp *
+find_app_for_app_id (CsmManager *manager,
+                     const char *app_id)
 {
-        gboolean has;
-        gboolean disabled;
-
-        has = csm_app_has_autostart_condition (app, condition);
-        disabled = csm_app_peek_is_disabled (app);
-
-        return has && !disabled;
+        CsmApp *app;
+        app = (CsmApp *)csm_store_lookup_index (manager->priv->apps,
+                                                INDEX_APP_ID,
+                                                app_id);
+        return app;
 }
 
 static gboolean
-csm_manager_is_autostart_condition_handled (CsmExportedManager    *skeleton,
-                                            GDBusMethodInvocation *invocation,
-                                            const char            *condition,
-                                            CsmManager            *manager)
+inhibitor_has_client_id (gpointer      key,
+                         CsmInhibitor *inhibitor,
+                         const char   *client_id_a)
 {
-        CsmApp *app;
-        gboolean handled;
+        gboolean    matches;
+        const char *client_id_b;
 
-        app = (CsmApp *) csm_store_find (manager->priv->apps,(
-                                         CsmStoreFunc) _app_has_autostart_condition,
-                                         (char *)condition);
+        client_id_b = csm_inhibitor_peek_client_id (inhibitor);
 
-        if (app != NULL) {
-                handled = TRUE;
-        } else {
-                handled = FALSE;
+        matches = FALSE;
+        if (! IS_STRING_EMPTY (client_id_a) && ! IS_STRING_EMPTY (client_id_b)) {
+                matches = (strcmp (client_id_a, client_id_b) == 0);
+                if (matches) {
+                        g_debug ("CsmManager: removing JIT inhibitor for %s for reason '%s'",
+                                 csm_inhibitor_peek_client_id (inhibitor),
+                                 csm_inhibitor_peek_reason (inhibitor));
+                }
         }
 
-        csm_exported_manager_complete_is_autostart_condition_handled (skeleton,
-                                                                      invocation,
-                                                                      handled);
-
-        return TRUE;
+        return matches;
 }
 
-static gboolean
-csm_manager_shutdown (CsmExportedManager    *skeleton,
-                      GDBusMethodInvocation *invocation,
-                      CsmManager            *manager)
+static CsmApp *
+find_app_for_startup_id (CsmManager *manager,
+                        const char *startup_id)
 {
-        g_debug ("CsmManager: Shutdown called");
+        CsmApp *found_app;
+        GSList *a;
 
-        if (manager->priv->phase != CSM_MANAGER_PHASE_RUNNING) {
-                g_dbus_method_invocation_return_error (invocation,
-                                                       CSM_MANAGER_ERROR,
-                                                       CSM_MANAGER_ERROR_NOT_IN_RUNNING,
-                                                       "Shutdown interface is only available during the Running phase");
+        found_app = NULL;
 
-                return TRUE;
-        }
+        /* If we're starting up the session, try to match the new client
+         * with one pending apps for the current phase. If not, try to match
+         * with any of the autostarted apps. */
+        if (manager->priv->phase < CSM_MANAGER_PHASE_APPLICATION) {
+                for (a = manager->priv->pending_apps; a != NULL; a = a->next) {
+                        CsmApp *app = CSM_APP (a->data);
 
-        if (_log_out_is_locked_down (manager)) {
-                g_dbus_method_invocation_return_error (invocation,
-                                                       CSM_MANAGER_ERROR,
-                                                       CSM_MANAGER_ERROR_LOCKED_DOWN,
-                                                       "Logout has been locked down");
+                        if (strcmp (startup_id, csm_app_peek_startup_id (app)) == 0) {
+                                found_app = app;
+                                goto out;
+                        }
+                }
 
-                return TRUE;
+                /* Apps started ahead of their phase are not pending yet */
+                if (!manager->priv->dag_enabled) {
+                        goto out;
+                }
         }
 
-        show_shutdown_dialog (manager, FALSE);
+        found_app = (CsmApp *)csm_store_lookup_index (manager->priv->apps,
+                                                      INDEX_STARTUP_ID,
+                                                      startup_id);
+ out:
+        return found_app;
+}
 
-        csm_exported_manager_complete_shutdown (skeleton,
-                                                invocation);
+static gboolean
+restart_cinnamon_launcher (CsmManager *manager)
+{
+    CsmApp *app;
 
-        return TRUE;
+    app = find_app_for_app_id (manager, "cinnamon.desktop");
+
+    if (app) {
+        GError *error = NULL;
+
+        g_debug ("CsmManager: Restarting cinnamon-launcher");
+
+        commit_pending_environment (manager);
+
+        if (!csm_app_restart (app, &error)) {
+            g_warning ("CsmManager: Unable to restart cinnamon-launcher: %s", error->message);
+            g_error_free (error);
+        }
+    } else {
+        g_warning ("CsmManager: Unable to find the cinnamon-launcher");
+    }
+
+    return G_SOURCE_REMOVE;
 }
 
 static gboolean
-csm_manager_reboot (CsmExportedManager     *skeleton,
-                    GDBusMethodInvocation  *invocation,
-                    CsmManager  *manager)
+csm_manager_setenv (CsmExportedManager    *skeleton,
+                    GDBusMethodInvocation *invocation,
+                    const gchar           *variable,
+                    const gchar           *value,
+                    CsmManager            *manager)
 {
-        g_debug ("CsmManager: Reboot called");
-
-        if (manager->priv->phase != CSM_MANAGER_PHASE_RUNNING) {
+        if (!CSM_IS_MANAGER (manager)) {
                 g_dbus_method_invocation_return_error (invocation,
                                                        CSM_MANAGER_ERROR,
-                                                       CSM_MANAGER_ERROR_NOT_IN_RUNNING,
-                                                       "Reboot interface is only available during the Running phase");
+                                                       CSM_MANAGER_ERROR_GENERAL,
+                                                       "CSM_IS_MANAGER failed on csm_manager_setenv");
 
                 return TRUE;
         }
 
-        if (_log_out_is_locked_down (manager)) {
+        if (manager->priv->phase > CSM_MANAGER_PHASE_INITIALIZATION) {
                 g_dbus_method_invocation_return_error (invocation,
                                                        CSM_MANAGER_ERROR,
-                                                       CSM_MANAGER_ERROR_LOCKED_DOWN,
-                                                       "Logout has been locked down");
+                                                       CSM_MANAGER_ERROR_NOT_IN_INITIALIZATION,
+                                                       "Setenv interface is only available during the Initialization phase");
 
                 return TRUE;
         }
- 
-        show_shutdown_dialog (manager, TRUE);
 
-        csm_exported_manager_complete_reboot (skeleton,
-                                              invocation);
+        /* Clients tend to call Setenv several times in a row */
+        if (manager->priv->pending_env == NULL) {
+                manager->priv->pending_env = csm_util_env_transaction_begin ();
+                manager->priv->pending_env_id = g_idle_add ((GSourceFunc) on_pending_environment_idle,
+                                                            manager);
+        }
+        csm_util_env_transaction_setenv (manager->priv->pending_env, variable, value);
+
+        csm_exported_manager_complete_setenv (skeleton, invocation);
 
         return TRUE;
 }
 
 static gboolean
-csm_manager_can_shutdown (CsmExportedManager    *skeleton,
-                          GDBusMethodInvocation *invocation,
-                          CsmManager            *manager)
+csm_manager_initialization_error (CsmExportedManager    *skeleton,
+                                  GDBusMethodInvocation *invocation,
+                                  const char            *message,
+                                  gboolean               fatal,
+                                  CsmManager            *manager)
 {
-        gboolean shutdown_available;
+        if (!CSM_IS_MANAGER (manager)) {
+                g_dbus_method_invocation_return_error (invocation,
+                                                       CSM_MANAGER_ERROR,
+                                                       CSM_MANAGER_ERROR_GENERAL,
+                                                       "CSM_IS_MANAGER failed on csm_manager_initialization_error");
 
-        g_debug ("CsmManager: CanShutdown called");
+                return TRUE;
+        }
 
-        shutdown_available = !_log_out_is_locked_down (manager) &&
-                             (csm_system_can_stop (manager->priv->system)
-                              || csm_system_can_restart (manager->priv->system)
-                              || csm_system_can_suspend (manager->priv->system)
-                              || csm_system_can_hibernate (manager->priv->system));
+        if (manager->priv->phase != CSM_MANAGER_PHASE_INITIALIZATION) {
+                g_dbus_method_invocation_return_error (invocation,
+                                                       CSM_MANAGER_ERROR,
+                                                       CSM_MANAGER_ERROR_NOT_IN_INITIALIZATION,
+                                                       "InitializationError interface is only available during the Initialization phase");
 
-        csm_exported_manager_complete_can_shutdown (skeleton,
-                                                    invocation,
-                                                    shutdown_available);
+                return TRUE;
+        }
+
+        csm_util_init_error (fatal, "%s", message);
+
+        csm_exported_manager_complete_initialization_error (skeleton, invocation);
 
         return TRUE;
 }
 
 static gboolean
-csm_manager_logout_dbus (CsmExportedManager    *skeleton,
-                         GDBusMethodInvocation *invocation,
-                         guint                  logout_mode,
-                         CsmManager            *manager)
+csm_manager_register_client (CsmExportedManager      *skeleton,
+                             GDBusMethodInvocation   *invocation,
+                             const char              *app_id,
+                             const char              *startup_id,
+                             CsmManager              *manager)
 {
-        g_debug ("CsmManager: Logout called");
+        char      *new_startup_id;
+        const char *sender;
+        CsmClient *client;
+        CsmApp    *app;
 
-        if (manager->priv->phase != CSM_MANAGER_PHASE_RUNNING) {
+        if (!CSM_IS_MANAGER (manager)) {
                 g_dbus_method_invocation_return_error (invocation,
                                                        CSM_MANAGER_ERROR,
-                                                       CSM_MANAGER_ERROR_NOT_IN_RUNNING,
-                                                       "Logout interface is only available during the Running phase");
+                                                       CSM_MANAGER_ERROR_GENERAL,
+                                                       "CSM_IS_MANAGER failed on csm_manager_register_client");
 
                 return TRUE;
         }
 
-        if (_log_out_is_locked_down (manager)) {
-                g_dbus_method_invocation_return_error (invocation,
-                                                       CSM_MANAGER_ERROR,
-                                                       CSM_MANAGER_ERROR_LOCKED_DOWN,
-                                                       "Logout has been locked down");
+        app = NULL;
+        client = NULL;
 
-                return TRUE;
-        }
+        g_debug ("CsmManager: RegisterClient %s", startup_id);
 
-        switch (logout_mode) {
-        case CSM_MANAGER_LOGOUT_MODE_NORMAL:
-        case CSM_MANAGER_LOGOUT_MODE_NO_CONFIRMATION:
-        case CSM_MANAGER_LOGOUT_MODE_FORCE:
-                user_logout (manager, logout_mode);
-                break;
-        default:
-                g_debug ("Unknown logout mode option");
+        if (manager->priv->phase >= CSM_MANAGER_PHASE_QUERY_END_SESSION) {
+                g_debug ("Unable to register client: shutting down");
 
                 g_dbus_method_invocation_return_error (invocation,
                                                        CSM_MANAGER_ERROR,
-                                                       CSM_MANAGER_ERROR_INVALID_OPTION,
-                                                       "Unknown logout mode flag");
+                                                       CSM_MANAGER_ERROR_NOT_IN_RUNNING,
+                                                       "Unable to register client");
 
                 return TRUE;
         }
 
-        csm_exported_manager_complete_logout (skeleton,
-                                              invocation);
+        if (IS_STRING_EMPTY (startup_id)) {
+                new_startup_id = csm_util_generate_startup_id ();
+        } else {
+                client = find_client_for_startup_id (manager, startup_id);
+                /* We can't have two clients with the same startup id. */
+                if (client != NULL) {
+                        g_debug ("Unable to register client: already registered");
 
-        return TRUE;
-}
+                        g_dbus_method_invocation_return_error (invocation,
+                                                               CSM_MANAGER_ERROR,
+                                                               CSM_MANAGER_ERROR_ALREADY_REGISTERED,
+                                                               "Unable to register client");
 
-static gboolean
-csm_manager_is_session_running (CsmExportedManager    *skeleton,
-                                GDBusMethodInvocation *invocation,
-                                CsmManager            *manager)
-{
+                        return TRUE;
+                }
 
-        csm_exported_manager_complete_is_session_running (skeleton,
-                                                          invocation,
-                                                          (manager->priv->phase == CSM_MANAGER_PHASE_RUNNING));
+                new_startup_id = g_strdup (startup_id);
+        }
 
-        return TRUE;
-}
+        g_debug ("CsmManager: Adding new client %s to session", new_startup_id);
 
-static gboolean
-csm_manager_request_shutdown (CsmExportedManager    *skeleton,
-                              GDBusMethodInvocation *invocation,
-                              CsmManager            *manager)
-{
-        g_debug ("CsmManager: RequestShutdown called");
+        if (app == NULL && !IS_STRING_EMPTY (startup_id)) {
+                app = find_app_for_startup_id (manager, startup_id);
+        }
+        if (app == NULL && !IS_STRING_EMPTY (app_id)) {
+                /* try to associate this app id with a known app */
+                app = find_app_for_app_id (manager, app_id);
+        }
+
+        sender = g_dbus_method_invocation_get_sender (invocation);
+        client = csm_dbus_client_new (new_startup_id, sender);
+
+        if (client == NULL) {
+                g_debug ("Unable to create client");
 
-        if (manager->priv->phase != CSM_MANAGER_PHASE_RUNNING) {
                 g_dbus_method_invocation_return_error (invocation,
                                                        CSM_MANAGER_ERROR,
-                                                       CSM_MANAGER_ERROR_NOT_IN_RUNNING,
-                                                       "RequestShutdown interface is only available during the Running phase");
+                                                       CSM_MANAGER_ERROR_GENERAL,
+                                                       "Unable to register client");
 
                 return TRUE;
         }
 
-        request_shutdown (manager);
+        csm_store_add (manager->priv->clients, csm_client_peek_id (client), G_OBJECT (client));
+        /* the store will own the ref */
+        g_object_unref (client);
 
-        csm_exported_manager_complete_request_shutdown (skeleton,
-                                                        invocation);
+        if (app != NULL) {
+                csm_client_set_app_id (client, csm_app_peek_app_id (app));
+                csm_app_registered (app);
+        } else {
+                /* if an app id is specified store it in the client
+                   so we can save it later */
+                csm_client_set_app_id (client, app_id);
+        }
+
+        csm_client_set_status (client, CSM_CLIENT_REGISTERED);
+
+        g_assert (new_startup_id != NULL);
+        g_free (new_startup_id);
+
+        csm_exported_manager_complete_register_client (skeleton,
+                                                       invocation,
+                                                       csm_client_peek_id (client));
 
         return TRUE;
 }
 
 static gboolean
-csm_manager_request_reboot (CsmExportedManager     *skeleton,
-                            GDBusMethodInvocation  *invocation,
-                            CsmManager *manager)
+csm_manager_unregister_client (CsmExportedManager     *skeleton,
+                               GDBusMethodInvocation  *invocation,
+                               const char             *client_id,
+                               CsmManager             *manager)
 {
-        g_debug ("CsmManager: RequestReboot called");
+        CsmClient *client;
 
-        if (manager->priv->phase != CSM_MANAGER_PHASE_RUNNING) {
+        if (!CSM_IS_MANAGER (manager)) {
                 g_dbus_method_invocation_return_error (invocation,
                                                        CSM_MANAGER_ERROR,
-                                                       CSM_MANAGER_ERROR_NOT_IN_RUNNING,
-                                                       "RequestReboot interface is only available during the Running phase");
+                                                       CSM_MANAGER_ERROR_GENERAL,
+                                                       "CSM_IS_MANAGER failed on csm_manager_register_client");
 
                 return TRUE;
         }
 
-        request_reboot (manager);
+        g_debug ("CsmManager: UnregisterClient %s", client_id);
 
-        csm_exported_manager_complete_request_reboot (skeleton,
-                                                      invocation);
-
-        return TRUE;
-}
-
-static gboolean
-csm_manager_restart_cinnamon_launcher (CsmExportedManager     *skeleton,
-                                       GDBusMethodInvocation  *invocation,
-                                       CsmManager             *manager)
-{
-        g_debug ("CsmManager: RestartCinnamonLauncher called");
+        client = (CsmClient *)csm_store_lookup (manager->priv->clients, client_id);
+        if (client == NULL) {
+                g_debug ("Unable to unregister client: not registered");
 
-        if (manager->priv->phase != CSM_MANAGER_PHASE_RUNNING) {
                 g_dbus_method_invocation_return_error (invocation,
                                                        CSM_MANAGER_ERROR,
-                                                       CSM_MANAGER_ERROR_NOT_IN_RUNNING,
-                                                       "RestartCinnamonLauncher interface is only available during the Running phase");
+                                                       CSM_MANAGER_ERROR_NOT_REGISTERED,
+                                                       "Unable to unregister client");
 
                 return TRUE;
         }
 
-        g_idle_add ((GSourceFunc)restart_cinnamon_launcher, manager);
+        /* don't disconnect client here, only change the status.
+           Wait until it leaves the bus before disconnecting it */
+        csm_client_set_status (client, CSM_CLIENT_UNREGISTERED);
 
-        csm_exported_manager_complete_restart_cinnamon_launcher (skeleton,
-                                                                 invocation);
+        csm_exported_manager_complete_unregister_client (skeleton,
+                                                         invocation);
 
         return TRUE;
 }
 
-static void
-_disconnect_client (CsmManager *manager,
-                    CsmClient  *client)
+static gboolean
+csm_manager_inhibit (CsmExportedManager      *skeleton,
+                     GDBusMethodInvocation   *invocation,
+                     const char              *app_id,
+                     guint                    toplevel_xid,
+                     const char              *reason,
+                     guint                    flags,
+                     CsmManager              *manager)
 {
-        gboolean              is_condition_client;
-        CsmApp               *app;
-        const char           *app_id;
-        const char           *startup_id;
-        gboolean              app_restart;
-        CsmClientRestartStyle client_restart_hint;
-
-        g_debug ("CsmManager: disconnect client: %s", csm_client_peek_id (client));
-
-        /* take a ref so it doesn't get finalized */
-        g_object_ref (client);
-
-        csm_client_set_status (client, CSM_CLIENT_FINISHED);
-
-        is_condition_client = FALSE;
-        if (g_slist_find (manager->priv->condition_clients, client)) {
-                manager->priv->condition_clients = g_slist_remove (manager->priv->condition_clients, client);
-
-                is_condition_client = TRUE;
-        }
+        CsmInhibitor *inhibitor;
+        guint         cookie;
 
-        /* remove any inhibitors for this client */
-        csm_store_foreach_remove (manager->priv->inhibitors,
-                                  (CsmStoreFunc)inhibitor_has_client_id,
-                                  (gpointer)csm_client_peek_id (client));
+        g_debug ("CsmManager: Inhibit xid=%u app_id=%s reason=%s flags=%u",
+                 toplevel_xid,
+                 app_id,
+                 reason,
+                 flags);
 
-        app = NULL;
+        if (manager->priv->logout_mode == CSM_MANAGER_LOGOUT_MODE_FORCE) {
+                g_debug ("CsmManager: Unable to inhibit: Forced logout cannot be inhibited");
 
-        /* first try to match on startup ID */
-        startup_id = csm_client_peek_startup_id (client);
-        if (! IS_STRING_EMPTY (startup_id)) {
-                app = find_app_for_startup_id (manager, startup_id);
+                g_dbus_method_invocation_return_error (invocation,
+                                                       CSM_MANAGER_ERROR,
+                                                       CSM_MANAGER_ERROR_GENERAL,
+                                                       "Forced logout cannot be inhibited");
 
+                return TRUE;
         }
 
-        /* then try to find matching app-id */
-        if (app == NULL) {
-                app_id = csm_client_peek_app_id (client);
-                if (! IS_STRING_EMPTY (app_id)) {
-                        g_debug ("CsmManager: disconnect for app '%s'", app_id);
-                        app = find_app_for_app_id (manager, app_id);
-                }
-        }
+        if (IS_STRING_EMPTY (app_id)) {
+                g_debug ("CsmManager: Unable to inhibit: Application ID not specified");
 
-        switch (manager->priv->phase) {
-            case CSM_MANAGER_PHASE_QUERY_END_SESSION:
-                /* Instead of answering our end session query, the client just exited.
-                 * Treat that as an "okay, end the session" answer.
-                 *
-                 * This call implicitly removes any inhibitors for the client, along
-                 * with removing the client from the pending query list.
-                 */
-                _handle_client_end_session_response (manager,
-                                                     client,
-                                                     TRUE,
-                                                     FALSE,
-                                                     FALSE,
-                                                     "Client exited in "
-                                                     "query end session phase "
-                                                     "instead of end session "
-                                                     "phase");
-                break;
-            case CSM_MANAGER_PHASE_END_SESSION:
-                if (! g_slist_find (manager->priv->query_clients, client)) {
-                        /* the client sent its EndSessionResponse and we already
-                         * processed it.
-                         */
-                        break;
-                }
+                g_dbus_method_invocation_return_error (invocation,
+                                                       CSM_MANAGER_ERROR,
+                                                       CSM_MANAGER_ERROR_GENERAL,
+                                                       "Application ID not specified");
 
-                /* Client exited without sending EndSessionResponse.
-                 * The likely reason is that its exit code is written in a way
-                 * that never returns, and sending EndSessionResponse is handled
-                 * in library code after the callback. Or maybe the application
-                 * crashed while handling EndSession. Or it was lazy.
-                 */
-                _handle_client_end_session_response (manager,
-                                                     client,
-                                                     TRUE,
-                                                     FALSE,
-                                                     FALSE,
-                                                     "Client exited in "
-                                                     "end session phase without "
-                                                     "sending EndSessionResponse");
-        default:
-                /* do nothing */
-                break;
+                return TRUE;
         }
 
-        if (manager->priv->dbus_disconnected && CSM_IS_DBUS_CLIENT (client)) {
-                g_debug ("CsmManager: dbus disconnected, not restarting application");
-                goto out;
-        }
+        if (IS_STRING_EMPTY (reason)) {
+                g_debug ("CsmManager: Unable to inhibit: Reason not specific");
 
-        if (app == NULL) {
-                g_debug ("CsmManager: unable to find application for client - not restarting");
-                goto out;
-        }
+                g_dbus_method_invocation_return_error (invocation,
+                                                       CSM_MANAGER_ERROR,
+                                                       CSM_MANAGER_ERROR_GENERAL,
+                                                       "Reason not specified");
 
-        if (manager->priv->phase >= CSM_MANAGER_PHASE_QUERY_END_SESSION) {
-                g_debug ("CsmManager: in shutdown, not restarting application");
-                goto out;
+                return TRUE;
         }
 
-        app_restart = csm_app_peek_autorestart (app);
-        client_restart_hint = csm_client_peek_restart_style_hint (client);
+        if (flags == 0) {
+                g_debug ("CsmManager: Unable to inhibit: Invalid inhibit flags");
 
-        /* allow legacy clients to override the app info */
-        if (! app_restart
-            && client_restart_hint != CSM_CLIENT_RESTART_IMMEDIATELY) {
-                g_debug ("CsmManager: autorestart not set, not restarting application");
-                goto out;
-        }
+                g_dbus_method_invocation_return_error (invocation,
+                                                       CSM_MANAGER_ERROR,
+                                                       CSM_MANAGER_ERROR_GENERAL,
+                                                       "Invalid inhibit flags");
 
-        if (is_condition_client) {
-                g_debug ("CsmManager: app conditionally disabled, not restarting application");
-                goto out;
+                return TRUE;
         }
 
-        g_debug ("CsmManager: restarting app");
+        cookie = _generate_unique_cookie (manager);
+        inhibitor = csm_inhibitor_new (app_id,
+                                       toplevel_xid,
+                                       flags,
+                                       reason,
+                                       g_dbus_method_invocation_get_sender (invocation),
+                                       cookie);
+        csm_store_add (manager->priv->inhibitors, csm_inhibitor_peek_id (inhibitor), G_OBJECT (inhibitor));
+        g_object_unref (inhibitor);
 
-        _restart_app (manager, app);
+        csm_exported_manager_complete_inhibit (skeleton,
+                                               invocation,
+                                               cookie);
 
- out:
-        g_object_unref (client);
+        return TRUE;
 }
 
-typedef struct {
-        const char *service_name;
-        CsmManager *manager;
-} RemoveClientData;
-
 static gboolean
-_disconnect_dbus_client (const char       *id,
-                         CsmClient        *client,
-                         RemoveClientData *data)
+csm_manager_uninhibit (CsmExportedManager    *skeleton,
+                       GDBusMethodInvocation *invocation,
+                       guint                  cookie,
+                       CsmManager            *manager)
 {
-        const char *name;
+        CsmInhibitor *inhibitor;
 
-        if (! CSM_IS_DBUS_CLIENT (client)) {
-                return FALSE;
-        }
+        g_debug ("CsmManager: Uninhibit %u", cookie);
 
-        /* If no service name, then we simply disconnect all clients */
-        if (!data->service_name) {
-                _disconnect_client (data->manager, client);
-                return TRUE;
-        }
+        inhibitor = find_inhibitor_for_cookie (manager, cookie);
+        if (inhibitor == NULL) {
+                g_debug ("Unable to uninhibit: Invalid cookie");
 
-        name = csm_dbus_client_get_bus_name (CSM_DBUS_CLIENT (client));
-        if (IS_STRING_EMPTY (name)) {
-                return FALSE;
-        }
+                g_dbus_method_invocation_return_error (invocation,
+                                                       CSM_MANAGER_ERROR,
+                                                       CSM_MANAGER_ERROR_GENERAL,
+                                                       "Unable to uninhibit: Invalid cookie");
 
-        if (strcmp (data->service_name, name) == 0) {
-                _disconnect_client (data->manager, client);
                 return TRUE;
         }
 
-        return FALSE;
-}
+        g_debug ("CsmManager: removing inhibitor %s %u reason '%s' %u connection %s",
+                 csm_inhibitor_peek_app_id (inhibitor),
+                 csm_inhibitor_peek_toplevel_xid (inhibitor),
+                 csm_inhibitor_peek_reason (inhibitor),
+                 csm_inhibitor_peek_flags (inhibitor),
+                 csm_inhibitor_peek_bus_name (inhibitor));
 
-/**
- * remove_clients_for_connection:
- * @manager: a #CsmManager
- * @service_name: a service name
- *
- * Disconnects clients that own @service_name.
- *
- * If @service_name is NULL, then disconnects all clients for the connection.
- */
-static void
-remove_clients_for_connection (CsmManager *manager,
-                               const char *service_name)
-{
-        RemoveClientData data;
+        csm_store_remove (manager->priv->inhibitors, csm_inhibitor_peek_id (inhibitor));
 
-        data.service_name = service_name;
-        data.manager = manager;
+        csm_exported_manager_complete_uninhibit (skeleton,
+                                                 invocation);
 
-        /* disconnect dbus clients for name */
-        csm_store_foreach_remove (manager->priv->clients,
-                                  (CsmStoreFunc)_disconnect_dbus_client,
-                                  &data);
-
-        if (manager->priv->phase >= CSM_MANAGER_PHASE_QUERY_END_SESSION
-            && csm_store_size (manager->priv->clients) == 0) {
-                g_debug ("CsmManager: last client disconnected - exiting");
-                end_phase (manager);
-        }
-}
+        return TRUE;
+}
 
 static gboolean
-inhibitor_has_bus_name (gpointer          key,
-                        CsmInhibitor     *inhibitor,
-                        RemoveClientData *data)
+csm_manager_is_inhibited (CsmExportedManager    *skeleton,
+                          GDBusMethodInvocation *invocation,
+                          guint                  flags,
+                          CsmManager            *manager)
 {
-        gboolean    matches;
-        const char *bus_name_b;
+        gboolean is_inhibited;
 
-        bus_name_b = csm_inhibitor_peek_bus_name (inhibitor);
+        is_inhibited = is_flag_inhibited (manager, flags);
 
-        matches = FALSE;
-        if (! IS_STRING_EMPTY (data->service_name) && ! IS_STRING_EMPTY (bus_name_b)) {
-                matches = (strcmp (data->service_name, bus_name_b) == 0);
-                if (matches) {
-                        g_debug ("CsmManager: removing inhibitor from %s for reason '%s' on connection %s",
-                                 csm_inhibitor_peek_app_id (inhibitor),
-                                 csm_inhibitor_peek_reason (inhibitor),
-                                 csm_inhibitor_peek_bus_name (inhibitor));
-                }
-        }
+        csm_exported_manager_complete_is_inhibited (skeleton,
+                                                    invocation,
+                                                    is_inhibited);
 
-        return matches;
+        return TRUE;
 }
 
-static void
-remove_inhibitors_for_connection (CsmManager *manager,
-                                  const char *service_name)
+static gboolean
+listify_store_ids (char       *id,
+                   GObject    *object,
+                   GPtrArray **array)
 {
-        RemoveClientData data;
+        g_ptr_array_add (*array, g_strdup (id));
+        return FALSE;
+}
 
-        data.service_name = service_name;
-        data.manager = manager;
+static gboolean
+csm_manager_get_clients (CsmExportedManager     *skeleton,
+                         GDBusMethodInvocation  *invocation,
+                         CsmManager             *manager)
+{
+        GPtrArray *clients;
 
-        debug_inhibitors (manager);
+        clients = g_ptr_array_new_with_free_func (g_free);
 
-        csm_store_foreach_remove (manager->priv->inhibitors,
-                                  (CsmStoreFunc)inhibitor_has_bus_name,
-                                  &data);
+        csm_store_foreach (manager->priv->clients,
+                           (CsmStoreFunc)listify_store_ids,
+                           &clients);
+
+        g_ptr_array_add (clients, NULL);
+
+        csm_exported_manager_complete_get_clients (skeleton,
+                                                   invocation,
+                                                   (const gchar * const *) clients->pdata);
+        g_ptr_array_unref (clients);
+
+        return TRUE;
 }
 
-static void
-on_dbus_proxy_signal (GDBusProxy *proxy,
-                      gchar      *sender_name,
-                      gchar      *signal_name,
-                      GVariant   *parameters,
-                      gpointer    user_data)
+static gboolean
+csm_manager_get_inhibitors (CsmExportedManager     *skeleton,
+                            GDBusMethodInvocation  *invocation,
+                            CsmManager             *manager)
 {
-    CsmManager *manager;
-    gchar *name, *old_owner, *new_owner;
+        GPtrArray *inhibitors;
 
-    manager = CSM_MANAGER (user_data);
+        inhibitors = g_ptr_array_new_with_free_func (g_free);
 
-    if (g_strcmp0 (signal_name, "NameOwnerChanged") != 0) {
-            return;
-    }
+        csm_store_foreach (manager->priv->inhibitors,
+                           (CsmStoreFunc)listify_store_ids,
+                           &inhibitors);
 
-    g_variant_get (parameters, "(sss)",
-                   &name,
-                   &old_owner,
-                   &new_owner);
+        g_ptr_array_add (inhibitors, NULL);
 
-    if (strlen (new_owner) == 0 && strlen (old_owner) > 0) {
-        /* service removed */
-        remove_inhibitors_for_connection (manager, old_owner);
-        remove_clients_for_connection (manager, old_owner);
+        csm_exported_manager_complete_get_inhibitors (skeleton,
+                                                      invocation,
+                                                      (const gchar * const *) inhibitors->pdata);
+        g_ptr_array_unref (inhibitors);
 
-        if (g_strcmp0 (name, "org.Cinnamon") == 0) {
-            g_debug ("org.Cinnamon has lost its owner (Cinnamon is not running)");
-        }
-    } else if (strlen (old_owner) == 0 && strlen (new_owner) > 0) {
-        /* service added */
-        if (g_strcmp0 (name, "org.Cinnamon") == 0) {
-            g_debug ("org.Cinnamon has an owner (Cinnamon is running)");
-        }
+        return TRUE;
+}
 
-        /* use this if we support automatically registering
-         * well known bus names */
-    }
+static gboolean
+_app_has_autostart_condition (const char *id,
+                              CsmApp     *app,
+                              const char *condition)
+{
+        gboolean has;
+        gboolean disabled;
 
-    g_free (name);
-    g_free (old_owner);
-    g_free (new_owner);
+        has = csm_app_has_autostart_condition (app, condition);
+        disabled = csm_app_peek_is_disabled (app);
+
+        return has && !disabled;
 }
 
-static void
-on_bus_connection_closed (GDBusConnection *connection,
-                          gboolean         remote_peer_vanished,
-                          GError          *error,
-                          gpointer         user_data)
+static gboolean
+csm_manager_is_autostart_condition_handled (CsmExportedManager    *skeleton,
+                                            GDBusMethodInvocation *invocation,
+                                            const char            *condition,
+                                            CsmManager            *manager)
 {
-        CsmManager *manager;
+        CsmApp *app;
+        gboolean handled;
 
-        manager = CSM_MANAGER (user_data);
+        app = (CsmApp *) csm_store_find (manager->priv->apps,(
+                                         CsmStoreFunc) _app_has_autostart_condition,
+                                         (char *)condition);
 
-        g_debug ("CsmManager: dbus disconnected; disconnecting dbus clients...");
+        if (app != NULL) {
+                handled = TRUE;
+        } else {
+                handled = FALSE;
+        }
 
-        manager->priv->dbus_disconnected = TRUE;
-        remove_clients_for_connection (manager, NULL);
-}
+        csm_exported_manager_complete_is_autostart_condition_handled (skeleton,
+                                                                      invocation,
+                                                                      handled);
 
-static gboolean csm_manager_is_switch_user_inhibited (CsmManager *manager);
-static gboolean csm_manager_is_suspend_inhibited (CsmManager *manager);
+        return TRUE;
+}
 
 static gboolean
-handle_dialog_method_call (CsmExportedDialog     *dialog_skeleton,
-                           GDBusMethodInvocation *invocation,
-                           gpointer               user_data)
+csm_manager_shutdown (CsmExportedManager    *skeleton,
+                      GDBusMethodInvocation *invocation,
+                      CsmManager            *manager)
 {
-    CsmManager *manager = CSM_MANAGER (user_data);
-    const gchar *method_name = g_dbus_method_invocation_get_method_name (invocation);
+        g_debug ("CsmManager: Shutdown called");
 
-    g_debug("Dialog method received: %s", method_name);
+        if (manager->priv->phase != CSM_MANAGER_PHASE_RUNNING) {
+                g_dbus_method_invocation_return_error (invocation,
+                                                       CSM_MANAGER_ERROR,
+                                                       CSM_MANAGER_ERROR_NOT_IN_RUNNING,
+                                                       "Shutdown interface is only available during the Running phase");
 
-    if (g_strcmp0 (method_name, "Suspend") == 0) {
-        request_suspend (manager);
-        csm_exported_dialog_complete_suspend (dialog_skeleton, invocation);
-    }
-    else
-    if (g_strcmp0 (method_name, "Hibernate") == 0) {
-        request_hibernate (manager);
-        csm_exported_dialog_complete_hibernate (dialog_skeleton, invocation);
-    }
-    else
-    if (g_strcmp0 (method_name, "Restart") == 0) {
-        request_reboot (manager);
-        csm_exported_dialog_complete_restart (dialog_skeleton, invocation);
-    }
-    else
-    if (g_strcmp0 (method_name, "Shutdown") == 0) {
-        request_shutdown (manager);
-        csm_exported_dialog_complete_shutdown (dialog_skeleton, invocation);
-    }
-    else
-    if (g_strcmp0 (method_name, "SwitchUser") == 0) {
-        request_switch_user (manager);
-        csm_exported_dialog_complete_switch_user (dialog_skeleton, invocation);
-    }
-    else
-    if (g_strcmp0 (method_name, "Logout") == 0) {
-        request_logout (manager, CSM_MANAGER_LOGOUT_MODE_NO_CONFIRMATION);
-        csm_exported_dialog_complete_logout (dialog_skeleton, invocation);
-    }
-    else
-    if (g_strcmp0 (method_name, "Cancel") == 0) {
-        if (manager->priv->dialog_action != CSM_LOGOUT_ACTION_UNDEFINED) {
-            g_debug ("session-manager dialog was cancelled during inhibit phase");
-            cancel_end_session (manager);
-        }
-        else
-        {
-            g_debug ("session-manager dialog was cancelled");
+                return TRUE;
         }
 
-        close_end_session_dialog (manager);
-        csm_exported_dialog_complete_logout (dialog_skeleton, invocation);
-    }
-    else
-    if (g_strcmp0 (method_name, "IgnoreInhibitors") == 0) {
-        close_end_session_dialog (manager);
-        do_inhibit_dialog_action (manager);
-        csm_exported_dialog_complete_ignore_inhibitors (dialog_skeleton, invocation);
-    }
-    else
-    if (g_strcmp0 (method_name, "GetCapabilities") == 0) {
-        GVariant *ret;
-        gboolean can_hybrid_sleep = g_settings_get_boolean (manager->priv->settings, KEY_PREFER_HYBRID_SLEEP) &&
-                              csm_system_can_hybrid_sleep (manager->priv->system);
+        if (_log_out_is_locked_down (manager)) {
+                g_dbus_method_invocation_return_error (invocation,
+                                                       CSM_MANAGER_ERROR,
+                                                       CSM_MANAGER_ERROR_LOCKED_DOWN,
+                                                       "Logout has been locked down");
 
-        ret = g_variant_new ("(bbbbbbb)",
-                             !(_switch_user_is_locked_down (manager) || csm_manager_is_switch_user_inhibited (manager)),
-                             (!_log_out_is_locked_down (manager)) && csm_system_can_stop (manager->priv->system),
-                             (!_log_out_is_locked_down (manager)) && csm_system_can_restart (manager->priv->system),
-                             can_hybrid_sleep,
-                             csm_system_can_suspend (manager->priv->system),
-                             csm_system_can_hibernate (manager->priv->system),
-                             (!csm_manager_is_logout_inhibited (manager)));
+                return TRUE;
+        }
 
-        csm_exported_dialog_complete_get_capabilities (dialog_skeleton, invocation, ret);
-    }
-    else {
-        g_warning ("Unknown method name %s", method_name);
-        g_dbus_method_invocation_return_error (invocation,
-                                               CSM_MANAGER_ERROR,
-                                               CSM_MANAGER_ERROR_INVALID_METHOD,
-                                               "Unknown method name %s",
-                                               method_name);
-    }
+        show_shutdown_dialog (manager, FALSE);
 
-    return TRUE;
-}
+        csm_exported_manager_complete_shutdown (skeleton,
+                                                invocation);
+
+        return TRUE;
+}
+
+static gboolean
+csm_manager_reboot (CsmExportedManager     *skeleton,
+                    GDBusMethodInvocation  *invocation,
+                    CsmManager  *manager)
+{
+        g_debug ("CsmManager: Reboot called");
+
+        if (manager->priv->phase != CSM_MANAGER_PHASE_RUNNING) {
+                g_dbus_method_invocation_return_error (invocation,
+                                                       CSM_MANAGER_ERROR,
+                                                       CSM_MANAGER_ERROR_NOT_IN_RUNNING,
+                                                       "Reboot interface is only available during the Running phase");
+
+                return TRUE;
+        }
+
+        if (_log_out_is_locked_down (manager)) {
+                g_dbus_method_invocation_return_error (invocation,
+                                                       CSM_MANAGER_ERROR,
+                                                       CSM_MANAGER_ERROR_LOCKED_DOWN,
+                                                       "Logout has been locked down");
+
+                return TRUE;
+        }
+ 
+        show_shutdown_dialog (manager, TRUE);
+
+        csm_exported_manager_complete_reboot (skeleton,
+                                              invocation);
+
+        return TRUE;
+}
+
+static gboolean
+csm_manager_can_shutdown (CsmExportedManager    *skeleton,
+                          GDBusMethodInvocation *invocation,
+                          CsmManager            *manager)
+{
+        gboolean shutdown_available;
+
+        g_debug ("CsmManager: CanShutdown called");
+
+        shutdown_available = !_log_out_is_locked_down (manager) &&
+                             (csm_system_can_stop (manager->priv->system)
+                              || csm_system_can_restart (manager->priv->system)
+                              || csm_system_can_suspend (manager->priv->system)
+                              || csm_system_can_hibernate (manager->priv->system));
+
+        csm_exported_manager_complete_can_shutdown (skeleton,
+                                                    invocation,
+                                                    shutdown_available);
+
+        return TRUE;
+}
+
+static gboolean
+csm_manager_logout_dbus (CsmExportedManager    *skeleton,
+                         GDBusMethodInvocation *invocation,
+                         guint                  logout_mode,
+                         CsmManager            *manager)
+{
+        g_debug ("CsmManager: Logout called");
+
+        if (manager->priv->phase != CSM_MANAGER_PHASE_RUNNING) {
+                g_dbus_method_invocation_return_error (invocation,
+                                                       CSM_MANAGER_ERROR,
+                                                       CSM_MANAGER_ERROR_NOT_IN_RUNNING,
+                                                       "Logout interface is only available during the Running phase");
+
+                return TRUE;
+        }
+
+        if (_log_out_is_locked_down (manager)) {
+                g_dbus_method_invocation_return_error (invocation,
+                                                       CSM_MANAGER_ERROR,
+                                                       CSM_MANAGER_ERROR_LOCKED_DOWN,
+                                                       "Logout has been locked down");
+
+                return TRUE;
+        }
+
+        switch (logout_mode) {
+        case CSM_MANAGER_LOGOUT_MODE_NORMAL:
+        case CSM_MANAGER_LOGOUT_MODE_NO_CONFIRMATION:
+        case CSM_MANAGER_LOGOUT_MODE_FORCE:
+                user_logout (manager, logout_mode);
+                break;
+        default:
+                g_debug ("Unknown logout mode option");
+
+                g_dbus_method_invocation_return_error (invocation,
+                                                       CSM_MANAGER_ERROR,
+                                                       CSM_MANAGER_ERROR_INVALID_OPTION,
+                                                       "Unknown logout mode flag");
+
+                return TRUE;
+        }
+
+        csm_exported_manager_complete_logout (skeleton,
+                                              invocation);
+
+        return TRUE;
+}
+
+static gboolean
+csm_manager_is_session_running (CsmExportedManager    *skeleton,
+                                GDBusMethodInvocation *invocation,
+                                CsmManager            *manager)
+{
+
+        csm_exported_manager_complete_is_session_running (skeleton,
+                                                          invocation,
+                                                          (manager->priv->phase == CSM_MANAGER_PHASE_RUNNING));
+
+        return TRUE;
+}
+
+static gboolean
+csm_manager_get_startup_timeline (CsmExportedManager    *skeleton,
+                                  GDBusMethodInvocation *invocation,
+                                  CsmManager            *manager)
+{
+        csm_exported_manager_complete_get_startup_timeline (skeleton,
+                                                            invocation,
+                                                            csm_timeline_to_variant ());
+
+        return TRUE;
+}
+
+static gboolean
+csm_manager_request_shutdown (CsmExportedManager    *skeleton,
+                              GDBusMethodInvocation *invocation,
+                              CsmManager            *manager)
+{
+        g_debug ("CsmManager: RequestShutdown called");
+
+        if (manager->priv->phase != CSM_MANAGER_PHASE_RUNNING) {
+                g_dbus_method_invocation_return_error (invocation,
+                                                       CSM_MANAGER_ERROR,
+                                                       CSM_MANAGER_ERROR_NOT_IN_RUNNING,
+                                                       "RequestShutdown interface is only available during the Running phase");
+
+                return TRUE;
+        }
+
+        request_shutdown (manager);
+
+        csm_exported_manager_complete_request_shutdown (skeleton,
+                                                        invocation);
+
+        return TRUE;
+}
+
+static gboolean
+csm_manager_request_reboot (CsmExportedManager     *skeleton,
+                            GDBusMethodInvocation  *invocation,
+                            CsmManager *manager)
+{
+        g_debug ("CsmManager: RequestReboot called");
+
+        if (manager->priv->phase != CSM_MANAGER_PHASE_RUNNING) {
+                g_dbus_method_invocation_return_error (invocation,
+                                                       CSM_MANAGER_ERROR,
+                                                       CSM_MANAGER_ERROR_NOT_IN_RUNNING,
+                                                       "RequestReboot interface is only available during the Running phase");
+
+                return TRUE;
+        }
+
+        request_reboot (manager);
+
+        csm_exported_manager_complete_request_reboot (skeleton,
+                                                      invocation);
+
+        return TRUE;
+}
+
+static gboolean
+csm_manager_restart_cinnamon_launcher (CsmExportedManager     *skeleton,
+                                       GDBusMethodInvocation  *invocation,
+                                       CsmManager             *manager)
+{
+        g_debug ("CsmManager: RestartCinnamonLauncher called");
+
+        if (manager->priv->phase != CSM_MANAGER_PHASE_RUNNING) {
+                g_dbus_method_invocation_return_error (invocation,
+                                                       CSM_MANAGER_ERROR,
+                                                       CSM_MANAGER_ERROR_NOT_IN_RUNNING,
+                                                       "RestartCinnamonLauncher interface is only available during the Running phase");
+
+                return TRUE;
+        }
+
+        g_idle_add ((GSourceFunc)restart_cinnamon_launcher, manager);
+
+        csm_exported_manager_complete_restart_cinnamon_launcher (skeleton,
+                                                                 invocation);
+
+        return TRUE;
+}
+
+static void
+_disconnect_client (CsmManager *manager,
+                    CsmClient  *client)
+{
+        gboolean              is_condition_client;
+        CsmApp               *app;
+        const char           *app_id;
+        const char           *startup_id;
+        gboolean              app_restart;
+        CsmClientRestartStyle client_restart_hint;
+
+        g_debug ("CsmManager: disconnect client: %s", csm_client_peek_id (client));
+
+        /* take a ref so it doesn't get finalized */
+        g_object_ref (client);
+
+        csm_client_set_status (client, CSM_CLIENT_FINISHED);
+
+        is_condition_client = FALSE;
+        if (g_slist_find (manager->priv->condition_clients, client)) {
+                manager->priv->condition_clients = g_slist_remove (manager->priv->condition_clients, client);
+
+                is_condition_client = TRUE;
+        }
+
+        /* remove any inhibitors for this client */
+        csm_store_foreach_remove_index (manager->priv->inhibitors,
+                                        INDEX_CLIENT_ID,
+                                        csm_client_peek_id (client),
+                                        (CsmStoreFunc)inhibitor_has_client_id,
+                                        (gpointer)csm_client_peek_id (client));
+
+        app = NULL;
+
+        /* first try to match on startup ID */
+        startup_id = csm_client_peek_startup_id (client);
+        if (! IS_STRING_EMPTY (startup_id)) {
+                app = find_app_for_startup_id (manager, startup_id);
+
+        }
+
+        /* then try to find matching app-id */
+        if (app == NULL) {
+                app_id = csm_client_peek_app_id (client);
+                if (! IS_STRING_EMPTY (app_id)) {
+                        g_debug ("CsmManager: disconnect for app '%s'", app_id);
+                        app = find_app_for_app_id (manager, app_id);
+                }
+        }
+
+        switch (manager->priv->phase) {
+            case CSM_MANAGER_PHASE_QUERY_END_SESSION:
+                /* Instead of answering our end session query, the client just exited.
+                 * Treat that as an "okay, end the session" answer.
+                 *
+                 * This call implicitly removes any inhibitors for the client, along
+                 * with removing the client from the pending query list.
+                 */
+                _handle_client_end_session_response (manager,
+                                                     client,
+                                                     TRUE,
+                                                     FALSE,
+                                                     FALSE,
+                                                     "Client exited in "
+                                                     "query end session phase "
+                                                     "instead of end session "
+                                                     "phase");
+                break;
+            case CSM_MANAGER_PHASE_END_SESSION:
+                if (! g_slist_find (manager->priv->query_clients, client)) {
+                        /* the client sent its EndSessionResponse and we already
+                         * processed it.
+                         */
+                        break;
+                }
+
+                /* Client exited without sending EndSessionResponse.
+                 * The likely reason is that its exit code is written in a way
+                 * that never returns, and sending EndSessionResponse is handled
+                 * in library code after the callback. Or maybe the application
+                 * crashed while handling EndSession. Or it was lazy.
+                 */
+                _handle_client_end_session_response (manager,
+                                                     client,
+                                                     TRUE,
+                                                     FALSE,
+                                                     FALSE,
+                                                     "Client exited in "
+                                                     "end session phase without "
+                                                     "sending EndSessionResponse");
+        default:
+                /* do nothing */
+                break;
+        }
+
+        if (manager->priv->dbus_disconnected && CSM_IS_DBUS_CLIENT (client)) {
+                g_debug ("CsmManager: dbus disconnected, not restarting application");
+                goto out;
+        }
+
+        if (app == NULL) {
+                g_debug ("CsmManager: unable to find application for client - not restarting");
+                goto out;
+        }
+
+        if (manager->priv->phase >= CSM_MANAGER_PHASE_QUERY_END_SESSION) {
+                g_debug ("CsmManager: in shutdown, not restarting application");
+                goto out;
+        }
+
+        app_restart = csm_app_peek_autorestart (app);
+        client_restart_hint = csm_client_peek_restart_style_hint (client);
+
+        /* allow legacy clients to override the app info */
+        if (! app_restart
+            && client_restart_hint != CSM_CLIENT_RESTART_IMMEDIATELY) {
+                g_debug ("CsmManager: autorestart not set, not restarting application");
+                goto out;
+        }
+
+        if (is_condition_client) {
+                g_debug ("CsmManager: app conditionally disabled, not restarting application");
+                goto out;
+        }
+
+        g_debug ("CsmManager: restarting app");
+
+        _restart_app (manager, app);
+
+ out:
+        g_object_unref (client);
+}
+
+typedef struct {
+        const char *service_name;
+        CsmManager *manager;
+} RemoveClientData;
+
+static gboolean
+_disconnect_dbus_client (const char       *id,
+                         CsmClient        *client,
+                         RemoveClientData *data)
+{
+        const char *name;
+
+        if (! CSM_IS_DBUS_CLIENT (client)) {
+                return FALSE;
+        }
+
+        /* If no service name, then we simply disconnect all clients */
+        if (!data->service_name) {
+                _disconnect_client (data->manager, client);
+                return TRUE;
+        }
+
+        name = csm_dbus_client_get_bus_name (CSM_DBUS_CLIENT (client));
+        if (IS_STRING_EMPTY (name)) {
+                return FALSE;
+        }
+
+        if (strcmp (data->service_name, name) == 0) {
+                _disconnect_client (data->manager, client);
+                return TRUE;
+        }
+
+        return FALSE;
+}
+
+/**
+ * remove_clients_for_connection:
+ * @manager: a #CsmManager
+ * @service_name: a service name
+ *
+ * Disconnects clients that own @service_name.
+ *
+ * If @service_name is NULL, then disconnects all clients for the connection.
+ */
+static void
+remove_clients_for_connection (CsmManager *manager,
+                               const char *service_name)
+{
+        RemoveClientData data;
+
+        data.service_name = service_name;
+        data.manager = manager;
+
+        /* disconnect dbus clients for name */
+        if (service_name != NULL) {
+                csm_store_foreach_remove_index (manager->priv->clients,
+                                                INDEX_BUS_NAME,
+                                                service_name,
+                                                (CsmStoreFunc)_disconnect_dbus_client,
+                                                &data);
+        } else {
+                csm_store_foreach_remove (manager->priv->clients,
+                                          (CsmStoreFunc)_disconnect_dbus_client,
+                                          &data);
+        }
+
+        if (manager->priv->phase >= CSM_MANAGER_PHASE_QUERY_END_SESSION
+            && csm_store_size (manager->priv->clients) == 0) {
+                g_debug ("CsmManager: last client disconnected - exiting");
+                end_phase (manager);
+        }
+}
+
+static gboolean
+inhibitor_has_bus_name (gpointer          key,
+                        CsmInhibitor     *inhibitor,
+                        RemoveClientData *data)
+{
+        gboolean    matches;
+        const char *bus_name_b;
+
+        bus_name_b = csm_inhibitor_peek_bus_name (inhibitor);
+
+        matches = FALSE;
+        if (! IS_STRING_EMPTY (data->service_name) && ! IS_STRING_EMPTY (bus_name_b)) {
+                matches = (strcmp (data->service_name, bus_name_b) == 0);
+                if (matches) {
+                        g_debug ("CsmManager: removing inhibitor from %s for reason '%s' on connection %s",
+                                 csm_inhibitor_peek_app_id (inhibitor),
+                                 csm_inhibitor_peek_reason (inhibitor),
+                                 csm_inhibitor_peek_bus_name (inhibitor));
+                }
+        }
+
+        return matches;
+}
+
+static void
+remove_inhibitors_for_connection (CsmManager *manager,
+                                  const char *service_name)
+{
+        RemoveClientData data;
+
+        data.service_name = service_name;
+        data.manager = manager;
+
+        debug_inhibitors (manager);
+
+        csm_store_foreach_remove_index (manager->priv->inhibitors,
+                                        INDEX_BUS_NAME,
+                                        service_name,
+                                        (CsmStoreFunc)inhibitor_has_bus_name,
+                                        &data);
+}
+
+static void
+on_dbus_proxy_signal (GDBusProxy *proxy,
+                      gchar      *sender_name,
+                      gchar      *signal_name,
+                      GVariant   *parameters,
+                      gpointer    user_data)
+{
+    CsmManager *manager;
+    gchar *name, *old_owner, *new_owner;
+
+    manager = CSM_MANAGER (user_data);
+
+    if (g_strcmp0 (signal_name, "NameOwnerChanged") != 0) {
+            return;
+    }
+
+    g_variant_get (parameters, "(sss)",
+                   &name,
+                   &old_owner,
+                   &new_owner);
+
+    if (strlen (new_owner) == 0 && strlen (old_owner) > 0) {
+        /* service removed */
+        remove_inhibitors_for_connection (manager, old_owner);
+        remove_clients_for_connection (manager, old_owner);
+
+        if (g_strcmp0 (name, "org.Cinnamon") == 0) {
+            g_debug ("org.Cinnamon has lost its owner (Cinnamon is not running)");
+        }
+    } else if (strlen (old_owner) == 0 && strlen (new_owner) > 0) {
+        /* service added */
+        if (g_strcmp0 (name, "org.Cinnamon") == 0) {
+            g_debug ("org.Cinnamon has an owner (Cinnamon is running)");
+        }
+
+        /* use this if we support automatically registering
+         * well known bus names */
+    }
+
+    g_free (name);
+    g_free (old_owner);
+    g_free (new_owner);
+}
+
+static void
+on_bus_connection_closed (GDBusConnection *connection,
+                          gboolean         remote_peer_vanished,
+                          GError          *error,
+                          gpointer         user_data)
+{
+        CsmManager *manager;
+
+        manager = CSM_MANAGER (user_data);
+
+        g_debug ("CsmManager: dbus disconnected; disconnecting dbus clients...");
+
+        manager->priv->dbus_disconnected = TRUE;
+        remove_clients_for_connection (manager, NULL);
+}
+
+static gboolean csm_manager_is_switch_user_inhibited (CsmManager *manager);
+static gboolean csm_manager_is_suspend_inhibited (CsmManager *manager);
+
+static gboolean
+handle_dialog_method_call (CsmExportedDialog     *dialog_skeleton,
+                           GDBusMethodInvocation *invocation,
+                           gpointer               user_data)
+{
+    CsmManager *manager = CSM_MANAGER (user_data);
+    const gchar *method_name = g_dbus_method_invocation_get_method_name (invocation);
+
+    g_debug("Dialog method received: %s", method_name);
+
+    if (g_strcmp0 (method_name, "Suspend") == 0) {
+        request_suspend (manager);
+        csm_exported_dialog_complete_suspend (dialog_skeleton, invocation);
+    }
+    else
+    if (g_strcmp0 (method_name, "Hibernate") == 0) {
+        request_hibernate (manager);
+        csm_exported_dialog_complete_hibernate (dialog_skeleton, invocation);
+    }
+    else
+    if (g_strcmp0 (method_name, "Restart") == 0) {
+        request_reboot (manager);
+        csm_exported_dialog_complete_restart (dialog_skeleton, invocation);
+    }
+    else
+    if (g_strcmp0 (method_name, "Shutdown") == 0) {
+        request_shutdown (manager);
+        csm_exported_dialog_complete_shutdown (dialog_skeleton, invocation);
+    }
+    else
+    if (g_strcmp0 (method_name, "SwitchUser") == 0) {
+        request_switch_user (manager);
+        csm_exported_dialog_complete_switch_user (dialog_skeleton, invocation);
+    }
+    else
+    if (g_strcmp0 (method_name, "Logout") == 0) {
+        request_logout (manager, CSM_MANAGER_LOGOUT_MODE_NO_CONFIRMATION);
+        csm_exported_dialog_complete_logout (dialog_skeleton, invocation);
+    }
+    else
+    if (g_strcmp0 (method_name, "Cancel") == 0) {
+        if (manager->priv->dialog_action != CSM_LOGOUT_ACTION_UNDEFINED) {
+            g_debug ("session-manager dialog was cancelled during inhibit phase");
+            cancel_end_session (manager);
+        }
+        else
+        {
+            g_debug ("session-manager dialog was cancelled");
+        }
+
+        close_end_session_dialog (manager);
+        csm_exported_dialog_complete_logout (dialog_skeleton, invocation);
+    }
+    else
+    if (g_strcmp0 (method_name, "IgnoreInhibitors") == 0) {
+        close_end_session_dialog (manager);
+        do_inhibit_dialog_action (manager);
+        csm_exported_dialog_complete_ignore_inhibitors (dialog_skeleton, invocation);
+    }
+    else
+    if (g_strcmp0 (method_name, "GetCapabilities") == 0) {
+        GVariant *ret;
+        gboolean can_hybrid_sleep = g_settings_get_boolean (manager->priv->settings, KEY_PREFER_HYBRID_SLEEP) &&
+                              csm_system_can_hybrid_sleep (manager->priv->system);
+
+        ret = g_variant_new ("(bbbbbbb)",
+                             !(_switch_user_is_locked_down (manager) || csm_manager_is_switch_user_inhibited (manager)),
+                             (!_log_out_is_locked_down (manager)) && csm_system_can_stop (manager->priv->system),
+                             (!_log_out_is_locked_down (manager)) && csm_system_can_restart (manager->priv->system),
+                             can_hybrid_sleep,
+                             csm_system_can_suspend (manager->priv->system),
+                             csm_system_can_hibernate (manager->priv->system),
+                             (!csm_manager_is_logout_inhibited (manager)));
+
+        csm_exported_dialog_complete_get_capabilities (dialog_skeleton, invocation, ret);
+    }
+    else {
+        g_warning ("Unknown method name %s", method_name);
+        g_dbus_method_invocation_return_error (invocation,
+                                               CSM_MANAGER_ERROR,
+                                               CSM_MANAGER_ERROR_INVALID_METHOD,
+                                               "Unknown method name %s",
+                                               method_name);
+    }
+
+    return TRUE;
+}
 
 typedef struct
 {
-    const gchar  *signal_name;
-    gpointer      callback;
-} SkeletonSignal;
+    const gchar  *signal_name;
+    gpointer      callback;
+} SkeletonSignal;
+
+static SkeletonSignal skeleton_signals[] = {
+    // signal name                              callback
+    { "handle-setenv",                          csm_manager_setenv },
+    { "handle-initialization-error",            csm_manager_initialization_error },
+    { "handle-register-client",                 csm_manager_register_client },
+    { "handle-unregister-client",               csm_manager_unregister_client },
+    { "handle-inhibit",                         csm_manager_inhibit },
+    { "handle-uninhibit",                       csm_manager_uninhibit },
+    { "handle-is-inhibited",                    csm_manager_is_inhibited },
+    { "handle-get-clients",                     csm_manager_get_clients },
+    { "handle-get-inhibitors",                  csm_manager_get_inhibitors },
+    { "handle-is-autostart-condition-handled",  csm_manager_is_autostart_condition_handled },
+    { "handle-shutdown",                        csm_manager_shutdown },
+    { "handle-reboot",                          csm_manager_reboot },
+    { "handle-can-shutdown",                    csm_manager_can_shutdown },
+    { "handle-logout",                          csm_manager_logout_dbus },
+    { "handle-is-session-running",              csm_manager_is_session_running },
+    { "handle-get-startup-timeline",            csm_manager_get_startup_timeline },
+    { "handle-request-shutdown",                csm_manager_request_shutdown },
+    { "handle-request-reboot",                  csm_manager_request_reboot },
+    { "handle-restart-cinnamon-launcher",       csm_manager_restart_cinnamon_launcher }
+};
+
+static SkeletonSignal dialog_skeleton_signals[] = {
+    // signal name                              callback
+    { "handle-suspend",                         handle_dialog_method_call },
+    { "handle-hibernate",                       handle_dialog_method_call },
+    { "handle-restart",                         handle_dialog_method_call },
+    { "handle-shutdown",                        handle_dialog_method_call },
+    { "handle-switch-user",                     handle_dialog_method_call },
+    { "handle-logout",                          handle_dialog_method_call },
+    { "handle-cancel",                          handle_dialog_method_call },
+    { "handle-ignore-inhibitors",               handle_dialog_method_call },
+    { "handle-get-capabilities",                handle_dialog_method_call },
+};
+
+static gboolean
+register_manager (CsmManager *manager)
+{
+        GDBusInterfaceSkeleton *skeleton;
+        GError *error = NULL;
+        gint i;
+
+        error = NULL;
+        manager->priv->connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error);
+        if (manager->priv->connection == NULL) {
+                if (error != NULL) {
+                        g_critical ("error getting session bus: %s", error->message);
+                        g_error_free (error);
+                }
+                exit (1);
+        }
+
+        g_signal_connect (manager->priv->connection,
+                          "closed",
+                          G_CALLBACK (on_bus_connection_closed),
+                           manager);
+
+        manager->priv->dbus_disconnected = FALSE;
+
+        manager->priv->bus_proxy = g_dbus_proxy_new_sync (manager->priv->connection,
+                                                          G_DBUS_PROXY_FLAGS_NONE,
+                                                          NULL,
+                                                          "org.freedesktop.DBus",
+                                                          "/org/freedesktop/DBus",
+                                                          "org.freedesktop.DBus",
+                                                          NULL,
+                                                          &error);
+
+        g_signal_connect (manager->priv->bus_proxy,
+                          "g-signal",
+                          G_CALLBACK (on_dbus_proxy_signal),
+                          manager);
+
+        manager->priv->cinnamon_proxy = g_dbus_proxy_new_sync (manager->priv->connection,
+                                                               G_DBUS_PROXY_FLAGS_NONE,
+                                                               NULL,
+                                                               "org.Cinnamon",
+                                                               "/org/Cinnamon",
+                                                               "org.Cinnamon",
+                                                               NULL,
+                                                               &error);
+
+        skeleton = G_DBUS_INTERFACE_SKELETON (csm_exported_manager_skeleton_new ());
+        manager->priv->skeleton = CSM_EXPORTED_MANAGER (skeleton);
+
+        g_dbus_interface_skeleton_export (skeleton,
+                                          manager->priv->connection,
+                                          CSM_MANAGER_DBUS_PATH,
+                                          &error);
+
+        if (error != NULL) {
+                g_critical ("error exporting manager skeleton: %s", error->message);
+                g_error_free (error);
+
+                exit(1);
+        }
+
+        for (i = 0; i < G_N_ELEMENTS (skeleton_signals); i++) {
+                SkeletonSignal sig = skeleton_signals[i];
+
+                g_signal_connect (skeleton,
+                                  sig.signal_name,
+                                  G_CALLBACK (sig.callback),
+                                  manager);
+        }
+
+        skeleton = G_DBUS_INTERFACE_SKELETON (csm_exported_dialog_skeleton_new ());
+        manager->priv->dialog_skeleton = CSM_EXPORTED_DIALOG (skeleton);
+
+        g_dbus_interface_skeleton_export (skeleton,
+                                          manager->priv->connection,
+                                          CSM_MANAGER_DBUS_PATH,
+                                          &error);
+
+        for (i = 0; i < G_N_ELEMENTS (dialog_skeleton_signals); i++) {
+                SkeletonSignal sig = dialog_skeleton_signals[i];
+
+                g_signal_connect (skeleton,
+                                  sig.signal_name,
+                                  G_CALLBACK (sig.callback),
+                                  manager);
+        }
+
+        return TRUE;
+}
+
+
+static void
+csm_manager_set_failsafe (CsmManager *manager,
+                          gboolean    enabled)
+{
+        g_return_if_fail (CSM_IS_MANAGER (manager));
+
+        manager->priv->failsafe = enabled;
+}
+
+gboolean
+csm_manager_get_failsafe (CsmManager *manager)
+{
+        g_return_val_if_fail (CSM_IS_MANAGER (manager), FALSE);
+
+	return manager->priv->failsafe;
+}
+
+const char *
+csm_manager_peek_session_name (CsmManager *manager)
+{
+        g_return_val_if_fail (CSM_IS_MANAGER (manager), NULL);
+
+        return manager->priv->session_name;
+}
+
+static void
+on_client_disconnected (CsmClient  *client,
+                        CsmManager *manager)
+{
+        g_debug ("CsmManager: disconnect client");
+        _disconnect_client (manager, client);
+        csm_store_remove (manager->priv->clients, csm_client_peek_id (client));
+        if (manager->priv->phase >= CSM_MANAGER_PHASE_QUERY_END_SESSION
+            && csm_store_size (manager->priv->clients) == 0) {
+                g_debug ("CsmManager: last client disconnected - exiting");
+                end_phase (manager);
+        }
+}
+
+static gboolean
+on_xsmp_client_register_request (CsmXSMPClient *client,
+                                 char         **id,
+                                 CsmManager    *manager)
+{
+        gboolean handled;
+        char    *new_id;
+        CsmApp  *app;
+
+        handled = TRUE;
+        new_id = NULL;
+
+        if (manager->priv->phase >= CSM_MANAGER_PHASE_QUERY_END_SESSION) {
+                goto out;
+        }
+
+        if (IS_STRING_EMPTY (*id)) {
+                new_id = csm_util_generate_startup_id ();
+        } else {
+                CsmClient *client;
+
+                client = find_client_for_startup_id (manager, *id);
+                /* We can't have two clients with the same id. */
+                if (client != NULL) {
+                        goto out;
+                }
+
+                new_id = g_strdup (*id);
+        }
+
+        g_debug ("CsmManager: Adding new client %s to session", new_id);
+
+        g_signal_connect (client,
+                          "disconnected",
+                          G_CALLBACK (on_client_disconnected),
+                          manager);
+
+        /* If it's a brand new client id, we just accept the client*/
+        if (IS_STRING_EMPTY (*id)) {
+                goto out;
+        }
+
+        app = find_app_for_startup_id (manager, new_id);
+        if (app != NULL) {
+                csm_client_set_app_id (CSM_CLIENT (client), csm_app_peek_app_id (app));
+                csm_app_registered (app);
+                goto out;
+        }
+
+        /* app not found */
+        g_free (new_id);
+        new_id = NULL;
+
+ out:
+        g_free (*id);
+        *id = new_id;
+
+        return handled;
+}
+
+static void
+_finished_playing_logout_sound (ca_context *c, uint32_t id, int error, void *userdata) 
+{
+    g_warning ("Finished playing logout sound");
+    CsmManager *manager = (CsmManager *) userdata;
+    manager->priv->logout_sound_is_playing = FALSE;    
+    g_warning ("Resuming logout sequence...");
+}
+
+static void
+maybe_play_logout_sound (CsmManager *manager)
+{
+    GSettings *settings = g_settings_new ("org.cinnamon.sounds");
+        gboolean enabled = g_settings_get_boolean(settings, "logout-enabled");
+        gchar *sound = g_settings_get_string (settings, "logout-file");
+        if (enabled) {
+            if (sound) {
+                if (g_file_test (sound, G_FILE_TEST_EXISTS)) {
+                    g_warning ("Playing logout sound '%s'", sound);
+                    manager->priv->logout_sound_is_playing = TRUE;
+                    ca_context_create (&manager->priv->ca);
+                    ca_context_set_driver (manager->priv->ca, "pulse");
+                    ca_context_change_props (manager->priv->ca, 0, CA_PROP_APPLICATION_ID, "org.gnome.VolumeControl", NULL);
+                    ca_proplist *proplist = NULL;
+                    ca_proplist_create(&proplist);
+                    ca_proplist_sets(proplist, CA_PROP_MEDIA_FILENAME, sound);
+                    int result = ca_context_play_full(manager->priv->ca, 0, proplist, _finished_playing_logout_sound, manager); 
+                    if (result != CA_SUCCESS) {
+                        g_warning ("Logout sound failed to play, skipping.");
+                        manager->priv->logout_sound_is_playing = FALSE;
+                    }
+                }
+            }
+        }
+        g_free(sound);
+        g_object_unref (settings);    
+
+        while (manager->priv->logout_sound_is_playing) {
+            sleep(1);
+        }
+}
+
+static void
+maybe_save_session (CsmManager *manager)
+{
+        GError *error;
+
+        if (csm_system_is_login_session (manager->priv->system))
+                return;
+
+        /* We only allow session saving when session is running or when
+         * logging out */
+        if (manager->priv->phase != CSM_MANAGER_PHASE_RUNNING &&
+            manager->priv->phase != CSM_MANAGER_PHASE_END_SESSION) {
+                return;
+        }
+
+        if (!csm_manager_get_autosave_enabled (manager)) {
+                csm_session_save_clear ();
+                return;
+        }
+
+        error = NULL;
+        csm_session_save (manager->priv->clients, &error);
+
+        if (error) {
+                g_warning ("Error saving session: %s", error->message);
+                g_error_free (error);
+        }
+}
+
+static void
+_handle_client_end_session_response (CsmManager *manager,
+                                     CsmClient  *client,
+                                     gboolean    is_ok,
+                                     gboolean    do_last,
+                                     gboolean    cancel,
+                                     const char *reason)
+{
+        /* just ignore if received outside of shutdown */
+        if (manager->priv->phase < CSM_MANAGER_PHASE_QUERY_END_SESSION) {
+                return;
+        }
 
-static SkeletonSignal skeleton_signals[] = {
-    // signal name                              callback
-    { "handle-setenv",                          csm_manager_setenv },
-    { "handle-initialization-error",            csm_manager_initialization_error },
-    { "handle-register-client",                 csm_manager_register_client },
-    { "handle-unregister-client",               csm_manager_unregister_client },
-    { "handle-inhibit",                         csm_manager_inhibit },
-    { "handle-uninhibit",                       csm_manager_uninhibit },
-    { "handle-is-inhibited",                    csm_manager_is_inhibited },
-    { "handle-get-clients",                     csm_manager_get_clients },
-    { "handle-get-inhibitors",                  csm_manager_get_inhibitors },
-    { "handle-is-autostart-condition-handled",  csm_manager_is_autostart_condition_handled },
-    { "handle-shutdown",                        csm_manager_shutdown },
-    { "handle-reboot",                          csm_manager_reboot },
-    { "handle-can-shutdown",                    csm_manager_can_shutdown },
-    { "handle-logout",                          csm_manager_logout_dbus },
-    { "handle-is-session-running",              csm_manager_is_session_running },
-    { "handle-request-shutdown",                csm_manager_request_shutdown },
-    { "handle-request-reboot",                  csm_manager_request_reboot },
-    { "handle-restart-cinnamon-launcher",       csm_manager_restart_cinnamon_launcher }
-};
+        g_debug ("CsmManager: Response from end session request: is-ok=%d do-last=%d cancel=%d reason=%s", is_ok, do_last, cancel, reason ? reason :"");
 
-static SkeletonSignal dialog_skeleton_signals[] = {
-    // signal name                              callback
-    { "handle-suspend",                         handle_dialog_method_call },
-    { "handle-hibernate",                       handle_dialog_method_call },
-    { "handle-restart",                         handle_dialog_method_call },
-    { "handle-shutdown",                        handle_dialog_method_call },
-    { "handle-switch-user",                     handle_dialog_method_call },
-    { "handle-logout",                          handle_dialog_method_call },
-    { "handle-cancel",                          handle_dialog_method_call },
-    { "handle-ignore-inhibitors",               handle_dialog_method_call },
-    { "handle-get-capabilities",                handle_dialog_method_call },
-};
+        if (cancel) {
+                cancel_end_session (manager);
+                return;
+        }
 
-static gboolean
-register_manager (CsmManager *manager)
+        manager->priv->query_clients = g_slist_remove (manager->priv->query_clients, client);
+
+        if (! is_ok && manager->priv->logout_mode != CSM_MANAGER_LOGOUT_MODE_FORCE) {
+                guint         cookie;
+                CsmInhibitor *inhibitor;
+                char         *app_id;
+                const char   *bus_name;
+
+                /* FIXME: do we support updating the reason? */
+
+                /* Create JIT inhibit */
+                if (CSM_IS_DBUS_CLIENT (client)) {
+                        bus_name = csm_dbus_client_get_bus_name (CSM_DBUS_CLIENT (client));
+                } else {
+                        bus_name = NULL;
+                }
+
+                app_id = g_strdup (csm_client_peek_app_id (client));
+                if (IS_STRING_EMPTY (app_id)) {
+                        /* XSMP clients don't give us an app id unless we start them */
+                        g_free (app_id);
+                        app_id = csm_client_get_app_name (client);
+                }
+
+                cookie = _generate_unique_cookie (manager);
+                inhibitor = csm_inhibitor_new_for_client (csm_client_peek_id (client),
+                                                          app_id,
+                                                          CSM_INHIBITOR_FLAG_LOGOUT,
+                                                          reason != NULL ? reason : _("Not responding"),
+                                                          bus_name,
+                                                          cookie);
+                g_free (app_id);
+                csm_store_add (manager->priv->inhibitors, csm_inhibitor_peek_id (inhibitor), G_OBJECT (inhibitor));
+                g_object_unref (inhibitor);
+        } else {
+                csm_store_foreach_remove_index (manager->priv->inhibitors,
+                                                INDEX_CLIENT_ID,
+                                                csm_client_peek_id (client),
+                                                (CsmStoreFunc)inhibitor_has_client_id,
+                                                (gpointer)csm_client_peek_id (client));
+        }
+
+        if (manager->priv->phase == CSM_MANAGER_PHASE_QUERY_END_SESSION) { 
+                if (manager->priv->query_clients == NULL) {
+                        query_end_session_complete (manager);
+                }
+        } else if (manager->priv->phase == CSM_MANAGER_PHASE_END_SESSION) {
+                if (do_last) {
+                        /* This only makes sense if we're in part 1 of
+                         * CSM_MANAGER_PHASE_END_SESSION. Doing this in part 2
+                         * can only happen because of a buggy client that loops
+                         * wanting to be last again and again. The phase
+                         * timeout will take care of this issue. */
+                        manager->priv->next_query_clients = g_slist_prepend (manager->priv->next_query_clients,
+                                                                             client);
+                }
+
+                /* we can continue to the next step if all clients have replied
+                 * and if there's no inhibitor */
+                if (manager->priv->query_clients != NULL
+                    || csm_manager_is_logout_inhibited (manager)) {
+                        return;
+                }
+
+                if (manager->priv->next_query_clients != NULL) {
+                        do_phase_end_session_part_2 (manager);
+                } else {
+                        end_phase (manager);
+                }
+        }
+}
+
+static void
+on_client_end_session_response (CsmClient  *client,
+                                gboolean    is_ok,
+                                gboolean    do_last,
+                                gboolean    cancel,
+                                const char *reason,
+                                CsmManager *manager)
 {
-        GDBusInterfaceSkeleton *skeleton;
-        GError *error = NULL;
-        gint i;
+        _handle_client_end_session_response (manager,
+                                             client,
+                                             is_ok,
+                                             do_last,
+                                             cancel,
+                                             reason);
+}
+
+gboolean
+csm_manager_logout (CsmManager *manager,
+                    guint       logout_mode,
+                    GError    **error)
+{
+        g_debug ("CsmManager: Logout called");
+
+        g_return_val_if_fail (CSM_IS_MANAGER (manager), FALSE);
+
+        if (manager->priv->phase != CSM_MANAGER_PHASE_RUNNING) {
+                g_set_error (error,
+                             CSM_MANAGER_ERROR,
+                             CSM_MANAGER_ERROR_NOT_IN_RUNNING,
+                             "Logout interface is only available during the Running phase");
+                return FALSE;
+        }
+
+        if (_log_out_is_locked_down (manager)) {
+                g_set_error (error,
+                             CSM_MANAGER_ERROR,
+                             CSM_MANAGER_ERROR_LOCKED_DOWN,
+                             "Logout has been locked down");
+                return FALSE;
+        }
+
+        switch (logout_mode) {
+        case CSM_MANAGER_LOGOUT_MODE_NORMAL:
+        case CSM_MANAGER_LOGOUT_MODE_NO_CONFIRMATION:
+        case CSM_MANAGER_LOGOUT_MODE_FORCE:
+                user_logout (manager, logout_mode);
+                break;
+
+        default:
+                g_debug ("Unknown logout mode option");
+
+                g_set_error (error,
+                             CSM_MANAGER_ERROR,
+                             CSM_MANAGER_ERROR_INVALID_OPTION,
+                             "Unknown logout mode flag");
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+
+static void
+on_xsmp_client_logout_request (CsmXSMPClient *client,
+                               gboolean       show_dialog,
+                               CsmManager    *manager)
+{
+        GError *error;
+        int     logout_mode;
+
+        if (show_dialog) {
+                logout_mode = CSM_MANAGER_LOGOUT_MODE_NORMAL;
+        } else {
+                logout_mode = CSM_MANAGER_LOGOUT_MODE_NO_CONFIRMATION;
+        }
 
         error = NULL;
-        manager->priv->connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error);
-        if (manager->priv->connection == NULL) {
-                if (error != NULL) {
-                        g_critical ("error getting session bus: %s", error->message);
-                        g_error_free (error);
-                }
-                exit (1);
+
+        csm_manager_logout (manager, logout_mode, &error);
+        if (error != NULL) {
+                g_warning ("Unable to logout: %s", error->message);
+                g_error_free (error);
         }
+}
 
-        g_signal_connect (manager->priv->connection,
-                          "closed",
-                          G_CALLBACK (on_bus_connection_closed),
-                           manager);
+static void
+on_store_client_added (CsmStore   *store,
+                       const char *id,
+                       CsmManager *manager)
+{
+        CsmClient *client;
 
-        manager->priv->dbus_disconnected = FALSE;
+        g_debug ("CsmManager: Client added: %s", id);
 
-        manager->priv->bus_proxy = g_dbus_proxy_new_sync (manager->priv->connection,
-                                                          G_DBUS_PROXY_FLAGS_NONE,
-                                                          NULL,
-                                                          "org.freedesktop.DBus",
-                                                          "/org/freedesktop/DBus",
-                                                          "org.freedesktop.DBus",
-                                                          NULL,
-                                                          &error);
+        client = (CsmClient *)csm_store_lookup (store, id);
 
-        g_signal_connect (manager->priv->bus_proxy,
-                          "g-signal",
-                          G_CALLBACK (on_dbus_proxy_signal),
+        /* a bit hacky */
+        if (CSM_IS_XSMP_CLIENT (client)) {
+                g_signal_connect (client,
+                                  "register-request",
+                                  G_CALLBACK (on_xsmp_client_register_request),
+                                  manager);
+                g_signal_connect (client,
+                                  "logout-request",
+                                  G_CALLBACK (on_xsmp_client_logout_request),
+                                  manager);
+        }
+
+        g_signal_connect (client,
+                          "end-session-response",
+                          G_CALLBACK (on_client_end_session_response),
                           manager);
 
-        manager->priv->cinnamon_proxy = g_dbus_proxy_new_sync (manager->priv->connection,
-                                                               G_DBUS_PROXY_FLAGS_NONE,
-                                                               NULL,
-                                                               "org.Cinnamon",
-                                                               "/org/Cinnamon",
-                                                               "org.Cinnamon",
-                                                               NULL,
-                                                               &error);
+        g_signal_connect (client,
+                          "disconnected",
+                          G_CALLBACK (on_client_disconnected),
+                          manager);
+
+        csm_exported_manager_emit_client_added (manager->priv->skeleton, id);
+}
 
-        skeleton = G_DBUS_INTERFACE_SKELETON (csm_exported_manager_skeleton_new ());
-        manager->priv->skeleton = CSM_EXPORTED_MANAGER (skeleton);
+static void
+on_store_client_removed (CsmStore   *store,
+                         const char *id,
+                         CsmManager *manager)
+{
+        g_debug ("CsmManager: Client removed: %s", id);
 
-        g_dbus_interface_skeleton_export (skeleton,
-                                          manager->priv->connection,
-                                          CSM_MANAGER_DBUS_PATH,
-                                          &error);
+        csm_exported_manager_emit_client_removed (manager->priv->skeleton, id);
+}
 
-        if (error != NULL) {
-                g_critical ("error exporting manager skeleton: %s", error->message);
-                g_error_free (error);
+static void
+csm_manager_set_client_store (CsmManager *manager,
+                              CsmStore   *store)
+{
+        g_return_if_fail (CSM_IS_MANAGER (manager));
 
-                exit(1);
+        if (store != NULL) {
+                g_object_ref (store);
         }
 
-        for (i = 0; i < G_N_ELEMENTS (skeleton_signals); i++) {
-                SkeletonSignal sig = skeleton_signals[i];
+        if (manager->priv->clients != NULL) {
+                g_signal_handlers_disconnect_by_func (manager->priv->clients,
+                                                      on_store_client_added,
+                                                      manager);
+                g_signal_handlers_disconnect_by_func (manager->priv->clients,
+                                                      on_store_client_removed,
+                                                      manager);
 
-                g_signal_connect (skeleton,
-                                  sig.signal_name,
-                                  G_CALLBACK (sig.callback),
-                                  manager);
+                g_object_unref (manager->priv->clients);
         }
 
-        skeleton = G_DBUS_INTERFACE_SKELETON (csm_exported_dialog_skeleton_new ());
-        manager->priv->dialog_skeleton = CSM_EXPORTED_DIALOG (skeleton);
 
-        g_dbus_interface_skeleton_export (skeleton,
-                                          manager->priv->connection,
-                                          CSM_MANAGER_DBUS_PATH,
-                                          &error);
+        g_debug ("CsmManager: setting client store %p", store);
 
-        for (i = 0; i < G_N_ELEMENTS (dialog_skeleton_signals); i++) {
-                SkeletonSignal sig = dialog_skeleton_signals[i];
+        manager->priv->clients = store;
 
-                g_signal_connect (skeleton,
-                                  sig.signal_name,
-                                  G_CALLBACK (sig.callback),
+        if (manager->priv->clients != NULL) {
+                csm_store_add_index (manager->priv->clients,
+                                     INDEX_STARTUP_ID,
+                                     (CsmStoreIndexFunc) client_startup_id_keys,
+                                     "startup-id");
+                csm_store_add_index (manager->priv->clients,
+                                     INDEX_BUS_NAME,
+                                     (CsmStoreIndexFunc) client_bus_name_keys,
+                                     "bus-name");
+
+            if (manager->priv->xsmp_server)
+                    g_object_unref (manager->priv->xsmp_server);
+
+                manager->priv->xsmp_server = csm_xsmp_server_new (store);
+
+                g_signal_connect (manager->priv->clients,
+                                  "added",
+                                  G_CALLBACK (on_store_client_added),
+                                  manager);
+                g_signal_connect (manager->priv->clients,
+                                  "removed",
+                                  G_CALLBACK (on_store_client_removed),
                                   manager);
         }
-
-        return TRUE;
 }
 
+static void
+csm_manager_set_property (GObject       *object,
+                          guint          prop_id,
+                          const GValue  *value,
+                          GParamSpec    *pspec)
+{
+        CsmManager *self;
+
+        self = CSM_MANAGER (object);
+
+        switch (prop_id) {
+        case PROP_FAILSAFE:
+                csm_manager_set_failsafe (self, g_value_get_boolean (value));
+                break;
+         case PROP_FALLBACK:
+                self->priv->is_fallback_session = g_value_get_boolean (value);
+                break;
+         case PROP_CLIENT_STORE:
+                csm_manager_set_client_store (self, g_value_get_object (value));
+                break;
+        default:
+                G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+                break;
+        }
+}
 
 static void
-csm_manager_set_failsafe (CsmManager *manager,
-                          gboolean    enabled)
+csm_manager_get_property (GObject    *object,
+                          guint       prop_id,
+                          GValue     *value,
+                          GParamSpec *pspec)
 {
-        g_return_if_fail (CSM_IS_MANAGER (manager));
+        CsmManager *self;
 
-        manager->priv->failsafe = enabled;
+        self = CSM_MANAGER (object);
+
+        switch (prop_id) {
+        case PROP_FAILSAFE:
+                g_value_set_boolean (value, self->priv->failsafe);
+                break;
+        case PROP_SESSION_NAME:
+                g_value_set_string (value, self->priv->session_name);
+                break;
+        case PROP_FALLBACK:
+                g_value_set_boolean (value, self->priv->is_fallback_session);
+                break;
+        case PROP_CLIENT_STORE:
+                g_value_set_object (value, self->priv->clients);
+                break;
+        default:
+                G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+                break;
+        }
 }
 
-gboolean
-csm_manager_get_failsafe (CsmManager *manager)
+static GObject *
+csm_manager_constructor (GType                  type,
+                         guint                  n_construct_properties,
+                         GObjectConstructParam *construct_properties)
 {
-        g_return_val_if_fail (CSM_IS_MANAGER (manager), FALSE);
+        CsmManager *manager;
 
-	return manager->priv->failsafe;
+        manager = CSM_MANAGER (G_OBJECT_CLASS (csm_manager_parent_class)->constructor (type,
+                                                                                       n_construct_properties,
+                                                                                       construct_properties));
+        return G_OBJECT (manager);
 }
 
 static void
-on_client_disconnected (CsmClient  *client,
-                        CsmManager *manager)
+update_inhibited_actions (CsmManager *manager)
 {
-        g_debug ("CsmManager: disconnect client");
-        _disconnect_client (manager, client);
-        csm_store_remove (manager->priv->clients, csm_client_peek_id (client));
-        if (manager->priv->phase >= CSM_MANAGER_PHASE_QUERY_END_SESSION
-            && csm_store_size (manager->priv->clients) == 0) {
-                g_debug ("CsmManager: last client disconnected - exiting");
-                end_phase (manager);
-        }
+        if (csm_exported_manager_get_inhibited_actions (manager->priv->skeleton) == manager->priv->inhibited_actions)
+                return;
+
+        g_debug ("CsmManager: new inhibit flag: %d", manager->priv->inhibited_actions);
+
+        csm_exported_manager_set_inhibited_actions (manager->priv->skeleton,
+                                                    manager->priv->inhibited_actions);
+
+        g_dbus_interface_skeleton_flush (G_DBUS_INTERFACE_SKELETON (manager->priv->skeleton));
+
+        emit_inhibitor_info_to_dialog (manager, manager->priv->dialog_action);
 }
 
+/* Passes on what changed since the last call to logind, the exported
+ * InhibitedActions and presence. Adding goes first, so that replacing the
+ * last suspend inhibitor doesn't release and re-take the logind lock. */
 static gboolean
-on_xsmp_client_register_request (CsmXSMPClient *client,
-                                 char         **id,
-                                 CsmManager    *manager)
+flush_inhibitor_changes (CsmManager *manager)
 {
-        gboolean handled;
-        char    *new_id;
-        CsmApp  *app;
+        GHashTableIter iter;
+        gpointer       id;
+        gpointer       flags;
+        guint          i;
 
-        handled = TRUE;
-        new_id = NULL;
+        manager->priv->inhibitor_flush_id = 0;
 
-        if (manager->priv->phase >= CSM_MANAGER_PHASE_QUERY_END_SESSION) {
-                goto out;
+        g_hash_table_iter_init (&iter, manager->priv->system_inhibitors_added);
+        while (g_hash_table_iter_next (&iter, &id, &flags)) {
+                csm_system_add_inhibitor (manager->priv->system, id,
+                                          GPOINTER_TO_UINT (flags));
         }
+        g_hash_table_remove_all (manager->priv->system_inhibitors_added);
 
-        if (IS_STRING_EMPTY (*id)) {
-                new_id = csm_util_generate_startup_id ();
-        } else {
-                CsmClient *client;
-
-                client = (CsmClient *)csm_store_find (manager->priv->clients,
-                                                      (CsmStoreFunc)_client_has_startup_id,
-                                                      *id);
-                /* We can't have two clients with the same id. */
-                if (client != NULL) {
-                        goto out;
-                }
-
-                new_id = g_strdup (*id);
+        for (i = 0; i < manager->priv->system_inhibitors_removed->len; i++) {
+                csm_system_remove_inhibitor (manager->priv->system,
+                                             g_ptr_array_index (manager->priv->system_inhibitors_removed, i));
         }
+        g_ptr_array_set_size (manager->priv->system_inhibitors_removed, 0);
 
-        g_debug ("CsmManager: Adding new client %s to session", new_id);
+        update_inhibited_actions (manager);
 
-        g_signal_connect (client,
-                          "disconnected",
-                          G_CALLBACK (on_client_disconnected),
-                          manager);
+        update_idle (manager);
 
-        /* If it's a brand new client id, we just accept the client*/
-        if (IS_STRING_EMPTY (*id)) {
-                goto out;
+        return FALSE;
+}
+
+/* For the logind block locks, which must never be held any longer than
+ * they have to */
+static void
+flush_inhibitor_changes_now (CsmManager *manager)
+{
+        if (manager->priv->inhibitor_flush_id > 0) {
+                g_source_remove (manager->priv->inhibitor_flush_id);
         }
 
-        app = find_app_for_startup_id (manager, new_id);
-        if (app != NULL) {
-                csm_client_set_app_id (CSM_CLIENT (client), csm_app_peek_app_id (app));
-                csm_app_registered (app);
-                goto out;
+        flush_inhibitor_changes (manager);
+}
+
+static void
+queue_inhibitor_changes (CsmManager *manager)
+{
+        if (manager->priv->inhibitor_flush_id > 0) {
+                return;
         }
 
-        /* app not found */
-        g_free (new_id);
-        new_id = NULL;
+        manager->priv->inhibitor_flush_id = g_timeout_add (CSM_MANAGER_INHIBITOR_COALESCE_TIME,
+                                                           (GSourceFunc) flush_inhibitor_changes,
+                                                           manager);
+}
 
- out:
-        g_free (*id);
-        *id = new_id;
+/* Counts the inhibitors with each flag, and returns the flags of all of
+ * them */
+static CsmInhibitorFlag
+count_inhibition_flags (CsmManager *manager,
+                        guint       flags,
+                        int         delta)
+{
+        CsmInhibitorFlag inhibited_actions;
+        int              i;
 
-        return handled;
+        inhibited_actions = 0;
+
+        for (i = 0; i < CSM_MANAGER_N_INHIBITOR_FLAGS; i++) {
+                if (flags & (1 << i)) {
+                        g_assert (delta > 0 || manager->priv->inhibitor_counts[i] > 0);
+                        manager->priv->inhibitor_counts[i] += delta;
+                }
+
+                if (manager->priv->inhibitor_counts[i] > 0) {
+                        inhibited_actions |= 1 << i;
+                }
+        }
+
+        return inhibited_actions;
 }
 
 static void
-_finished_playing_logout_sound (ca_context *c, uint32_t id, int error, void *userdata) 
+on_store_inhibitor_added (CsmStore   *store,
+                          const char *id,
+                          CsmManager *manager)
 {
-    g_warning ("Finished playing logout sound");
-    CsmManager *manager = (CsmManager *) userdata;
-    manager->priv->logout_sound_is_playing = FALSE;    
-    g_warning ("Resuming logout sequence...");
+        CsmInhibitor *i;
+        guint         flags;
+
+        g_debug ("CsmManager: Inhibitor added: %s", id);
+
+        i = CSM_INHIBITOR (csm_store_lookup (store, id));
+        flags = csm_inhibitor_peek_flags (i);
+
+        g_hash_table_insert (manager->priv->inhibitor_flags,
+                             g_strdup (id),
+                             GUINT_TO_POINTER (flags));
+        manager->priv->inhibited_actions = count_inhibition_flags (manager, flags, 1);
+
+        g_hash_table_insert (manager->priv->system_inhibitors_added,
+                             g_strdup (id),
+                             GUINT_TO_POINTER (flags));
+        queue_inhibitor_changes (manager);
+
+        csm_exported_manager_emit_inhibitor_added (manager->priv->skeleton, id);
 }
 
 static void
-maybe_play_logout_sound (CsmManager *manager)
-{
-    GSettings *settings = g_settings_new ("org.cinnamon.sounds");
-        gboolean enabled = g_settings_get_boolean(settings, "logout-enabled");
-        gchar *sound = g_settings_get_string (settings, "logout-file");
-        if (enabled) {
-            if (sound) {
-                if (g_file_test (sound, G_FILE_TEST_EXISTS)) {
-                    g_warning ("Playing logout sound '%s'", sound);
-                    manager->priv->logout_sound_is_playing = TRUE;
-                    ca_context_create (&manager->priv->ca);
-                    ca_context_set_driver (manager->priv->ca, "pulse");
-                    ca_context_change_props (manager->priv->ca, 0, CA_PROP_APPLICATION_ID, "org.gnome.VolumeControl", NULL);
-                    ca_proplist *proplist = NULL;
-                    ca_proplist_create(&proplist);
-                    ca_proplist_sets(proplist, CA_PROP_MEDIA_FILENAME, sound);
-                    int result = ca_context_play_full(manager->priv->ca, 0, proplist, _finished_playing_logout_sound, manager); 
-                    if (result != CA_SUCCESS) {
-                        g_warning ("Logout sound failed to play, skipping.");
-                        manager->priv->logout_sound_is_playing = FALSE;
-                    }
-                }
-            }
+on_store_inhibitor_removed (CsmStore   *store,
+                            const char *id,
+                            CsmManager *manager)
+{
+        gpointer         flags;
+
+        g_debug ("CsmManager: Inhibitor removed: %s", id);
+
+        if (g_hash_table_lookup_extended (manager->priv->inhibitor_flags, id, NULL, &flags)) {
+                manager->priv->inhibited_actions = count_inhibition_flags (manager,
+                                                                           GPOINTER_TO_UINT (flags),
+                                                                           -1);
+                g_hash_table_remove (manager->priv->inhibitor_flags, id);
         }
-        g_free(sound);
-        g_object_unref (settings);    
 
-        while (manager->priv->logout_sound_is_playing) {
-            sleep(1);
+        /* logind never has to hear about an inhibitor that came and went,
+         * but one it knows about has to be released right away */
+        if (g_hash_table_remove (manager->priv->system_inhibitors_added, id)) {
+                queue_inhibitor_changes (manager);
+        } else {
+                g_ptr_array_add (manager->priv->system_inhibitors_removed, g_strdup (id));
+                flush_inhibitor_changes_now (manager);
         }
+
+        csm_exported_manager_emit_inhibitor_removed (manager->priv->skeleton, id);
 }
 
 static void
-maybe_save_session (CsmManager *manager)
+csm_manager_dispose (GObject *object)
 {
-        GError *error;
+        CsmManager *manager = CSM_MANAGER (object);
 
-        if (csm_system_is_login_session (manager->priv->system))
-                return;
+        g_debug ("CsmManager: disposing manager");
 
-        /* We only allow session saving when session is running or when
-         * logging out */
-        if (manager->priv->phase != CSM_MANAGER_PHASE_RUNNING &&
-            manager->priv->phase != CSM_MANAGER_PHASE_END_SESSION) {
-                return;
+        close_end_session_dialog (manager);
+
+        g_clear_object (&manager->priv->xsmp_server);
+
+        g_clear_object (&manager->priv->bus_proxy);
+        g_clear_object (&manager->priv->cinnamon_proxy);
+
+        if (manager->priv->clients != NULL) {
+                g_signal_handlers_disconnect_by_func (manager->priv->clients,
+                                                      on_store_client_added,
+                                                      manager);
+                g_signal_handlers_disconnect_by_func (manager->priv->clients,
+                                                      on_store_client_removed,
+                                                      manager);
+                g_object_unref (manager->priv->clients);
+                manager->priv->clients = NULL;
         }
 
-        if (!csm_manager_get_autosave_enabled (manager)) {
-                csm_session_save_clear ();
-                return;
+        if (manager->priv->autostart_reload_id > 0) {
+                g_source_remove (manager->priv->autostart_reload_id);
+                manager->priv->autostart_reload_id = 0;
         }
 
-        error = NULL;
-        csm_session_save (manager->priv->clients, &error);
+        if (manager->priv->autostart_monitors != NULL) {
+                g_ptr_array_foreach (manager->priv->autostart_monitors,
+                                     (GFunc) g_signal_handlers_disconnect_by_data,
+                                     manager);
+                g_clear_pointer (&manager->priv->autostart_monitors, g_ptr_array_unref);
+        }
+        g_clear_pointer (&manager->priv->autostart_dirs, g_strfreev);
+        g_clear_pointer (&manager->priv->autostart_mtimes, g_hash_table_unref);
 
-        if (error) {
-                g_warning ("Error saving session: %s", error->message);
-                g_error_free (error);
+        launch_queue_clear (manager);
+        g_clear_pointer (&manager->priv->launch_in_flight, g_hash_table_unref);
+
+        if (manager->priv->apps != NULL) {
+                g_object_unref (manager->priv->apps);
+                manager->priv->apps = NULL;
         }
-}
 
-static void
-_handle_client_end_session_response (CsmManager *manager,
-                                     CsmClient  *client,
-                                     gboolean    is_ok,
-                                     gboolean    do_last,
-                                     gboolean    cancel,
-                                     const char *reason)
-{
-        /* just ignore if received outside of shutdown */
-        if (manager->priv->phase < CSM_MANAGER_PHASE_QUERY_END_SESSION) {
-                return;
+        g_slist_free (manager->priv->required_apps);
+        manager->priv->required_apps = NULL;
+
+        if (manager->priv->dag_flush_id > 0) {
+                g_source_remove (manager->priv->dag_flush_id);
+                manager->priv->dag_flush_id = 0;
         }
+        g_slist_free (manager->priv->dag_waiting);
+        manager->priv->dag_waiting = NULL;
+        g_clear_pointer (&manager->priv->dag_visited, g_hash_table_unref);
+        g_clear_pointer (&manager->priv->dag_settled, g_hash_table_unref);
+        g_clear_pointer (&manager->priv->launch_times, g_hash_table_unref);
+        g_clear_pointer (&manager->priv->late_apps, g_hash_table_unref);
 
-        g_debug ("CsmManager: Response from end session request: is-ok=%d do-last=%d cancel=%d reason=%s", is_ok, do_last, cancel, reason ? reason :"");
+        if (manager->priv->readahead_record_id > 0) {
+                g_source_remove (manager->priv->readahead_record_id);
+                manager->priv->readahead_record_id = 0;
+        }
 
-        if (cancel) {
-                cancel_end_session (manager);
-                return;
+        if (manager->priv->inhibitors != NULL) {
+                g_signal_handlers_disconnect_by_func (manager->priv->inhibitors,
+                                                      on_store_inhibitor_added,
+                                                      manager);
+                g_signal_handlers_disconnect_by_func (manager->priv->inhibitors,
+                                                      on_store_inhibitor_removed,
+                                                      manager);
+
+                g_object_unref (manager->priv->inhibitors);
+                manager->priv->inhibitors = NULL;
         }
 
-        manager->priv->query_clients = g_slist_remove (manager->priv->query_clients, client);
+        if (manager->priv->inhibitor_flush_id > 0) {
+                g_source_remove (manager->priv->inhibitor_flush_id);
+                manager->priv->inhibitor_flush_id = 0;
+        }
 
-        if (! is_ok && manager->priv->logout_mode != CSM_MANAGER_LOGOUT_MODE_FORCE) {
-                guint         cookie;
-                CsmInhibitor *inhibitor;
-                char         *app_id;
-                const char   *bus_name;
+        commit_pending_environment (manager);
 
-                /* FIXME: do we support updating the reason? */
+        g_clear_pointer (&manager->priv->inhibitor_flags, g_hash_table_unref);
+        g_clear_pointer (&manager->priv->system_inhibitors_added, g_hash_table_unref);
+        g_clear_pointer (&manager->priv->system_inhibitors_removed, g_ptr_array_unref);
 
-                /* Create JIT inhibit */
-                if (CSM_IS_DBUS_CLIENT (client)) {
-                        bus_name = csm_dbus_client_get_bus_name (CSM_DBUS_CLIENT (client));
-                } else {
-                        bus_name = NULL;
-                }
+        if (manager->priv->presence != NULL) {
+                g_object_unref (manager->priv->presence);
+                manager->priv->presence = NULL;
+        }
 
-                app_id = g_strdup (csm_client_peek_app_id (client));
-                if (IS_STRING_EMPTY (app_id)) {
-                        /* XSMP clients don't give us an app id unless we start them */
-                        g_free (app_id);
-                        app_id = csm_client_get_app_name (client);
-                }
+        if (manager->priv->settings) {
+                g_object_unref (manager->priv->settings);
+                manager->priv->settings = NULL;
+        }
 
-                cookie = _generate_unique_cookie (manager);
-                inhibitor = csm_inhibitor_new_for_client (csm_client_peek_id (client),
-                                                          app_id,
-                                                          CSM_INHIBITOR_FLAG_LOGOUT,
-                                                          reason != NULL ? reason : _("Not responding"),
-                                                          bus_name,
-                                                          cookie);
-                g_free (app_id);
-                csm_store_add (manager->priv->inhibitors, csm_inhibitor_peek_id (inhibitor), G_OBJECT (inhibitor));
-                g_object_unref (inhibitor);
-        } else {
-                csm_store_foreach_remove (manager->priv->inhibitors,
-                                          (CsmStoreFunc)inhibitor_has_client_id,
-                                          (gpointer)csm_client_peek_id (client));
+        g_clear_pointer (&manager->priv->blacklist, csm_substring_matcher_free);
+        g_clear_object (&manager->priv->cinnamon_settings);
+
+        if (manager->priv->session_settings) {
+                g_object_unref (manager->priv->session_settings);
+                manager->priv->session_settings = NULL;
         }
 
-        if (manager->priv->phase == CSM_MANAGER_PHASE_QUERY_END_SESSION) { 
-                if (manager->priv->query_clients == NULL) {
-                        query_end_session_complete (manager);
-                }
-        } else if (manager->priv->phase == CSM_MANAGER_PHASE_END_SESSION) {
-                if (do_last) {
-                        /* This only makes sense if we're in part 1 of
-                         * CSM_MANAGER_PHASE_END_SESSION. Doing this in part 2
-                         * can only happen because of a buggy client that loops
-                         * wanting to be last again and again. The phase
-                         * timeout will take care of this issue. */
-                        manager->priv->next_query_clients = g_slist_prepend (manager->priv->next_query_clients,
-                                                                             client);
-                }
+        if (manager->priv->power_settings) {
+                g_object_unref (manager->priv->power_settings);
+                manager->priv->power_settings = NULL;
+        }
 
-                /* we can continue to the next step if all clients have replied
-                 * and if there's no inhibitor */
-                if (manager->priv->query_clients != NULL
-                    || csm_manager_is_logout_inhibited (manager)) {
-                        return;
-                }
+        if (manager->priv->lockdown_settings) {
+                g_object_unref (manager->priv->lockdown_settings);
+                manager->priv->lockdown_settings = NULL;
+        }
 
-                if (manager->priv->next_query_clients != NULL) {
-                        do_phase_end_session_part_2 (manager);
-                } else {
-                        end_phase (manager);
-                }
+        if (manager->priv->system != NULL) {
+                g_object_unref (manager->priv->system);
+                manager->priv->system = NULL;
+        }
+
+        if (manager->priv->skeleton != NULL) {
+                g_dbus_interface_skeleton_unexport_from_connection (G_DBUS_INTERFACE_SKELETON (manager->priv->skeleton),
+                                                                    manager->priv->connection);
+                g_clear_object (&manager->priv->skeleton);
         }
+
+        g_signal_handlers_disconnect_by_func (manager->priv->connection,
+                                              on_bus_connection_closed,
+                                              manager);
+        g_clear_object (&manager->priv->connection);
+
+        G_OBJECT_CLASS (csm_manager_parent_class)->dispose (object);
 }
 
 static void
-on_client_end_session_response (CsmClient  *client,
-                                gboolean    is_ok,
-                                gboolean    do_last,
-                                gboolean    cancel,
-                                const char *reason,
-                                CsmManager *manager)
+csm_manager_class_init (CsmManagerClass *klass)
 {
-        _handle_client_end_session_response (manager,
-                                             client,
-                                             is_ok,
-                                             do_last,
-                                             cancel,
-                                             reason);
-}
+        GObjectClass   *object_class = G_OBJECT_CLASS (klass);
 
-gboolean
-csm_manager_logout (CsmManager *manager,
-                    guint       logout_mode,
-                    GError    **error)
-{
-        g_debug ("CsmManager: Logout called");
+        object_class->get_property = csm_manager_get_property;
+        object_class->set_property = csm_manager_set_property;
+        object_class->constructor = csm_manager_constructor;
+        object_class->dispose = csm_manager_dispose;
 
-        g_return_val_if_fail (CSM_IS_MANAGER (manager), FALSE);
+        signals [PHASE_CHANGED] =
+                g_signal_new ("phase-changed",
+                              G_TYPE_FROM_CLASS (object_class),
+                              G_SIGNAL_RUN_LAST,
+                              G_STRUCT_OFFSET (CsmManagerClass, phase_changed),
+                              NULL,
+                              NULL,
+                              g_cclosure_marshal_VOID__STRING,
+                              G_TYPE_NONE,
+                              1, G_TYPE_STRING);
+
+        g_object_class_install_property (object_class,
+                                         PROP_FAILSAFE,
+                                         g_param_spec_boolean ("failsafe",
+                                                               NULL,
+                                                               NULL,
+                                                               FALSE,
+                                                               G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
+
+        /**
+         * CsmManager::session-name
+         *
+         * Then name of the currently active session, typically "gnome" or "gnome-fallback".
+         * This may be the name of the configured default session, or the name of a fallback
+         * session in case we fell back.
+         */
+        g_object_class_install_property (object_class,
+                                         PROP_SESSION_NAME,
+                                         g_param_spec_string ("session-name",
+                                                              NULL,
+                                                              NULL,
+                                                              NULL,
+                                                              G_PARAM_READABLE));
+
+        /**
+         * CsmManager::fallback
+         *
+         * If %TRUE, the current session is running in the "fallback" mode;
+         * this is distinct from whether or not it was configured as default.
+         */
+        g_object_class_install_property (object_class,
+                                         PROP_FALLBACK,
+                                         g_param_spec_boolean ("fallback",
+                                                               NULL,
+                                                               NULL,
+                                                               FALSE,
+                                                               G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
+
+        g_object_class_install_property (object_class,
+                                         PROP_CLIENT_STORE,
+                                         g_param_spec_object ("client-store",
+                                                              NULL,
+                                                              NULL,
+                                                              CSM_TYPE_STORE,
+                                                              G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
 
-        if (manager->priv->phase != CSM_MANAGER_PHASE_RUNNING) {
-                g_set_error (error,
-                             CSM_MANAGER_ERROR,
-                             CSM_MANAGER_ERROR_NOT_IN_RUNNING,
-                             "Logout interface is only available during the Running phase");
-                return FALSE;
-        }
+        g_type_class_add_private (klass, sizeof (CsmManagerPrivate));
+}
 
-        if (_log_out_is_locked_down (manager)) {
-                g_set_error (error,
-                             CSM_MANAGER_ERROR,
-                             CSM_MANAGER_ERROR_LOCKED_DOWN,
-                             "Logout has been locked down");
-                return FALSE;
-        }
+static void
+on_presence_status_changed (CsmPresence  *presence,
+                            guint         status,
+                            CsmManager   *manager)
+{
+        CsmSystem *system;
 
-        switch (logout_mode) {
-        case CSM_MANAGER_LOGOUT_MODE_NORMAL:
-        case CSM_MANAGER_LOGOUT_MODE_NO_CONFIRMATION:
-        case CSM_MANAGER_LOGOUT_MODE_FORCE:
-                user_logout (manager, logout_mode);
-                break;
+        system = csm_get_system ();
+        csm_system_set_session_idle (system,
+                                     (status == CSM_PRESENCE_STATUS_IDLE));
+        g_object_unref (system);
+}
 
-        default:
-                g_debug ("Unknown logout mode option");
+static gboolean
+idle_timeout_get_mapping (GValue *value,
+                          GVariant *variant,
+                          gpointer user_data)
+{
+        guint32 idle_timeout;
 
-                g_set_error (error,
-                             CSM_MANAGER_ERROR,
-                             CSM_MANAGER_ERROR_INVALID_OPTION,
-                             "Unknown logout mode flag");
-                return FALSE;
-        }
+        idle_timeout = g_variant_get_uint32 (variant);
+        g_value_set_uint (value, idle_timeout * 1000);
 
         return TRUE;
 }
 
-
 static void
-on_xsmp_client_logout_request (CsmXSMPClient *client,
-                               gboolean       show_dialog,
-                               CsmManager    *manager)
+update_blacklist (CsmManager *manager)
 {
-        GError *error;
-        int     logout_mode;
+        char **blacklist;
 
-        if (show_dialog) {
-                logout_mode = CSM_MANAGER_LOGOUT_MODE_NORMAL;
-        } else {
-                logout_mode = CSM_MANAGER_LOGOUT_MODE_NO_CONFIRMATION;
-        }
+        blacklist = g_settings_get_strv (manager->priv->settings, KEY_BLACKLIST);
 
-        error = NULL;
+        csm_substring_matcher_free (manager->priv->blacklist);
+        manager->priv->blacklist = csm_substring_matcher_new ((const char * const *) blacklist);
 
-        csm_manager_logout (manager, logout_mode, &error);
-        if (error != NULL) {
-                g_warning ("Unable to logout: %s", error->message);
-                g_error_free (error);
-        }
+        g_strfreev (blacklist);
 }
 
 static void
-on_store_client_added (CsmStore   *store,
-                       const char *id,
-                       CsmManager *manager)
+on_blacklist_changed (GSettings  *settings,
+                      const char *key,
+                      CsmManager *manager)
 {
-        CsmClient *client;
+        g_debug ("CsmManager: autostart blacklist changed");
 
-        g_debug ("CsmManager: Client added: %s", id);
+        update_blacklist (manager);
+        queue_autostart_reload (manager);
+}
 
-        client = (CsmClient *)csm_store_lookup (store, id);
+static void
+csm_manager_init (CsmManager *manager)
+{
 
-        /* a bit hacky */
-        if (CSM_IS_XSMP_CLIENT (client)) {
-                g_signal_connect (client,
-                                  "register-request",
-                                  G_CALLBACK (on_xsmp_client_register_request),
-                                  manager);
-                g_signal_connect (client,
-                                  "logout-request",
-                                  G_CALLBACK (on_xsmp_client_logout_request),
-                                  manager);
-        }
+        manager->priv = CSM_MANAGER_GET_PRIVATE (manager);
 
-        g_signal_connect (client,
-                          "end-session-response",
-                          G_CALLBACK (on_client_end_session_response),
+        manager->priv->settings = g_settings_new (CSM_MANAGER_SCHEMA);
+        manager->priv->session_settings = g_settings_new (SESSION_SCHEMA);
+        manager->priv->power_settings = g_settings_new (POWER_SETTINGS_SCHEMA);
+        manager->priv->lockdown_settings = g_settings_new (LOCKDOWN_SCHEMA);
+
+        g_signal_connect (manager->priv->settings,
+                          "changed::" KEY_BLACKLIST,
+                          G_CALLBACK (on_blacklist_changed),
                           manager);
+        update_blacklist (manager);
 
-        g_signal_connect (client,
-                          "disconnected",
-                          G_CALLBACK (on_client_disconnected),
+        manager->priv->inhibitor_flags = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                                g_free, NULL);
+        manager->priv->system_inhibitors_added = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                                        g_free, NULL);
+        manager->priv->system_inhibitors_removed = g_ptr_array_new_with_free_func (g_free);
+        manager->priv->inhibitors = csm_store_new ();
+        csm_store_add_index (manager->priv->inhibitors,
+                             INDEX_COOKIE,
+                             (CsmStoreIndexFunc) inhibitor_cookie_keys,
+                             "cookie");
+        csm_store_add_index (manager->priv->inhibitors,
+                             INDEX_BUS_NAME,
+                             (CsmStoreIndexFunc) inhibitor_bus_name_keys,
+                             "bus-name");
+        csm_store_add_index (manager->priv->inhibitors,
+                             INDEX_CLIENT_ID,
+                             (CsmStoreIndexFunc) inhibitor_client_id_keys,
+                             "client-id");
+        g_signal_connect (manager->priv->inhibitors,
+                          "added",
+                          G_CALLBACK (on_store_inhibitor_added),
+                          manager);
+        g_signal_connect (manager->priv->inhibitors,
+                          "removed",
+                          G_CALLBACK (on_store_inhibitor_removed),
                           manager);
 
-        csm_exported_manager_emit_client_added (manager->priv->skeleton, id);
-}
+        manager->priv->apps = csm_store_new ();
+        csm_store_add_index (manager->priv->apps,
+                             INDEX_APP_ID,
+                             (CsmStoreIndexFunc) app_app_id_keys,
+                             NULL);
+        csm_store_add_index (manager->priv->apps,
+                             INDEX_STARTUP_ID,
+                             (CsmStoreIndexFunc) app_startup_id_keys,
+                             "startup-id");
+        /* csm_autostart_app_add_provides () needs a csm_store_reindex () */
+        csm_store_add_index (manager->priv->apps,
+                             INDEX_PROVIDES,
+                             (CsmStoreIndexFunc) app_provides_keys,
+                             NULL);
+        manager->priv->dag_visited = g_hash_table_new (NULL, NULL);
+        manager->priv->dag_settled = g_hash_table_new (NULL, NULL);
+        manager->priv->launch_times = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+        manager->priv->late_apps = g_hash_table_new (NULL, NULL);
+        g_queue_init (&manager->priv->launch_queue);
+        manager->priv->launch_in_flight = g_hash_table_new (NULL, NULL);
 
-static void
-on_store_client_removed (CsmStore   *store,
-                         const char *id,
-                         CsmManager *manager)
-{
-        g_debug ("CsmManager: Client removed: %s", id);
+        manager->priv->presence = csm_presence_new ();
+        g_signal_connect (manager->priv->presence,
+                          "status-changed",
+                          G_CALLBACK (on_presence_status_changed),
+                          manager);
 
-        csm_exported_manager_emit_client_removed (manager->priv->skeleton, id);
+        g_settings_bind_with_mapping (manager->priv->session_settings,
+                                      KEY_IDLE_DELAY,
+                                      manager->priv->presence,
+                                      "idle-timeout",
+                                      G_SETTINGS_BIND_GET,
+                                      idle_timeout_get_mapping,
+                                      NULL,
+                                      NULL, NULL);
+
+        manager->priv->system = csm_get_system ();
 }
 
-static void
-csm_manager_set_client_store (CsmManager *manager,
-                              CsmStore   *store)
+CsmManager *
+csm_manager_get (void)
 {
-        g_return_if_fail (CSM_IS_MANAGER (manager));
+        return manager_object;
+}
 
-        if (store != NULL) {
-                g_object_ref (store);
-        }
+CsmManager *
+csm_manager_new (CsmStore *client_store,
+                 gboolean  failsafe)
+{
+        if (manager_object != NULL) {
+                g_object_ref (manager_object);
+        } else {
+                gboolean res;
 
-        if (manager->priv->clients != NULL) {
-                g_signal_handlers_disconnect_by_func (manager->priv->clients,
-                                                      on_store_client_added,
-                                                      manager);
-                g_signal_handlers_disconnect_by_func (manager->priv->clients,
-                                                      on_store_client_removed,
-                                                      manager);
+                manager_object = g_object_new (CSM_TYPE_MANAGER,
+                                               "client-store", client_store,
+                                               "failsafe", failsafe,
+                                               NULL);
 
-                g_object_unref (manager->priv->clients);
+                g_object_add_weak_pointer (manager_object,
+                                           (gpointer *) &manager_object);
+                res = register_manager (manager_object);
+                if (! res) {
+                        g_object_unref (manager_object);
+                        return NULL;
+                }
         }
 
+        return CSM_MANAGER (manager_object);
+}
 
-        g_debug ("CsmManager: setting client store %p", store);
-
-        manager->priv->clients = store;
-
-        if (manager->priv->clients != NULL) {
-            if (manager->priv->xsmp_server)
-                    g_object_unref (manager->priv->xsmp_server);
-
-                manager->priv->xsmp_server = csm_xsmp_server_new (store);
+static gboolean
+csm_manager_is_switch_user_inhibited (CsmManager *manager)
+{
+        return is_flag_inhibited (manager, CSM_INHIBITOR_FLAG_SWITCH_USER);
+}
 
-                g_signal_connect (manager->priv->clients,
-                                  "added",
-                                  G_CALLBACK (on_store_client_added),
-                                  manager);
-                g_signal_connect (manager->priv->clients,
-                                  "removed",
-                                  G_CALLBACK (on_store_client_removed),
-                                  manager);
-        }
+static gboolean
+csm_manager_is_suspend_inhibited (CsmManager *manager)
+{
+        return is_flag_inhibited (manager, CSM_INHIBITOR_FLAG_SUSPEND);
 }
 
 static void
-csm_manager_set_property (GObject       *object,
-                          guint          prop_id,
-                          const GValue  *value,
-                          GParamSpec    *pspec)
+request_reboot (CsmManager *manager)
 {
-        CsmManager *self;
-
-        self = CSM_MANAGER (object);
+        g_debug ("CsmManager: requesting reboot");
 
-        switch (prop_id) {
-        case PROP_FAILSAFE:
-                csm_manager_set_failsafe (self, g_value_get_boolean (value));
-                break;
-         case PROP_FALLBACK:
-                self->priv->is_fallback_session = g_value_get_boolean (value);
-                break;
-         case PROP_CLIENT_STORE:
-                csm_manager_set_client_store (self, g_value_get_object (value));
-                break;
-        default:
-                G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
-                break;
-        }
+        /* FIXME: We need to support a more structured shutdown here,
+         * but that's blocking on an improved ConsoleKit api.
+         *
+         * See https://bugzilla.gnome.org/show_bug.cgi?id=585614
+         */
+        manager->priv->logout_type = CSM_MANAGER_LOGOUT_REBOOT_INTERACT;
+        end_phase (manager);
 }
 
 static void
-csm_manager_get_property (GObject    *object,
-                          guint       prop_id,
-                          GValue     *value,
-                          GParamSpec *pspec)
+request_shutdown (CsmManager *manager)
 {
-        CsmManager *self;
-
-        self = CSM_MANAGER (object);
+        g_debug ("CsmManager: requesting shutdown");
 
-        switch (prop_id) {
-        case PROP_FAILSAFE:
-                g_value_set_boolean (value, self->priv->failsafe);
-                break;
-        case PROP_SESSION_NAME:
-                g_value_set_string (value, self->priv->session_name);
-                break;
-        case PROP_FALLBACK:
-                g_value_set_boolean (value, self->priv->is_fallback_session);
-                break;
-        case PROP_CLIENT_STORE:
-                g_value_set_object (value, self->priv->clients);
-                break;
-        default:
-                G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
-                break;
-        }
+        /* See the comment in request_reboot() for some more details about
+         * what work needs to be done here. */
+        manager->priv->logout_type = CSM_MANAGER_LOGOUT_SHUTDOWN_INTERACT;
+        end_phase (manager);
 }
 
-static gboolean
-_find_app_provides (const char *id,
-                    CsmApp     *app,
-                    const char *service)
+static void
+request_suspend (CsmManager *manager)
 {
-        return csm_app_provides (app, service);
-}
+        g_debug ("CsmManager: requesting suspend");
 
-static GObject *
-csm_manager_constructor (GType                  type,
-                         guint                  n_construct_properties,
-                         GObjectConstructParam *construct_properties)
-{
-        CsmManager *manager;
+        if (! csm_manager_is_suspend_inhibited (manager)) {
+                manager_attempt_suspend (manager);
+                return;
+        }
 
-        manager = CSM_MANAGER (G_OBJECT_CLASS (csm_manager_parent_class)->constructor (type,
-                                                                                       n_construct_properties,
-                                                                                       construct_properties));
-        return G_OBJECT (manager);
+        emit_inhibitor_info_to_dialog (manager, CSM_LOGOUT_ACTION_SLEEP);
 }
 
 static void
-update_inhibited_actions (CsmManager *manager,
-                          CsmInhibitorFlag new_inhibited_actions)
+request_hibernate (CsmManager *manager)
 {
-        if (manager->priv->inhibited_actions == new_inhibited_actions)
-                return;
+        g_debug ("CsmManager: requesting hibernate");
 
-        manager->priv->inhibited_actions = new_inhibited_actions;
+        /* hibernate uses suspend inhibit */
+        if (! csm_manager_is_suspend_inhibited (manager)) {
+                manager_attempt_hibernate (manager);
+                return;
+        }
 
-        g_debug ("CsmManager: new inhibit flag: %d", new_inhibited_actions);
+        emit_inhibitor_info_to_dialog (manager, CSM_LOGOUT_ACTION_HIBERNATE);
+}
 
-        csm_exported_manager_set_inhibited_actions (manager->priv->skeleton,
-                                                    manager->priv->inhibited_actions);
+static void
+request_logout (CsmManager           *manager,
+                CsmManagerLogoutMode  mode)
+{
+        g_debug ("CsmManager: requesting logout");
 
-        g_dbus_interface_skeleton_flush (G_DBUS_INTERFACE_SKELETON (manager->priv->skeleton));
+        manager->priv->logout_mode = mode;
+        manager->priv->logout_type = CSM_MANAGER_LOGOUT_LOGOUT;
 
-        emit_inhibitor_info_to_dialog (manager, manager->priv->dialog_action);
+        end_phase (manager);
 }
 
 static void
-on_store_inhibitor_added (CsmStore   *store,
-                          const char *id,
-                          CsmManager *manager)
+request_switch_user (CsmManager *manager)
 {
-        CsmInhibitor *i;
-        CsmInhibitorFlag new_inhibited_actions;
-
-        g_debug ("CsmManager: Inhibitor added: %s", id);
-
-        i = CSM_INHIBITOR (csm_store_lookup (store, id));
-        csm_system_add_inhibitor (manager->priv->system, id,
-                                  csm_inhibitor_peek_flags (i));
+        g_debug ("CsmManager: requesting user switch");
 
-        new_inhibited_actions = manager->priv->inhibited_actions | csm_inhibitor_peek_flags (i);
-        update_inhibited_actions (manager, new_inhibited_actions);
+	/* See comment in manager_switch_user() to understand why we do this in
+	 * both functions. */
+	if (_switch_user_is_locked_down (manager)) {
+		g_warning ("Unable to switch user: User switching has been locked down");
+		return;
+	}
 
-        csm_exported_manager_emit_inhibitor_added (manager->priv->skeleton, id);
+    if (! csm_manager_is_switch_user_inhibited (manager)) {
+            manager_switch_user (manager);
+            return;
+    }
 
-        update_idle (manager);
+    emit_inhibitor_info_to_dialog (manager, CSM_LOGOUT_ACTION_SWITCH_USER);
 }
 
-static gboolean
-collect_inhibition_flags (const char *id,
-                          GObject    *object,
-                          gpointer    user_data)
+static GSubprocess *dialog_process = NULL;
+static GCancellable *dialog_cancellable = NULL;
+
+static void
+on_dialog_exited (GObject *source,
+                  GAsyncResult *result,
+                  gpointer user_data)
 {
-        CsmInhibitorFlag *new_inhibited_actions = user_data;
+    GError *error = NULL;
+    g_debug ("Session quit dialog exited");
 
-        *new_inhibited_actions |= csm_inhibitor_peek_flags (CSM_INHIBITOR (object));
+    if (!g_subprocess_wait_finish ((GSubprocess *) source,
+                                   result,
+                                   &error)) {
+        if (error != NULL) {
+            g_critical ("The session-manager dialog did not exit successfully: %s", error->message);
+            g_error_free (error);
+        }
+    }
 
-        return FALSE;
+    g_clear_object (&dialog_process);
+    g_clear_object (&dialog_cancellable);
 }
 
 static void
-on_store_inhibitor_removed (CsmStore   *store,
-                            const char *id,
-                            CsmManager *manager)
+on_dialog_read (GObject *source,
+                GAsyncResult *result,
+                gpointer user_data)
 {
-        CsmInhibitorFlag new_inhibited_actions;
-
-        g_debug ("CsmManager: Inhibitor removed: %s", id);
-
-        csm_system_remove_inhibitor (manager->priv->system, id);
+    GInputStream *stream = G_INPUT_STREAM (source);
 
-        new_inhibited_actions = 0;
-        csm_store_foreach (manager->priv->inhibitors,
-                           collect_inhibition_flags,
-                           &new_inhibited_actions);
-        update_inhibited_actions (manager, new_inhibited_actions);
+    g_debug ("Session quit dialog read output");
 
-        csm_exported_manager_emit_inhibitor_removed (manager->priv->skeleton, id);
+    gssize read = g_input_stream_read_finish (stream, result, NULL);
+    if (read > 0) {
+        g_debug ("Session quit dialog (self-owned) output: %.*s", (gint) read, (gchar *) user_data);
+    } else {
+        g_debug ("Session quit dialog (self-owned) stdout closed");
+        g_free (user_data);
+        g_input_stream_close (stream, NULL, NULL);
+        return;
+    }
 
-        update_idle (manager);
+    g_input_stream_read_async (stream,
+                               user_data,
+                               1024,
+                               G_PRIORITY_DEFAULT,
+                               NULL,
+                               (GAsyncReadyCallback) on_dialog_read,
+                               user_data);
 }
 
 static void
-csm_manager_dispose (GObject *object)
+close_end_session_dialog (CsmManager *manager)
 {
-        CsmManager *manager = CSM_MANAGER (object);
-
-        g_debug ("CsmManager: disposing manager");
+    g_debug ("Closing end session dialog");
 
-        close_end_session_dialog (manager);
+    if (dialog_process != NULL) {
+        g_subprocess_send_signal (dialog_process, SIGTERM);
+        return;
+    }
 
-        g_clear_object (&manager->priv->xsmp_server);
+    // If Cinnamon has already left the bus (e.g. it crashed and we're tearing
+    // down), there's nothing to close. This uses cinnamon_proxy's cached name
+    // owner, which may lag behind a NameOwnerChanged we haven't dispatched yet -
+    // that's fine here, the session is ending regardless.
+    gchar *owner = g_dbus_proxy_get_name_owner (manager->priv->cinnamon_proxy);
+    if (owner == NULL) {
+        g_debug ("Cinnamon is not on the bus, nothing to close");
+        return;
+    }
+    g_free (owner);
 
-        g_clear_object (&manager->priv->bus_proxy);
-        g_clear_object (&manager->priv->cinnamon_proxy);
+    GError *error = NULL;
+    GVariant *ret = NULL;
 
-        if (manager->priv->clients != NULL) {
-                g_signal_handlers_disconnect_by_func (manager->priv->clients,
-                                                      on_store_client_added,
-                                                      manager);
-                g_signal_handlers_disconnect_by_func (manager->priv->clients,
-                                                      on_store_client_removed,
-                                                      manager);
-                g_object_unref (manager->priv->clients);
-                manager->priv->clients = NULL;
-        }
+    ret = g_dbus_proxy_call_sync (manager->priv->cinnamon_proxy,
+                                  "CloseEndSessionDialog",
+                                  NULL,
+                                  G_DBUS_CALL_FLAGS_NONE,
+                                  -1,
+                                  NULL,
+                                  &error);
 
-        if (manager->priv->apps != NULL) {
-                g_object_unref (manager->priv->apps);
-                manager->priv->apps = NULL;
-        }
+    if (error != NULL) {
+        g_critical ("Unable to close Cinnamon's end session dialog: %s", error->message);
+        g_error_free (error);
+    } else {
+        g_variant_unref (ret);
+    }
+}
 
-        g_slist_free (manager->priv->required_apps);
-        manager->priv->required_apps = NULL;
+static void
+launch_gtk_dialog (CsmManager *manager,
+               DialogMode  mode)
+{
+    GError *error;
+    const gchar *flag;
+    g_debug ("Trying to launch fallback (Gtk) end-session dialog");
 
-        if (manager->priv->inhibitors != NULL) {
-                g_signal_handlers_disconnect_by_func (manager->priv->inhibitors,
-                                                      on_store_inhibitor_added,
-                                                      manager);
-                g_signal_handlers_disconnect_by_func (manager->priv->inhibitors,
-                                                      on_store_inhibitor_removed,
-                                                      manager);
+    if (dialog_process != NULL) {
+        g_debug ("There's already a session-manager dialog");
+        return;
+    }
 
-                g_object_unref (manager->priv->inhibitors);
-                manager->priv->inhibitors = NULL;
-        }
+    // If we're spawning the dialog and *already* in the query phase,
+    // we can assume something went wrong previously, so reset back
+    // to the RUNNING phase.
+    if (manager->priv->phase == CSM_MANAGER_PHASE_QUERY_END_SESSION) {
+        g_critical ("Session not in running phase, previous dialog may have exited unexpectedly");
+        cancel_end_session (manager);
+    }
 
-        if (manager->priv->presence != NULL) {
-                g_object_unref (manager->priv->presence);
-                manager->priv->presence = NULL;
-        }
+    switch (mode) {
+        case DIALOG_MODE_LOGOUT:
+            flag = "--logout";
+            break;
+        case DIALOG_MODE_REBOOT:
+            flag = "--reboot";
+            break;
+        case DIALOG_MODE_SHUTDOWN:
+            flag = "--power-off";
+            
+            break;
+        default:
+            g_warning ("Unknown dialog mode: %d", mode);
+            return;
+    }
 
-        if (manager->priv->settings) {
-                g_object_unref (manager->priv->settings);
-                manager->priv->settings = NULL;
-        }
+    const gchar *argv[] = {
+        "cinnamon-session-quit",
+        "--sm-owned",
+        flag,
+        NULL
+    };
 
-        if (manager->priv->session_settings) {
-                g_object_unref (manager->priv->session_settings);
-                manager->priv->session_settings = NULL;
-        }
+    gboolean debugging = g_settings_get_boolean (manager->priv->settings, KEY_DEBUG);
+    GSubprocessFlags flags = G_SUBPROCESS_FLAGS_NONE;
 
-        if (manager->priv->power_settings) {
-                g_object_unref (manager->priv->power_settings);
-                manager->priv->power_settings = NULL;
-        }
+    if (debugging) {
+        flags = G_SUBPROCESS_FLAGS_STDERR_PIPE;
+    }
 
-        if (manager->priv->lockdown_settings) {
-                g_object_unref (manager->priv->lockdown_settings);
-                manager->priv->lockdown_settings = NULL;
-        }
+    error = NULL;
+    dialog_process = g_subprocess_newv (argv, flags, &error);
 
-        if (manager->priv->system != NULL) {
-                g_object_unref (manager->priv->system);
-                manager->priv->system = NULL;
+    if (dialog_process == NULL) {
+        if (error != NULL) {
+            g_critical ("Failed to launch session-manager dialog: %s", error->message);
+            g_error_free (error);
+            return;
         }
+    }
 
-        if (manager->priv->skeleton != NULL) {
-                g_dbus_interface_skeleton_unexport_from_connection (G_DBUS_INTERFACE_SKELETON (manager->priv->skeleton),
-                                                                    manager->priv->connection);
-                g_clear_object (&manager->priv->skeleton);
-        }
+    if (debugging) {
+        GInputStream *stdout = g_subprocess_get_stderr_pipe (dialog_process);
+        guint8 *buffer = g_malloc (1024);
+        g_input_stream_read_async (G_INPUT_STREAM (stdout),
+                                   buffer,
+                                   1024,
+                                   G_PRIORITY_DEFAULT,
+                                   NULL,
+                                   (GAsyncReadyCallback) on_dialog_read,
+                                   buffer);
+    }
 
-        g_signal_handlers_disconnect_by_func (manager->priv->connection,
-                                              on_bus_connection_closed,
-                                              manager);
-        g_clear_object (&manager->priv->connection);
+    dialog_cancellable = g_cancellable_new ();
 
-        G_OBJECT_CLASS (csm_manager_parent_class)->dispose (object);
+    g_subprocess_wait_async (dialog_process,
+                              dialog_cancellable,
+                              (GAsyncReadyCallback) on_dialog_exited,
+                              manager);
 }
 
-static void
-csm_manager_class_init (CsmManagerClass *klass)
+static gboolean
+launch_cinnamon_dialog (CsmManager  *manager,
+                        DialogMode   mode,
+                        GError     **error)
 {
-        GObjectClass   *object_class = G_OBJECT_CLASS (klass);
-
-        object_class->get_property = csm_manager_get_property;
-        object_class->set_property = csm_manager_set_property;
-        object_class->constructor = csm_manager_constructor;
-        object_class->dispose = csm_manager_dispose;
-
-        signals [PHASE_CHANGED] =
-                g_signal_new ("phase-changed",
-                              G_TYPE_FROM_CLASS (object_class),
-                              G_SIGNAL_RUN_LAST,
-                              G_STRUCT_OFFSET (CsmManagerClass, phase_changed),
-                              NULL,
-                              NULL,
-                              g_cclosure_marshal_VOID__STRING,
-                              G_TYPE_NONE,
-                              1, G_TYPE_STRING);
+    GVariant *ret = NULL;
 
-        g_object_class_install_property (object_class,
-                                         PROP_FAILSAFE,
-                                         g_param_spec_boolean ("failsafe",
-                                                               NULL,
-                                                               NULL,
-                                                               FALSE,
-                                                               G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
+    g_debug ("Requesting Cinnamon display its end-session dialog");
 
-        /**
-         * CsmManager::session-name
-         *
-         * Then name of the currently active session, typically "gnome" or "gnome-fallback".
-         * This may be the name of the configured default session, or the name of a fallback
-         * session in case we fell back.
-         */
-        g_object_class_install_property (object_class,
-                                         PROP_SESSION_NAME,
-                                         g_param_spec_string ("session-name",
-                                                              NULL,
-                                                              NULL,
-                                                              NULL,
-                                                              G_PARAM_READABLE));
+    ret = g_dbus_proxy_call_sync (manager->priv->cinnamon_proxy,
+                                  "ShowEndSessionDialog",
+                                  g_variant_new ("(i)", mode),
+                                  G_DBUS_CALL_FLAGS_NONE,
+                                  -1,
+                                  NULL,
+                                  error);
 
-        /**
-         * CsmManager::fallback
-         *
-         * If %TRUE, the current session is running in the "fallback" mode;
-         * this is distinct from whether or not it was configured as default.
-         */
-        g_object_class_install_property (object_class,
-                                         PROP_FALLBACK,
-                                         g_param_spec_boolean ("fallback",
-                                                               NULL,
-                                                               NULL,
-                                                               FALSE,
-                                                               G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
+    if (*error != NULL) {
+        return FALSE;
+    }
+    g_debug ("launch ret is: %p", ret);
 
-        g_object_class_install_property (object_class,
-                                         PROP_CLIENT_STORE,
-                                         g_param_spec_object ("client-store",
-                                                              NULL,
-                                                              NULL,
-                                                              CSM_TYPE_STORE,
-                                                              G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
+    g_variant_unref (ret);
 
-        g_type_class_add_private (klass, sizeof (CsmManagerPrivate));
+    return TRUE;
 }
 
 static void
-on_presence_status_changed (CsmPresence  *presence,
-                            guint         status,
-                            CsmManager   *manager)
+show_end_session_dialog (CsmManager *manager,
+                         DialogMode  mode)
 {
-        CsmSystem *system;
+    GError *error = NULL;
+    
+    if (g_settings_get_boolean (manager->priv->settings, KEY_FORCE_GTK_END_SESSION)) {
+        g_debug ("Using Gtk end-session dialog based on settings.");
+        launch_gtk_dialog (manager, mode);
+        return;
+    }
 
-        system = csm_get_system ();
-        csm_system_set_session_idle (system,
-                                     (status == CSM_PRESENCE_STATUS_IDLE));
-        g_object_unref (system);
+    if (!launch_cinnamon_dialog (manager, mode, &error)) {
+        if (error->code == G_DBUS_ERROR_NAME_HAS_NO_OWNER) {
+            g_debug ("Cinnamon is not running, falling back to Gtk end-session dialog");
+        } else {
+            g_critical ("Failed to launch Cinnamon's end session dialog, falling back to Gtk end-session dialog: %s", error->message);
+        }
+
+        g_error_free (error);
+        launch_gtk_dialog (manager, mode);
+    }
 }
 
-static gboolean
-idle_timeout_get_mapping (GValue *value,
-                          GVariant *variant,
-                          gpointer user_data)
+static void
+show_shutdown_dialog (CsmManager *manager,
+                      gboolean    is_reboot)
 {
-        guint32 idle_timeout;
+        if (manager->priv->phase > CSM_MANAGER_PHASE_QUERY_END_SESSION) {
+                /* Already shutting down, nothing more to do */
+                return;
+        }
 
-        idle_timeout = g_variant_get_uint32 (variant);
-        g_value_set_uint (value, idle_timeout * 1000);
+        manager->priv->logout_mode = CSM_MANAGER_LOGOUT_MODE_NORMAL;
 
-        return TRUE;
+        show_end_session_dialog (manager, is_reboot ? DIALOG_MODE_REBOOT : DIALOG_MODE_SHUTDOWN);
 }
 
 static void
-csm_manager_init (CsmManager *manager)
+show_logout_dialog (CsmManager *manager)
 {
+        if (manager->priv->phase > CSM_MANAGER_PHASE_QUERY_END_SESSION) {
+                /* Already shutting down, nothing more to do */
+                return;
+        }
 
-        manager->priv = CSM_MANAGER_GET_PRIVATE (manager);
-
-        manager->priv->settings = g_settings_new (CSM_MANAGER_SCHEMA);
-        manager->priv->session_settings = g_settings_new (SESSION_SCHEMA);
-        manager->priv->power_settings = g_settings_new (POWER_SETTINGS_SCHEMA);
-        manager->priv->lockdown_settings = g_settings_new (LOCKDOWN_SCHEMA);
-
-        manager->priv->inhibitors = csm_store_new ();
-        g_signal_connect (manager->priv->inhibitors,
-                          "added",
-                          G_CALLBACK (on_store_inhibitor_added),
-                          manager);
-        g_signal_connect (manager->priv->inhibitors,
-                          "removed",
-                          G_CALLBACK (on_store_inhibitor_removed),
-                          manager);
-
-        manager->priv->apps = csm_store_new ();
-
-        manager->priv->presence = csm_presence_new ();
-        g_signal_connect (manager->priv->presence,
-                          "status-changed",
-                          G_CALLBACK (on_presence_status_changed),
-                          manager);
-
-        g_settings_bind_with_mapping (manager->priv->session_settings,
-                                      KEY_IDLE_DELAY,
-                                      manager->priv->presence,
-                                      "idle-timeout",
-                                      G_SETTINGS_BIND_GET,
-                                      idle_timeout_get_mapping,
-                                      NULL,
-                                      NULL, NULL);
+        manager->priv->logout_mode = CSM_MANAGER_LOGOUT_MODE_NORMAL;
 
-        manager->priv->system = csm_get_system ();
+        show_end_session_dialog (manager, DIALOG_MODE_LOGOUT);
 }
 
-CsmManager *
-csm_manager_get (void)
+static void
+user_logout (CsmManager           *manager,
+             CsmManagerLogoutMode  mode)
 {
-        return manager_object;
-}
+        gboolean logout_prompt;
 
-CsmManager *
-csm_manager_new (CsmStore *client_store,
-                 gboolean  failsafe)
-{
-        if (manager_object != NULL) {
-                g_object_ref (manager_object);
-        } else {
-                gboolean res;
+        if (manager->priv->phase >= CSM_MANAGER_PHASE_QUERY_END_SESSION) {
+                /* Already shutting down, nothing more to do */
+                return;
+        }
 
-                manager_object = g_object_new (CSM_TYPE_MANAGER,
-                                               "client-store", client_store,
-                                               "failsafe", failsafe,
-                                               NULL);
+        logout_prompt = g_settings_get_boolean (manager->priv->settings,
+                                                KEY_LOGOUT_PROMPT);
 
-                g_object_add_weak_pointer (manager_object,
-                                           (gpointer *) &manager_object);
-                res = register_manager (manager_object);
-                if (! res) {
-                        g_object_unref (manager_object);
-                        return NULL;
-                }
+        /* If the shell isn't running, and this isn't a non-interative logout request,
+         * and the user has their settings configured to show a confirmation dialog for
+         * logout, then go ahead and show the fallback confirmation dialog now.
+         *
+         * If the shell is running, then the confirmation dialog and inhibitor dialog are
+         * combined, so we'll show it at a later stage in the logout process.
+         */
+        if (mode == CSM_MANAGER_LOGOUT_MODE_NORMAL && logout_prompt) {
+                show_logout_dialog (manager);
+        } else {
+                request_logout (manager, mode);
         }
+}
 
-        return CSM_MANAGER (manager_object);
+/*
+  dbus-send --session --type=method_call --print-reply
+      --dest=org.gnome.SessionManager
+      /org/gnome/SessionManager
+      org.freedesktop.DBus.Introspectable.Introspect
+*/
+
+gboolean
+csm_manager_set_phase (CsmManager      *manager,
+                       CsmManagerPhase  phase)
+{
+        g_return_val_if_fail (CSM_IS_MANAGER (manager), FALSE);
+        manager->priv->phase = phase;
+        return (TRUE);
 }
 
 static gboolean
-csm_manager_is_switch_user_inhibited (CsmManager *manager)
+_log_out_is_locked_down (CsmManager *manager)
 {
-        CsmInhibitor *inhibitor;
-
-        if (manager->priv->inhibitors == NULL) {
-                return FALSE;
-        }
-
-        inhibitor = (CsmInhibitor *)csm_store_find (manager->priv->inhibitors,
-                                                    (CsmStoreFunc)inhibitor_has_flag,
-                                                    GUINT_TO_POINTER (CSM_INHIBITOR_FLAG_SWITCH_USER));
-        if (inhibitor == NULL) {
-                return FALSE;
-        }
-        return TRUE;
+        return g_settings_get_boolean (manager->priv->lockdown_settings,
+                                       KEY_DISABLE_LOG_OUT);
 }
 
 static gboolean
-csm_manager_is_suspend_inhibited (CsmManager *manager)
+_switch_user_is_locked_down (CsmManager *manager)
 {
-        CsmInhibitor *inhibitor;
-
-        if (manager->priv->inhibitors == NULL) {
-                return FALSE;
-        }
-
-        inhibitor = (CsmInhibitor *)csm_store_find (manager->priv->inhibitors,
-                                                    (CsmStoreFunc)inhibitor_has_flag,
-                                                    GUINT_TO_POINTER (CSM_INHIBITOR_FLAG_SUSPEND));
-        if (inhibitor == NULL) {
-                return FALSE;
-        }
-        return TRUE;
+        return g_settings_get_boolean (manager->priv->lockdown_settings,
+                                       KEY_DISABLE_USER_SWITCHING);
 }
 
-static void
-request_reboot (CsmManager *manager)
-{
-        g_debug ("CsmManager: requesting reboot");
-
-        /* FIXME: We need to support a more structured shutdown here,
-         * but that's blocking on an improved ConsoleKit api.
-         *
-         * See https://bugzilla.gnome.org/show_bug.cgi?id=585614
-         */
-        manager->priv->logout_type = CSM_MANAGER_LOGOUT_REBOOT_INTERACT;
-        end_phase (manager);
-}
 
 static void
-request_shutdown (CsmManager *manager)
+append_app (CsmManager *manager,
+            CsmApp     *app,
+            const char *provides,
+            gboolean    is_required)
 {
-        g_debug ("CsmManager: requesting shutdown");
+        const char *id;
+        const char *app_id;
+        CsmApp     *dup;
 
-        /* See the comment in request_reboot() for some more details about
-         * what work needs to be done here. */
-        manager->priv->logout_type = CSM_MANAGER_LOGOUT_SHUTDOWN_INTERACT;
-        end_phase (manager);
-}
+        id = csm_app_peek_id (app);
+        if (IS_STRING_EMPTY (id)) {
+                g_debug ("CsmManager: not adding app: no id");
+                return;
+        }
 
-static void
-request_suspend (CsmManager *manager)
-{
-        g_debug ("CsmManager: requesting suspend");
+        dup = (CsmApp *)csm_store_lookup (manager->priv->apps, id);
+        if (dup != NULL) {
+                g_debug ("CsmManager: not adding app: already added");
+                return;
+        }
 
-        if (! csm_manager_is_suspend_inhibited (manager)) {
-                manager_attempt_suspend (manager);
+        app_id = csm_app_peek_app_id (app);
+        if (IS_STRING_EMPTY (app_id)) {
+                g_debug ("CsmManager: not adding app: no app-id");
                 return;
         }
 
-        emit_inhibitor_info_to_dialog (manager, CSM_LOGOUT_ACTION_SLEEP);
-}
+        dup = find_app_for_app_id (manager, app_id);
+        if (dup != NULL) {
+                g_debug ("CsmManager: not adding app: app-id '%s' already exists", app_id);
 
-static void
-request_hibernate (CsmManager *manager)
-{
-        g_debug ("CsmManager: requesting hibernate");
+                if (provides && CSM_IS_AUTOSTART_APP (dup)) {
+                        csm_autostart_app_add_provides (CSM_AUTOSTART_APP (dup), provides);
+                        csm_store_reindex (manager->priv->apps, csm_app_peek_id (dup));
+                }
+
+                if (is_required &&
+                    !g_slist_find (manager->priv->required_apps, dup)) {
+                        g_debug ("CsmManager: making app '%s' required", csm_app_peek_app_id (dup));
+                        manager->priv->required_apps = g_slist_prepend (manager->priv->required_apps, dup);
+                }
 
-        /* hibernate uses suspend inhibit */
-        if (! csm_manager_is_suspend_inhibited (manager)) {
-                manager_attempt_hibernate (manager);
                 return;
         }
 
-        emit_inhibitor_info_to_dialog (manager, CSM_LOGOUT_ACTION_HIBERNATE);
+        csm_store_add (manager->priv->apps, id, G_OBJECT (app));
+        if (is_required) {
+                g_debug ("CsmManager: adding required app %s", csm_app_peek_app_id (app));
+                manager->priv->required_apps = g_slist_prepend (manager->priv->required_apps, app);
+        }
 }
 
-static void
-request_logout (CsmManager           *manager,
-                CsmManagerLogoutMode  mode)
+static gboolean
+add_autostart_app_internal (CsmManager      *manager,
+                            const char      *path,
+                            GDesktopAppInfo *app_info,
+                            GVariant        *record,
+                            const char      *provides,
+                            gboolean         is_required)
 {
-        g_debug ("CsmManager: requesting logout");
+        CsmApp  *app;
+        char   **internal_provides;
 
-        manager->priv->logout_mode = mode;
-        manager->priv->logout_type = CSM_MANAGER_LOGOUT_LOGOUT;
+        g_return_val_if_fail (CSM_IS_MANAGER (manager), FALSE);
+        g_return_val_if_fail (path != NULL, FALSE);
 
-        end_phase (manager);
-}
+        /* Note: if we cannot add the app because its service is already
+         * provided, because its app-id is taken, or because of any other
+         * reason meaning there is already an app playing its role, then we
+         * should make sure that relevant properties (like
+         * provides/is_required) are set in the pre-existing app if needed. */
 
-static void
-request_switch_user (CsmManager *manager)
-{
-        g_debug ("CsmManager: requesting user switch");
+        /* first check to see if service is already provided */
+        if (provides != NULL) {
+                CsmApp *dup;
 
-	/* See comment in manager_switch_user() to understand why we do this in
-	 * both functions. */
-	if (_switch_user_is_locked_down (manager)) {
-		g_warning ("Unable to switch user: User switching has been locked down");
-		return;
-	}
+                dup = (CsmApp *)csm_store_lookup_index (manager->priv->apps,
+                                                        INDEX_PROVIDES,
+                                                        provides);
+                if (dup != NULL) {
+                        g_debug ("CsmManager: service '%s' is already provided", provides);
 
-    if (! csm_manager_is_switch_user_inhibited (manager)) {
-            manager_switch_user (manager);
-            return;
-    }
+                        if (is_required &&
+                            !g_slist_find (manager->priv->required_apps, dup)) {
+                                g_debug ("CsmManager: making app '%s' required", csm_app_peek_app_id (dup));
+                                manager->priv->required_apps = g_slist_prepend (manager->priv->required_apps, dup);
+                        }
 
-    emit_inhibitor_info_to_dialog (manager, CSM_LOGOUT_ACTION_SWITCH_USER);
-}
+                        return FALSE;
+                }
+        }
 
-static GSubprocess *dialog_process = NULL;
-static GCancellable *dialog_cancellable = NULL;
+        app = csm_autostart_app_new_for_app_info (path, app_info, record);
 
-static void
-on_dialog_exited (GObject *source,
-                  GAsyncResult *result,
-                  gpointer user_data)
-{
-    GError *error = NULL;
-    g_debug ("Session quit dialog exited");
+        if (app == NULL) {
+                return FALSE;
+        }
 
-    if (!g_subprocess_wait_finish ((GSubprocess *) source,
-                                   result,
-                                   &error)) {
-        if (error != NULL) {
-            g_critical ("The session-manager dialog did not exit successfully: %s", error->message);
-            g_error_free (error);
+        internal_provides = csm_app_get_provides (app);
+        if (internal_provides) {
+                int i;
+                gboolean provided = FALSE;
+
+                for (i = 0; internal_provides[i] != NULL; i++) {
+                        CsmApp *dup;
+
+                        dup = (CsmApp *)csm_store_lookup_index (manager->priv->apps,
+                                                                INDEX_PROVIDES,
+                                                                internal_provides[i]);
+                        if (dup != NULL) {
+                                g_debug ("CsmManager: service '%s' is already provided", internal_provides[i]);
+
+                                if (is_required &&
+                                    !g_slist_find (manager->priv->required_apps, dup)) {
+                                        g_debug ("CsmManager: making app '%s' required", csm_app_peek_app_id (dup));
+                                        manager->priv->required_apps = g_slist_prepend (manager->priv->required_apps, dup);
+                                }
+
+                                provided = TRUE;
+                                break;
+                        }
+                }
+
+                g_strfreev (internal_provides);
+
+                if (provided) {
+                        g_object_unref (app);
+                        return FALSE;
+                }
         }
-    }
 
-    g_clear_object (&dialog_process);
-    g_clear_object (&dialog_cancellable);
+        if (provides)
+                csm_autostart_app_add_provides (CSM_AUTOSTART_APP (app), provides);
+
+        g_debug ("CsmManager: read %s", path);
+        append_app (manager, app, provides, is_required);
+        g_object_unref (app);
+
+        return TRUE;
 }
 
-static void
-on_dialog_read (GObject *source,
-                GAsyncResult *result,
-                gpointer user_data)
+gboolean
+csm_manager_add_autostart_app (CsmManager *manager,
+                               const char *path,
+                               const char *provides)
 {
-    GInputStream *stream = G_INPUT_STREAM (source);
+        return add_autostart_app_internal (manager,
+                                           path,
+                                           NULL,
+                                           NULL,
+                                           provides,
+                                           FALSE);
+}
 
-    g_debug ("Session quit dialog read output");
+/**
+ * csm_manager_add_required_app:
+ * @manager: a #CsmManager
+ * @path: Path to desktop file
+ * @provides: What the component provides, as a space separated list
+ *
+ * Similar to csm_manager_add_autostart_app(), except marks the
+ * component as being required; we then try harder to ensure
+ * it's running and inform the user if we can't.
+ *
+ */
+gboolean
+csm_manager_add_required_app (CsmManager *manager,
+                              const char *path,
+                              const char *provides)
+{
+        return add_autostart_app_internal (manager,
+                                           path,
+                                           NULL,
+                                           NULL,
+                                           provides,
+                                           TRUE);
+}
 
-    gssize read = g_input_stream_read_finish (stream, result, NULL);
-    if (read > 0) {
-        g_debug ("Session quit dialog (self-owned) output: %.*s", (gint) read, (gchar *) user_data);
-    } else {
-        g_debug ("Session quit dialog (self-owned) stdout closed");
-        g_free (user_data);
-        g_input_stream_close (stream, NULL, NULL);
-        return;
-    }
 
-    g_input_stream_read_async (stream,
-                               user_data,
-                               1024,
-                               G_PRIORITY_DEFAULT,
-                               NULL,
-                               (GAsyncReadyCallback) on_dialog_read,
-                               user_data);
+typedef struct {
+        char            *path;
+        GDesktopAppInfo *app_info;
+        GVariant        *record;
+        /* only for apps from a startup plan */
+        char           **provides;
+        gboolean         is_required;
+} AutostartEntry;
+
+static void
+autostart_entry_free (AutostartEntry *entry)
+{
+        g_free (entry->path);
+        g_clear_object (&entry->app_info);
+        g_clear_pointer (&entry->record, g_variant_unref);
+        g_strfreev (entry->provides);
+        g_free (entry);
+}
+
+static void
+parse_autostart_entry (AutostartEntry *entry,
+                       gpointer        user_data)
+{
+        /* Runs in a worker thread; the app itself is built on the main
+         * thread since it exports itself on the bus and sets up monitors */
+        entry->app_info = csm_autostart_app_preparse (entry->path, &entry->record);
 }
 
 static void
-close_end_session_dialog (CsmManager *manager)
+collect_autostart_entries (CsmManager *manager,
+                           const char *path,
+                           GPtrArray  *entries)
 {
-    g_debug ("Closing end session dialog");
+        GDir       *dir;
+        const char *name;
 
-    if (dialog_process != NULL) {
-        g_subprocess_send_signal (dialog_process, SIGTERM);
-        return;
-    }
+        g_debug ("CsmManager: *** Adding autostart apps for %s", path);
 
-    // If Cinnamon has already left the bus (e.g. it crashed and we're tearing
-    // down), there's nothing to close. This uses cinnamon_proxy's cached name
-    // owner, which may lag behind a NameOwnerChanged we haven't dispatched yet -
-    // that's fine here, the session is ending regardless.
-    gchar *owner = g_dbus_proxy_get_name_owner (manager->priv->cinnamon_proxy);
-    if (owner == NULL) {
-        g_debug ("Cinnamon is not on the bus, nothing to close");
-        return;
-    }
-    g_free (owner);
+        dir = g_dir_open (path, 0, NULL);
+        if (dir == NULL) {
+                return;
+        }
 
-    GError *error = NULL;
-    GVariant *ret = NULL;
+        while ((name = g_dir_read_name (dir))) {
+                AutostartEntry *entry;
 
-    ret = g_dbus_proxy_call_sync (manager->priv->cinnamon_proxy,
-                                  "CloseEndSessionDialog",
-                                  NULL,
-                                  G_DBUS_CALL_FLAGS_NONE,
-                                  -1,
-                                  NULL,
-                                  &error);
+                if (!g_str_has_suffix (name, ".desktop") ||
+                    csm_manager_get_app_is_blacklisted (manager, name)) {
+                        continue;
+                }
 
-    if (error != NULL) {
-        g_critical ("Unable to close Cinnamon's end session dialog: %s", error->message);
-        g_error_free (error);
-    } else {
-        g_variant_unref (ret);
-    }
+                entry = g_new0 (AutostartEntry, 1);
+                entry->path = g_build_filename (path, name, NULL);
+                g_ptr_array_add (entries, entry);
+        }
+
+        g_dir_close (dir);
 }
 
 static void
-launch_gtk_dialog (CsmManager *manager,
-               DialogMode  mode)
+parse_autostart_entries (GPtrArray *entries)
 {
-    GError *error;
-    const gchar *flag;
-    g_debug ("Trying to launch fallback (Gtk) end-session dialog");
+        GThreadPool *pool;
+        GError      *error;
+        guint        i;
 
-    if (dialog_process != NULL) {
-        g_debug ("There's already a session-manager dialog");
-        return;
-    }
+        if (entries->len > 1) {
+                error = NULL;
+                pool = g_thread_pool_new ((GFunc) parse_autostart_entry,
+                                          NULL,
+                                          MIN (g_get_num_processors (), CSM_MANAGER_MAX_PARSE_THREADS),
+                                          FALSE,
+                                          &error);
+                if (pool == NULL) {
+                        /* Not fatal, the apps just get parsed below */
+                        g_warning ("Unable to create desktop file parser threads: %s", error->message);
+                        g_error_free (error);
+                } else {
+                        for (i = 0; i < entries->len; i++) {
+                                g_thread_pool_push (pool, g_ptr_array_index (entries, i), NULL);
+                        }
 
-    // If we're spawning the dialog and *already* in the query phase,
-    // we can assume something went wrong previously, so reset back
-    // to the RUNNING phase.
-    if (manager->priv->phase == CSM_MANAGER_PHASE_QUERY_END_SESSION) {
-        g_critical ("Session not in running phase, previous dialog may have exited unexpectedly");
-        cancel_end_session (manager);
-    }
+                        /* wait for all of them */
+                        g_thread_pool_free (pool, FALSE, TRUE);
+                }
+        }
+}
 
-    switch (mode) {
-        case DIALOG_MODE_LOGOUT:
-            flag = "--logout";
-            break;
-        case DIALOG_MODE_REBOOT:
-            flag = "--reboot";
-            break;
-        case DIALOG_MODE_SHUTDOWN:
-            flag = "--power-off";
-            
-            break;
-        default:
-            g_warning ("Unknown dialog mode: %d", mode);
-            return;
-    }
+/**
+ * csm_manager_add_autostart_apps_from_dirs:
+ * @manager: a #CsmManager
+ * @dirs: %NULL-terminated list of directories, highest precedence first
+ *
+ * Parses the desktop files of all @dirs on a pool of worker threads, then
+ * adds the resulting apps in directory order, so that the first directory
+ * providing an app id wins just as if they had been added one by one.
+ */
+void
+csm_manager_add_autostart_apps_from_dirs (CsmManager         *manager,
+                                          const char * const *dirs)
+{
+        GPtrArray *entries;
+        guint      i;
 
-    const gchar *argv[] = {
-        "cinnamon-session-quit",
-        "--sm-owned",
-        flag,
-        NULL
-    };
+        g_return_if_fail (CSM_IS_MANAGER (manager));
+        g_return_if_fail (dirs != NULL);
 
-    gboolean debugging = g_settings_get_boolean (manager->priv->settings, KEY_DEBUG);
-    GSubprocessFlags flags = G_SUBPROCESS_FLAGS_NONE;
+        entries = g_ptr_array_new_with_free_func ((GDestroyNotify) autostart_entry_free);
 
-    if (debugging) {
-        flags = G_SUBPROCESS_FLAGS_STDERR_PIPE;
-    }
+        for (i = 0; dirs[i] != NULL; i++) {
+                collect_autostart_entries (manager, dirs[i], entries);
+        }
 
-    error = NULL;
-    dialog_process = g_subprocess_newv (argv, flags, &error);
+        parse_autostart_entries (entries);
 
-    if (dialog_process == NULL) {
-        if (error != NULL) {
-            g_critical ("Failed to launch session-manager dialog: %s", error->message);
-            g_error_free (error);
-            return;
+        for (i = 0; i < entries->len; i++) {
+                AutostartEntry *entry = g_ptr_array_index (entries, i);
+
+                add_autostart_app_internal (manager,
+                                            entry->path,
+                                            entry->app_info,
+                                            entry->record,
+                                            NULL,
+                                            FALSE);
         }
-    }
 
-    if (debugging) {
-        GInputStream *stdout = g_subprocess_get_stderr_pipe (dialog_process);
-        guint8 *buffer = g_malloc (1024);
-        g_input_stream_read_async (G_INPUT_STREAM (stdout),
-                                   buffer,
-                                   1024,
-                                   G_PRIORITY_DEFAULT,
-                                   NULL,
-                                   (GAsyncReadyCallback) on_dialog_read,
-                                   buffer);
-    }
+        g_ptr_array_unref (entries);
+}
 
-    dialog_cancellable = g_cancellable_new ();
+static int
+compare_startup_apps (CsmApp *a,
+                      CsmApp *b)
+{
+        if (csm_app_peek_phase (a) != csm_app_peek_phase (b)) {
+                return csm_app_peek_phase (a) < csm_app_peek_phase (b) ? -1 : 1;
+        }
 
-    g_subprocess_wait_async (dialog_process,
-                              dialog_cancellable,
-                              (GAsyncReadyCallback) on_dialog_exited,
-                              manager);
+        return g_strcmp0 (csm_app_peek_app_id (a), csm_app_peek_app_id (b));
 }
 
-static gboolean
-launch_cinnamon_dialog (CsmManager  *manager,
-                        DialogMode   mode,
-                        GError     **error)
+/**
+ * csm_manager_get_startup_apps:
+ * @manager: a #CsmManager
+ *
+ * Returns: (transfer floating): the autostart apps added so far, as
+ *     an array of desktop file, whether the app is required and what it
+ *     provides for the session, in phase order. The phase is left out,
+ *     it comes from the desktop file, which the plan checks. See
+ *     csm_manager_add_startup_apps().
+ */
+GVariant *
+csm_manager_get_startup_apps (CsmManager *manager)
 {
-    GVariant *ret = NULL;
+        GVariantBuilder  builder;
+        GSList          *apps;
+        GSList          *l;
 
-    g_debug ("Requesting Cinnamon display its end-session dialog");
+        g_return_val_if_fail (CSM_IS_MANAGER (manager), NULL);
 
-    ret = g_dbus_proxy_call_sync (manager->priv->cinnamon_proxy,
-                                  "ShowEndSessionDialog",
-                                  g_variant_new ("(i)", mode),
-                                  G_DBUS_CALL_FLAGS_NONE,
-                                  -1,
-                                  NULL,
-                                  error);
+        apps = NULL;
+        csm_store_foreach (manager->priv->apps,
+                           (CsmStoreFunc)_collect_app,
+                           &apps);
+        apps = g_slist_sort (apps, (GCompareFunc) compare_startup_apps);
 
-    if (*error != NULL) {
-        return FALSE;
-    }
-    g_debug ("launch ret is: %p", ret);
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sbas)"));
 
-    g_variant_unref (ret);
+        for (l = apps; l != NULL; l = l->next) {
+                CsmApp  *app = l->data;
+                char    *path;
+                char   **provides;
 
-    return TRUE;
-}
+                if (!CSM_IS_AUTOSTART_APP (app)) {
+                        continue;
+                }
 
-static void
-show_end_session_dialog (CsmManager *manager,
-                         DialogMode  mode)
-{
-    GError *error = NULL;
-    
-    if (g_settings_get_boolean (manager->priv->settings, KEY_FORCE_GTK_END_SESSION)) {
-        g_debug ("Using Gtk end-session dialog based on settings.");
-        launch_gtk_dialog (manager, mode);
-        return;
-    }
+                g_object_get (app, "desktop-filename", &path, NULL);
+                provides = csm_autostart_app_get_session_provides (CSM_AUTOSTART_APP (app));
 
-    if (!launch_cinnamon_dialog (manager, mode, &error)) {
-        if (error->code == G_DBUS_ERROR_NAME_HAS_NO_OWNER) {
-            g_debug ("Cinnamon is not running, falling back to Gtk end-session dialog");
-        } else {
-            g_critical ("Failed to launch Cinnamon's end session dialog, falling back to Gtk end-session dialog: %s", error->message);
+                g_variant_builder_add (&builder, "(sb^as)",
+                                       path,
+                                       g_slist_find (manager->priv->required_apps, app) != NULL,
+                                       provides);
+
+                g_strfreev (provides);
+                g_free (path);
         }
 
-        g_error_free (error);
-        launch_gtk_dialog (manager, mode);
-    }
+        g_slist_free_full (apps, g_object_unref);
+
+        return g_variant_builder_end (&builder);
 }
 
-static void
-show_shutdown_dialog (CsmManager *manager,
-                      gboolean    is_reboot)
+/**
+ * csm_manager_add_startup_apps:
+ * @manager: a #CsmManager
+ * @apps: what csm_manager_get_startup_apps() returned for an earlier
+ *     login
+ *
+ * Adds @apps without resolving them again. Nothing is checked against
+ * the blacklist here: the plan is only used while the blacklisted files
+ * are the same as when it was saved.
+ */
+void
+csm_manager_add_startup_apps (CsmManager *manager,
+                              GVariant   *apps)
 {
-        if (manager->priv->phase > CSM_MANAGER_PHASE_QUERY_END_SESSION) {
-                /* Already shutting down, nothing more to do */
-                return;
-        }
+        GPtrArray    *entries;
+        GVariantIter  iter;
+        const char   *path;
+        char        **provides;
+        gboolean      is_required;
+        guint         i;
 
-        manager->priv->logout_mode = CSM_MANAGER_LOGOUT_MODE_NORMAL;
+        g_return_if_fail (CSM_IS_MANAGER (manager));
+        g_return_if_fail (g_variant_is_of_type (apps, G_VARIANT_TYPE ("a(sbas)")));
 
-        show_end_session_dialog (manager, is_reboot ? DIALOG_MODE_REBOOT : DIALOG_MODE_SHUTDOWN);
-}
+        entries = g_ptr_array_new_with_free_func ((GDestroyNotify) autostart_entry_free);
 
-static void
-show_logout_dialog (CsmManager *manager)
-{
-        if (manager->priv->phase > CSM_MANAGER_PHASE_QUERY_END_SESSION) {
-                /* Already shutting down, nothing more to do */
-                return;
+        g_variant_iter_init (&iter, apps);
+        while (g_variant_iter_next (&iter, "(&sb^as)", &path, &is_required, &provides)) {
+                AutostartEntry *entry;
+
+                entry = g_new0 (AutostartEntry, 1);
+                entry->path = g_strdup (path);
+                entry->provides = provides;
+                entry->is_required = is_required;
+                g_ptr_array_add (entries, entry);
         }
 
-        manager->priv->logout_mode = CSM_MANAGER_LOGOUT_MODE_NORMAL;
+        parse_autostart_entries (entries);
 
-        show_end_session_dialog (manager, DIALOG_MODE_LOGOUT);
+        for (i = 0; i < entries->len; i++) {
+                AutostartEntry *entry = g_ptr_array_index (entries, i);
+                CsmApp         *app;
+                int             j;
+
+                app = csm_autostart_app_new_for_app_info (entry->path, entry->app_info, entry->record);
+                if (app == NULL) {
+                        continue;
+                }
+
+                for (j = 0; entry->provides[j] != NULL; j++) {
+                        csm_autostart_app_add_provides (CSM_AUTOSTART_APP (app), entry->provides[j]);
+                }
+
+                g_debug ("CsmManager: read %s", entry->path);
+                append_app (manager, app, NULL, entry->is_required);
+                g_object_unref (app);
+        }
+
+        g_ptr_array_unref (entries);
 }
 
-static void
-user_logout (CsmManager           *manager,
-             CsmManagerLogoutMode  mode)
+gboolean
+csm_manager_add_autostart_apps_from_dir (CsmManager *manager,
+                                         const char *path)
 {
-        gboolean logout_prompt;
+        const char *dirs[] = { path, NULL };
 
-        if (manager->priv->phase >= CSM_MANAGER_PHASE_QUERY_END_SESSION) {
-                /* Already shutting down, nothing more to do */
-                return;
+        g_return_val_if_fail (CSM_IS_MANAGER (manager), FALSE);
+        g_return_val_if_fail (path != NULL, FALSE);
+
+        if (!g_file_test (path, G_FILE_TEST_IS_DIR)) {
+                return FALSE;
         }
 
-        logout_prompt = g_settings_get_boolean (manager->priv->settings,
-                                                KEY_LOGOUT_PROMPT);
+        csm_manager_add_autostart_apps_from_dirs (manager, dirs);
 
-        /* If the shell isn't running, and this isn't a non-interative logout request,
-         * and the user has their settings configured to show a confirmation dialog for
-         * logout, then go ahead and show the fallback confirmation dialog now.
-         *
-         * If the shell is running, then the confirmation dialog and inhibitor dialog are
-         * combined, so we'll show it at a later stage in the logout process.
-         */
-        if (mode == CSM_MANAGER_LOGOUT_MODE_NORMAL && logout_prompt) {
-                show_logout_dialog (manager);
-        } else {
-                request_logout (manager, mode);
+        return TRUE;
+}
+
+/* Autostart directory hot-reload.
+ *
+ * Once the session runs, desktop files added to, removed from or changed
+ * in the autostart directories are applied to the running session: new
+ * apps are started, apps whose file went away, got shadowed or
+ * blacklisted are stopped, and changed apps are read again, restarting
+ * them if they were running and starting them if they were disabled
+ * until now.  Bursts of changes, like a package install, are coalesced
+ * into one pass.
+ */
+
+static gint64
+get_autostart_file_mtime (const char *path)
+{
+        GStatBuf buf;
+
+        if (g_stat (path, &buf) != 0) {
+                return -1;
         }
-}
 
-/*
-  dbus-send --session --type=method_call --print-reply
-      --dest=org.gnome.SessionManager
-      /org/gnome/SessionManager
-      org.freedesktop.DBus.Introspectable.Introspect
-*/
+        return (gint64) buf.st_mtim.tv_sec * G_USEC_PER_SEC + buf.st_mtim.tv_nsec / 1000;
+}
 
-gboolean
-csm_manager_set_phase (CsmManager      *manager,
-                       CsmManagerPhase  phase)
+static void
+remember_autostart_file_mtime (CsmManager *manager,
+                               const char *path)
 {
-        g_return_val_if_fail (CSM_IS_MANAGER (manager), FALSE);
-        manager->priv->phase = phase;
-        return (TRUE);
+        gint64 *mtime;
+
+        mtime = g_new (gint64, 1);
+        *mtime = get_autostart_file_mtime (path);
+        g_hash_table_replace (manager->priv->autostart_mtimes, g_strdup (path), mtime);
 }
 
-static gboolean
-_log_out_is_locked_down (CsmManager *manager)
+/* Returns the desktop file of @app if it was read from one of the
+ * watched autostart dirs */
+static char *
+get_watched_autostart_file (CsmManager *manager,
+                            CsmApp     *app)
 {
-        return g_settings_get_boolean (manager->priv->lockdown_settings,
-                                       KEY_DISABLE_LOG_OUT);
+        char *path;
+        char *dirname;
+
+        if (!CSM_IS_AUTOSTART_APP (app)) {
+                return NULL;
+        }
+
+        g_object_get (app, "desktop-filename", &path, NULL);
+        if (path == NULL) {
+                return NULL;
+        }
+
+        dirname = g_path_get_dirname (path);
+        if (!g_strv_contains ((const char * const *) manager->priv->autostart_dirs, dirname)) {
+                g_clear_pointer (&path, g_free);
+        }
+        g_free (dirname);
+
+        return path;
 }
 
-static gboolean
-_switch_user_is_locked_down (CsmManager *manager)
+static void
+remove_autostart_app (CsmManager *manager,
+                      CsmApp     *app)
 {
-        return g_settings_get_boolean (manager->priv->lockdown_settings,
-                                       KEY_DISABLE_USER_SWITCHING);
-}
+        CsmClient *client;
+
+        g_debug ("CsmManager: removing app %s", csm_app_peek_app_id (app));
+
+        client = find_client_for_startup_id (manager, csm_app_peek_startup_id (app));
+        stop_app_or_client (manager, app, client);
+
+        g_signal_handlers_disconnect_by_data (app, manager);
+
+        if (g_queue_remove (&manager->priv->launch_queue, app)) {
+                g_object_unref (app);
+        }
+        g_hash_table_remove (manager->priv->launch_in_flight, app);
+        g_hash_table_remove (manager->priv->launch_times, app);
+        g_hash_table_remove (manager->priv->late_apps, app);
+        g_hash_table_remove (manager->priv->dag_visited, app);
+        g_hash_table_remove (manager->priv->dag_settled, app);
 
+        csm_store_remove (manager->priv->apps, csm_app_peek_id (app));
+}
 
 static void
-append_app (CsmManager *manager,
-            CsmApp     *app,
-            const char *provides,
-            gboolean    is_required)
+start_added_autostart_app (CsmManager *manager,
+                           CsmApp     *app)
 {
-        const char *id;
-        const char *app_id;
-        CsmApp     *dup;
+        int delay;
 
-        id = csm_app_peek_id (app);
-        if (IS_STRING_EMPTY (id)) {
-                g_debug ("CsmManager: not adding app: no id");
-                return;
-        }
+        g_debug ("CsmManager: added app %s", csm_app_peek_app_id (app));
 
-        dup = (CsmApp *)csm_store_lookup (manager->priv->apps, id);
-        if (dup != NULL) {
-                g_debug ("CsmManager: not adding app: already added");
+        g_signal_connect (app,
+                          "condition-changed",
+                          G_CALLBACK (app_condition_changed),
+                          manager);
+
+        if (csm_app_peek_is_disabled (app)
+            || csm_app_peek_is_conditionally_disabled (app)) {
                 return;
         }
 
-        app_id = csm_app_peek_app_id (app);
-        if (IS_STRING_EMPTY (app_id)) {
-                g_debug ("CsmManager: not adding app: no app-id");
+        delay = csm_app_peek_autostart_delay (app);
+        if (delay > 0) {
+                g_timeout_add_seconds (delay,
+                                       (GSourceFunc)_autostart_delay_timeout,
+                                       g_object_ref (app));
                 return;
         }
 
-        dup = find_app_for_app_id (manager, app_id);
-        if (dup != NULL) {
-                g_debug ("CsmManager: not adding app: app-id '%s' already exists", app_id);
+        start_app_or_warn (manager, app);
+}
 
-                if (provides && CSM_IS_AUTOSTART_APP (dup))
-                        csm_autostart_app_add_provides (CSM_AUTOSTART_APP (dup), provides);
+static void
+reload_autostart_apps (CsmManager *manager)
+{
+        GPtrArray  *entries;
+        GHashTable *wanted;
+        GHashTable *known;
+        GHashTable *restart;
+        GSList     *apps;
+        GSList     *l;
+        guint       i;
 
-                if (is_required &&
-                    !g_slist_find (manager->priv->required_apps, dup)) {
-                        g_debug ("CsmManager: making app '%s' required", csm_app_peek_app_id (dup));
-                        manager->priv->required_apps = g_slist_prepend (manager->priv->required_apps, dup);
-                }
+        g_debug ("CsmManager: *** Reloading autostart apps");
 
-                return;
-        }
+        manager->priv->autostart_reload_pending = FALSE;
 
-        csm_store_add (manager->priv->apps, id, G_OBJECT (app));
-        if (is_required) {
-                g_debug ("CsmManager: adding required app %s", csm_app_peek_app_id (app));
-                manager->priv->required_apps = g_slist_prepend (manager->priv->required_apps, app);
+        /* app id => desktop file, the first directory wins */
+        entries = g_ptr_array_new_with_free_func ((GDestroyNotify) autostart_entry_free);
+        for (i = 0; manager->priv->autostart_dirs[i] != NULL; i++) {
+                collect_autostart_entries (manager, manager->priv->autostart_dirs[i], entries);
         }
-}
 
-static gboolean
-add_autostart_app_internal (CsmManager *manager,
-                            const char *path,
-                            const char *provides,
-                            gboolean    is_required)
-{
-        CsmApp  *app;
-        char   **internal_provides;
+        wanted = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+        for (i = 0; i < entries->len; i++) {
+                AutostartEntry *entry = g_ptr_array_index (entries, i);
+                char           *app_id;
 
-        g_return_val_if_fail (CSM_IS_MANAGER (manager), FALSE);
-        g_return_val_if_fail (path != NULL, FALSE);
+                app_id = g_path_get_basename (entry->path);
+                if (g_hash_table_contains (wanted, app_id)) {
+                        g_free (app_id);
+                        continue;
+                }
 
-        /* Note: if we cannot add the app because its service is already
-         * provided, because its app-id is taken, or because of any other
-         * reason meaning there is already an app playing its role, then we
-         * should make sure that relevant properties (like
-         * provides/is_required) are set in the pre-existing app if needed. */
+                g_hash_table_insert (wanted, app_id, g_strdup (entry->path));
+        }
+        g_ptr_array_unref (entries);
 
-        /* first check to see if service is already provided */
-        if (provides != NULL) {
-                CsmApp *dup;
+        /* the autostart apps there were before, and the replaced ones
+         * that were running or have been disabled until now */
+        known = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+        restart = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 
-                dup = (CsmApp *)csm_store_find (manager->priv->apps,
-                                                (CsmStoreFunc)_find_app_provides,
-                                                (char *)provides);
-                if (dup != NULL) {
-                        g_debug ("CsmManager: service '%s' is already provided", provides);
+        apps = NULL;
+        csm_store_foreach (manager->priv->apps,
+                           (CsmStoreFunc)_collect_app,
+                           &apps);
+
+        for (l = apps; l != NULL; l = l->next) {
+                CsmApp     *app = l->data;
+                const char *app_id;
+                const char *wanted_path;
+                char       *path;
+                gint64     *mtime;
+
+                path = get_watched_autostart_file (manager, app);
+                if (path == NULL) {
+                        continue;
+                }
 
-                        if (is_required &&
-                            !g_slist_find (manager->priv->required_apps, dup)) {
-                                g_debug ("CsmManager: making app '%s' required", csm_app_peek_app_id (dup));
-                                manager->priv->required_apps = g_slist_prepend (manager->priv->required_apps, dup);
-                        }
+                app_id = csm_app_peek_app_id (app);
+                wanted_path = g_hash_table_lookup (wanted, app_id);
+                mtime = g_hash_table_lookup (manager->priv->autostart_mtimes, path);
 
-                        return FALSE;
+                g_hash_table_add (known, g_strdup (app_id));
+
+                if (g_strcmp0 (wanted_path, path) == 0
+                    && mtime != NULL
+                    && *mtime == get_autostart_file_mtime (path)) {
+                        /* unchanged */
+                        g_hash_table_remove (wanted, app_id);
+                } else if (g_slist_find (manager->priv->required_apps, app) != NULL) {
+                        g_debug ("CsmManager: not reloading required app %s", app_id);
+                        g_hash_table_remove (wanted, app_id);
+                } else {
+                        /* Reread from the new contents; finished one-shots
+                         * that stay enabled aren't started again */
+                        if (wanted_path != NULL
+                            && (csm_app_is_running (app) || csm_app_peek_is_disabled (app))) {
+                                g_hash_table_add (restart, g_strdup (app_id));
+                        }
+                        remove_autostart_app (manager, app);
                 }
+
+                g_free (path);
         }
+        g_slist_free_full (apps, g_object_unref);
 
-        app = csm_autostart_app_new (path);
+        /* What is left is new, or replaces what was removed above; only the
+         * new ones and the replacements of running apps are started */
+        apps = NULL;
+        for (i = 0; manager->priv->autostart_dirs[i] != NULL; i++) {
+                GHashTableIter iter;
+                const char    *app_id;
+                const char    *path;
+                char          *dirname;
 
-        if (app == NULL) {
-                return FALSE;
-        }
+                g_hash_table_iter_init (&iter, wanted);
+                while (g_hash_table_iter_next (&iter, (gpointer *) &app_id, (gpointer *) &path)) {
+                        CsmApp *app;
 
-        internal_provides = csm_app_get_provides (app);
-        if (internal_provides) {
-                int i;
-                gboolean provided = FALSE;
+                        /* keep the precedence of the directories for provides */
+                        dirname = g_path_get_dirname (path);
+                        if (strcmp (dirname, manager->priv->autostart_dirs[i]) != 0) {
+                                g_free (dirname);
+                                continue;
+                        }
+                        g_free (dirname);
 
-                for (i = 0; internal_provides[i] != NULL; i++) {
-                        CsmApp *dup;
+                        remember_autostart_file_mtime (manager, path);
 
-                        dup = (CsmApp *)csm_store_find (manager->priv->apps,
-                                                        (CsmStoreFunc)_find_app_provides,
-                                                        (char *)internal_provides[i]);
-                        if (dup != NULL) {
-                                g_debug ("CsmManager: service '%s' is already provided", internal_provides[i]);
+                        if (find_app_for_app_id (manager, app_id) != NULL) {
+                                /* from the saved session or a required component */
+                                continue;
+                        }
 
-                                if (is_required &&
-                                    !g_slist_find (manager->priv->required_apps, dup)) {
-                                        g_debug ("CsmManager: making app '%s' required", csm_app_peek_app_id (dup));
-                                        manager->priv->required_apps = g_slist_prepend (manager->priv->required_apps, dup);
-                                }
+                        if (!add_autostart_app_internal (manager, path, NULL, NULL, NULL, FALSE)) {
+                                continue;
+                        }
 
-                                provided = TRUE;
-                                break;
+                        app = find_app_for_app_id (manager, app_id);
+                        if (app != NULL
+                            && (!g_hash_table_contains (known, app_id)
+                                || g_hash_table_contains (restart, app_id))) {
+                                apps = g_slist_prepend (apps, app);
                         }
                 }
+        }
 
-                g_strfreev (internal_provides);
+        for (l = g_slist_reverse (apps); l != NULL; l = l->next) {
+                start_added_autostart_app (manager, l->data);
+        }
 
-                if (provided) {
-                        g_object_unref (app);
-                        return FALSE;
-                }
+        g_slist_free (apps);
+        g_hash_table_unref (restart);
+        g_hash_table_unref (known);
+        g_hash_table_unref (wanted);
+}
+
+static gboolean
+on_autostart_reload_timeout (CsmManager *manager)
+{
+        manager->priv->autostart_reload_id = 0;
+
+        if (manager->priv->phase < CSM_MANAGER_PHASE_RUNNING) {
+                /* see start_phase () */
+                manager->priv->autostart_reload_pending = TRUE;
+        } else if (manager->priv->phase == CSM_MANAGER_PHASE_RUNNING) {
+                reload_autostart_apps (manager);
         }
 
-        if (provides)
-                csm_autostart_app_add_provides (CSM_AUTOSTART_APP (app), provides);
+        return FALSE;
+}
 
-        g_debug ("CsmManager: read %s", path);
-        append_app (manager, app, provides, is_required);
-        g_object_unref (app);
+static void
+queue_autostart_reload (CsmManager *manager)
+{
+        if (manager->priv->autostart_dirs == NULL) {
+                return;
+        }
 
-        return TRUE;
+        if (manager->priv->autostart_reload_id > 0) {
+                g_source_remove (manager->priv->autostart_reload_id);
+        }
+
+        manager->priv->autostart_reload_id = g_timeout_add (CSM_MANAGER_AUTOSTART_RELOAD_DELAY,
+                                                            (GSourceFunc) on_autostart_reload_timeout,
+                                                            manager);
 }
 
-gboolean
-csm_manager_add_autostart_app (CsmManager *manager,
-                               const char *path,
-                               const char *provides)
+static gboolean
+is_desktop_file (GFile *file)
 {
-        return add_autostart_app_internal (manager,
-                                           path,
-                                           provides,
-                                           FALSE);
+        char    *basename;
+        gboolean res;
+
+        basename = g_file_get_basename (file);
+        res = g_str_has_suffix (basename, ".desktop");
+        g_free (basename);
+
+        return res;
+}
+
+static void
+on_autostart_dir_changed (GFileMonitor      *monitor,
+                          GFile             *file,
+                          GFile             *other_file,
+                          GFileMonitorEvent  event,
+                          CsmManager        *manager)
+{
+        switch (event) {
+        case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+        case G_FILE_MONITOR_EVENT_CREATED:
+        case G_FILE_MONITOR_EVENT_DELETED:
+        case G_FILE_MONITOR_EVENT_MOVED_IN:
+        case G_FILE_MONITOR_EVENT_MOVED_OUT:
+                break;
+        case G_FILE_MONITOR_EVENT_RENAMED:
+                if (is_desktop_file (other_file)) {
+                        queue_autostart_reload (manager);
+                        return;
+                }
+                break;
+        default:
+                /* Ignore any other monitor event */
+                return;
+        }
+
+        if (is_desktop_file (file)) {
+                queue_autostart_reload (manager);
+        }
 }
 
 /**
- * csm_manager_add_required_app:
+ * csm_manager_watch_autostart_dirs:
  * @manager: a #CsmManager
- * @path: Path to desktop file
- * @provides: What the component provides, as a space separated list
- *
- * Similar to csm_manager_add_autostart_app(), except marks the
- * component as being required; we then try harder to ensure
- * it's running and inform the user if we can't.
+ * @dirs: %NULL-terminated list of directories, highest precedence first
  *
+ * Applies changes to the desktop files in @dirs, which the autostart apps
+ * have been added from, to the running session.
  */
-gboolean
-csm_manager_add_required_app (CsmManager *manager,
-                              const char *path,
-                              const char *provides)
-{
-        return add_autostart_app_internal (manager,
-                                           path,
-                                           provides,
-                                           TRUE);
-}
-
-
-gboolean
-csm_manager_add_autostart_apps_from_dir (CsmManager *manager,
-                                         const char *path)
+void
+csm_manager_watch_autostart_dirs (CsmManager         *manager,
+                                  const char * const *dirs)
 {
-        GDir       *dir;
-        const char *name;
+        GSList *apps;
+        GSList *l;
+        guint   i;
 
-        g_return_val_if_fail (CSM_IS_MANAGER (manager), FALSE);
-        g_return_val_if_fail (path != NULL, FALSE);
+        g_return_if_fail (CSM_IS_MANAGER (manager));
+        g_return_if_fail (dirs != NULL);
+        g_return_if_fail (manager->priv->autostart_dirs == NULL);
 
-        g_debug ("CsmManager: *** Adding autostart apps for %s", path);
+        manager->priv->autostart_dirs = g_strdupv ((char **) dirs);
+        manager->priv->autostart_monitors = g_ptr_array_new_with_free_func (g_object_unref);
+        manager->priv->autostart_mtimes = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                                 g_free, g_free);
 
-        dir = g_dir_open (path, 0, NULL);
-        if (dir == NULL) {
-                return FALSE;
-        }
+        for (i = 0; dirs[i] != NULL; i++) {
+                GFileMonitor *monitor;
+                GFile        *dir;
+                GError       *error;
 
-        while ((name = g_dir_read_name (dir))) {
-                char *desktop_file;
+                error = NULL;
+                dir = g_file_new_for_path (dirs[i]);
+                monitor = g_file_monitor_directory (dir, G_FILE_MONITOR_WATCH_MOVES, NULL, &error);
+                g_object_unref (dir);
 
-                if (!g_str_has_suffix (name, ".desktop") ||
-                    csm_manager_get_app_is_blacklisted (manager, name)) {
+                if (monitor == NULL) {
+                        g_warning ("Unable to monitor %s: %s", dirs[i], error->message);
+                        g_error_free (error);
                         continue;
                 }
 
-                desktop_file = g_build_filename (path, name, NULL);
-                csm_manager_add_autostart_app (manager, desktop_file, NULL);
-                g_free (desktop_file);
+                g_signal_connect (monitor, "changed",
+                                  G_CALLBACK (on_autostart_dir_changed),
+                                  manager);
+                g_ptr_array_add (manager->priv->autostart_monitors, monitor);
         }
 
-        g_dir_close (dir);
-
-        return TRUE;
+        /* what has been loaded so far */
+        apps = NULL;
+        csm_store_foreach (manager->priv->apps,
+                           (CsmStoreFunc)_collect_app,
+                           &apps);
+        for (l = apps; l != NULL; l = l->next) {
+                char *path;
+
+                path = get_watched_autostart_file (manager, l->data);
+                if (path != NULL) {
+                        remember_autostart_file_mtime (manager, path);
+                        g_free (path);
+                }
+        }
+        g_slist_free_full (apps, g_object_unref);
 }
 
 
+static void
+on_polkit_agent_setting_changed (GSettings  *settings,
+                                 const char *key,
+                                 CsmManager *manager)
+{
+    manager->priv->internal_polkit_agent = g_settings_get_boolean (settings, KEY_ENABLE_POLKIT_AGENT);
+}
+
 static gboolean
-mate_polkit_agent_should_be_skipped (const char *name)
+mate_polkit_agent_should_be_skipped (CsmManager *manager,
+                                     const char *name)
 {
     /* /etc/xdg/autostart launches the MATE polkit agent unconditionally, but
      * it only makes sense as an X11 fallback when our own agent is disabled.
@@ -4444,17 +6470,24 @@ mate_polkit_agent_should_be_skipped (const char *name)
      * polkitd, and adds log noise at startup; on Wayland it's useless either
      * way. cinnamon-launcher still starts it by hand when it drops to the
      * fallback MATE panel, then kills it when restarting Cinnamon. */
-    if (g_strstr_len (name, -1, POLKIT_MATE_AGENT_ID) == NULL)
+    if (strstr (name, POLKIT_MATE_AGENT_ID) == NULL)
         return FALSE;
 
     if (csm_util_is_wayland_session ())
         return TRUE;
 
-    GSettings *settings = g_settings_new (CINNAMON_SCHEMA);
-    gboolean internal_agent_enabled = g_settings_get_boolean (settings, KEY_ENABLE_POLKIT_AGENT);
-    g_object_unref (settings);
+    if (manager->priv->cinnamon_settings == NULL) {
+        manager->priv->cinnamon_settings = g_settings_new (CINNAMON_SCHEMA);
+        g_signal_connect (manager->priv->cinnamon_settings,
+                          "changed::" KEY_ENABLE_POLKIT_AGENT,
+                          G_CALLBACK (on_polkit_agent_setting_changed),
+                          manager);
+        on_polkit_agent_setting_changed (manager->priv->cinnamon_settings,
+                                         KEY_ENABLE_POLKIT_AGENT,
+                                         manager);
+    }
 
-    return internal_agent_enabled;
+    return manager->priv->internal_polkit_agent;
 }
 
 gboolean
@@ -4463,30 +6496,10 @@ csm_manager_get_app_is_blacklisted (CsmManager *manager,
 {
     g_return_val_if_fail (CSM_IS_MANAGER (manager), FALSE);
 
-    if (mate_polkit_agent_should_be_skipped (name))
+    if (mate_polkit_agent_should_be_skipped (manager, name))
         return TRUE;
 
-    gchar **gs_blacklist = g_settings_get_strv(manager->priv->settings, KEY_BLACKLIST);
-    GList *list = NULL;
-    gboolean ret = FALSE;
-
-    int i;
-    for (i = 0; i < g_strv_length (gs_blacklist); i++)
-        list = g_list_append (list, g_strdup (gs_blacklist[i]));
-
-    GList *l;
-
-    for (l = list; l != NULL; l = l->next) {
-        gchar *ptr = g_strstr_len (name, -1, l->data);
-        if (ptr != NULL) {
-            ret = TRUE;
-            break;
-        }
-    }
-
-    g_list_free_full (list, g_free);
-    g_strfreev (gs_blacklist);
-    return ret;
+    return csm_substring_matcher_match (manager->priv->blacklist, name);
 }
 
 gboolean
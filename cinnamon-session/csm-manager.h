@@ -124,6 +124,8 @@ CsmManager *        csm_manager_get                            (void);
 
 gboolean            csm_manager_get_failsafe                   (CsmManager     *manager);
 
+const char *        csm_manager_peek_session_name              (CsmManager     *manager);
+
 gboolean            csm_manager_add_autostart_app              (CsmManager     *manager,
                                                                 const char     *path,
                                                                 const char     *provides);
@@ -132,6 +134,13 @@ gboolean            csm_manager_add_required_app               (CsmManager     *
                                                                 const char     *provides);
 gboolean            csm_manager_add_autostart_apps_from_dir    (CsmManager     *manager,
                                                                 const char     *path);
+void                csm_manager_add_autostart_apps_from_dirs   (CsmManager     *manager,
+                                                                const char * const *dirs);
+void                csm_manager_watch_autostart_dirs           (CsmManager     *manager,
+                                                                const char * const *dirs);
+GVariant *          csm_manager_get_startup_apps               (CsmManager     *manager);
+void                csm_manager_add_startup_apps               (CsmManager     *manager,
+                                                                GVariant       *apps);
 gboolean            csm_manager_add_legacy_session_apps        (CsmManager     *manager,
                                                                 const char     *path);
 
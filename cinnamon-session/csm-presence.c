@@ -45,6 +45,10 @@
 
 #define MAX_STATUS_TEXT 140
 
+/* How long idle has to stay enabled before the idle watch is re-added,
+ * so that inhibitors coming and going don't keep re-adding it */
+#define CSM_PRESENCE_IDLE_REARM_DELAY 1000 /* milliseconds */
+
 #define CSM_PRESENCE_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), CSM_TYPE_PRESENCE, CsmPresencePrivate))
 
 struct CsmPresencePrivate
@@ -55,6 +59,7 @@ struct CsmPresencePrivate
         gboolean          idle_enabled;
         GnomeIdleMonitor *idle_monitor;
         guint             idle_watch_id;
+        guint             idle_rearm_id;
         guint             idle_timeout;
         gboolean          screensaver_active;
         GDBusConnection  *connection;
@@ -198,6 +203,11 @@ idle_became_active_cb (GnomeIdleMonitor *idle_monitor,
 static void
 reset_idle_watch (CsmPresence  *presence)
 {
+        if (presence->priv->idle_rearm_id > 0) {
+                g_source_remove (presence->priv->idle_rearm_id);
+                presence->priv->idle_rearm_id = 0;
+        }
+
         if (presence->priv->idle_watch_id > 0) {
                 g_debug ("CsmPresence: removing idle watch (%i)", presence->priv->idle_watch_id);
                 gnome_idle_monitor_remove_watch (presence->priv->idle_monitor,
@@ -218,6 +228,34 @@ reset_idle_watch (CsmPresence  *presence)
         }
 }
 
+static gboolean
+on_idle_rearm_timeout (CsmPresence *presence)
+{
+        presence->priv->idle_rearm_id = 0;
+
+        reset_idle_watch (presence);
+
+        return FALSE;
+}
+
+/* Removing the watch can't wait, re-adding it can */
+static void
+queue_reset_idle_watch (CsmPresence *presence)
+{
+        if (!presence->priv->idle_enabled) {
+                reset_idle_watch (presence);
+                return;
+        }
+
+        if (presence->priv->idle_watch_id > 0 || presence->priv->idle_rearm_id > 0) {
+                return;
+        }
+
+        presence->priv->idle_rearm_id = g_timeout_add (CSM_PRESENCE_IDLE_REARM_DELAY,
+                                                       (GSourceFunc) on_idle_rearm_timeout,
+                                                       presence);
+}
+
 static void
 on_screensaver_g_signal (GDBusProxy  *proxy,
                          gchar       *sender_name,
@@ -436,7 +474,7 @@ csm_presence_set_idle_enabled (CsmPresence  *presence,
 
         if (presence->priv->idle_enabled != enabled) {
                 presence->priv->idle_enabled = enabled;
-                reset_idle_watch (presence);
+                queue_reset_idle_watch (presence);
                 g_object_notify (G_OBJECT (presence), "idle-enabled");
 
         }
@@ -506,6 +544,11 @@ csm_presence_finalize (GObject *object)
 {
         CsmPresence *presence = (CsmPresence *) object;
 
+        if (presence->priv->idle_rearm_id > 0) {
+                g_source_remove (presence->priv->idle_rearm_id);
+                presence->priv->idle_rearm_id = 0;
+        }
+
         if (presence->priv->idle_watch_id > 0) {
                 gnome_idle_monitor_remove_watch (presence->priv->idle_monitor,
                                                  presence->priv->idle_watch_id);
@@ -0,0 +1,299 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * csm-readahead.c
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#include "config.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "csm-readahead.h"
+#include "csm-util.h"
+
+#define CSM_READAHEAD_SAMPLE_INTERVAL 1 /* seconds */
+#define CSM_READAHEAD_MAX_FILES       4096
+
+/* from linux/ioprio.h, which isn't always installed */
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_BE    2
+#define IOPRIO_CLASS_SHIFT 13
+
+static char       *profile_filename = NULL;
+static GArray     *pids = NULL;
+static GPtrArray  *files = NULL;
+static GHashTable *seen = NULL;
+static guint       sample_id = 0;
+
+static char *
+get_profile_filename (const char *session_name)
+{
+        const char *cache_dir;
+        char       *name;
+        char       *filename;
+
+        cache_dir = csm_util_get_cache_dir ();
+        if (cache_dir == NULL || IS_STRING_EMPTY (session_name)) {
+                return NULL;
+        }
+
+        name = g_strdup_printf ("readahead-%s", session_name);
+        g_strdelimit (name, "/", '_');
+        filename = g_build_filename (cache_dir, name, NULL);
+        g_free (name);
+
+        return filename;
+}
+
+static gpointer
+prefetch_files (char **paths)
+{
+        guint count;
+        int   i;
+
+        /* Only fill in for the login itself, never compete with it */
+        setpriority (PRIO_PROCESS, (id_t) syscall (SYS_gettid), 19);
+#ifdef SYS_ioprio_set
+        syscall (SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+                 (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | 7);
+#endif
+
+        count = 0;
+        for (i = 0; paths[i] != NULL; i++) {
+                struct stat buf;
+                int         fd;
+
+                if (paths[i][0] != '/') {
+                        continue;
+                }
+
+                fd = open (paths[i], O_RDONLY | O_CLOEXEC | O_NOCTTY);
+                if (fd < 0) {
+                        continue;
+                }
+
+                if (fstat (fd, &buf) == 0 && S_ISREG (buf.st_mode)) {
+                        posix_fadvise (fd, 0, 0, POSIX_FADV_WILLNEED);
+                        count++;
+                }
+
+                close (fd);
+        }
+
+        g_debug ("CsmReadahead: prefetched %u files", count);
+
+        g_strfreev (paths);
+
+        return NULL;
+}
+
+static void
+add_file (const char *path)
+{
+        char *file;
+
+        if (files->len >= CSM_READAHEAD_MAX_FILES ||
+            g_hash_table_contains (seen, path)) {
+                return;
+        }
+
+        file = g_strdup (path);
+        g_ptr_array_add (files, file);
+        g_hash_table_add (seen, file);
+}
+
+/* Returns FALSE once the process is gone */
+static gboolean
+sample_pid (GPid pid)
+{
+        char  *maps;
+        char  *contents;
+        char **lines;
+        int    i;
+
+        maps = g_strdup_printf ("/proc/%d/maps", (int) pid);
+        if (!g_file_get_contents (maps, &contents, NULL, NULL)) {
+                g_free (maps);
+                return FALSE;
+        }
+        g_free (maps);
+
+        lines = g_strsplit (contents, "\n", -1);
+        g_free (contents);
+
+        /* address perms offset dev inode pathname */
+        for (i = 0; lines[i] != NULL; i++) {
+                const char *path;
+
+                path = strchr (lines[i], '/');
+                if (path == NULL ||
+                    g_str_has_prefix (path, "/dev/") ||
+                    g_str_has_suffix (path, " (deleted)")) {
+                        continue;
+                }
+
+                add_file (path);
+        }
+
+        g_strfreev (lines);
+
+        return TRUE;
+}
+
+static gboolean
+sample_pids (gpointer user_data)
+{
+        guint i;
+
+        for (i = pids->len; i > 0; i--) {
+                if (!sample_pid (g_array_index (pids, GPid, i - 1))) {
+                        g_array_remove_index_fast (pids, i - 1);
+                }
+        }
+
+        return TRUE;
+}
+
+/**
+ * csm_readahead_start:
+ * @session_name: the session being started
+ *
+ * Prefetches the files recorded for @session_name during the previous
+ * login from a low priority thread, and starts recording a new profile
+ * from the processes passed to csm_readahead_track_pid().
+ */
+void
+csm_readahead_start (const char *session_name)
+{
+        char    *contents;
+        GThread *thread;
+        GError  *error;
+
+        g_return_if_fail (profile_filename == NULL);
+
+        profile_filename = get_profile_filename (session_name);
+        if (profile_filename == NULL) {
+                return;
+        }
+
+        if (g_file_get_contents (profile_filename, &contents, NULL, NULL)) {
+                char **paths;
+
+                paths = g_strsplit (contents, "\n", -1);
+                g_free (contents);
+
+                error = NULL;
+                thread = g_thread_try_new ("csm-readahead",
+                                           (GThreadFunc) prefetch_files,
+                                           paths,
+                                           &error);
+                if (thread == NULL) {
+                        g_warning ("Unable to start readahead thread: %s", error->message);
+                        g_error_free (error);
+                        g_strfreev (paths);
+                } else {
+                        g_thread_unref (thread);
+                }
+        }
+
+        pids = g_array_new (FALSE, FALSE, sizeof (GPid));
+        files = g_ptr_array_new_with_free_func (g_free);
+        seen = g_hash_table_new (g_str_hash, g_str_equal);
+
+        sample_id = g_timeout_add_seconds (CSM_READAHEAD_SAMPLE_INTERVAL,
+                                           sample_pids,
+                                           NULL);
+}
+
+void
+csm_readahead_track_pid (GPid pid)
+{
+        if (pids == NULL || pid <= 0) {
+                return;
+        }
+
+        g_array_append_val (pids, pid);
+}
+
+/* To be called once @pid has been reaped, before it can be reused by an
+ * unrelated process */
+void
+csm_readahead_untrack_pid (GPid pid)
+{
+        guint i;
+
+        if (pids == NULL) {
+                return;
+        }
+
+        for (i = pids->len; i > 0; i--) {
+                if (g_array_index (pids, GPid, i - 1) == pid) {
+                        g_array_remove_index_fast (pids, i - 1);
+                }
+        }
+}
+
+/* Stops recording and saves what was recorded as the profile for the
+ * next login. */
+gboolean
+csm_readahead_finish (GError **error)
+{
+        GString  *str;
+        gboolean  res;
+        guint     i;
+
+        if (files == NULL) {
+                return TRUE;
+        }
+
+        g_source_remove (sample_id);
+        sample_id = 0;
+
+        sample_pids (NULL);
+
+        res = TRUE;
+
+        /* Keep the old profile if nothing could be sampled */
+        if (files->len > 0) {
+                str = g_string_new (NULL);
+                for (i = 0; i < files->len; i++) {
+                        g_string_append (str, g_ptr_array_index (files, i));
+                        g_string_append_c (str, '\n');
+                }
+
+                res = g_file_set_contents (profile_filename, str->str, str->len, error);
+                if (res) {
+                        g_debug ("CsmReadahead: recorded %u files in %s",
+                                 files->len, profile_filename);
+                }
+
+                g_string_free (str, TRUE);
+        }
+
+        g_clear_pointer (&seen, g_hash_table_unref);
+        g_clear_pointer (&files, g_ptr_array_unref);
+        g_clear_pointer (&pids, g_array_unref);
+
+        return res;
+}
@@ -0,0 +1,40 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * csm-readahead.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#ifndef __CSM_READAHEAD_H__
+#define __CSM_READAHEAD_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Per-session profile of the files mapped by autostart apps, prefetched
+ * on the next login */
+
+void        csm_readahead_start     (const char  *session_name);
+
+void        csm_readahead_track_pid (GPid         pid);
+
+void        csm_readahead_untrack_pid (GPid       pid);
+
+gboolean    csm_readahead_finish    (GError     **error);
+
+G_END_DECLS
+
+#endif /* __CSM_READAHEAD_H__ */
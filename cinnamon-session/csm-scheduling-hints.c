@@ -0,0 +1,214 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * csm-scheduling-hints.c
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "csm-scheduling-hints.h"
+
+/* by IOPRIO_CLASS_*, as systemd names them */
+static const char *io_scheduling_classes[] = {
+        "none",
+        "realtime",
+        "best-effort",
+        "idle"
+};
+
+/**
+ * csm_scheduling_hints_parse_nice:
+ * @str: a nice value, -20 to 19
+ * @nice: (out): the value
+ *
+ * Returns: %FALSE if @str isn't a valid nice value
+ */
+gboolean
+csm_scheduling_hints_parse_nice (const char *str,
+                                 int        *nice)
+{
+        char   *end;
+        gint64  value;
+
+        value = g_ascii_strtoll (str, &end, 10);
+        if (end == str || *end != '\0' || value < -20 || value > 19) {
+                return FALSE;
+        }
+
+        *nice = value;
+
+        return TRUE;
+}
+
+/**
+ * csm_scheduling_hints_parse_ioprio:
+ * @class_str: an I/O scheduling class as systemd names them, or ""
+ * @priority_str: a priority, 0 to 7, or ""
+ * @ioprio: (out): the value the ioprio_set syscall takes, 0 if both
+ *     are empty
+ *
+ * Like systemd, a priority alone means best-effort, and a class alone
+ * means the default priority of 4.
+ *
+ * Returns: %FALSE if either is invalid
+ */
+gboolean
+csm_scheduling_hints_parse_ioprio (const char *class_str,
+                                   const char *priority_str,
+                                   int        *ioprio)
+{
+        char   *end;
+        gint64  priority;
+        int     io_class;
+        guint   i;
+
+        io_class = 0;
+        if (class_str[0] != '\0') {
+                for (i = 1; i < G_N_ELEMENTS (io_scheduling_classes); i++) {
+                        if (strcmp (class_str, io_scheduling_classes[i]) == 0) {
+                                io_class = i;
+                                break;
+                        }
+                }
+
+                if (io_class == 0) {
+                        return FALSE;
+                }
+        }
+
+        priority = -1;
+        if (priority_str[0] != '\0') {
+                priority = g_ascii_strtoll (priority_str, &end, 10);
+                if (end == priority_str || *end != '\0' || priority < 0 || priority > 7) {
+                        return FALSE;
+                }
+        }
+
+        if (io_class == 0 && priority < 0) {
+                *ioprio = 0;
+                return TRUE;
+        }
+
+        if (io_class == 0) {
+                io_class = IOPRIO_CLASS_BE;
+        }
+
+        /* the idle class has no levels */
+        if (io_class == IOPRIO_CLASS_IDLE) {
+                priority = 0;
+        } else if (priority < 0) {
+                priority = 4;
+        }
+
+        *ioprio = (io_class << IOPRIO_CLASS_SHIFT) | priority;
+
+        return TRUE;
+}
+
+/**
+ * csm_scheduling_hints_parse_cpu_affinity:
+ * @str: CPU numbers and ranges like 0-3, separated by spaces or commas
+ * @mask: (out): the mask the sched_setaffinity syscall takes
+ * @mask_size: (out): the size of @mask in bytes
+ *
+ * Returns: %FALSE if @str is invalid or names no CPU
+ */
+gboolean
+csm_scheduling_hints_parse_cpu_affinity (const char  *str,
+                                         gulong     **mask,
+                                         gsize       *mask_size)
+{
+        GArray  *words;
+        char   **tokens;
+        gboolean valid;
+        int      i;
+
+        words = g_array_new (FALSE, TRUE, sizeof (gulong));
+        tokens = g_strsplit_set (str, " ,", -1);
+        valid = TRUE;
+
+        for (i = 0; valid && tokens[i] != NULL; i++) {
+                const char *range;
+                char       *end;
+                guint64     first;
+                guint64     last;
+                guint64     cpu;
+
+                if (tokens[i][0] == '\0') {
+                        continue;
+                }
+
+                first = g_ascii_strtoull (tokens[i], &end, 10);
+                last = first;
+                valid = end != tokens[i] && g_ascii_isdigit (tokens[i][0]);
+
+                if (valid && *end == '-') {
+                        range = end + 1;
+                        last = g_ascii_strtoull (range, &end, 10);
+                        valid = end != range && g_ascii_isdigit (range[0]);
+                }
+
+                valid = valid && *end == '\0' && first <= last && last < CSM_SCHEDULING_HINTS_MAX_CPUS;
+                if (!valid) {
+                        break;
+                }
+
+                for (cpu = first; cpu <= last; cpu++) {
+                        guint word;
+
+                        word = cpu / (8 * sizeof (gulong));
+                        if (word >= words->len) {
+                                g_array_set_size (words, word + 1);
+                        }
+                        g_array_index (words, gulong, word) |= 1UL << (cpu % (8 * sizeof (gulong)));
+                }
+        }
+
+        g_strfreev (tokens);
+
+        if (!valid || words->len == 0) {
+                g_array_unref (words);
+                return FALSE;
+        }
+
+        *mask_size = words->len * sizeof (gulong);
+        *mask = (gulong *) g_array_free (words, FALSE);
+
+        return TRUE;
+}
+
+/**
+ * csm_scheduling_hints_io_class_name:
+ * @ioprio: a value as the ioprio_get syscall returns it
+ *
+ * Returns: the name of the I/O scheduling class of @ioprio
+ */
+const char *
+csm_scheduling_hints_io_class_name (int ioprio)
+{
+        int io_class;
+
+        io_class = ioprio >> IOPRIO_CLASS_SHIFT;
+        if (io_class < 0 || io_class >= (int) G_N_ELEMENTS (io_scheduling_classes)) {
+                io_class = 0;
+        }
+
+        return io_scheduling_classes[io_class];
+}
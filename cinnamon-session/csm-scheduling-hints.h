@@ -0,0 +1,56 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * csm-scheduling-hints.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#ifndef __CSM_SCHEDULING_HINTS_H__
+#define __CSM_SCHEDULING_HINTS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Parsing of X-Cinnamon-Nice, X-Cinnamon-IOSchedulingClass,
+ * X-Cinnamon-IOSchedulingPriority and X-Cinnamon-CPUAffinity into what
+ * the kernel takes */
+
+/* from linux/ioprio.h, which isn't always installed */
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_BE    2
+#define IOPRIO_CLASS_IDLE  3
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_PRIO_MASK   ((1 << IOPRIO_CLASS_SHIFT) - 1)
+
+/* highest CPU number X-Cinnamon-CPUAffinity may name, plus one */
+#define CSM_SCHEDULING_HINTS_MAX_CPUS 8192
+
+gboolean    csm_scheduling_hints_parse_nice         (const char  *str,
+                                                     int         *nice);
+
+gboolean    csm_scheduling_hints_parse_ioprio       (const char  *class_str,
+                                                     const char  *priority_str,
+                                                     int         *ioprio);
+
+gboolean    csm_scheduling_hints_parse_cpu_affinity (const char  *str,
+                                                     gulong     **mask,
+                                                     gsize       *mask_size);
+
+const char *csm_scheduling_hints_io_class_name      (int          ioprio);
+
+G_END_DECLS
+
+#endif /* __CSM_SCHEDULING_HINTS_H__ */
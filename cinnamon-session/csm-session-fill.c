@@ -26,6 +26,7 @@
 #include "csm-system.h"
 #include "csm-manager.h"
 #include "csm-process-helper.h"
+#include "csm-startup-plan.h"
 #include "csm-util.h"
 
 #define CSM_KEYFILE_SESSION_GROUP "Cinnamon Session"
@@ -179,22 +180,6 @@ check_required (GKeyFile *keyfile)
         return !error;
 }
 
-static void
-maybe_load_saved_session_apps (CsmManager *manager)
-{
-        CsmSystem *system;
-        gboolean is_login;
-
-        system = csm_get_system ();
-        is_login = csm_system_is_login_session (system);
-        g_object_unref (system);
-
-        // if (is_login)
-        //         return;
-
-        csm_manager_add_autostart_apps_from_dir (manager, csm_util_get_saved_session_dir ());
-}
-
 static void
 append_required_providers_helper (const char *provides,
                                   const char *default_provider,
@@ -225,10 +210,8 @@ append_required_components_helper (const char *component,
 
 
 static void
-load_standard_apps (CsmManager *manager,
-                    GKeyFile   *keyfile)
+run_session_migration (void)
 {
-        
         if (g_file_test ("/usr/bin/session-migration", G_FILE_TEST_EXISTS)) {
             GError *error;
             g_debug ("fill: *** Executing user migration");
@@ -238,26 +221,58 @@ load_standard_apps (CsmManager *manager,
                      g_error_free (error);
             }
         }
+}
 
+static void
+watch_autostart_dirs (CsmManager *manager)
+{
+        char **autostart_dirs;
+
+        if (csm_manager_get_failsafe (manager))
+                return;
+
+        /* the saved session only changes when we save it */
+        autostart_dirs = csm_util_get_autostart_dirs ();
+        csm_manager_watch_autostart_dirs (manager,
+                                          (const char * const *) autostart_dirs);
+        g_strfreev (autostart_dirs);
+}
+
+static void
+load_standard_apps (CsmManager *manager,
+                    GKeyFile   *keyfile)
+{
         g_debug ("fill: *** Adding required components");
         handle_required_components (keyfile, !csm_manager_get_failsafe (manager),
                                     append_required_components_helper, manager);
         g_debug ("fill: *** Done adding required components");
 
         if (!csm_manager_get_failsafe (manager)) {
-                char **autostart_dirs;
-                int    i;
+                char      **autostart_dirs;
+                GPtrArray  *dirs;
+                int         i;
 
                 autostart_dirs = csm_util_get_autostart_dirs ();
+                dirs = g_ptr_array_new ();
 
-                if (csm_manager_get_autosave_enabled (manager))
-                        maybe_load_saved_session_apps (manager);
+                /* The saved session takes precedence over autostart dirs */
+                if (csm_manager_get_autosave_enabled (manager)) {
+                        const char *saved_session_dir;
 
-                for (i = 0; autostart_dirs[i]; i++) {
-                        csm_manager_add_autostart_apps_from_dir (manager,
-                                                                 autostart_dirs[i]);
+                        saved_session_dir = csm_util_get_saved_session_dir ();
+                        if (saved_session_dir != NULL)
+                                g_ptr_array_add (dirs, (gpointer) saved_session_dir);
                 }
 
+                for (i = 0; autostart_dirs[i]; i++)
+                        g_ptr_array_add (dirs, autostart_dirs[i]);
+
+                g_ptr_array_add (dirs, NULL);
+
+                csm_manager_add_autostart_apps_from_dirs (manager,
+                                                          (const char * const *) dirs->pdata);
+
+                g_ptr_array_free (dirs, TRUE);
                 g_strfreev (autostart_dirs);
         }
 
@@ -353,7 +368,8 @@ error:
  * session that is shipped in XDG_DATA_DIRS.
  */
 static GKeyFile *
-find_valid_session_keyfile (const char *session)
+find_valid_session_keyfile (const char     *session,
+                            CsmStartupPlan *plan)
 {
         GPtrArray          *dirs;
         const char * const *system_config_dirs;
@@ -381,9 +397,11 @@ find_valid_session_keyfile (const char *session)
 
         for (i = 0; i < dirs->len; i++) {
                 path = g_build_filename (dirs->pdata[i], "cinnamon-session", "sessions", basename, NULL);
+                csm_startup_plan_add_input (plan, path);
                 keyfile = get_session_keyfile_if_valid (path);
                 if (keyfile != NULL)
                         break;
+                g_clear_pointer (&path, g_free);
         }
 
         if (dirs)
@@ -397,9 +415,11 @@ find_valid_session_keyfile (const char *session)
 }
 
 static GKeyFile *
-get_session_keyfile (const char *session,
-                     char      **actual_session,
-                     gboolean   *is_fallback)
+get_session_keyfile (const char     *session,
+                     char          **actual_session,
+                     gboolean       *is_fallback,
+                     CsmStartupPlan *plan,
+                     gboolean       *uses_helper)
 {
         GKeyFile *keyfile;
         gboolean  session_runnable;
@@ -410,7 +430,7 @@ get_session_keyfile (const char *session,
 
         g_debug ("fill: *** Getting session '%s'", session);
 
-        keyfile = find_valid_session_keyfile (session);
+        keyfile = find_valid_session_keyfile (session, plan);
 
         if (!keyfile)
                 return NULL;
@@ -421,6 +441,8 @@ get_session_keyfile (const char *session,
                                        CSM_KEYFILE_SESSION_GROUP, CSM_KEYFILE_RUNNABLE_KEY,
                                        NULL);
         if (!IS_STRING_EMPTY (value)) {
+                /* its answer can't be planned for */
+                *uses_helper = TRUE;
                 g_debug ("fill: *** Launching helper '%s' to know if session is runnable", value);
                 session_runnable = csm_process_helper (value, CSM_RUNNABLE_HELPER_TIMEOUT, &error);
                 if (!session_runnable) {
@@ -455,15 +477,15 @@ get_session_keyfile (const char *session,
         if (!IS_STRING_EMPTY (value)) {
                 if (is_fallback)
                         *is_fallback = TRUE;
-                keyfile = get_session_keyfile (value, actual_session, NULL);
+                keyfile = get_session_keyfile (value, actual_session, NULL, plan, uses_helper);
         }
         g_free (value);
 
         return keyfile;
 }
 
-static void
-set_xdg_current_desktop (GKeyFile *keyfile)
+static char *
+get_desktop_name (GKeyFile *keyfile)
 {
         char     *value;
 
@@ -471,13 +493,181 @@ set_xdg_current_desktop (GKeyFile *keyfile)
                                        CSM_KEYFILE_SESSION_GROUP, CSM_KEYFILE_DESKTOP_NAME_KEY,
                                        NULL);
 
-        if (!IS_STRING_EMPTY (value)) {
-                csm_util_setenv ("XDG_CURRENT_DESKTOP", value);
+        if (IS_STRING_EMPTY (value)) {
+                g_free (value);
+                value = g_strdup ("GNOME");
         }
-        else {
-                csm_util_setenv ("XDG_CURRENT_DESKTOP", "GNOME");
+
+        return value;
+}
+
+/* Startup plan, see csm-startup-plan.h
+ *
+ * Its inputs are the session files that were looked at, the directories
+ * required components are looked up in, and every desktop file in the
+ * autostart dirs or in the plan. Which of the autostart files are
+ * blacklisted goes into the context along with the directory lists. */
+
+static void
+scan_autostart_dirs (CsmManager     *manager,
+                     GString        *context,
+                     CsmStartupPlan *plan)
+{
+        char       **autostart_dirs;
+        GPtrArray   *dirs;
+        guint        i;
+
+        if (csm_manager_get_failsafe (manager))
+                return;
+
+        autostart_dirs = csm_util_get_autostart_dirs ();
+        dirs = g_ptr_array_new ();
+
+        if (csm_manager_get_autosave_enabled (manager)) {
+                const char *saved_session_dir;
+
+                saved_session_dir = csm_util_get_saved_session_dir ();
+                if (saved_session_dir != NULL)
+                        g_ptr_array_add (dirs, (gpointer) saved_session_dir);
+        }
+
+        for (i = 0; autostart_dirs[i]; i++)
+                g_ptr_array_add (dirs, autostart_dirs[i]);
+
+        for (i = 0; i < dirs->len; i++) {
+                GDir       *dir;
+                const char *name;
+
+                if (context != NULL)
+                        g_string_append_printf (context, "autostart %s\n", (char *) dirs->pdata[i]);
+                csm_startup_plan_add_input (plan, dirs->pdata[i]);
+
+                dir = g_dir_open (dirs->pdata[i], 0, NULL);
+                if (dir == NULL)
+                        continue;
+
+                while ((name = g_dir_read_name (dir))) {
+                        char *path;
+
+                        if (!g_str_has_suffix (name, ".desktop"))
+                                continue;
+
+                        if (csm_manager_get_app_is_blacklisted (manager, name)) {
+                                if (context != NULL)
+                                        g_string_append_printf (context, "blacklisted %s\n", name);
+                                continue;
+                        }
+
+                        if (plan != NULL) {
+                                path = g_build_filename (dirs->pdata[i], name, NULL);
+                                csm_startup_plan_add_input (plan, path);
+                                g_free (path);
+                        }
+                }
+
+                g_dir_close (dir);
+        }
+
+        g_ptr_array_free (dirs, TRUE);
+        g_strfreev (autostart_dirs);
+}
+
+/* Everything besides files that the plan depends on */
+static char *
+get_plan_context (CsmManager *manager)
+{
+        GString  *context;
+        char    **desktop_dirs;
+        int       i;
+
+        context = g_string_new (VERSION "\n");
+        g_string_append_printf (context, "failsafe %d\n", csm_manager_get_failsafe (manager));
+        g_string_append_printf (context, "autosave %d\n", csm_manager_get_autosave_enabled (manager));
+
+        desktop_dirs = csm_util_get_desktop_dirs (TRUE, TRUE);
+        for (i = 0; desktop_dirs[i]; i++)
+                g_string_append_printf (context, "desktop %s\n", desktop_dirs[i]);
+        g_strfreev (desktop_dirs);
+
+        scan_autostart_dirs (manager, context, NULL);
+
+        return g_string_free (context, FALSE);
+}
+
+static void
+record_plan_inputs (CsmManager     *manager,
+                    CsmStartupPlan *plan)
+{
+        char **desktop_dirs;
+        int    i;
+
+        if (plan == NULL)
+                return;
+
+        desktop_dirs = csm_util_get_desktop_dirs (TRUE, TRUE);
+        for (i = 0; desktop_dirs[i]; i++)
+                csm_startup_plan_add_input (plan, desktop_dirs[i]);
+        g_strfreev (desktop_dirs);
+
+        scan_autostart_dirs (manager, NULL, plan);
+}
+
+static void
+save_startup_plan (CsmManager     *manager,
+                   CsmStartupPlan *plan,
+                   const char     *actual_session,
+                   gboolean        is_fallback,
+                   const char     *desktop_name)
+{
+        GVariant     *apps;
+        GVariantIter  iter;
+        const char   *path;
+        GError       *error;
+
+        apps = g_variant_ref_sink (csm_manager_get_startup_apps (manager));
+
+        /* required components outside of the autostart dirs */
+        g_variant_iter_init (&iter, apps);
+        while (g_variant_iter_next (&iter, "(&sbas)", &path, NULL, NULL))
+                csm_startup_plan_add_input (plan, path);
+
+        csm_startup_plan_set_apps (plan, apps);
+        g_variant_unref (apps);
+
+        csm_startup_plan_set_session (plan, actual_session, is_fallback, desktop_name);
+
+        error = NULL;
+        if (!csm_startup_plan_save (plan, &error)) {
+                g_warning ("Unable to save startup plan: %s", error->message);
+                g_error_free (error);
         }
-        g_free (value);
+}
+
+static gboolean
+fill_from_plan (CsmManager *manager,
+                const char *session,
+                const char *context)
+{
+        CsmStartupPlan *plan;
+
+        plan = csm_startup_plan_load (session, context);
+        if (plan == NULL)
+                return FALSE;
+
+        g_debug ("fill: *** Using the startup plan of session '%s'", session);
+
+        _csm_manager_set_active_session (manager,
+                                         csm_startup_plan_peek_session (plan),
+                                         csm_startup_plan_get_is_fallback (plan));
+        _csm_manager_export_login_session_id (manager);
+
+        csm_util_setenv ("XDG_CURRENT_DESKTOP", csm_startup_plan_peek_desktop_name (plan));
+
+        csm_manager_add_startup_apps (manager, csm_startup_plan_peek_apps (plan));
+
+        csm_startup_plan_free (plan);
+
+        return TRUE;
 }
 
 gboolean
@@ -486,24 +676,52 @@ csm_session_fill (CsmManager  *manager,
 {
         GKeyFile *keyfile;
         gboolean is_fallback;
+        gboolean uses_helper;
         char *actual_session;
+        char *desktop_name;
+        char *context;
+        CsmStartupPlan *plan;
+
+        /* may change the autostart dirs, so before looking at them */
+        run_session_migration ();
+
+        context = get_plan_context (manager);
+
+        if (fill_from_plan (manager, session, context)) {
+                g_free (context);
+                watch_autostart_dirs (manager);
+                return TRUE;
+        }
 
-        keyfile = get_session_keyfile (session, &actual_session, &is_fallback);
+        plan = csm_startup_plan_new (session, context);
+        g_free (context);
+
+        record_plan_inputs (manager, plan);
+
+        uses_helper = FALSE;
+        keyfile = get_session_keyfile (session, &actual_session, &is_fallback, plan, &uses_helper);
 
         if (!keyfile) {
                 g_free (actual_session);
+                csm_startup_plan_free (plan);
                 return FALSE;
         }
 
         _csm_manager_set_active_session (manager, actual_session, is_fallback);
         _csm_manager_export_login_session_id (manager);
 
-        g_free (actual_session);
-
-        set_xdg_current_desktop (keyfile);
+        desktop_name = get_desktop_name (keyfile);
+        csm_util_setenv ("XDG_CURRENT_DESKTOP", desktop_name);
 
         load_standard_apps (manager, keyfile);
+        watch_autostart_dirs (manager);
+
+        if (plan != NULL && !uses_helper)
+                save_startup_plan (manager, plan, actual_session, is_fallback, desktop_name);
 
+        csm_startup_plan_free (plan);
+        g_free (desktop_name);
+        g_free (actual_session);
         g_key_file_free (keyfile);
 
         return TRUE;
@@ -0,0 +1,378 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * csm-startup-plan.c
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#include "config.h"
+
+#include <sys/stat.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "csm-startup-plan.h"
+#include "csm-util.h"
+
+/* Bump whenever the layout of the file changes */
+#define CSM_STARTUP_PLAN_VERSION 2
+
+/* version, context, actual session, is fallback, desktop name,
+ * input path => (mtime, size), apps */
+#define CSM_STARTUP_PLAN_TYPE "(ussbsa{s(xt)}a(sbas))"
+#define CSM_STARTUP_PLAN_APPS_TYPE "a(sbas)"
+
+struct _CsmStartupPlan
+{
+        char       *filename;
+        char       *context;
+
+        char       *actual_session;
+        gboolean    is_fallback;
+        char       *desktop_name;
+
+        /* path => GVariant (mtime, size) */
+        GHashTable *inputs;
+        GVariant   *apps;
+};
+
+static char *
+get_plan_filename (const char *session_name)
+{
+        const char *cache_dir;
+        char       *name;
+        char       *filename;
+
+        cache_dir = csm_util_get_cache_dir ();
+        if (cache_dir == NULL || IS_STRING_EMPTY (session_name)) {
+                return NULL;
+        }
+
+        name = g_strdup_printf ("startup-plan-%s", session_name);
+        g_strdelimit (name, "/", '_');
+        filename = g_build_filename (cache_dir, name, NULL);
+        g_free (name);
+
+        return filename;
+}
+
+/* Missing files are inputs too, they may turn up */
+static GVariant *
+get_file_key (const char *path)
+{
+        GStatBuf buf;
+        gint64   mtime;
+        guint64  size;
+
+        if (g_stat (path, &buf) == 0) {
+                mtime = (gint64) buf.st_mtim.tv_sec * G_GINT64_CONSTANT (1000000000) + buf.st_mtim.tv_nsec;
+                size = (guint64) buf.st_size;
+        } else {
+                mtime = -1;
+                size = 0;
+        }
+
+        return g_variant_ref_sink (g_variant_new ("(xt)", mtime, size));
+}
+
+static CsmStartupPlan *
+plan_new (char       *filename,
+          const char *context)
+{
+        CsmStartupPlan *plan;
+
+        plan = g_new0 (CsmStartupPlan, 1);
+        plan->filename = filename;
+        plan->context = g_strdup (context);
+        plan->inputs = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                              g_free, (GDestroyNotify) g_variant_unref);
+
+        return plan;
+}
+
+/**
+ * csm_startup_plan_new:
+ * @session_name: the session asked for
+ * @context: everything besides files the plan depends on
+ *
+ * Returns: a plan to record the resolution of @session_name in, or %NULL
+ *     if there is nowhere to save it
+ */
+CsmStartupPlan *
+csm_startup_plan_new (const char *session_name,
+                      const char *context)
+{
+        char *filename;
+
+        g_return_val_if_fail (context != NULL, NULL);
+
+        filename = get_plan_filename (session_name);
+        if (filename == NULL) {
+                return NULL;
+        }
+
+        return plan_new (filename, context);
+}
+
+/* Records the current state of @path, the plan is stale once it changes */
+void
+csm_startup_plan_add_input (CsmStartupPlan *plan,
+                            const char     *path)
+{
+        if (plan == NULL || g_hash_table_contains (plan->inputs, path)) {
+                return;
+        }
+
+        g_hash_table_insert (plan->inputs, g_strdup (path), get_file_key (path));
+}
+
+void
+csm_startup_plan_set_session (CsmStartupPlan *plan,
+                              const char     *actual_session,
+                              gboolean        is_fallback,
+                              const char     *desktop_name)
+{
+        if (plan == NULL) {
+                return;
+        }
+
+        g_free (plan->actual_session);
+        plan->actual_session = g_strdup (actual_session);
+        plan->is_fallback = is_fallback;
+        g_free (plan->desktop_name);
+        plan->desktop_name = g_strdup (desktop_name);
+}
+
+/* @apps: path, whether it is required and what it provides for the
+ * session, see csm_manager_get_startup_apps() */
+void
+csm_startup_plan_set_apps (CsmStartupPlan *plan,
+                           GVariant       *apps)
+{
+        if (plan == NULL) {
+                return;
+        }
+
+        g_return_if_fail (g_variant_is_of_type (apps, G_VARIANT_TYPE (CSM_STARTUP_PLAN_APPS_TYPE)));
+
+        g_clear_pointer (&plan->apps, g_variant_unref);
+        plan->apps = g_variant_ref_sink (apps);
+}
+
+gboolean
+csm_startup_plan_save (CsmStartupPlan  *plan,
+                       GError         **error)
+{
+        GVariantBuilder  builder;
+        GHashTableIter   iter;
+        gpointer         path;
+        GVariant        *key;
+        GVariant        *contents;
+        gboolean         res;
+
+        if (plan == NULL) {
+                return TRUE;
+        }
+
+        g_return_val_if_fail (plan->actual_session != NULL, FALSE);
+        g_return_val_if_fail (plan->apps != NULL, FALSE);
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{s(xt)}"));
+        g_hash_table_iter_init (&iter, plan->inputs);
+        while (g_hash_table_iter_next (&iter, &path, (gpointer *) &key)) {
+                g_variant_builder_add (&builder, "{s@(xt)}", path, key);
+        }
+
+        contents = g_variant_ref_sink (g_variant_new ("(ussbs@a{s(xt)}@" CSM_STARTUP_PLAN_APPS_TYPE ")",
+                                                      CSM_STARTUP_PLAN_VERSION,
+                                                      plan->context,
+                                                      plan->actual_session,
+                                                      plan->is_fallback,
+                                                      plan->desktop_name != NULL ? plan->desktop_name : "",
+                                                      g_variant_builder_end (&builder),
+                                                      plan->apps));
+
+        res = g_file_set_contents (plan->filename,
+                                   g_variant_get_data (contents),
+                                   g_variant_get_size (contents),
+                                   error);
+        if (res) {
+                g_debug ("CsmStartupPlan: wrote %" G_GSIZE_FORMAT " apps and %u inputs to %s",
+                         g_variant_n_children (plan->apps),
+                         g_hash_table_size (plan->inputs),
+                         plan->filename);
+        }
+
+        g_variant_unref (contents);
+
+        return res;
+}
+
+static gboolean
+inputs_are_current (GVariant *inputs)
+{
+        GVariantIter  iter;
+        const char   *path;
+        GVariant     *key;
+
+        g_variant_iter_init (&iter, inputs);
+        while (g_variant_iter_next (&iter, "{&s@(xt)}", &path, &key)) {
+                GVariant *current;
+                gboolean  same;
+
+                current = get_file_key (path);
+                same = g_variant_equal (key, current);
+                g_variant_unref (current);
+                g_variant_unref (key);
+
+                if (!same) {
+                        g_debug ("CsmStartupPlan: %s changed", path);
+                        return FALSE;
+                }
+        }
+
+        return TRUE;
+}
+
+/**
+ * csm_startup_plan_load:
+ * @session_name: the session asked for
+ * @context: see csm_startup_plan_new()
+ *
+ * Returns: the plan saved for @session_name, or %NULL if there is none,
+ *     it was saved in another @context or any of its inputs changed since
+ */
+CsmStartupPlan *
+csm_startup_plan_load (const char *session_name,
+                       const char *context)
+{
+        CsmStartupPlan *plan;
+        char           *filename;
+        GMappedFile    *mapped;
+        GBytes         *bytes;
+        GVariant       *contents;
+        GVariant       *inputs;
+        const char     *saved_context;
+        guint32         version;
+
+        g_return_val_if_fail (context != NULL, NULL);
+
+        filename = get_plan_filename (session_name);
+        if (filename == NULL) {
+                return NULL;
+        }
+
+        mapped = g_mapped_file_new (filename, FALSE, NULL);
+        if (mapped == NULL) {
+                g_free (filename);
+                return NULL;
+        }
+
+        bytes = g_mapped_file_get_bytes (mapped);
+        g_mapped_file_unref (mapped);
+
+        contents = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (CSM_STARTUP_PLAN_TYPE),
+                                                                 bytes,
+                                                                 FALSE));
+        g_bytes_unref (bytes);
+
+        plan = NULL;
+
+        /* A truncated or otherwise corrupt file is the same as no file */
+        if (!g_variant_is_normal_form (contents)) {
+                g_debug ("CsmStartupPlan: ignoring corrupt plan %s", filename);
+                goto out;
+        }
+
+        g_variant_get_child (contents, 0, "u", &version);
+        if (version != CSM_STARTUP_PLAN_VERSION) {
+                g_debug ("CsmStartupPlan: ignoring plan version %u", version);
+                goto out;
+        }
+
+        g_variant_get_child (contents, 1, "&s", &saved_context);
+        if (g_strcmp0 (saved_context, context) != 0) {
+                g_debug ("CsmStartupPlan: ignoring plan for another context");
+                goto out;
+        }
+
+        inputs = g_variant_get_child_value (contents, 5);
+        if (!inputs_are_current (inputs)) {
+                g_variant_unref (inputs);
+                goto out;
+        }
+        g_variant_unref (inputs);
+
+        plan = plan_new (g_steal_pointer (&filename), context);
+        g_variant_get (contents, "(u&ssbs@a{s(xt)}@" CSM_STARTUP_PLAN_APPS_TYPE ")",
+                       NULL,
+                       NULL,
+                       &plan->actual_session,
+                       &plan->is_fallback,
+                       &plan->desktop_name,
+                       NULL,
+                       &plan->apps);
+
+        g_debug ("CsmStartupPlan: using plan for session %s with %" G_GSIZE_FORMAT " apps",
+                 plan->actual_session,
+                 g_variant_n_children (plan->apps));
+
+out:
+        g_variant_unref (contents);
+        g_free (filename);
+
+        return plan;
+}
+
+const char *
+csm_startup_plan_peek_session (CsmStartupPlan *plan)
+{
+        return plan->actual_session;
+}
+
+gboolean
+csm_startup_plan_get_is_fallback (CsmStartupPlan *plan)
+{
+        return plan->is_fallback;
+}
+
+const char *
+csm_startup_plan_peek_desktop_name (CsmStartupPlan *plan)
+{
+        return plan->desktop_name;
+}
+
+GVariant *
+csm_startup_plan_peek_apps (CsmStartupPlan *plan)
+{
+        return plan->apps;
+}
+
+void
+csm_startup_plan_free (CsmStartupPlan *plan)
+{
+        if (plan == NULL) {
+                return;
+        }
+
+        g_free (plan->filename);
+        g_free (plan->context);
+        g_free (plan->actual_session);
+        g_free (plan->desktop_name);
+        g_hash_table_destroy (plan->inputs);
+        g_clear_pointer (&plan->apps, g_variant_unref);
+        g_free (plan);
+}
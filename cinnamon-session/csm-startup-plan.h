@@ -0,0 +1,64 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * csm-startup-plan.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#ifndef __CSM_STARTUP_PLAN_H__
+#define __CSM_STARTUP_PLAN_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* The result of resolving a session, persisted per session name so the
+ * next login can skip the resolution unless one of its inputs changed */
+
+typedef struct _CsmStartupPlan CsmStartupPlan;
+
+CsmStartupPlan *csm_startup_plan_new               (const char     *session_name,
+                                                    const char     *context);
+
+void            csm_startup_plan_add_input         (CsmStartupPlan *plan,
+                                                    const char     *path);
+
+void            csm_startup_plan_set_session       (CsmStartupPlan *plan,
+                                                    const char     *actual_session,
+                                                    gboolean        is_fallback,
+                                                    const char     *desktop_name);
+
+void            csm_startup_plan_set_apps          (CsmStartupPlan *plan,
+                                                    GVariant       *apps);
+
+gboolean        csm_startup_plan_save              (CsmStartupPlan *plan,
+                                                    GError        **error);
+
+CsmStartupPlan *csm_startup_plan_load              (const char     *session_name,
+                                                    const char     *context);
+
+const char *    csm_startup_plan_peek_session      (CsmStartupPlan *plan);
+
+gboolean        csm_startup_plan_get_is_fallback   (CsmStartupPlan *plan);
+
+const char *    csm_startup_plan_peek_desktop_name (CsmStartupPlan *plan);
+
+GVariant *      csm_startup_plan_peek_apps         (CsmStartupPlan *plan);
+
+void            csm_startup_plan_free              (CsmStartupPlan *plan);
+
+G_END_DECLS
+
+#endif /* __CSM_STARTUP_PLAN_H__ */
@@ -37,9 +37,24 @@
 struct CsmStorePrivate
 {
         GHashTable *objects;
+        /* object => id, for the objects found through an index */
+        GHashTable *ids;
+        GPtrArray  *indexes;
         gboolean    locked;
 };
 
+typedef struct
+{
+        char              *name;
+        CsmStoreIndexFunc  func;
+        /* the property whose changes change the keys, if any */
+        char              *property;
+        /* key => GPtrArray of objects */
+        GHashTable        *objects;
+        /* object => its keys */
+        GHashTable        *keys;
+} StoreIndex;
+
 enum {
         ADDED,
         REMOVED,
@@ -54,6 +69,9 @@ enum {
 static guint signals [LAST_SIGNAL] = { 0 };
 
 static void     csm_store_finalize      (GObject       *object);
+static void     on_object_notify        (GObject       *object,
+                                         GParamSpec    *pspec,
+                                         CsmStore      *store);
 
 G_DEFINE_TYPE (CsmStore, csm_store, G_TYPE_OBJECT)
 
@@ -68,6 +86,143 @@ csm_store_error_quark (void)
         return ret;
 }
 
+static void
+store_index_free (StoreIndex *index)
+{
+        g_free (index->name);
+        g_free (index->property);
+        g_hash_table_destroy (index->objects);
+        g_hash_table_destroy (index->keys);
+        g_free (index);
+}
+
+static StoreIndex *
+find_index (CsmStore   *store,
+            const char *name)
+{
+        guint i;
+
+        for (i = 0; i < store->priv->indexes->len; i++) {
+                StoreIndex *index = g_ptr_array_index (store->priv->indexes, i);
+
+                if (strcmp (index->name, name) == 0) {
+                        return index;
+                }
+        }
+
+        return NULL;
+}
+
+static void
+index_add_object (StoreIndex *index,
+                  GObject    *object)
+{
+        char **keys;
+        int    i;
+
+        keys = index->func (object);
+        if (keys == NULL) {
+                return;
+        }
+
+        for (i = 0; keys[i] != NULL; i++) {
+                GPtrArray *objects;
+
+                objects = g_hash_table_lookup (index->objects, keys[i]);
+                if (objects == NULL) {
+                        objects = g_ptr_array_new ();
+                        g_hash_table_insert (index->objects, g_strdup (keys[i]), objects);
+                }
+
+                g_ptr_array_add (objects, object);
+        }
+
+        g_hash_table_insert (index->keys, object, keys);
+}
+
+static void
+index_remove_object (StoreIndex *index,
+                     GObject    *object)
+{
+        char **keys;
+        int    i;
+
+        keys = g_hash_table_lookup (index->keys, object);
+        if (keys == NULL) {
+                return;
+        }
+
+        for (i = 0; keys[i] != NULL; i++) {
+                GPtrArray *objects;
+
+                objects = g_hash_table_lookup (index->objects, keys[i]);
+                if (objects == NULL) {
+                        continue;
+                }
+
+                g_ptr_array_remove (objects, object);
+                if (objects->len == 0) {
+                        g_hash_table_remove (index->objects, keys[i]);
+                }
+        }
+
+        g_hash_table_remove (index->keys, object);
+}
+
+static void
+indexes_add_object (CsmStore   *store,
+                    const char *id,
+                    GObject    *object)
+{
+        guint i;
+
+        if (store->priv->indexes->len == 0) {
+                return;
+        }
+
+        g_hash_table_insert (store->priv->ids, object, g_strdup (id));
+
+        for (i = 0; i < store->priv->indexes->len; i++) {
+                index_add_object (g_ptr_array_index (store->priv->indexes, i), object);
+        }
+
+        g_signal_connect (object, "notify", G_CALLBACK (on_object_notify), store);
+}
+
+static void
+indexes_remove_object (CsmStore *store,
+                       GObject  *object)
+{
+        guint i;
+
+        if (!g_hash_table_remove (store->priv->ids, object)) {
+                return;
+        }
+
+        for (i = 0; i < store->priv->indexes->len; i++) {
+                index_remove_object (g_ptr_array_index (store->priv->indexes, i), object);
+        }
+
+        g_signal_handlers_disconnect_by_func (object, on_object_notify, store);
+}
+
+static void
+on_object_notify (GObject    *object,
+                  GParamSpec *pspec,
+                  CsmStore   *store)
+{
+        guint i;
+
+        for (i = 0; i < store->priv->indexes->len; i++) {
+                StoreIndex *index = g_ptr_array_index (store->priv->indexes, i);
+
+                if (g_strcmp0 (index->property, pspec->name) == 0) {
+                        index_remove_object (index, object);
+                        index_add_object (index, object);
+                }
+        }
+}
+
 guint
 csm_store_size (CsmStore    *store)
 {
@@ -95,6 +250,8 @@ csm_store_remove (CsmStore   *store,
 
         g_object_ref (found);
 
+        indexes_remove_object (store, found);
+
         removed = g_hash_table_remove (store->priv->objects, id_copy);
         g_assert (removed);
 
@@ -167,6 +324,7 @@ foreach_remove_wrapper (const char  *id,
 
         res = (data->func) (id, object, data->user_data);
         if (res) {
+                indexes_remove_object (data->store, object);
                 data->removed = g_list_prepend (data->removed, g_strdup (id));
         }
 
@@ -226,11 +384,203 @@ csm_store_clear (CsmStore *store)
                                   NULL);
 }
 
+/**
+ * csm_store_add_index:
+ * @store: a #CsmStore
+ * @index: the name of the index
+ * @func: returns the keys of an object
+ * @property: (allow-none): the property of the objects that changes what
+ *     @func returns, see csm_store_reindex() for anything else
+ *
+ * Indexes the objects of @store by the keys @func returns for them, so
+ * that looking them up by one of these keys doesn't need a scan of the
+ * whole store. Several objects can share a key.
+ */
+void
+csm_store_add_index (CsmStore          *store,
+                     const char        *index,
+                     CsmStoreIndexFunc  func,
+                     const char        *property)
+{
+        StoreIndex     *new_index;
+        GHashTableIter  iter;
+        gpointer        id;
+        gpointer        object;
+
+        g_return_if_fail (CSM_IS_STORE (store));
+        g_return_if_fail (index != NULL);
+        g_return_if_fail (func != NULL);
+
+        if (find_index (store, index) != NULL) {
+                return;
+        }
+
+        new_index = g_new0 (StoreIndex, 1);
+        new_index->name = g_strdup (index);
+        new_index->func = func;
+        new_index->property = g_strdup (property);
+        new_index->objects = g_hash_table_new_full (g_str_hash,
+                                                    g_str_equal,
+                                                    g_free,
+                                                    (GDestroyNotify) g_ptr_array_unref);
+        new_index->keys = g_hash_table_new_full (NULL,
+                                                 NULL,
+                                                 NULL,
+                                                 (GDestroyNotify) g_strfreev);
+
+        g_ptr_array_add (store->priv->indexes, new_index);
+
+        g_hash_table_iter_init (&iter, store->priv->objects);
+        while (g_hash_table_iter_next (&iter, &id, &object)) {
+                if (store->priv->indexes->len == 1) {
+                        indexes_add_object (store, id, object);
+                } else {
+                        index_add_object (new_index, object);
+                }
+        }
+}
+
+/**
+ * csm_store_lookup_index:
+ * @store: a #CsmStore
+ * @index: the name of the index
+ * @key: the key to look for
+ *
+ * Returns: (transfer none): an object indexed under @key, or %NULL
+ */
+GObject *
+csm_store_lookup_index (CsmStore   *store,
+                        const char *index,
+                        const char *key)
+{
+        StoreIndex *found;
+        GPtrArray  *objects;
+
+        g_return_val_if_fail (CSM_IS_STORE (store), NULL);
+        g_return_val_if_fail (index != NULL, NULL);
+
+        if (key == NULL) {
+                return NULL;
+        }
+
+        found = find_index (store, index);
+        g_return_val_if_fail (found != NULL, NULL);
+
+        objects = g_hash_table_lookup (found->objects, key);
+        if (objects == NULL) {
+                return NULL;
+        }
+
+        return g_ptr_array_index (objects, 0);
+}
+
+/**
+ * csm_store_foreach_remove_index:
+ * @store: a #CsmStore
+ * @index: the name of the index
+ * @key: the key to look for
+ * @func: (allow-none): decides whether to remove an object
+ * @user_data: data for @func
+ *
+ * Like csm_store_foreach_remove(), but only for the objects indexed under
+ * @key, and removing all of them if @func is %NULL.
+ *
+ * Returns: the number of objects removed
+ */
+guint
+csm_store_foreach_remove_index (CsmStore    *store,
+                                const char  *index,
+                                const char  *key,
+                                CsmStoreFunc func,
+                                gpointer     user_data)
+{
+        StoreIndex *found;
+        GPtrArray  *objects;
+        GPtrArray  *matches;
+        guint       ret;
+        guint       i;
+
+        g_return_val_if_fail (CSM_IS_STORE (store), 0);
+        g_return_val_if_fail (index != NULL, 0);
+
+        if (key == NULL) {
+                return 0;
+        }
+
+        found = find_index (store, index);
+        g_return_val_if_fail (found != NULL, 0);
+
+        objects = g_hash_table_lookup (found->objects, key);
+        if (objects == NULL) {
+                return 0;
+        }
+
+        /* removing changes the index */
+        matches = g_ptr_array_new_with_free_func (g_object_unref);
+        for (i = 0; i < objects->len; i++) {
+                g_ptr_array_add (matches, g_object_ref (g_ptr_array_index (objects, i)));
+        }
+
+        ret = 0;
+        for (i = 0; i < matches->len; i++) {
+                GObject    *object = g_ptr_array_index (matches, i);
+                const char *id;
+
+                id = g_hash_table_lookup (store->priv->ids, object);
+                if (id == NULL) {
+                        continue;
+                }
+
+                if (func == NULL || func (id, object, user_data)) {
+                        if (csm_store_remove (store, id)) {
+                                ret++;
+                        }
+                }
+        }
+
+        g_ptr_array_unref (matches);
+
+        return ret;
+}
+
+/**
+ * csm_store_reindex:
+ * @store: a #CsmStore
+ * @id: the id of an object
+ *
+ * Updates the indexes after the keys of the object changed in a way that
+ * isn't notified through a property.
+ */
+void
+csm_store_reindex (CsmStore   *store,
+                   const char *id)
+{
+        GObject *object;
+        guint    i;
+
+        g_return_if_fail (CSM_IS_STORE (store));
+        g_return_if_fail (id != NULL);
+
+        object = g_hash_table_lookup (store->priv->objects, id);
+        if (object == NULL) {
+                return;
+        }
+
+        for (i = 0; i < store->priv->indexes->len; i++) {
+                StoreIndex *index = g_ptr_array_index (store->priv->indexes, i);
+
+                index_remove_object (index, object);
+                index_add_object (index, object);
+        }
+}
+
 gboolean
 csm_store_add (CsmStore   *store,
                const char *id,
                GObject    *object)
 {
+        GObject *old;
+
         g_return_val_if_fail (store != NULL, FALSE);
         g_return_val_if_fail (id != NULL, FALSE);
         g_return_val_if_fail (object != NULL, FALSE);
@@ -243,9 +593,16 @@ csm_store_add (CsmStore   *store,
 
         g_debug ("CsmStore: Adding object id %s to store", id);
 
-        g_hash_table_insert (store->priv->objects,
-                             g_strdup (id),
-                             g_object_ref (object));
+        old = g_hash_table_lookup (store->priv->objects, id);
+        if (old != NULL) {
+                indexes_remove_object (store, old);
+        }
+
+        g_hash_table_replace (store->priv->objects,
+                              g_strdup (id),
+                              g_object_ref (object));
+
+        indexes_add_object (store, id, object);
 
         g_signal_emit (store, signals [ADDED], 0, id);
 
@@ -382,6 +739,8 @@ csm_store_init (CsmStore *store)
                                                       g_str_equal,
                                                       g_free,
                                                       (GDestroyNotify) _destroy_object);
+        store->priv->ids = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+        store->priv->indexes = g_ptr_array_new_with_free_func ((GDestroyNotify) store_index_free);
 }
 
 static void
@@ -397,6 +756,8 @@ csm_store_finalize (GObject *object)
         g_return_if_fail (store->priv != NULL);
 
         g_hash_table_destroy (store->priv->objects);
+        g_hash_table_destroy (store->priv->ids);
+        g_ptr_array_unref (store->priv->indexes);
 
         G_OBJECT_CLASS (csm_store_parent_class)->finalize (object);
 }
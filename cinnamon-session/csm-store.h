@@ -62,6 +62,9 @@ typedef gboolean (*CsmStoreFunc) (const char *id,
                                   GObject    *object,
                                   gpointer    user_data);
 
+/* Returns the keys an object is indexed under, or NULL for none */
+typedef char **  (*CsmStoreIndexFunc) (GObject *object);
+
 GQuark              csm_store_error_quark              (void);
 GType               csm_store_get_type                 (void);
 
@@ -91,6 +94,21 @@ GObject *           csm_store_find                     (CsmStore    *store,
 GObject *           csm_store_lookup                   (CsmStore    *store,
                                                         const char  *id);
 
+void                csm_store_add_index                (CsmStore          *store,
+                                                        const char        *index,
+                                                        CsmStoreIndexFunc  func,
+                                                        const char        *property);
+GObject *           csm_store_lookup_index             (CsmStore    *store,
+                                                        const char  *index,
+                                                        const char  *key);
+guint               csm_store_foreach_remove_index     (CsmStore    *store,
+                                                        const char  *index,
+                                                        const char  *key,
+                                                        CsmStoreFunc func,
+                                                        gpointer     user_data);
+void                csm_store_reindex                  (CsmStore    *store,
+                                                        const char  *id);
+
 
 G_END_DECLS
 
@@ -0,0 +1,187 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * csm-substring-matcher.c
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#include "csm-substring-matcher.h"
+
+/* One row of the transition table per state, state 0 being the root.
+ * Missing transitions are resolved through the failure links while
+ * building, so matching never has to backtrack. */
+typedef struct {
+        guint32  next[256];
+        /* a pattern ends here, or at a suffix of here */
+        gboolean output;
+} MatcherState;
+
+struct _CsmSubstringMatcher
+{
+        GArray *states;
+};
+
+static MatcherState *
+get_state (CsmSubstringMatcher *matcher,
+           guint32              state)
+{
+        return &g_array_index (matcher->states, MatcherState, state);
+}
+
+static void
+add_pattern (CsmSubstringMatcher *matcher,
+             const char          *pattern)
+{
+        const guchar *p;
+        guint32       state;
+
+        state = 0;
+        for (p = (const guchar *) pattern; *p != '\0'; p++) {
+                guint32 next;
+
+                next = get_state (matcher, state)->next[*p];
+                if (next == 0) {
+                        /* new states start out all zeroes */
+                        next = matcher->states->len;
+                        g_array_set_size (matcher->states, next + 1);
+                        get_state (matcher, state)->next[*p] = next;
+                }
+
+                state = next;
+        }
+
+        get_state (matcher, state)->output = TRUE;
+}
+
+/* Turns the trie into the automaton, breadth first so that the failure
+ * state of a state is always complete before the state itself */
+static void
+build_transitions (CsmSubstringMatcher *matcher)
+{
+        guint32 *fail;
+        guint32 *queue;
+        guint    head;
+        guint    tail;
+        guint    c;
+
+        fail = g_new0 (guint32, matcher->states->len);
+        queue = g_new (guint32, matcher->states->len);
+        head = tail = 0;
+
+        for (c = 0; c < 256; c++) {
+                guint32 child;
+
+                child = get_state (matcher, 0)->next[c];
+                if (child != 0) {
+                        fail[child] = 0;
+                        queue[tail++] = child;
+                }
+        }
+
+        while (head < tail) {
+                MatcherState *state;
+                guint32       s;
+
+                s = queue[head++];
+                state = get_state (matcher, s);
+
+                if (get_state (matcher, fail[s])->output) {
+                        state->output = TRUE;
+                }
+
+                for (c = 0; c < 256; c++) {
+                        guint32 child;
+
+                        child = state->next[c];
+                        if (child != 0) {
+                                fail[child] = get_state (matcher, fail[s])->next[c];
+                                queue[tail++] = child;
+                        } else {
+                                state->next[c] = get_state (matcher, fail[s])->next[c];
+                        }
+                }
+        }
+
+        g_free (queue);
+        g_free (fail);
+}
+
+/**
+ * csm_substring_matcher_new:
+ * @patterns: (allow-none): %NULL-terminated list of substrings
+ *
+ * Like testing each of @patterns with strstr(), an empty pattern
+ * matching every string.
+ *
+ * Returns: (transfer full): a new matcher
+ */
+CsmSubstringMatcher *
+csm_substring_matcher_new (const char * const *patterns)
+{
+        CsmSubstringMatcher *matcher;
+        guint                i;
+
+        matcher = g_new0 (CsmSubstringMatcher, 1);
+        matcher->states = g_array_sized_new (FALSE, TRUE, sizeof (MatcherState), 1);
+        g_array_set_size (matcher->states, 1);
+
+        for (i = 0; patterns != NULL && patterns[i] != NULL; i++) {
+                add_pattern (matcher, patterns[i]);
+        }
+
+        build_transitions (matcher);
+
+        return matcher;
+}
+
+gboolean
+csm_substring_matcher_match (CsmSubstringMatcher *matcher,
+                             const char          *str)
+{
+        const guchar *p;
+        guint32       state;
+
+        g_return_val_if_fail (matcher != NULL, FALSE);
+        g_return_val_if_fail (str != NULL, FALSE);
+
+        state = 0;
+        if (get_state (matcher, state)->output) {
+                return TRUE;
+        }
+
+        for (p = (const guchar *) str; *p != '\0'; p++) {
+                state = get_state (matcher, state)->next[*p];
+                if (get_state (matcher, state)->output) {
+                        return TRUE;
+                }
+        }
+
+        return FALSE;
+}
+
+void
+csm_substring_matcher_free (CsmSubstringMatcher *matcher)
+{
+        if (matcher == NULL) {
+                return;
+        }
+
+        g_array_unref (matcher->states);
+        g_free (matcher);
+}
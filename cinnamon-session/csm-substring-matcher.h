@@ -0,0 +1,41 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * csm-substring-matcher.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#ifndef __CSM_SUBSTRING_MATCHER_H__
+#define __CSM_SUBSTRING_MATCHER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Aho-Corasick automaton telling whether a string contains any of a set
+ * of substrings, in one pass and without allocating */
+
+typedef struct _CsmSubstringMatcher CsmSubstringMatcher;
+
+CsmSubstringMatcher *csm_substring_matcher_new   (const char * const  *patterns);
+
+gboolean             csm_substring_matcher_match (CsmSubstringMatcher *matcher,
+                                                  const char          *str);
+
+void                 csm_substring_matcher_free  (CsmSubstringMatcher *matcher);
+
+G_END_DECLS
+
+#endif /* __CSM_SUBSTRING_MATCHER_H__ */
@@ -30,9 +30,32 @@
 
 enum {
         REQUEST_FAILED = 0,
+        CAPABILITIES_CHANGED,
         LAST_SIGNAL
 };
 
+typedef struct {
+        gboolean known;
+        gboolean value;
+} CapabilityEntry;
+
+/* Answers of the backend, so that the shutdown dialog and CanShutdown
+ * never wait for logind or polkit */
+typedef struct {
+        CapabilityEntry entries[CSM_SYSTEM_N_CAPABILITIES];
+        /* bumped on invalidation, so outdated answers are dropped */
+        guint           generation;
+} CapabilityCache;
+
+typedef struct {
+        CsmSystem           *system;
+        CsmSystemCapability  capability;
+        guint                generation;
+        char                *method;
+} CapabilityQuery;
+
+G_DEFINE_QUARK (csm-system-capability-cache, capability_cache)
+
 static guint signals[LAST_SIGNAL] = { 0 };
 
 G_DEFINE_INTERFACE (CsmSystem, csm_system, G_TYPE_OBJECT)
@@ -50,6 +73,16 @@ csm_system_default_init (CsmSystemInterface *iface)
                               g_cclosure_marshal_VOID__POINTER,
                               G_TYPE_NONE,
                               1, G_TYPE_POINTER);
+        signals [CAPABILITIES_CHANGED] =
+                g_signal_new ("capabilities-changed",
+                              CSM_TYPE_SYSTEM,
+                              G_SIGNAL_RUN_LAST,
+                              G_STRUCT_OFFSET (CsmSystemInterface, capabilities_changed),
+                              NULL,
+                              NULL,
+                              g_cclosure_marshal_VOID__VOID,
+                              G_TYPE_NONE,
+                              0);
 }
 
 GQuark
@@ -70,34 +103,221 @@ csm_system_can_switch_user (CsmSystem *system)
         return CSM_SYSTEM_GET_IFACE (system)->can_switch_user (system);
 }
 
+static CapabilityCache *
+get_capability_cache (CsmSystem *system)
+{
+        CapabilityCache *cache;
+
+        cache = g_object_get_qdata (G_OBJECT (system), capability_cache_quark ());
+        if (cache == NULL) {
+                cache = g_new0 (CapabilityCache, 1);
+                g_object_set_qdata_full (G_OBJECT (system),
+                                         capability_cache_quark (),
+                                         cache,
+                                         g_free);
+        }
+
+        return cache;
+}
+
+/* Asks the backend directly, blocking until it answers */
+static gboolean
+call_capability_vfunc (CsmSystem           *system,
+                       CsmSystemCapability  capability)
+{
+        CsmSystemInterface *iface;
+        gboolean          (*can) (CsmSystem *system);
+
+        iface = CSM_SYSTEM_GET_IFACE (system);
+
+        switch (capability) {
+        case CSM_SYSTEM_CAPABILITY_STOP:
+                can = iface->can_stop;
+                break;
+        case CSM_SYSTEM_CAPABILITY_RESTART:
+                can = iface->can_restart;
+                break;
+        case CSM_SYSTEM_CAPABILITY_HYBRID_SLEEP:
+                can = iface->can_hybrid_sleep;
+                break;
+        case CSM_SYSTEM_CAPABILITY_SUSPEND:
+                can = iface->can_suspend;
+                break;
+        case CSM_SYSTEM_CAPABILITY_HIBERNATE:
+                can = iface->can_hibernate;
+                break;
+        default:
+                g_return_val_if_reached (FALSE);
+        }
+
+        /* ConsoleKit has no hybrid sleep */
+        if (can == NULL) {
+                return FALSE;
+        }
+
+        return can (system);
+}
+
+/* Both "(b)" (ConsoleKit's CanStop) and "(s)" answers are used */
+static gboolean
+parse_capability_reply (GVariant *res)
+{
+        gboolean    value;
+        const char *answer;
+
+        if (g_variant_is_of_type (res, G_VARIANT_TYPE ("(b)"))) {
+                g_variant_get (res, "(b)", &value);
+                return value;
+        }
+
+        if (g_variant_is_of_type (res, G_VARIANT_TYPE ("(s)"))) {
+                g_variant_get (res, "(&s)", &answer);
+                return g_strcmp0 (answer, "yes") == 0 ||
+                       g_strcmp0 (answer, "challenge") == 0;
+        }
+
+        return FALSE;
+}
+
+static void
+on_capability_query_done (GObject      *source,
+                          GAsyncResult *result,
+                          gpointer      user_data)
+{
+        CapabilityQuery *query = user_data;
+        CapabilityCache *cache;
+        GError          *error;
+        GVariant        *res;
+
+        error = NULL;
+        res = g_dbus_proxy_call_finish (G_DBUS_PROXY (source), result, &error);
+
+        cache = get_capability_cache (query->system);
+
+        if (query->generation != cache->generation) {
+                g_debug ("CsmSystem: dropping outdated answer to %s", query->method);
+        } else if (res == NULL) {
+                g_warning ("Calling %s failed: %s", query->method, error->message);
+                cache->entries[query->capability].value = FALSE;
+                cache->entries[query->capability].known = TRUE;
+        } else {
+                cache->entries[query->capability].value = parse_capability_reply (res);
+                cache->entries[query->capability].known = TRUE;
+                g_debug ("CsmSystem: %s: %s", query->method,
+                         cache->entries[query->capability].value ? "yes" : "no");
+        }
+
+        if (res != NULL) {
+                g_variant_unref (res);
+        }
+        g_clear_error (&error);
+
+        g_object_unref (query->system);
+        g_free (query->method);
+        g_free (query);
+}
+
+/* Refreshes every answer in the background. Until the new answers
+ * arrive callers keep getting the previous ones. */
+static void
+prefetch_capabilities (CsmSystem *system)
+{
+        CsmSystemInterface *iface;
+        CapabilityCache    *cache;
+        guint               i;
+
+        iface = CSM_SYSTEM_GET_IFACE (system);
+        cache = get_capability_cache (system);
+
+        cache->generation++;
+
+        for (i = 0; i < CSM_SYSTEM_N_CAPABILITIES; i++) {
+                CapabilityQuery *query;
+                GDBusProxy      *proxy;
+                const char      *method;
+
+                proxy = NULL;
+                method = NULL;
+                if (iface->get_capability_query != NULL) {
+                        proxy = iface->get_capability_query (system, i, &method);
+                }
+
+                if (proxy == NULL || method == NULL) {
+                        /* asked directly, on the next call */
+                        cache->entries[i].known = FALSE;
+                        continue;
+                }
+
+                query = g_new0 (CapabilityQuery, 1);
+                query->system = g_object_ref (system);
+                query->capability = i;
+                query->generation = cache->generation;
+                query->method = g_strdup (method);
+
+                g_dbus_proxy_call (proxy,
+                                   method,
+                                   NULL,
+                                   G_DBUS_CALL_FLAGS_NONE,
+                                   -1,
+                                   NULL,
+                                   on_capability_query_done,
+                                   query);
+        }
+}
+
+static void
+on_capabilities_changed (CsmSystem *system)
+{
+        g_debug ("CsmSystem: capabilities changed, asking again");
+
+        prefetch_capabilities (system);
+}
+
+static gboolean
+get_capability (CsmSystem           *system,
+                CsmSystemCapability  capability)
+{
+        CapabilityEntry *entry;
+
+        entry = &get_capability_cache (system)->entries[capability];
+
+        /* only before the first answer arrived, or without a query */
+        if (!entry->known) {
+                entry->value = call_capability_vfunc (system, capability);
+                entry->known = TRUE;
+        }
+
+        return entry->value;
+}
+
 gboolean
 csm_system_can_stop (CsmSystem *system)
 {
-        return CSM_SYSTEM_GET_IFACE (system)->can_stop (system);
+        return get_capability (system, CSM_SYSTEM_CAPABILITY_STOP);
 }
 
 gboolean
 csm_system_can_restart (CsmSystem *system)
 {
-        return CSM_SYSTEM_GET_IFACE (system)->can_restart (system);
+        return get_capability (system, CSM_SYSTEM_CAPABILITY_RESTART);
 }
 
 gboolean
 csm_system_can_hybrid_sleep (CsmSystem *system)
 {
-        return CSM_SYSTEM_GET_IFACE (system)->can_hybrid_sleep (system);
+        return get_capability (system, CSM_SYSTEM_CAPABILITY_HYBRID_SLEEP);
 }
 
 gboolean
 csm_system_can_suspend (CsmSystem *system)
 {
-        return CSM_SYSTEM_GET_IFACE (system)->can_suspend (system);
+        return get_capability (system, CSM_SYSTEM_CAPABILITY_SUSPEND);
 }
 
 gboolean
 csm_system_can_hibernate (CsmSystem *system)
 {
-        return CSM_SYSTEM_GET_IFACE (system)->can_hibernate (system);
+        return get_capability (system, CSM_SYSTEM_CAPABILITY_HIBERNATE);
 }
 
 void
@@ -190,6 +410,12 @@ csm_get_system (void)
                                 g_debug ("Using ConsoleKit for session tracking");
                         }
                 }
+
+                if (system != NULL) {
+                        g_signal_connect (system, "capabilities-changed",
+                                          G_CALLBACK (on_capabilities_changed), NULL);
+                        prefetch_capabilities (system);
+                }
         }
 
         return g_object_ref (system);
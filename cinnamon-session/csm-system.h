@@ -26,6 +26,7 @@
 
 #include <glib.h>
 #include <glib-object.h>
+#include <gio/gio.h>
 
 #include "csm-inhibitor.h"
 
@@ -42,12 +43,23 @@ typedef struct _CsmSystem          CsmSystem;
 typedef struct _CsmSystemInterface CsmSystemInterface;
 typedef enum   _CsmSystemError     CsmSystemError;
 
+/* The answers csm-system.c caches for both backends */
+typedef enum {
+        CSM_SYSTEM_CAPABILITY_STOP = 0,
+        CSM_SYSTEM_CAPABILITY_RESTART,
+        CSM_SYSTEM_CAPABILITY_HYBRID_SLEEP,
+        CSM_SYSTEM_CAPABILITY_SUSPEND,
+        CSM_SYSTEM_CAPABILITY_HIBERNATE,
+        CSM_SYSTEM_N_CAPABILITIES
+} CsmSystemCapability;
+
 struct _CsmSystemInterface
 {
         GTypeInterface base_interface;
 
         void (* request_completed)    (CsmSystem *system,
                                        GError    *error);
+        void (* capabilities_changed) (CsmSystem *system);
 
         gboolean (* can_switch_user)  (CsmSystem *system);
         gboolean (* can_stop)         (CsmSystem *system);
@@ -71,6 +83,12 @@ struct _CsmSystemInterface
                                        const gchar      *id);
         gboolean (* is_last_session_for_user) (CsmSystem *system);
         gchar *  (* get_login_session_id) (CsmSystem *system);
+
+        /* The method of the returned proxy that answers @capability,
+         * so that it can be asked in the background */
+        GDBusProxy * (* get_capability_query) (CsmSystem            *system,
+                                               CsmSystemCapability   capability,
+                                               const char          **method);
 };
 
 enum _CsmSystemError {
@@ -40,6 +40,7 @@
 
 #include <glib.h>
 #include <glib-object.h>
+#include <glib-unix.h>
 #include <glib/gi18n.h>
 #include <gio/gio.h>
 #include <gio/gunixfdlist.h>
@@ -53,29 +54,89 @@
 #define SD_SEAT_INTERFACE    "org.freedesktop.login1.Seat"
 #define SD_SESSION_INTERFACE "org.freedesktop.login1.Session"
 
+/* logind property changes are passed on as capabilities-changed at most
+ * this often, since every listener answers with five polkit checks */
+#define CSM_SYSTEMD_CAPABILITIES_CHANGED_DELAY 500 /* milliseconds */
+
+/* The logind locks taken on behalf of session inhibitors, one per
+ * what/mode combination, whatever the number of inhibitors */
+typedef struct
+{
+        CsmInhibitorFlag  flags;
+        const char       *what;
+        const char       *mode;
+} LogindLockType;
+
+static const LogindLockType lock_types[] = {
+        { CSM_INHIBITOR_FLAG_SUSPEND, "sleep:shutdown", "block" },
+};
+
+#define N_LOCK_TYPES G_N_ELEMENTS (lock_types)
+
+typedef struct
+{
+        /* session inhibitors that need the lock */
+        guint            count;
+        gint             fd;
+        /* an Inhibit call is in flight */
+        gboolean         pending;
+} LogindLock;
+
 struct _CsmSystemdPrivate
 {
         GDBusProxy      *sd_proxy;
         char            *session_id;
         gchar           *session_path;
 
-        GSList          *inhibitors;
-        gint             inhibit_fd;
+        /* inhibitor id => flags */
+        GHashTable      *inhibitors;
+        LogindLock       locks[N_LOCK_TYPES];
+
+        /* What logind knows about our other sessions and our seat,
+         * refreshed whenever login_monitor wakes up */
+        sd_login_monitor *login_monitor;
+        guint            login_monitor_id;
+        /* other session id => type, which never changes */
+        GHashTable      *session_types;
+        gboolean         is_last_session;
+        gboolean         can_multi_session;
+
+        /* see sd_proxy_properties_changed_cb () */
+        char            *foreign_block_inhibited;
+        guint            capabilities_changed_id;
 };
 
+typedef struct
+{
+        CsmSystemd      *manager;
+        guint            lock;
+} InhibitData;
+
 static void csm_systemd_system_init (CsmSystemInterface *iface);
 
+static void sd_proxy_signal_cb (GDBusProxy  *proxy,
+                                const gchar *sender_name,
+                                const gchar *signal_name,
+                                GVariant    *parameters,
+                                gpointer     user_data);
+
+static void sd_proxy_properties_changed_cb (GDBusProxy *proxy,
+                                            GVariant   *changed_properties,
+                                            GStrv       invalidated_properties,
+                                            gpointer    user_data);
+
 G_DEFINE_TYPE_WITH_CODE (CsmSystemd, csm_systemd, G_TYPE_OBJECT,
                          G_IMPLEMENT_INTERFACE (CSM_TYPE_SYSTEM,
                                                 csm_systemd_system_init))
 
 static void
-drop_system_inhibitor (CsmSystemd *manager)
+drop_system_inhibitor (CsmSystemd *manager,
+                       guint       lock)
 {
-        if (manager->priv->inhibit_fd != -1) {
-                g_debug ("Dropping system inhibitor");
-                close (manager->priv->inhibit_fd);
-                manager->priv->inhibit_fd = -1;
+        if (manager->priv->locks[lock].fd != -1) {
+                g_debug ("Dropping system inhibitor for %s", lock_types[lock].what);
+                close (manager->priv->locks[lock].fd);
+                manager->priv->locks[lock].fd = -1;
         }
 }
 
@@ -83,15 +144,29 @@ static void
 csm_systemd_finalize (GObject *object)
 {
         CsmSystemd *systemd = CSM_SYSTEMD (object);
+        guint       i;
 
         g_clear_object (&systemd->priv->sd_proxy);
         free (systemd->priv->session_id);
         g_free (systemd->priv->session_path);
 
-        if (systemd->priv->inhibitors != NULL) {
-                g_slist_free_full (systemd->priv->inhibitors, g_free);
+        g_clear_pointer (&systemd->priv->inhibitors, g_hash_table_unref);
+        for (i = 0; i < N_LOCK_TYPES; i++) {
+                drop_system_inhibitor (systemd, i);
+        }
+
+        if (systemd->priv->login_monitor_id > 0) {
+                g_source_remove (systemd->priv->login_monitor_id);
+                systemd->priv->login_monitor_id = 0;
+        }
+        g_clear_pointer (&systemd->priv->login_monitor, sd_login_monitor_unref);
+        g_clear_pointer (&systemd->priv->session_types, g_hash_table_unref);
+
+        if (systemd->priv->capabilities_changed_id > 0) {
+                g_source_remove (systemd->priv->capabilities_changed_id);
+                systemd->priv->capabilities_changed_id = 0;
         }
-        drop_system_inhibitor (systemd);
+        g_free (systemd->priv->foreign_block_inhibited);
 
         G_OBJECT_CLASS (csm_systemd_parent_class)->finalize (object);
 }
@@ -108,18 +183,130 @@ csm_systemd_class_init (CsmSystemdClass *manager_class)
         g_type_class_add_private (manager_class, sizeof (CsmSystemdPrivate));
 }
 
+static void
+refresh_sessions (CsmSystemd *manager)
+{
+        GHashTable  *session_types;
+        char       **sessions;
+        char        *seat;
+        int          ret;
+        int          i;
+
+        session_types = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                               g_free, g_free);
+        manager->priv->is_last_session = FALSE;
+
+        sessions = NULL;
+        ret = sd_uid_get_sessions (getuid (), FALSE, &sessions);
+
+        if (manager->priv->session_id != NULL && ret > 0) {
+                manager->priv->is_last_session = TRUE;
+
+                for (i = 0; sessions[i] != NULL; i++) {
+                        char *state = NULL;
+                        char *type;
+
+                        if (g_strcmp0 (sessions[i], manager->priv->session_id) == 0)
+                                continue;
+
+                        type = NULL;
+                        if (manager->priv->session_types != NULL) {
+                                type = g_strdup (g_hash_table_lookup (manager->priv->session_types,
+                                                                      sessions[i]));
+                        }
+                        if (type == NULL) {
+                                char *sd_type = NULL;
+
+                                if (sd_session_get_type (sessions[i], &sd_type) != 0)
+                                        continue;
+
+                                type = g_strdup (sd_type);
+                                free (sd_type);
+                        }
+                        g_hash_table_replace (session_types, g_strdup (sessions[i]), type);
+
+                        if (g_strcmp0 (type, "x11") != 0 &&
+                            g_strcmp0 (type, "wayland") != 0)
+                                continue;
+
+                        if (sd_session_get_state (sessions[i], &state) != 0)
+                                continue;
+
+                        if (g_strcmp0 (state, "closing") != 0)
+                                manager->priv->is_last_session = FALSE;
+
+                        free (state);
+                }
+        }
+
+        if (sessions != NULL) {
+                for (i = 0; sessions[i]; i++)
+                        free (sessions[i]);
+                free (sessions);
+        }
+
+        g_clear_pointer (&manager->priv->session_types, g_hash_table_unref);
+        manager->priv->session_types = session_types;
+
+        seat = NULL;
+        sd_session_get_seat (manager->priv->session_id, &seat);
+        manager->priv->can_multi_session = sd_seat_can_multi_session (seat) > 0;
+        free (seat);
+}
+
+static gboolean
+on_login_monitor_event (gint          fd,
+                        GIOCondition  condition,
+                        CsmSystemd   *manager)
+{
+        sd_login_monitor_flush (manager->priv->login_monitor);
+
+        refresh_sessions (manager);
+
+        g_debug ("CsmSystemd: sessions changed, last session: %d, multi-session seat: %d",
+                 manager->priv->is_last_session, manager->priv->can_multi_session);
+
+        return TRUE;
+}
+
+static void
+start_login_monitor (CsmSystemd *manager)
+{
+        int ret;
+
+        ret = sd_login_monitor_new (NULL, &manager->priv->login_monitor);
+        if (ret < 0) {
+                g_warning ("Unable to monitor logind sessions: %s", strerror (-ret));
+                manager->priv->login_monitor = NULL;
+                return;
+        }
+
+        manager->priv->login_monitor_id =
+                g_unix_fd_add (sd_login_monitor_get_fd (manager->priv->login_monitor),
+                               (GIOCondition) sd_login_monitor_get_events (manager->priv->login_monitor),
+                               (GUnixFDSourceFunc) on_login_monitor_event,
+                               manager);
+
+        refresh_sessions (manager);
+}
+
 static void
 csm_systemd_init (CsmSystemd *manager)
 {
         GError *error;
         GDBusConnection *bus;
         GVariant *res;
+        guint i;
 
         manager->priv = G_TYPE_INSTANCE_GET_PRIVATE (manager,
                                                      CSM_TYPE_SYSTEMD,
                                                      CsmSystemdPrivate);
 
-        manager->priv->inhibit_fd = -1;
+        manager->priv->inhibitors = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                           g_free, NULL);
+        for (i = 0; i < N_LOCK_TYPES; i++) {
+                manager->priv->locks[i].fd = -1;
+        }
 
         error = NULL;
 
@@ -143,6 +330,11 @@ csm_systemd_init (CsmSystemd *manager)
                         g_warning ("Failed to connect to systemd: %s",
                                    error->message);
                         g_error_free (error);
+                } else {
+                        g_signal_connect (manager->priv->sd_proxy, "g-signal",
+                                          G_CALLBACK (sd_proxy_signal_cb), manager);
+                        g_signal_connect (manager->priv->sd_proxy, "g-properties-changed",
+                                          G_CALLBACK (sd_proxy_properties_changed_cb), manager);
                 }
 
                 g_object_unref (bus);
@@ -150,6 +342,8 @@ csm_systemd_init (CsmSystemd *manager)
 
         sd_pid_get_session (getpid (), &manager->priv->session_id);
 
+        start_login_monitor (manager);
+
         if (manager->priv->session_id == NULL) {
                 g_warning ("Could not get session id for session. Check that logind is "
                            "properly installed and pam_systemd is getting used at login.");
@@ -274,14 +468,13 @@ static gboolean
 csm_systemd_can_switch_user (CsmSystem *system)
 {
         CsmSystemd *manager = CSM_SYSTEMD (system);
-        gchar *seat;
-        gint ret;
 
-        sd_session_get_seat (manager->priv->session_id, &seat);
-        ret = sd_seat_can_multi_session (seat);
-        free (seat);
+        /* without a monitor nothing would keep the answers current */
+        if (manager->priv->login_monitor == NULL) {
+                refresh_sessions (manager);
+        }
 
-        return ret > 0;
+        return manager->priv->can_multi_session;
 }
 
 static gboolean
@@ -545,7 +738,7 @@ static void
 csm_systemd_suspend (CsmSystem *system, gboolean suspend_then_hibernate)
 {
 	gchar *method = "Suspend";
-	if (suspend_then_hibernate && csm_systemd_can_suspend (system) && csm_systemd_can_hibernate (system)) {
+	if (suspend_then_hibernate && csm_system_can_suspend (system) && csm_system_can_hibernate (system)) {
 		method = "SuspendThenHibernate";
 	}
 	g_debug ("Suspend using: %s", method);
@@ -583,12 +776,16 @@ inhibit_done (GObject      *source,
               gpointer      user_data)
 {
         GDBusProxy *proxy = G_DBUS_PROXY (source);
-        CsmSystemd *manager = CSM_SYSTEMD (user_data);
+        InhibitData *data = user_data;
+        CsmSystemd *manager = data->manager;
+        LogindLock *lock = &manager->priv->locks[data->lock];
         GError *error = NULL;
         GVariant *res;
         GUnixFDList *fd_list = NULL;
         gint idx;
 
+        lock->pending = FALSE;
+
         res = g_dbus_proxy_call_with_unix_fd_list_finish (proxy, &fd_list, result, &error);
 
         if (!res) {
@@ -596,19 +793,56 @@ inhibit_done (GObject      *source,
                 g_error_free (error);
         } else {
                 g_variant_get (res, "(h)", &idx);
-                manager->priv->inhibit_fd = g_unix_fd_list_get (fd_list, idx, &error);
-                if (manager->priv->inhibit_fd == -1) {
+                lock->fd = g_unix_fd_list_get (fd_list, idx, &error);
+                if (lock->fd == -1) {
                         g_warning ("Failed to receive system inhibitor fd: %s", error->message);
                         g_error_free (error);
                 }
-                g_debug ("System inhibitor fd is %d", manager->priv->inhibit_fd);
+                g_debug ("System inhibitor fd for %s is %d", lock_types[data->lock].what, lock->fd);
                 g_object_unref (fd_list);
                 g_variant_unref (res);
         }
 
-        if (manager->priv->inhibitors == NULL) {
-                drop_system_inhibitor (manager);
+        /* the last inhibitor went away while we were waiting */
+        if (lock->count == 0) {
+                drop_system_inhibitor (manager, data->lock);
         }
+
+        g_object_unref (manager);
+        g_free (data);
+}
+
+static void
+acquire_system_inhibitor (CsmSystemd *manager,
+                          guint       lock)
+{
+        InhibitData *data;
+
+        /* still held, or about to be */
+        if (manager->priv->locks[lock].fd != -1 || manager->priv->locks[lock].pending) {
+                return;
+        }
+
+        g_debug ("Adding system inhibitor for %s", lock_types[lock].what);
+
+        data = g_new0 (InhibitData, 1);
+        data->manager = g_object_ref (manager);
+        data->lock = lock;
+
+        manager->priv->locks[lock].pending = TRUE;
+        g_dbus_proxy_call_with_unix_fd_list (manager->priv->sd_proxy,
+                                             "Inhibit",
+                                             g_variant_new ("(ssss)",
+                                                            lock_types[lock].what,
+                                                            g_get_user_name (),
+                                                            "user session inhibited",
+                                                            lock_types[lock].mode),
+                                             0,
+                                             G_MAXINT,
+                                             NULL,
+                                             NULL,
+                                             inhibit_done,
+                                             data);
 }
 
 static void
@@ -617,27 +851,21 @@ csm_systemd_add_inhibitor (CsmSystem        *system,
                            CsmInhibitorFlag  flag)
 {
         CsmSystemd *manager = CSM_SYSTEMD (system);
+        guint       i;
 
-        if ((flag & CSM_INHIBITOR_FLAG_SUSPEND) == 0)
+        if (g_hash_table_contains (manager->priv->inhibitors, id))
                 return;
 
-        if (manager->priv->inhibitors == NULL) {
-                g_debug ("Adding system inhibitor");
-                g_dbus_proxy_call_with_unix_fd_list (manager->priv->sd_proxy,
-                                                     "Inhibit",
-                                                     g_variant_new ("(ssss)",
-                                                                    "sleep:shutdown",
-                                                                    g_get_user_name (),
-                                                                    "user session inhibited",
-                                                                    "block"),
-                                                     0,
-                                                     G_MAXINT,
-                                                     NULL,
-                                                     NULL,
-                                                     inhibit_done,
-                                                     manager);
-        }
-        manager->priv->inhibitors = g_slist_prepend (manager->priv->inhibitors, g_strdup (id));
+        for (i = 0; i < N_LOCK_TYPES; i++) {
+                if ((flag & lock_types[i].flags) == 0)
+                        continue;
+
+                if (manager->priv->locks[i].count++ == 0) {
+                        acquire_system_inhibitor (manager, i);
+                }
+        }
+
+        g_hash_table_insert (manager->priv->inhibitors, g_strdup (id), GUINT_TO_POINTER (flag));
 }
 
 static void
@@ -645,97 +873,209 @@ csm_systemd_remove_inhibitor (CsmSystem   *system,
                               const gchar *id)
 {
         CsmSystemd *manager = CSM_SYSTEMD (system);
-        GSList *l;
+        gpointer    flag;
+        guint       i;
 
-        l = g_slist_find_custom (manager->priv->inhibitors, id, (GCompareFunc)g_strcmp0);
-        if (l == NULL)
+        if (!g_hash_table_lookup_extended (manager->priv->inhibitors, id, NULL, &flag))
                 return;
 
-        g_free (l->data);
-        manager->priv->inhibitors = g_slist_delete_link (manager->priv->inhibitors, l);
-        if (manager->priv->inhibitors == NULL) {
-                drop_system_inhibitor (manager);
+        for (i = 0; i < N_LOCK_TYPES; i++) {
+                if ((GPOINTER_TO_UINT (flag) & lock_types[i].flags) == 0)
+                        continue;
+
+                /* if the lock is still pending, inhibit_done () drops it */
+                if (--manager->priv->locks[i].count == 0) {
+                        drop_system_inhibitor (manager, i);
+                }
         }
+
+        g_hash_table_remove (manager->priv->inhibitors, id);
 }
 
 static gboolean
 csm_systemd_is_last_session_for_user (CsmSystem *system)
 {
-        char **sessions = NULL;
-        char *session = NULL;
-        gboolean is_last_session;
-        int ret, i;
+        CsmSystemd *manager = CSM_SYSTEMD (system);
 
-        ret = sd_pid_get_session (getpid (), &session);
+        if (manager->priv->login_monitor == NULL) {
+                refresh_sessions (manager);
+        }
 
-        if (ret != 0) {
-                return FALSE;
+        return manager->priv->is_last_session;
+}
+
+static gchar *
+csm_systemd_get_login_session_id (CsmSystem *system)
+{
+        CsmSystemd *manager = CSM_SYSTEMD (system);
+
+        gchar *pid_session;
+        gint ret;
+
+        ret = sd_pid_get_session (getpid (), &pid_session);
+
+        if (ret < 0) {
+            g_printerr ("can't get login session id for cinnamon-session. errno: %d\n", -ret);
+            return NULL;
         }
 
-        ret = sd_uid_get_sessions (getuid (), FALSE, &sessions);
+        g_debug ("Login session ID is: %s\n", pid_session);
 
-        if (ret <= 0) {
-                return FALSE;
+        return pid_session;
+}
+
+static GDBusProxy *
+csm_systemd_get_capability_query (CsmSystem            *system,
+                                  CsmSystemCapability   capability,
+                                  const char          **method)
+{
+        CsmSystemd *manager = CSM_SYSTEMD (system);
+        static const char *methods[CSM_SYSTEM_N_CAPABILITIES] = {
+                [CSM_SYSTEM_CAPABILITY_STOP] = "CanPowerOff",
+                [CSM_SYSTEM_CAPABILITY_RESTART] = "CanReboot",
+                [CSM_SYSTEM_CAPABILITY_HYBRID_SLEEP] = "CanHybridSleep",
+                [CSM_SYSTEM_CAPABILITY_SUSPEND] = "CanSuspend",
+                [CSM_SYSTEM_CAPABILITY_HIBERNATE] = "CanHibernate",
+        };
+
+        *method = methods[capability];
+
+        return manager->priv->sd_proxy;
+}
+
+/* What logind answers to the Can* calls may have changed */
+static void
+sd_proxy_signal_cb (GDBusProxy  *proxy,
+                    const gchar *sender_name,
+                    const gchar *signal_name,
+                    GVariant    *parameters,
+                    gpointer     user_data)
+{
+        CsmSystemd *manager = user_data;
+
+        if (g_strcmp0 (signal_name, "PrepareForShutdown") != 0) {
+                return;
         }
 
-        is_last_session = TRUE;
-        for (i = 0; sessions[i]; i++) {
-                char *state = NULL;
-                char *type = NULL;
+        g_signal_emit_by_name (manager, "capabilities-changed");
+}
 
-                if (g_strcmp0 (sessions[i], session) == 0)
-                        continue;
+static gboolean
+emit_capabilities_changed (CsmSystemd *manager)
+{
+        manager->priv->capabilities_changed_id = 0;
 
-                ret = sd_session_get_state (sessions[i], &state);
+        g_signal_emit_by_name (manager, "capabilities-changed");
 
-                if (ret != 0)
-                        continue;
+        return FALSE;
+}
 
-                if (g_strcmp0 (state, "closing") == 0) {
-                        free (state);
+static int
+compare_strings (gconstpointer a,
+                 gconstpointer b)
+{
+        return strcmp (*(const char * const *) a, *(const char * const *) b);
+}
+
+/* The sorted whats of @block_inhibited that we don't block ourselves.
+ * logind ignores the inhibitors of our own user when answering the Can*
+ * calls, so our locks coming and going doesn't change anything. */
+static char *
+get_foreign_block_inhibited (CsmSystemd *manager,
+                             const char *block_inhibited)
+{
+        GPtrArray *foreign;
+        char     **whats;
+        char      *res;
+        guint      i;
+        int        j;
+
+        foreign = g_ptr_array_new ();
+        whats = g_strsplit (block_inhibited, ":", -1);
+
+        for (j = 0; whats[j] != NULL; j++) {
+                gboolean ours;
+
+                if (whats[j][0] == '\0') {
                         continue;
                 }
-                free (state);
 
-                ret = sd_session_get_type (sessions[i], &type);
+                ours = FALSE;
+                for (i = 0; i < N_LOCK_TYPES && !ours; i++) {
+                        char **lock_whats;
 
-                if (ret != 0)
-                        continue;
+                        if (manager->priv->locks[i].fd == -1 && !manager->priv->locks[i].pending) {
+                                continue;
+                        }
 
-                if (g_strcmp0 (type, "x11") != 0 &&
-                    g_strcmp0 (type, "wayland") != 0) {
-                        free (type);
-                        continue;
+                        lock_whats = g_strsplit (lock_types[i].what, ":", -1);
+                        ours = g_strv_contains ((const char * const *) lock_whats, whats[j]);
+                        g_strfreev (lock_whats);
                 }
 
-                is_last_session = FALSE;
+                if (!ours) {
+                        g_ptr_array_add (foreign, whats[j]);
+                }
         }
 
-        for (i = 0; sessions[i]; i++)
-                free (sessions[i]);
-        free (sessions);
+        g_ptr_array_sort (foreign, compare_strings);
+        g_ptr_array_add (foreign, NULL);
+        res = g_strjoinv (":", (char **) foreign->pdata);
+
+        g_ptr_array_free (foreign, TRUE);
+        g_strfreev (whats);
 
-        return is_last_session;
+        return res;
 }
 
-static gchar *
-csm_systemd_get_login_session_id (CsmSystem *system)
+/* Only the sessions of other users and their block inhibitors change
+ * what logind answers; the likes of IdleHint and DelayInhibited change
+ * all the time, not least because of our own inhibitors. */
+static void
+sd_proxy_properties_changed_cb (GDBusProxy *proxy,
+                                GVariant   *changed_properties,
+                                GStrv       invalidated_properties,
+                                gpointer    user_data)
 {
-        CsmSystemd *manager = CSM_SYSTEMD (system);
-
-        gchar *pid_session;
-        gint ret;
+        CsmSystemd *manager = user_data;
+        const char *block_inhibited;
+        GVariant   *value;
+        gboolean    changed;
+
+        changed = FALSE;
+
+        if (g_variant_lookup (changed_properties, "BlockInhibited", "&s", &block_inhibited)) {
+                char *foreign;
+
+                foreign = get_foreign_block_inhibited (manager, block_inhibited);
+                if (g_strcmp0 (foreign, manager->priv->foreign_block_inhibited) != 0) {
+                        g_free (manager->priv->foreign_block_inhibited);
+                        manager->priv->foreign_block_inhibited = foreign;
+                        changed = TRUE;
+                } else {
+                        g_free (foreign);
+                }
+        }
 
-        ret = sd_pid_get_session (getpid (), &pid_session);
+        value = g_variant_lookup_value (changed_properties, "NCurrentSessions", NULL);
+        if (value != NULL) {
+                g_variant_unref (value);
+                changed = TRUE;
+        }
 
-        if (ret < 0) {
-            g_printerr ("can't get login session id for cinnamon-session. errno: %d\n", -ret);
-            return NULL;
+        if (invalidated_properties != NULL &&
+            (g_strv_contains ((const char * const *) invalidated_properties, "BlockInhibited") ||
+             g_strv_contains ((const char * const *) invalidated_properties, "NCurrentSessions"))) {
+                changed = TRUE;
         }
 
-        g_debug ("Login session ID is: %s\n", pid_session);
+        if (!changed || manager->priv->capabilities_changed_id > 0) {
+                return;
+        }
 
-        return pid_session;
+        manager->priv->capabilities_changed_id = g_timeout_add (CSM_SYSTEMD_CAPABILITIES_CHANGED_DELAY,
+                                                                (GSourceFunc) emit_capabilities_changed,
+                                                                manager);
 }
 
 static void
@@ -758,6 +1098,7 @@ csm_systemd_system_init (CsmSystemInterface *iface)
         iface->remove_inhibitor = csm_systemd_remove_inhibitor;
         iface->is_last_session_for_user = csm_systemd_is_last_session_for_user;
         iface->get_login_session_id = csm_systemd_get_login_session_id;
+        iface->get_capability_query = csm_systemd_get_capability_query;
 }
 
 CsmSystemd *
@@ -0,0 +1,289 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * csm-timeline.c
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#include "csm-timeline.h"
+
+/* Apps restarting in a loop shouldn't make us grow forever */
+#define CSM_TIMELINE_MAX_ENTRIES 4096
+
+#define CSM_TIMELINE_FILENAME "cinnamon-session-timeline.json"
+
+typedef struct {
+        CsmTimelineEvent  event;
+        char             *name;
+        gint64            time;
+        /* which launch of the app this is about, counting from 1 */
+        guint             launch;
+        /* an exit before the launch registered, which ends its slice */
+        gboolean          closes;
+} CsmTimelineEntry;
+
+typedef struct {
+        guint    launches;
+        /* the last launch hasn't registered or exited yet */
+        gboolean open;
+} CsmTimelineApp;
+
+static GArray     *entries = NULL;
+/* app id => CsmTimelineApp */
+static GHashTable *apps = NULL;
+/* once the session runs, only registrations of earlier launches count */
+static gboolean    startup_done = FALSE;
+
+static const char *
+event_to_string (CsmTimelineEvent event)
+{
+        switch (event) {
+        case CSM_TIMELINE_PHASE_START:
+                return "phase-start";
+        case CSM_TIMELINE_PHASE_END:
+                return "phase-end";
+        case CSM_TIMELINE_PHASE_REACHED:
+                return "phase-reached";
+        case CSM_TIMELINE_APP_SPAWN:
+                return "app-spawn";
+        case CSM_TIMELINE_APP_REGISTER:
+                return "app-register";
+        case CSM_TIMELINE_APP_EXIT:
+                return "app-exit";
+        default:
+                g_assert_not_reached ();
+        }
+
+        return NULL;
+}
+
+/* Timestamps are CLOCK_MONOTONIC in microseconds, so they line up with the
+ * monotonic timestamps in the journal. Recording stops once the running
+ * phase is reached, apart from the launches still open then ending. */
+void
+csm_timeline_record (CsmTimelineEvent  event,
+                     const char       *name)
+{
+        CsmTimelineEntry  entry;
+        CsmTimelineApp   *app;
+
+        if (entries == NULL) {
+                entries = g_array_new (FALSE, FALSE, sizeof (CsmTimelineEntry));
+                apps = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+        }
+
+        if (entries->len >= CSM_TIMELINE_MAX_ENTRIES) {
+                return;
+        }
+
+        if (name == NULL) {
+                name = "";
+        }
+
+        entry.launch = 0;
+        entry.closes = FALSE;
+
+        switch (event) {
+        case CSM_TIMELINE_APP_SPAWN:
+                if (startup_done) {
+                        return;
+                }
+
+                app = g_hash_table_lookup (apps, name);
+                if (app == NULL) {
+                        app = g_new0 (CsmTimelineApp, 1);
+                        g_hash_table_insert (apps, g_strdup (name), app);
+                }
+                app->launches++;
+                app->open = TRUE;
+                entry.launch = app->launches;
+                break;
+        case CSM_TIMELINE_APP_REGISTER:
+                app = g_hash_table_lookup (apps, name);
+                if (app == NULL || !app->open) {
+                        return;
+                }
+                app->open = FALSE;
+                entry.launch = app->launches;
+                break;
+        case CSM_TIMELINE_APP_EXIT:
+                app = g_hash_table_lookup (apps, name);
+                if (app == NULL) {
+                        return;
+                }
+
+                if (app->open) {
+                        app->open = FALSE;
+                        entry.closes = TRUE;
+                } else if (startup_done) {
+                        return;
+                }
+                entry.launch = app->launches;
+                break;
+        case CSM_TIMELINE_PHASE_REACHED:
+                startup_done = TRUE;
+                break;
+        default:
+                if (startup_done) {
+                        return;
+                }
+                break;
+        }
+
+        entry.event = event;
+        entry.name = g_strdup (name);
+        entry.time = g_get_monotonic_time ();
+
+        g_array_append_val (entries, entry);
+}
+
+GVariant *
+csm_timeline_to_variant (void)
+{
+        GVariantBuilder builder;
+        guint           i;
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sst)"));
+
+        for (i = 0; entries != NULL && i < entries->len; i++) {
+                CsmTimelineEntry *entry = &g_array_index (entries, CsmTimelineEntry, i);
+
+                g_variant_builder_add (&builder, "(sst)",
+                                       event_to_string (entry->event),
+                                       entry->name,
+                                       (guint64) entry->time);
+        }
+
+        return g_variant_builder_end (&builder);
+}
+
+static void
+append_json_string (GString    *str,
+                    const char *value)
+{
+        const char *p;
+
+        g_string_append_c (str, '"');
+        for (p = value; *p != '\0'; p++) {
+                if (*p == '"' || *p == '\\') {
+                        g_string_append_c (str, '\\');
+                        g_string_append_c (str, *p);
+                } else if ((guchar) *p < 0x20) {
+                        g_string_append_printf (str, "\\u%04x", (guint) *p);
+                } else {
+                        g_string_append_c (str, *p);
+                }
+        }
+        g_string_append_c (str, '"');
+}
+
+/* Phases become nested duration events on one track, except the ones
+ * that never end while starting up, which are instants; each app launch
+ * is an async slice from spawn to registration, or to an exit before
+ * that, with later exits as instants. Async events pair up by id, so
+ * every launch of an app gets its own. */
+static void
+append_trace_event (GString          *str,
+                    CsmTimelineEntry *entry)
+{
+        const char *ph;
+        int         tid;
+
+        switch (entry->event) {
+        case CSM_TIMELINE_PHASE_START:
+                ph = "B";
+                tid = 1;
+                break;
+        case CSM_TIMELINE_PHASE_END:
+                ph = "E";
+                tid = 1;
+                break;
+        case CSM_TIMELINE_PHASE_REACHED:
+                ph = "i";
+                tid = 1;
+                break;
+        case CSM_TIMELINE_APP_SPAWN:
+                ph = "b";
+                tid = 2;
+                break;
+        case CSM_TIMELINE_APP_REGISTER:
+                ph = "e";
+                tid = 2;
+                break;
+        case CSM_TIMELINE_APP_EXIT:
+                ph = entry->closes ? "e" : "n";
+                tid = 2;
+                break;
+        default:
+                g_assert_not_reached ();
+        }
+
+        g_string_append (str, "{\"name\":");
+        append_json_string (str, entry->name);
+        g_string_append_printf (str,
+                                ",\"cat\":\"%s\",\"ph\":\"%s\",\"pid\":1,\"tid\":%d,\"ts\":%" G_GINT64_FORMAT,
+                                tid == 1 ? "phase" : "app",
+                                ph,
+                                tid,
+                                entry->time);
+        if (tid == 2) {
+                char *id;
+
+                id = g_strdup_printf ("%s#%u", entry->name, entry->launch);
+                g_string_append (str, ",\"id\":");
+                append_json_string (str, id);
+                g_free (id);
+        }
+        g_string_append_c (str, '}');
+}
+
+/* Writes the timeline to $XDG_RUNTIME_DIR in the Chrome trace event
+ * format, which Perfetto and chrome://tracing can open directly. */
+gboolean
+csm_timeline_dump (GError **error)
+{
+        GString  *str;
+        char     *filename;
+        gboolean  res;
+        guint     i;
+
+        str = g_string_new ("{\"traceEvents\":[\n");
+
+        for (i = 0; entries != NULL && i < entries->len; i++) {
+                if (i > 0) {
+                        g_string_append (str, ",\n");
+                }
+                append_trace_event (str, &g_array_index (entries, CsmTimelineEntry, i));
+        }
+
+        g_string_append (str, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+        filename = g_build_filename (g_get_user_runtime_dir (),
+                                     CSM_TIMELINE_FILENAME,
+                                     NULL);
+        res = g_file_set_contents (filename, str->str, str->len, error);
+        if (res) {
+                g_debug ("CsmTimeline: wrote startup timeline to %s", filename);
+        }
+
+        g_free (filename);
+        g_string_free (str, TRUE);
+
+        return res;
+}
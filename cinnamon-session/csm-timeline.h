@@ -0,0 +1,45 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ * csm-timeline.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#ifndef __CSM_TIMELINE_H__
+#define __CSM_TIMELINE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+        CSM_TIMELINE_PHASE_START = 0,
+        CSM_TIMELINE_PHASE_END,
+        CSM_TIMELINE_PHASE_REACHED,
+        CSM_TIMELINE_APP_SPAWN,
+        CSM_TIMELINE_APP_REGISTER,
+        CSM_TIMELINE_APP_EXIT
+} CsmTimelineEvent;
+
+void        csm_timeline_record     (CsmTimelineEvent  event,
+                                     const char       *name);
+
+GVariant   *csm_timeline_to_variant (void);
+
+gboolean    csm_timeline_dump       (GError          **error);
+
+G_END_DECLS
+
+#endif /* __CSM_TIMELINE_H__ */
@@ -84,62 +84,239 @@ static const char * const variable_unsetlist[] = {
     NULL
 };
 
+/* The desktop files directly in a directory, so that finding one by
+ * name doesn't touch the filesystem, and its subdirectories. Rescanned
+ * after the directory monitor reports a change. */
+typedef struct {
+        char         *path;
+        GHashTable   *names;
+        GHashTable   *subdirs;
+        GFileMonitor *monitor;
+        gboolean      valid;
+} DesktopDirIndex;
+
+/* path => DesktopDirIndex */
+static GHashTable *desktop_dir_indexes = NULL;
+
+/* csm_util_get_desktop_dirs() for each [look_in_saved_session][autostart_first] */
+static char **desktop_dirs[2][2];
+
+static void
+on_desktop_dir_changed (GFileMonitor      *monitor,
+                        GFile             *file,
+                        GFile             *other_file,
+                        GFileMonitorEvent  event,
+                        DesktopDirIndex   *index)
+{
+        switch (event) {
+        case G_FILE_MONITOR_EVENT_CREATED:
+        case G_FILE_MONITOR_EVENT_DELETED:
+        case G_FILE_MONITOR_EVENT_MOVED:
+        case G_FILE_MONITOR_EVENT_MOVED_IN:
+        case G_FILE_MONITOR_EVENT_MOVED_OUT:
+        case G_FILE_MONITOR_EVENT_RENAMED:
+                index->valid = FALSE;
+                break;
+        default:
+                break;
+        }
+}
+
+static void
+desktop_dir_index_free (DesktopDirIndex *index)
+{
+        if (index->monitor != NULL) {
+                g_signal_handlers_disconnect_by_func (index->monitor,
+                                                      on_desktop_dir_changed,
+                                                      index);
+                g_object_unref (index->monitor);
+        }
+        g_hash_table_destroy (index->names);
+        g_hash_table_destroy (index->subdirs);
+        g_free (index->path);
+        g_free (index);
+}
+
+static DesktopDirIndex *
+get_desktop_dir_index (const char *path)
+{
+        DesktopDirIndex *index;
+        GDir            *dir;
+        const char      *name;
+
+        if (desktop_dir_indexes == NULL) {
+                desktop_dir_indexes = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                             NULL,
+                                                             (GDestroyNotify) desktop_dir_index_free);
+        }
+
+        index = g_hash_table_lookup (desktop_dir_indexes, path);
+        if (index == NULL) {
+                GFile *file;
+
+                index = g_new0 (DesktopDirIndex, 1);
+                index->path = g_strdup (path);
+                index->names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+                index->subdirs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+                /* also works for directories that don't exist yet */
+                file = g_file_new_for_path (path);
+                index->monitor = g_file_monitor_directory (file, G_FILE_MONITOR_NONE, NULL, NULL);
+                g_object_unref (file);
+                if (index->monitor != NULL) {
+                        g_signal_connect (index->monitor, "changed",
+                                          G_CALLBACK (on_desktop_dir_changed), index);
+                }
+
+                g_hash_table_insert (desktop_dir_indexes, index->path, index);
+        }
+
+        if (index->valid) {
+                return index;
+        }
+
+        g_hash_table_remove_all (index->names);
+        g_hash_table_remove_all (index->subdirs);
+
+        dir = g_dir_open (path, 0, NULL);
+        if (dir != NULL) {
+                while ((name = g_dir_read_name (dir)) != NULL) {
+                        char *subdir;
+
+                        if (g_str_has_suffix (name, ".desktop")) {
+                                g_hash_table_add (index->names, g_strdup (name));
+                                continue;
+                        }
+
+                        subdir = g_build_filename (path, name, NULL);
+                        if (g_file_test (subdir, G_FILE_TEST_IS_DIR)) {
+                                g_hash_table_add (index->subdirs, g_strdup (name));
+                        }
+                        g_free (subdir);
+                }
+                g_dir_close (dir);
+        }
+
+        /* without a monitor nothing would tell us to scan again */
+        index->valid = index->monitor != NULL;
+
+        return index;
+}
+
+/* Like g_key_file_load_from_dirs(), kde4-foo.desktop may also be
+ * kde4/foo.desktop, and so on for every further dash. Only the first
+ * level is indexed, which rules out most names without a stat. */
+static char *
+find_desktop_file_in_subdirs (DesktopDirIndex *index,
+                              const char      *desktop_file)
+{
+        const char *rest;
+        const char *dash;
+        char       *subdir;
+        char       *dir;
+        char       *path;
+
+        dash = strchr (desktop_file, '-');
+        if (dash == NULL) {
+                return NULL;
+        }
+
+        subdir = g_strndup (desktop_file, dash - desktop_file);
+        if (!g_hash_table_contains (index->subdirs, subdir)) {
+                g_free (subdir);
+                return NULL;
+        }
+
+        dir = g_build_filename (index->path, subdir, NULL);
+        g_free (subdir);
+
+        path = NULL;
+        rest = dash + 1;
+        while (path == NULL) {
+                char *next;
+
+                path = g_build_filename (dir, rest, NULL);
+                if (g_file_test (path, G_FILE_TEST_IS_REGULAR)) {
+                        break;
+                }
+                g_clear_pointer (&path, g_free);
+
+                dash = strchr (rest, '-');
+                if (dash == NULL) {
+                        break;
+                }
+
+                subdir = g_strndup (rest, dash - rest);
+                next = g_build_filename (dir, subdir, NULL);
+                g_free (subdir);
+                g_free (dir);
+                dir = next;
+                rest = dash + 1;
+        }
+
+        g_free (dir);
+
+        return path;
+}
+
+static char *
+find_desktop_file_in_dirs (char       **dirs,
+                           const char  *desktop_file)
+{
+        int i;
+
+        for (i = 0; dirs[i] != NULL; i++) {
+                DesktopDirIndex *index;
+                char            *path;
+
+                index = get_desktop_dir_index (dirs[i]);
+                if (g_hash_table_contains (index->names, desktop_file)) {
+                        return g_build_filename (dirs[i], desktop_file, NULL);
+                }
+
+                path = find_desktop_file_in_subdirs (index, desktop_file);
+                if (path != NULL) {
+                        return path;
+                }
+        }
+
+        return NULL;
+}
+
 char *
 csm_util_find_desktop_file_for_app_name (const char *name,
                                          gboolean    look_in_saved_session,
                                          gboolean    autostart_first)
 {
-        char     *app_path;
         char    **app_dirs;
-        GKeyFile *key_file;
+        char     *app_path;
         char     *desktop_file;
-        int       i;
-
-        app_path = NULL;
-
-        app_dirs = csm_util_get_desktop_dirs (look_in_saved_session, autostart_first);
 
-        key_file = g_key_file_new ();
+        app_dirs = desktop_dirs[look_in_saved_session != FALSE][autostart_first != FALSE];
+        if (app_dirs == NULL) {
+                app_dirs = csm_util_get_desktop_dirs (look_in_saved_session, autostart_first);
+                desktop_dirs[look_in_saved_session != FALSE][autostart_first != FALSE] = app_dirs;
+        }
 
         desktop_file = g_strdup_printf ("%s.desktop", name);
 
         g_debug ("CsmUtil: Looking for file '%s'", desktop_file);
 
-        for (i = 0; app_dirs[i] != NULL; i++) {
-                g_debug ("CsmUtil: Looking in '%s'", app_dirs[i]);
-        }
-
-        g_key_file_load_from_dirs (key_file,
-                                   desktop_file,
-                                   (const char **) app_dirs,
-                                   &app_path,
-                                   G_KEY_FILE_NONE,
-                                   NULL);
-
-        if (app_path != NULL) {
-                g_debug ("CsmUtil: found in XDG dirs: '%s'", app_path);
-        }
+        app_path = find_desktop_file_in_dirs (app_dirs, desktop_file);
 
         /* look for gnome vendor prefix */
         if (app_path == NULL) {
                 g_free (desktop_file);
                 desktop_file = g_strdup_printf ("gnome-%s.desktop", name);
 
-                g_key_file_load_from_dirs (key_file,
-                                           desktop_file,
-                                           (const char **) app_dirs,
-                                           &app_path,
-                                           G_KEY_FILE_NONE,
-                                           NULL);
-                if (app_path != NULL) {
-                        g_debug ("CsmUtil: found in XDG dirs: '%s'", app_path);
-                }
+                app_path = find_desktop_file_in_dirs (app_dirs, desktop_file);
         }
 
-        g_free (desktop_file);
-        g_key_file_free (key_file);
+        if (app_path != NULL) {
+                g_debug ("CsmUtil: found in XDG dirs: '%s'", app_path);
+        }
 
-        g_strfreev (app_dirs);
+        g_free (desktop_file);
 
         return app_path;
 }
@@ -229,12 +406,49 @@ csm_util_get_saved_session_dir (void)
         return _saved_session_dir;
 }
 
+/* Also called from the desktop file parser threads */
+const char *
+csm_util_get_cache_dir (void)
+{
+        static GMutex  lock;
+        static char   *cache_dir = NULL;
+
+        g_mutex_lock (&lock);
+
+        if (cache_dir == NULL) {
+                char *dir;
+
+                dir = g_build_filename (g_get_user_cache_dir (),
+                                        "cinnamon-session",
+                                        NULL);
+
+                if (ensure_dir_exists (dir)) {
+                        cache_dir = dir;
+                } else {
+                        g_free (dir);
+                }
+        }
+
+        g_mutex_unlock (&lock);
+
+        return cache_dir;
+}
+
 static char ** autostart_dirs;
 
 void
 csm_util_set_autostart_dirs (char ** dirs)
 {
+        int i, j;
+
         autostart_dirs = g_strdupv (dirs);
+
+        /* they are part of the directories searched for desktop files */
+        for (i = 0; i < 2; i++) {
+                for (j = 0; j < 2; j++) {
+                        g_clear_pointer (&desktop_dirs[i][j], g_strfreev);
+                }
+        }
 }
 
 static char **
@@ -521,79 +735,206 @@ csm_util_generate_startup_id (void)
                                 sequence);
 }
 
-static gboolean
-csm_util_update_activation_environment (const char  *variable,
-                                        const char  *value,
-                                        GError     **error)
+/* Nothing we ask over the session bus is worth hanging the session for */
+#define CSM_UTIL_DBUS_CALL_TIMEOUT 10000 /* ms */
+
+static GDBusConnection *session_bus = NULL;
+
+/**
+ * csm_util_get_session_bus:
+ * @error: a #GError
+ *
+ * Returns: (transfer none): the session bus connection shared by the
+ *     helpers here, or %NULL if it can't be reached
+ */
+GDBusConnection *
+csm_util_get_session_bus (GError **error)
 {
-        GDBusConnection *connection;
-        gboolean         environment_updated;
-        GVariantBuilder  builder;
-        GVariant        *reply;
-        GError          *bus_error = NULL;
+        if (session_bus != NULL && g_dbus_connection_is_closed (session_bus)) {
+                g_clear_object (&session_bus);
+        }
 
-        environment_updated = FALSE;
-        connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, error);
+        if (session_bus == NULL) {
+                session_bus = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, error);
+        }
 
-        if (connection == NULL) {
-                return FALSE;
+        return session_bus;
+}
+
+typedef struct {
+        char            *method_name;
+        CsmUtilCallback  callback;
+        gpointer         user_data;
+} SessionBusCall;
+
+static void
+on_session_bus_call_finished (GObject      *source,
+                              GAsyncResult *result,
+                              gpointer      user_data)
+{
+        SessionBusCall *call = user_data;
+        GVariant       *reply;
+        GError         *error = NULL;
+
+        reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, &error);
+
+        if (call->callback != NULL) {
+                call->callback (reply, error, call->user_data);
+        } else if (error != NULL) {
+                g_debug ("Calling %s failed: %s", call->method_name, error->message);
         }
 
-        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{ss}"));
-        g_variant_builder_add (&builder, "{ss}", variable, value);
-
-        reply = g_dbus_connection_call_sync (connection,
-                                             "org.freedesktop.DBus",
-                                             "/org/freedesktop/DBus",
-                                             "org.freedesktop.DBus",
-                                             "UpdateActivationEnvironment",
-                                             g_variant_new ("(@a{ss})",
-                                                            g_variant_builder_end (&builder)),
-                                             NULL,
-                                             G_DBUS_CALL_FLAGS_NONE,
-                                             -1, NULL, &bus_error);
-
-        if (bus_error != NULL) {
-                g_propagate_error (error, bus_error);
-        } else {
-                environment_updated = TRUE;
+        if (reply != NULL) {
                 g_variant_unref (reply);
         }
+        g_clear_error (&error);
 
-        g_clear_object (&connection);
+        g_free (call->method_name);
+        g_free (call);
+}
 
-        return environment_updated;
+/**
+ * csm_util_call_session_bus:
+ * @bus_name: the name of the peer
+ * @object_path: the object to call the method on
+ * @interface_name: the interface of the method
+ * @method_name: the method
+ * @parameters: (allow-none): a floating #GVariant tuple of the parameters
+ * @reply_type: (allow-none): the expected type of the reply
+ * @callback: (allow-none): called with either the reply or an error,
+ *     %NULL to only log failures
+ * @user_data: data for @callback
+ *
+ * Calls a method over the shared session bus connection without
+ * blocking, giving up after %CSM_UTIL_DBUS_CALL_TIMEOUT. Calls are
+ * sent in the order they are made. If the bus can't be reached,
+ * @callback is called before this returns.
+ */
+void
+csm_util_call_session_bus (const char         *bus_name,
+                           const char         *object_path,
+                           const char         *interface_name,
+                           const char         *method_name,
+                           GVariant           *parameters,
+                           const GVariantType *reply_type,
+                           CsmUtilCallback     callback,
+                           gpointer            user_data)
+{
+        csm_util_call_session_bus_full (bus_name,
+                                        object_path,
+                                        interface_name,
+                                        method_name,
+                                        parameters,
+                                        reply_type,
+                                        G_DBUS_CALL_FLAGS_NONE,
+                                        CSM_UTIL_DBUS_CALL_TIMEOUT,
+                                        callback,
+                                        user_data);
 }
 
-gboolean
-csm_util_export_activation_environment (GError     **error)
+/**
+ * csm_util_call_session_bus_full:
+ * @bus_name: the name of the peer
+ * @object_path: the object to call the method on
+ * @interface_name: the interface of the method
+ * @method_name: the method
+ * @parameters: (allow-none): a floating #GVariant tuple of the parameters
+ * @reply_type: (allow-none): the expected type of the reply
+ * @flags: flags for the call
+ * @timeout_msec: the timeout in milliseconds, or -1 for the D-Bus default
+ * @callback: (allow-none): called with either the reply or an error,
+ *     %NULL to only log failures
+ * @user_data: data for @callback
+ *
+ * Like csm_util_call_session_bus(), for the calls that need their own
+ * flags or timeout.
+ */
+void
+csm_util_call_session_bus_full (const char         *bus_name,
+                                const char         *object_path,
+                                const char         *interface_name,
+                                const char         *method_name,
+                                GVariant           *parameters,
+                                const GVariantType *reply_type,
+                                GDBusCallFlags      flags,
+                                int                 timeout_msec,
+                                CsmUtilCallback     callback,
+                                gpointer            user_data)
 {
         GDBusConnection *connection;
-        gboolean         environment_updated = FALSE;
-        char           **entry_names;
-        int              i = 0;
-        GVariantBuilder  builder;
-        GRegex          *name_regex, *value_regex;
-        GVariant        *reply;
-        GError          *bus_error = NULL;
-
-        connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, error);
+        SessionBusCall  *call;
+        GError          *error = NULL;
 
+        connection = csm_util_get_session_bus (&error);
         if (connection == NULL) {
-                return FALSE;
+                if (callback != NULL) {
+                        callback (NULL, error, user_data);
+                } else {
+                        g_debug ("Calling %s failed: %s", method_name, error->message);
+                }
+                g_error_free (error);
+                if (parameters != NULL) {
+                        g_variant_unref (g_variant_ref_sink (parameters));
+                }
+                return;
         }
 
-        name_regex = g_regex_new ("^[a-zA-Z_][a-zA-Z0-9_]*$", G_REGEX_OPTIMIZE, 0, error);
+        call = g_new0 (SessionBusCall, 1);
+        call->method_name = g_strdup (method_name);
+        call->callback = callback;
+        call->user_data = user_data;
+
+        g_dbus_connection_call (connection,
+                                bus_name,
+                                object_path,
+                                interface_name,
+                                method_name,
+                                parameters,
+                                reply_type,
+                                flags,
+                                timeout_msec,
+                                NULL,
+                                on_session_bus_call_finished,
+                                call);
+}
 
-        if (name_regex == NULL) {
-                return FALSE;
+static void
+on_activation_environment_updated (GVariant     *reply,
+                                   const GError *error,
+                                   gpointer      user_data)
+{
+        /* If this fails it isn't fatal, it means some things like session
+         * management and keyring won't work in activated clients.
+         */
+        if (error != NULL) {
+                g_warning ("Could not make bus activated clients aware of the environment: %s", error->message);
         }
+}
 
-        value_regex = g_regex_new ("^([[:blank:]]|[^[:cntrl:]])*$", G_REGEX_OPTIMIZE, 0, error);
-
-        if (value_regex == NULL) {
-                return FALSE;
+static void
+on_user_environment_updated (GVariant     *reply,
+                             const GError *error,
+                             gpointer      user_data)
+{
+        /* If this fails, the system user session won't get the updated environment
+         */
+        if (error != NULL) {
+                g_debug ("Could not make systemd aware of the environment: %s", error->message);
         }
+}
+
+/* Makes the whole environment of the session available to services
+ * activated by the bus */
+void
+csm_util_export_activation_environment (void)
+{
+        char           **entry_names;
+        int              i = 0;
+        GVariantBuilder  builder;
+        GRegex          *name_regex, *value_regex;
+
+        name_regex = g_regex_new ("^[a-zA-Z_][a-zA-Z0-9_]*$", G_REGEX_OPTIMIZE, 0, NULL);
+        value_regex = g_regex_new ("^([[:blank:]]|[^[:cntrl:]])*$", G_REGEX_OPTIMIZE, 0, NULL);
 
         g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{ss}"));
         for (entry_names = g_listenv (); entry_names[i] != NULL; i++) {
@@ -622,52 +963,28 @@ csm_util_export_activation_environment (GError     **error)
 
         g_strfreev (entry_names);
 
-        reply = g_dbus_connection_call_sync (connection,
-                                             "org.freedesktop.DBus",
-                                             "/org/freedesktop/DBus",
-                                             "org.freedesktop.DBus",
-                                             "UpdateActivationEnvironment",
-                                             g_variant_new ("(@a{ss})",
-                                                            g_variant_builder_end (&builder)),
-                                             NULL,
-                                             G_DBUS_CALL_FLAGS_NONE,
-                                             -1, NULL, &bus_error);
-
-        if (bus_error != NULL) {
-                g_propagate_error (error, bus_error);
-        } else {
-                environment_updated = TRUE;
-                g_variant_unref (reply);
-        }
-
-        g_clear_object (&connection);
-
-        return environment_updated;
+        csm_util_call_session_bus ("org.freedesktop.DBus",
+                                   "/org/freedesktop/DBus",
+                                   "org.freedesktop.DBus",
+                                   "UpdateActivationEnvironment",
+                                   g_variant_new ("(@a{ss})",
+                                                  g_variant_builder_end (&builder)),
+                                   NULL,
+                                   on_activation_environment_updated,
+                                   NULL);
 }
 
-gboolean
-csm_util_export_user_environment (GError     **error)
+/* Makes the whole environment of the session available to the systemd
+ * user instance */
+void
+csm_util_export_user_environment (void)
 {
-        GDBusConnection *connection;
-        gboolean         environment_updated = FALSE;
         char           **entries;
         int              i = 0;
         GVariantBuilder  builder;
         GRegex          *regex;
-        GVariant        *reply;
-        GError          *bus_error = NULL;
 
-        connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, error);
-
-        if (connection == NULL) {
-                return FALSE;
-        }
-
-        regex = g_regex_new ("^[a-zA-Z_][a-zA-Z0-9_]*=([[:blank:]]|[^[:cntrl:]])*$", G_REGEX_OPTIMIZE, 0, error);
-
-        if (regex == NULL) {
-                return FALSE;
-        }
+        regex = g_regex_new ("^[a-zA-Z_][a-zA-Z0-9_]*=([[:blank:]]|[^[:cntrl:]])*$", G_REGEX_OPTIMIZE, 0, NULL);
 
         entries = g_get_environ ();
 
@@ -700,225 +1017,390 @@ csm_util_export_user_environment (GError     **error)
 
         g_strfreev (entries);
 
-        reply = g_dbus_connection_call_sync (connection,
-                                             "org.freedesktop.systemd1",
-                                             "/org/freedesktop/systemd1",
-                                             "org.freedesktop.systemd1.Manager",
-                                             "UnsetAndSetEnvironment",
-                                             g_variant_builder_end (&builder),
-                                             NULL,
-                                             G_DBUS_CALL_FLAGS_NONE,
-                                             -1, NULL, &bus_error);
-
-        if (bus_error != NULL) {
-                g_propagate_error (error, bus_error);
-        } else {
-                environment_updated = TRUE;
-                g_variant_unref (reply);
-        }
+        csm_util_call_session_bus ("org.freedesktop.systemd1",
+                                   "/org/freedesktop/systemd1",
+                                   "org.freedesktop.systemd1.Manager",
+                                   "UnsetAndSetEnvironment",
+                                   g_variant_builder_end (&builder),
+                                   NULL,
+                                   on_user_environment_updated,
+                                   NULL);
+}
 
-        g_clear_object (&connection);
+static void
+on_systemd_unit_job_queued (GVariant     *reply,
+                            const GError *error,
+                            gpointer      user_data)
+{
+        char *unit = user_data;
 
-        return environment_updated;
+        if (error != NULL) {
+                g_debug ("Could not queue a job for %s: %s", unit, error->message);
+        }
+
+        g_free (unit);
 }
 
-static gboolean
-csm_util_update_user_environment (const char  *variable,
-                                  const char  *value,
-                                  GError     **error)
+void
+csm_util_start_systemd_unit (const char *unit,
+                             const char *mode)
 {
-        GDBusConnection *connection;
-        gboolean         environment_updated;
-        char            *entry;
-        GVariantBuilder  builder;
-        GVariant        *reply;
-        GError          *bus_error = NULL;
+        csm_util_call_session_bus ("org.freedesktop.systemd1",
+                                   "/org/freedesktop/systemd1",
+                                   "org.freedesktop.systemd1.Manager",
+                                   "StartUnit",
+                                   g_variant_new ("(ss)", unit, mode),
+                                   G_VARIANT_TYPE ("(o)"),
+                                   on_systemd_unit_job_queued,
+                                   g_strdup (unit));
+}
 
-        environment_updated = FALSE;
-        connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, error);
+void
+csm_util_stop_systemd_unit (const char *unit,
+                            const char *mode)
+{
+        csm_util_call_session_bus ("org.freedesktop.systemd1",
+                                   "/org/freedesktop/systemd1",
+                                   "org.freedesktop.systemd1.Manager",
+                                   "StopUnit",
+                                   g_variant_new ("(ss)", unit, mode),
+                                   G_VARIANT_TYPE ("(o)"),
+                                   on_systemd_unit_job_queued,
+                                   g_strdup (unit));
+}
 
-        if (connection == NULL) {
-                return FALSE;
+/* Same escaping as systemd-escape, which unit names must go through */
+static char *
+escape_unit_name_component (const char *str)
+{
+        GString    *escaped;
+        const char *p;
+
+        escaped = g_string_new (NULL);
+
+        for (p = str; *p != '\0'; p++) {
+                if (g_ascii_isalnum (*p) || *p == ':' || *p == '_' ||
+                    (*p == '.' && p != str)) {
+                        g_string_append_c (escaped, *p);
+                } else if (*p == '-') {
+                        /* '-' separates the components, it isn't part of them */
+                        g_string_append (escaped, "\\x2d");
+                } else {
+                        g_string_append_printf (escaped, "\\x%02x", (guchar) *p);
+                }
         }
 
-        g_variant_builder_init (&builder, G_VARIANT_TYPE ("as"));
-        entry = g_strdup_printf ("%s=%s", variable, value);
-        g_variant_builder_add (&builder, "s", entry);
-        g_free (entry);
-
-        reply = g_dbus_connection_call_sync (connection,
-                                             "org.freedesktop.systemd1",
-                                             "/org/freedesktop/systemd1",
-                                             "org.freedesktop.systemd1.Manager",
-                                             "SetEnvironment",
-                                             g_variant_new ("(@as)",
-                                                            g_variant_builder_end (&builder)),
-                                             NULL,
-                                             G_DBUS_CALL_FLAGS_NONE,
-                                             -1, NULL, &bus_error);
-
-        if (bus_error != NULL) {
-                g_propagate_error (error, bus_error);
+        return g_string_free (escaped, FALSE);
+}
+
+typedef struct {
+        char           *unit;
+        GDestroyNotify  notify;
+        gpointer        user_data;
+} StartScopeData;
+
+static void
+on_start_scope_finished (GVariant     *reply,
+                         const GError *error,
+                         gpointer      user_data)
+{
+        StartScopeData *data = user_data;
+
+        if (error != NULL) {
+                g_debug ("Could not create systemd scope %s: %s", data->unit, error->message);
         } else {
-                environment_updated = TRUE;
-                g_variant_unref (reply);
+                g_debug ("Created systemd scope %s", data->unit);
         }
 
-        g_clear_object (&connection);
+        if (data->notify != NULL) {
+                data->notify (data->user_data);
+        }
 
-        return environment_updated;
+        g_free (data->unit);
+        g_free (data);
 }
 
-gboolean
-csm_util_start_systemd_unit (const char  *unit,
-                             const char  *mode,
-                             GError     **error)
+/**
+ * csm_util_start_systemd_scope:
+ * @app_id: the app, used to name the scope
+ * @pid: the process to move into the scope
+ * @description: (allow-none): the description of the scope
+ * @properties: (allow-none): a floating a(sv) of further unit properties,
+ *     such as resource limits
+ * @notify: (allow-none): called with @user_data once systemd answered,
+ *     whether or not the scope was created
+ * @user_data: data for @notify
+ *
+ * Asks the systemd user instance to move @pid into a new transient scope
+ * named app-cinnamon-@app_id-@pid.scope, which gets its own cgroup.
+ * Failures, like not running under systemd, are only logged.
+ */
+void
+csm_util_start_systemd_scope (const char     *app_id,
+                              GPid            pid,
+                              const char     *description,
+                              GVariant       *properties,
+                              GDestroyNotify  notify,
+                              gpointer        user_data)
 {
-        g_autoptr(GDBusConnection) connection = NULL;
-        g_autoptr(GVariant)        reply = NULL;
-        GError          *bus_error = NULL;
+        GVariantBuilder  builder;
+        StartScopeData  *data;
+        char            *escaped;
+        char            *unit;
+
+        g_return_if_fail (app_id != NULL);
+        g_return_if_fail (pid > 0);
+
+        escaped = escape_unit_name_component (app_id);
+        unit = g_strdup_printf ("app-cinnamon-%s-%d.scope", escaped, (int) pid);
+        g_free (escaped);
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sv)"));
+        g_variant_builder_add (&builder, "(sv)", "PIDs",
+                               g_variant_new_fixed_array (G_VARIANT_TYPE_UINT32,
+                                                          &pid, 1, sizeof (guint32)));
+        /* don't keep the unit around once the app has exited */
+        g_variant_builder_add (&builder, "(sv)", "CollectMode",
+                               g_variant_new_string ("inactive-or-failed"));
+        if (description != NULL) {
+                g_variant_builder_add (&builder, "(sv)", "Description",
+                                       g_variant_new_string (description));
+        }
+        if (properties != NULL) {
+                GVariantIter  iter;
+                GVariant     *property;
+
+                g_variant_ref_sink (properties);
+                g_variant_iter_init (&iter, properties);
+                while ((property = g_variant_iter_next_value (&iter)) != NULL) {
+                        g_variant_builder_add_value (&builder, property);
+                        g_variant_unref (property);
+                }
+                g_variant_unref (properties);
+        }
 
-        connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, error);
+        data = g_new0 (StartScopeData, 1);
+        data->unit = unit;
+        data->notify = notify;
+        data->user_data = user_data;
+
+        csm_util_call_session_bus_full ("org.freedesktop.systemd1",
+                                        "/org/freedesktop/systemd1",
+                                        "org.freedesktop.systemd1.Manager",
+                                        "StartTransientUnit",
+                                        g_variant_new ("(ssa(sv)a(sa(sv)))",
+                                                       unit, "fail",
+                                                       &builder, NULL),
+                                        G_VARIANT_TYPE ("(o)"),
+                                        G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                        CSM_UTIL_DBUS_CALL_TIMEOUT,
+                                        on_start_scope_finished,
+                                        data);
+}
 
-        if (connection == NULL)
-                return FALSE;
+struct _CsmEnvTransaction
+{
+        /* variable => value, "" to unset */
+        GHashTable *variables;
+};
 
-        reply = g_dbus_connection_call_sync (connection,
-                                             "org.freedesktop.systemd1",
-                                             "/org/freedesktop/systemd1",
-                                             "org.freedesktop.systemd1.Manager",
-                                             "StartUnit",
-                                             g_variant_new ("(ss)",
-                                                            unit, mode),
-                                             NULL,
-                                             G_DBUS_CALL_FLAGS_NONE,
-                                             -1, NULL, &bus_error);
-
-        if (bus_error != NULL) {
-                g_propagate_error (error, bus_error);
-                return FALSE;
-        }
+/**
+ * csm_util_env_transaction_begin:
+ *
+ * Starts collecting environment changes that are passed on to the D-Bus
+ * activation environment and the systemd user instance all at once by
+ * csm_util_env_transaction_commit().
+ *
+ * Returns: (transfer full): a new transaction
+ */
+CsmEnvTransaction *
+csm_util_env_transaction_begin (void)
+{
+        CsmEnvTransaction *txn;
 
-        return TRUE;
+        txn = g_new0 (CsmEnvTransaction, 1);
+        txn->variables = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+        return txn;
 }
 
-gboolean
-csm_util_stop_systemd_unit (const char  *unit,
-                             const char  *mode,
-                             GError     **error)
+/**
+ * csm_util_env_transaction_setenv:
+ * @txn: a #CsmEnvTransaction
+ * @variable: the variable to set
+ * @value: (allow-none): its value, %NULL or empty to unset it
+ *
+ * Sets @variable in the environment of the session right away, and
+ * records it for csm_util_env_transaction_commit().
+ */
+void
+csm_util_env_transaction_setenv (CsmEnvTransaction *txn,
+                                 const char        *variable,
+                                 const char        *value)
 {
-        g_autoptr(GDBusConnection) connection = NULL;
-        g_autoptr(GVariant)        reply = NULL;
-        GError          *bus_error = NULL;
+        g_return_if_fail (txn != NULL);
+        g_return_if_fail (variable != NULL);
 
-        connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, error);
+        if (value == NULL || *value == '\0') {
+                g_unsetenv (variable);
+                value = "";
+        } else {
+                g_setenv (variable, value, TRUE);
+        }
+
+        g_hash_table_replace (txn->variables, g_strdup (variable), g_strdup (value));
+}
 
-        if (connection == NULL)
+/* systemd rejects the whole call for a single bad assignment */
+static gboolean
+is_valid_environment_entry (const char *variable,
+                            const char *value)
+{
+        const char *p;
+
+        if (!g_ascii_isalpha (variable[0]) && variable[0] != '_')
                 return FALSE;
 
-        reply = g_dbus_connection_call_sync (connection,
-                                             "org.freedesktop.systemd1",
-                                             "/org/freedesktop/systemd1",
-                                             "org.freedesktop.systemd1.Manager",
-                                             "StopUnit",
-                                             g_variant_new ("(ss)",
-                                                            unit, mode),
-                                             NULL,
-                                             G_DBUS_CALL_FLAGS_NONE,
-                                             -1, NULL, &bus_error);
-
-        if (bus_error != NULL) {
-                g_propagate_error (error, bus_error);
+        for (p = variable; *p != '\0'; p++) {
+                if (!g_ascii_isalnum (*p) && *p != '_')
+                        return FALSE;
+        }
+
+        if (!g_utf8_validate (value, -1, NULL))
                 return FALSE;
+
+        for (p = value; *p != '\0'; p++) {
+                if (g_ascii_iscntrl (*p) && *p != '\t')
+                        return FALSE;
         }
 
         return TRUE;
 }
 
-static gboolean
-csm_util_unset_user_environment (const char  *variable,
-                                 GError     **error)
+/**
+ * csm_util_env_transaction_commit:
+ * @txn: (transfer full): a #CsmEnvTransaction
+ *
+ * Passes the changes of @txn on asynchronously, with one
+ * UpdateActivationEnvironment and one UnsetAndSetEnvironment call, and
+ * frees @txn. Calls made later on the session bus are ordered after them.
+ */
+void
+csm_util_env_transaction_commit (CsmEnvTransaction *txn)
 {
-        GDBusConnection *connection;
-        gboolean         environment_updated;
-        GVariantBuilder  builder;
-        GVariant        *reply;
-        GError          *bus_error = NULL;
+        GVariantBuilder  activation;
+        GVariantBuilder  unset;
+        GVariantBuilder  set;
+        GHashTableIter   iter;
+        gpointer         variable;
+        gpointer         value;
 
-        environment_updated = FALSE;
-        connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, error);
+        g_return_if_fail (txn != NULL);
 
-        if (connection == NULL) {
-                return FALSE;
+        if (g_hash_table_size (txn->variables) == 0) {
+                goto out;
         }
 
-        g_variant_builder_init (&builder, G_VARIANT_TYPE ("as"));
-        g_variant_builder_add (&builder, "s", variable);
-
-        reply = g_dbus_connection_call_sync (connection,
-                                             "org.freedesktop.systemd1",
-                                             "/org/freedesktop/systemd1",
-                                             "org.freedesktop.systemd1.Manager",
-                                             "UnsetEnvironment",
-                                             g_variant_new ("(@as)",
-                                                            g_variant_builder_end (&builder)),
-                                             NULL,
-                                             G_DBUS_CALL_FLAGS_NONE,
-                                             -1, NULL, &bus_error);
-
-        if (bus_error != NULL) {
-                g_propagate_error (error, bus_error);
-        } else {
-                environment_updated = TRUE;
-                g_variant_unref (reply);
+        g_variant_builder_init (&activation, G_VARIANT_TYPE ("a{ss}"));
+        g_variant_builder_init (&unset, G_VARIANT_TYPE ("as"));
+        g_variant_builder_init (&set, G_VARIANT_TYPE ("as"));
+
+        g_hash_table_iter_init (&iter, txn->variables);
+        while (g_hash_table_iter_next (&iter, &variable, &value)) {
+                /* The D-Bus activation environment has no unset operation
+                 * (only set), so unset variables are cleared to the empty
+                 * string there, which is equivalent to unset for its consumers.
+                 */
+                g_variant_builder_add (&activation, "{ss}", variable, value);
+
+                if (!is_valid_environment_entry (variable, value)) {
+                        g_debug ("Not passing %s=%s on to systemd", (char *) variable, (char *) value);
+                } else if (*(char *) value == '\0') {
+                        g_variant_builder_add (&unset, "s", variable);
+                } else {
+                        char *entry;
+
+                        entry = g_strdup_printf ("%s=%s", (char *) variable, (char *) value);
+                        g_variant_builder_add (&set, "s", entry);
+                        g_free (entry);
+                }
         }
 
-        g_clear_object (&connection);
+        csm_util_call_session_bus ("org.freedesktop.DBus",
+                                   "/org/freedesktop/DBus",
+                                   "org.freedesktop.DBus",
+                                   "UpdateActivationEnvironment",
+                                   g_variant_new ("(a{ss})", &activation),
+                                   NULL,
+                                   on_activation_environment_updated,
+                                   NULL);
+
+        csm_util_call_session_bus ("org.freedesktop.systemd1",
+                                   "/org/freedesktop/systemd1",
+                                   "org.freedesktop.systemd1.Manager",
+                                   "UnsetAndSetEnvironment",
+                                   g_variant_new ("(asas)", &unset, &set),
+                                   NULL,
+                                   on_user_environment_updated,
+                                   NULL);
 
-        return environment_updated;
+ out:
+        g_hash_table_destroy (txn->variables);
+        g_free (txn);
 }
 
 void
 csm_util_setenv (const char *variable,
                  const char *value)
 {
-        GError *error = NULL;
+        CsmEnvTransaction *txn;
 
         /* An empty value means "unset". Genuinely remove the variable from the
-         * process and systemd environments; the D-Bus activation environment has
-         * no unset operation (only set), so it is cleared to the empty string
-         * there, which is equivalent to unset for its consumers.
+         * process and systemd environments.
          */
-        if (value == NULL || *value == '\0') {
-                g_unsetenv (variable);
+        txn = csm_util_env_transaction_begin ();
+        csm_util_env_transaction_setenv (txn, variable, value);
+        csm_util_env_transaction_commit (txn);
+}
 
-                if (!csm_util_update_activation_environment (variable, "", &error)) {
-                        g_warning ("Could not clear %s from the activation environment: %s", variable, error->message);
-                        g_clear_error (&error);
-                }
+/* Reads the total time in microseconds that some tasks were stalled on
+ * @resource ("cpu", "io" or "memory"), from the "some" line of
+ * /proc/pressure/@resource. Returns FALSE if the kernel lacks PSI. */
+gboolean
+csm_util_get_pressure_stall (const char *resource,
+                             guint64    *total)
+{
+        char       *filename;
+        char       *contents;
+        char       *end;
+        const char *p;
+        gboolean    res;
 
-                if (!csm_util_unset_user_environment (variable, &error)) {
-                        g_debug ("Could not make systemd unset the %s environment variable: %s", variable, error->message);
-                        g_clear_error (&error);
-                }
+        filename = g_build_filename ("/proc/pressure", resource, NULL);
+        res = g_file_get_contents (filename, &contents, NULL, NULL);
+        g_free (filename);
 
-                return;
+        if (!res) {
+                return FALSE;
         }
 
-        g_setenv (variable, value, TRUE);
+        /* only look at the first line */
+        end = strchr (contents, '\n');
+        if (end != NULL) {
+                *end = '\0';
+        }
 
-        /* If this fails it isn't fatal, it means some things like session
-         * management and keyring won't work in activated clients.
-         */
-        if (!csm_util_update_activation_environment (variable, value, &error)) {
-                g_warning ("Could not make bus activated clients aware of %s=%s environment variable: %s", variable, value, error->message);
-                g_clear_error (&error);
+        p = NULL;
+        if (g_str_has_prefix (contents, "some ")) {
+                p = strstr (contents, " total=");
         }
 
-        /* If this fails, the system user session won't get the updated environment
-         */
-        if (!csm_util_update_user_environment (variable, value, &error)) {
-                g_debug ("Could not make systemd aware of %s=%s environment variable: %s", variable, value, error->message);
-                g_clear_error (&error);
+        if (p != NULL) {
+                *total = g_ascii_strtoull (p + strlen (" total="), NULL, 10);
         }
+        res = p != NULL;
+
+        g_free (contents);
+
+        return res;
 }
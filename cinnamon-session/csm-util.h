@@ -21,6 +21,7 @@
 #define __CSM_UTIL_H__
 
 #include <glib.h>
+#include <gio/gio.h>
 
 G_BEGIN_DECLS
 
@@ -34,6 +35,8 @@ gchar      *csm_util_get_empty_tmp_session_dir      (void);
 
 const char *csm_util_get_saved_session_dir          (void);
 
+const char *csm_util_get_cache_dir                  (void);
+
 gchar**     csm_util_get_app_dirs                   (void);
 
 gchar**     csm_util_get_autostart_dirs             (void);
@@ -53,19 +56,61 @@ void        csm_util_init_error                     (gboolean    fatal,
 
 char *      csm_util_generate_startup_id            (void);
 
-gboolean    csm_util_export_activation_environment  (GError     **error);
+GDBusConnection *csm_util_get_session_bus          (GError     **error);
+
+typedef void (* CsmUtilCallback) (GVariant     *reply,
+                                  const GError *error,
+                                  gpointer      user_data);
+
+void        csm_util_call_session_bus               (const char         *bus_name,
+                                                     const char         *object_path,
+                                                     const char         *interface_name,
+                                                     const char         *method_name,
+                                                     GVariant           *parameters,
+                                                     const GVariantType *reply_type,
+                                                     CsmUtilCallback     callback,
+                                                     gpointer            user_data);
+
+void        csm_util_call_session_bus_full          (const char         *bus_name,
+                                                     const char         *object_path,
+                                                     const char         *interface_name,
+                                                     const char         *method_name,
+                                                     GVariant           *parameters,
+                                                     const GVariantType *reply_type,
+                                                     GDBusCallFlags      flags,
+                                                     int                 timeout_msec,
+                                                     CsmUtilCallback     callback,
+                                                     gpointer            user_data);
+
+void        csm_util_export_activation_environment  (void);
 
-gboolean    csm_util_export_user_environment        (GError     **error);
+void        csm_util_export_user_environment        (void);
 
 void        csm_util_setenv                         (const char *variable,
                                                      const char *value);
 
-gboolean    csm_util_start_systemd_unit             (const char  *unit,
-                                                     const char  *mode,
-                                                     GError     **error);
-gboolean    csm_util_stop_systemd_unit              (const char  *unit,
-                                                     const char  *mode,
-                                                     GError     **error);
+typedef struct _CsmEnvTransaction CsmEnvTransaction;
+
+CsmEnvTransaction *csm_util_env_transaction_begin   (void);
+void        csm_util_env_transaction_setenv         (CsmEnvTransaction *txn,
+                                                     const char        *variable,
+                                                     const char        *value);
+void        csm_util_env_transaction_commit         (CsmEnvTransaction *txn);
+
+void        csm_util_start_systemd_unit             (const char  *unit,
+                                                     const char  *mode);
+void        csm_util_stop_systemd_unit              (const char  *unit,
+                                                     const char  *mode);
+
+void        csm_util_start_systemd_scope            (const char     *app_id,
+                                                     GPid            pid,
+                                                     const char     *description,
+                                                     GVariant       *properties,
+                                                     GDestroyNotify  notify,
+                                                     gpointer        user_data);
+
+gboolean    csm_util_get_pressure_stall             (const char  *resource,
+                                                     guint64     *total);
 
 // main.c, exit mainloop
 void        csm_quit                                (void);
@@ -242,6 +242,7 @@ main (int argc, char **argv)
         struct sigaction  sa;
         GError           *error;
         guint             name_owner_id;
+        CsmEnvTransaction *env;
         static char     **override_autostart_dirs = NULL;
         GOptionContext   *options;
         static GOptionEntry entries[] = {
@@ -302,8 +303,11 @@ main (int argc, char **argv)
                 csm_util_init_error (TRUE, "Testing the fail whale");
         }
 
-        csm_util_export_activation_environment (NULL);
-        csm_util_export_user_environment (NULL);
+        csm_util_export_activation_environment ();
+        csm_util_export_user_environment ();
+
+        /* Everything set from here on reaches the bus and systemd in one go */
+        env = csm_util_env_transaction_begin ();
 
         {
                 gchar *ibus_path;
@@ -339,7 +343,7 @@ main (int argc, char **argv)
                  * which would otherwise force apps off text-input-v3 (e.g. a stale
                  * GTK_IM_MODULE=ibus routes GTK to the client-side ibus module, whose
                  * candidate popup can't be positioned on Wayland). Passing "" unsets
-                 * each var (csm_util_setenv treats an empty value as unset). The block
+                 * each var (an empty value means unset). The block
                  * below re-establishes just what this session needs. X11 is left
                  * untouched: there the client-side modules are the input path. */
                 if (is_wayland) {
@@ -350,7 +354,7 @@ main (int argc, char **argv)
                         guint i;
 
                         for (i = 0; i < G_N_ELEMENTS (im_vars); i++)
-                                csm_util_setenv (im_vars[i], "");
+                                csm_util_env_transaction_setenv (env, im_vars[i], "");
                 }
 
                 /* SDL_IM_MODULE is the one client-side IM var fcitx sets that ibus
@@ -360,7 +364,7 @@ main (int argc, char **argv)
                  * X11 too, since ibus has no SDL module and SDL defaults to ibus when
                  * the var is unset. (Wayland already cleared it above.) */
                 if (!is_wayland && !fcitx_active)
-                        csm_util_setenv ("SDL_IM_MODULE", "");
+                        csm_util_env_transaction_setenv (env, "SDL_IM_MODULE", "");
 
                 /* XWayland clients cannot reach fcitx through the compositor
                  * (text-input-v3 stops at the Wayland boundary), so they need
@@ -372,10 +376,10 @@ main (int argc, char **argv)
                  * still draws, mirroring im-config's X11 setup). GTK Wayland
                  * apps keep using text-input-v3: GTK_IM_MODULE stays unset. */
                 if (is_wayland && fcitx_active) {
-                        csm_util_setenv ("XMODIFIERS", "@im=fcitx");
-                        csm_util_setenv ("QT_IM_MODULES", "wayland;fcitx");
-                        csm_util_setenv ("QT_IM_MODULE", "fcitx");
-                        csm_util_setenv ("SDL_IM_MODULE", "fcitx");
+                        csm_util_env_transaction_setenv (env, "XMODIFIERS", "@im=fcitx");
+                        csm_util_env_transaction_setenv (env, "QT_IM_MODULES", "wayland;fcitx");
+                        csm_util_env_transaction_setenv (env, "QT_IM_MODULE", "fcitx");
+                        csm_util_env_transaction_setenv (env, "SDL_IM_MODULE", "fcitx");
                 }
 
                 if (ibus_path && !fcitx_active) {
@@ -383,15 +387,15 @@ main (int argc, char **argv)
                         p = g_getenv ("QT_IM_MODULES");
                         if (!p || !*p)
                                 p = "wayland;ibus";
-                        csm_util_setenv ("QT_IM_MODULES", p);
+                        csm_util_env_transaction_setenv (env, "QT_IM_MODULES", p);
                         p = g_getenv ("QT_IM_MODULE");
                         if (!p || !*p)
                                 p = "ibus";
-                        csm_util_setenv ("QT_IM_MODULE", p);
+                        csm_util_env_transaction_setenv (env, "QT_IM_MODULE", p);
                         p = g_getenv ("XMODIFIERS");
                         if (!p || !*p)
                                 p = "@im=ibus";
-                        csm_util_setenv ("XMODIFIERS", p);
+                        csm_util_env_transaction_setenv (env, "XMODIFIERS", p);
                 }
 
                 g_free (ibus_path);
@@ -404,7 +408,9 @@ main (int argc, char **argv)
         /* Some third-party programs rely on GNOME_DESKTOP_SESSION_ID to
          * detect if GNOME is running. We keep this for compatibility reasons.
          */
-        csm_util_setenv ("GNOME_DESKTOP_SESSION_ID", "this-is-deprecated");
+        csm_util_env_transaction_setenv (env, "GNOME_DESKTOP_SESSION_ID", "this-is-deprecated");
+
+        csm_util_env_transaction_commit (env);
 
         csm_util_set_autostart_dirs (override_autostart_dirs);
 
@@ -424,7 +430,12 @@ main (int argc, char **argv)
                 g_object_unref (manager);
         }
 
-        csm_util_export_activation_environment (NULL);
+        csm_util_export_activation_environment ();
+
+        /* the call is only queued, make sure it goes out before we exit */
+        if (csm_util_get_session_bus (NULL) != NULL) {
+                g_dbus_connection_flush_sync (csm_util_get_session_bus (NULL), NULL, NULL);
+        }
 
         g_bus_unown_name (name_owner_id);
 
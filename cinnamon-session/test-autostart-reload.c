@@ -0,0 +1,177 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Toggles Hidden in a user autostart file of the running session and
+ * checks that the session manager picks it up, see
+ * reload_autostart_apps(): the app must start once it is enabled, and
+ * must not run again when its file changes after it has finished */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#define SM_DBUS_NAME      "org.gnome.SessionManager"
+#define SM_DBUS_PATH      "/org/gnome/SessionManager"
+#define SM_DBUS_INTERFACE "org.gnome.SessionManager"
+
+#define DESKTOP_ID "test-autostart-reload.desktop"
+
+/* well past CSM_MANAGER_AUTOSTART_RELOAD_DELAY */
+#define SETTLE_TIME 3 /* seconds */
+
+static char *desktop_path = NULL;
+static char *stamp_path = NULL;
+
+static gboolean
+session_is_running (void)
+{
+        GDBusConnection *connection;
+        GVariant        *reply;
+        GError          *error = NULL;
+        gboolean         running;
+
+        connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error);
+        if (connection == NULL) {
+                g_printerr ("Failed to connect to the session bus: %s\n", error->message);
+                g_error_free (error);
+                return FALSE;
+        }
+
+        reply = g_dbus_connection_call_sync (connection,
+                                             SM_DBUS_NAME,
+                                             SM_DBUS_PATH,
+                                             SM_DBUS_INTERFACE,
+                                             "IsSessionRunning",
+                                             NULL,
+                                             G_VARIANT_TYPE ("(b)"),
+                                             G_DBUS_CALL_FLAGS_NONE,
+                                             -1, NULL, &error);
+        g_object_unref (connection);
+
+        if (reply == NULL) {
+                g_printerr ("Failed to ask the session manager: %s\n", error->message);
+                g_error_free (error);
+                return FALSE;
+        }
+
+        g_variant_get (reply, "(b)", &running);
+        g_variant_unref (reply);
+
+        return running;
+}
+
+static void
+write_desktop_file (gboolean    hidden,
+                    const char *comment)
+{
+        GKeyFile *keyfile;
+        char     *quoted;
+        char     *exec;
+        char     *data;
+        gsize     length;
+        GError   *error = NULL;
+
+        quoted = g_shell_quote (stamp_path);
+        exec = g_strdup_printf ("touch %s", quoted);
+        g_free (quoted);
+
+        keyfile = g_key_file_new ();
+        g_key_file_set_string (keyfile, G_KEY_FILE_DESKTOP_GROUP,
+                               G_KEY_FILE_DESKTOP_KEY_TYPE, G_KEY_FILE_DESKTOP_TYPE_APPLICATION);
+        g_key_file_set_string (keyfile, G_KEY_FILE_DESKTOP_GROUP,
+                               G_KEY_FILE_DESKTOP_KEY_NAME, "test-autostart-reload");
+        g_key_file_set_string (keyfile, G_KEY_FILE_DESKTOP_GROUP,
+                               G_KEY_FILE_DESKTOP_KEY_COMMENT, comment);
+        g_key_file_set_string (keyfile, G_KEY_FILE_DESKTOP_GROUP,
+                               G_KEY_FILE_DESKTOP_KEY_EXEC, exec);
+        g_key_file_set_boolean (keyfile, G_KEY_FILE_DESKTOP_GROUP,
+                                G_KEY_FILE_DESKTOP_KEY_HIDDEN, hidden);
+
+        data = g_key_file_to_data (keyfile, &length, NULL);
+        if (!g_file_set_contents (desktop_path, data, length, &error)) {
+                g_printerr ("Failed to write %s: %s\n", desktop_path, error->message);
+                exit (1);
+        }
+
+        g_free (data);
+        g_key_file_free (keyfile);
+        g_free (exec);
+}
+
+/* Changes the file, waits for the reload and reports whether the app ran */
+static gboolean
+check_step (const char *what,
+            gboolean    hidden,
+            gboolean    expect_started)
+{
+        gboolean started;
+
+        g_unlink (stamp_path);
+        write_desktop_file (hidden, what);
+        g_usleep (SETTLE_TIME * G_USEC_PER_SEC);
+
+        started = g_file_test (stamp_path, G_FILE_TEST_EXISTS);
+
+        g_print ("%-40s %s (%s)\n",
+                 what,
+                 started == expect_started ? "ok" : "FAILED",
+                 started ? "started" : "not started");
+
+        return started == expect_started;
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+        char     *dir;
+        gboolean  ok;
+
+        if (!session_is_running ()) {
+                g_printerr ("This needs a running cinnamon-session.\n");
+                return 1;
+        }
+
+        dir = g_build_filename (g_get_user_config_dir (), "autostart", NULL);
+        g_mkdir_with_parents (dir, 0755);
+        desktop_path = g_build_filename (dir, DESKTOP_ID, NULL);
+        stamp_path = g_build_filename (g_get_user_runtime_dir (), "test-autostart-reload.stamp", NULL);
+        g_free (dir);
+
+        if (g_file_test (desktop_path, G_FILE_TEST_EXISTS)) {
+                g_printerr ("%s is in the way.\n", desktop_path);
+                return 1;
+        }
+
+        ok = TRUE;
+        ok &= check_step ("added with Hidden=true", TRUE, FALSE);
+        ok &= check_step ("Hidden switched to false", FALSE, TRUE);
+        ok &= check_step ("changed after it finished", FALSE, FALSE);
+        ok &= check_step ("Hidden switched to true", TRUE, FALSE);
+        ok &= check_step ("Hidden switched back to false", FALSE, TRUE);
+
+        g_unlink (desktop_path);
+        g_unlink (stamp_path);
+        g_free (desktop_path);
+        g_free (stamp_path);
+
+        return ok ? 0 : 1;
+}
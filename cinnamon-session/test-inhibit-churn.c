@@ -0,0 +1,189 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Stresses the inhibitor bookkeeping of the running session manager the
+ * way media players and browsers do: idle inhibitors that come and go all
+ * the time, while others stay around */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include <gio/gio.h>
+
+#define SM_DBUS_NAME      "org.gnome.SessionManager"
+#define SM_DBUS_PATH      "/org/gnome/SessionManager"
+#define SM_DBUS_INTERFACE "org.gnome.SessionManager"
+
+#define INHIBIT_FLAG_IDLE    (1 << 3)
+#define INHIBIT_FLAG_SUSPEND (1 << 2)
+
+static GDBusConnection *connection = NULL;
+
+static guint
+inhibit (const char *reason,
+         guint       flags)
+{
+        GVariant *reply;
+        GError   *error = NULL;
+        guint     cookie;
+
+        reply = g_dbus_connection_call_sync (connection,
+                                             SM_DBUS_NAME,
+                                             SM_DBUS_PATH,
+                                             SM_DBUS_INTERFACE,
+                                             "Inhibit",
+                                             g_variant_new ("(susu)",
+                                                            "test-inhibit-churn",
+                                                            0,
+                                                            reason,
+                                                            flags),
+                                             G_VARIANT_TYPE ("(u)"),
+                                             G_DBUS_CALL_FLAGS_NONE,
+                                             -1, NULL, &error);
+        if (reply == NULL) {
+                g_printerr ("Failed to inhibit: %s\n", error->message);
+                exit (1);
+        }
+
+        g_variant_get (reply, "(u)", &cookie);
+        g_variant_unref (reply);
+
+        return cookie;
+}
+
+static void
+uninhibit (guint cookie)
+{
+        GVariant *reply;
+        GError   *error = NULL;
+
+        reply = g_dbus_connection_call_sync (connection,
+                                             SM_DBUS_NAME,
+                                             SM_DBUS_PATH,
+                                             SM_DBUS_INTERFACE,
+                                             "Uninhibit",
+                                             g_variant_new ("(u)", cookie),
+                                             NULL,
+                                             G_DBUS_CALL_FLAGS_NONE,
+                                             -1, NULL, &error);
+        if (reply == NULL) {
+                g_printerr ("Failed to uninhibit: %s\n", error->message);
+                exit (1);
+        }
+
+        g_variant_unref (reply);
+}
+
+static gboolean
+is_inhibited (guint flags)
+{
+        GVariant *reply;
+        GError   *error = NULL;
+        gboolean  inhibited;
+
+        reply = g_dbus_connection_call_sync (connection,
+                                             SM_DBUS_NAME,
+                                             SM_DBUS_PATH,
+                                             SM_DBUS_INTERFACE,
+                                             "IsInhibited",
+                                             g_variant_new ("(u)", flags),
+                                             G_VARIANT_TYPE ("(b)"),
+                                             G_DBUS_CALL_FLAGS_NONE,
+                                             -1, NULL, &error);
+        if (reply == NULL) {
+                g_printerr ("Failed to query inhibitors: %s\n", error->message);
+                exit (1);
+        }
+
+        g_variant_get (reply, "(b)", &inhibited);
+        g_variant_unref (reply);
+
+        return inhibited;
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+        int     cycles = 100000;
+        int     background = 200;
+        guint  *cookies;
+        gint64  start;
+        gint64  elapsed;
+        GError *error = NULL;
+        int     i;
+
+        if (argc > 3) {
+                g_printerr ("Too many arguments.\n");
+                g_printerr ("Usage: %s [CYCLES] [BACKGROUND_INHIBITORS]\n", argv[0]);
+                return 1;
+        }
+
+        if (argc >= 2) {
+                int n = atoi (argv[1]);
+                if (n > 0)
+                        cycles = n;
+        }
+        if (argc >= 3) {
+                int n = atoi (argv[2]);
+                if (n >= 0)
+                        background = n;
+        }
+
+        connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error);
+        if (connection == NULL) {
+                g_printerr ("Failed to connect to the session bus: %s\n", error->message);
+                return 1;
+        }
+
+        /* The ones that make scanning the store expensive */
+        cookies = g_new (guint, background);
+        for (i = 0; i < background; i++) {
+                cookies[i] = inhibit ("Background inhibitor", INHIBIT_FLAG_SUSPEND);
+        }
+
+        g_print ("%d inhibit/uninhibit cycles with %d other inhibitors\n",
+                 cycles, background);
+
+        start = g_get_monotonic_time ();
+
+        for (i = 0; i < cycles; i++) {
+                guint cookie;
+
+                cookie = inhibit ("Playing media", INHIBIT_FLAG_IDLE);
+                if (!is_inhibited (INHIBIT_FLAG_IDLE)) {
+                        g_printerr ("Idle not inhibited after cycle %d\n", i);
+                }
+                uninhibit (cookie);
+        }
+
+        elapsed = g_get_monotonic_time () - start;
+
+        g_print ("total: %" G_GINT64_FORMAT " ms, per cycle: %.1f us\n",
+                 elapsed / 1000,
+                 (double) elapsed / cycles);
+
+        for (i = 0; i < background; i++) {
+                uninhibit (cookies[i]);
+        }
+        g_free (cookies);
+
+        g_object_unref (connection);
+
+        return 0;
+}
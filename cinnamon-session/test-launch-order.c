@@ -0,0 +1,299 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Replays the registration latencies recorded in the app latency history
+ * to compare launching a phase in store order with launching it in the
+ * manager's order, see csm_latency_sort_launch_order(). The history is
+ * read through csm-latency.c, and never written back. */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "csm-latency.h"
+#include "csm-util.h"
+
+#define DEFAULT_TRIALS 10000
+
+typedef struct {
+        char     *app_id;
+        gboolean  required;
+        /* drawn for the current trial */
+        guint     latency;
+} App;
+
+/* Used when there is no history to replay */
+static const struct {
+        const char *app_id;
+        guint       msec;
+        gboolean    missed;
+} synthetic_apps[] = {
+        { "cinnamon-settings-daemon-xsettings.desktop",   180, FALSE },
+        { "cinnamon-settings-daemon-power.desktop",       240, FALSE },
+        { "cinnamon-settings-daemon-media-keys.desktop",  320, FALSE },
+        { "cinnamon-settings-daemon-keyboard.desktop",    120, FALSE },
+        { "cinnamon-settings-daemon-color.desktop",       450, FALSE },
+        { "nemo-autostart.desktop",                      1400, FALSE },
+        { "blueman.desktop",                              900, TRUE  },
+        { "nm-applet.desktop",                            600, FALSE },
+        { "mintupdate.desktop",                          2200, FALSE },
+        { "polkit-gnome-authentication-agent-1.desktop",  150, FALSE },
+        { "xapp-sn-watcher.desktop",                      100, FALSE },
+        { "gnome-keyring-secrets.desktop",                 80, FALSE }
+};
+
+static char *cache_dir = NULL;
+
+/* Stands in for the one in csm-util.c, which needs the whole session */
+const char *
+csm_util_get_cache_dir (void)
+{
+        return cache_dir;
+}
+
+static void
+make_synthetic_history (GRand *rand)
+{
+        guint i;
+        guint j;
+
+        for (i = 0; i < G_N_ELEMENTS (synthetic_apps); i++) {
+                /* +-30% around the typical value */
+                for (j = 0; j < 20; j++) {
+                        csm_latency_record (synthetic_apps[i].app_id,
+                                            synthetic_apps[i].msec * g_rand_double_range (rand, 0.7, 1.3));
+                }
+
+                if (synthetic_apps[i].missed) {
+                        csm_latency_record_miss (synthetic_apps[i].app_id,
+                                                 synthetic_apps[i].msec * 2);
+                }
+        }
+}
+
+/* Launches are @spawn_msec apart, and with @concurrency only that many
+ * apps may be between launch and registration at once. Returns when the
+ * last app registered. */
+static guint
+simulate (App   **order,
+          guint   n_apps,
+          guint   concurrency,
+          guint   spawn_msec)
+{
+        guint *slots;
+        guint  n_slots;
+        guint  launch;
+        guint  end;
+        guint  i;
+
+        n_slots = concurrency > 0 ? MIN (concurrency, n_apps) : n_apps;
+        slots = g_new0 (guint, n_slots);
+
+        launch = 0;
+        end = 0;
+
+        for (i = 0; i < n_apps; i++) {
+                guint slot;
+                guint s;
+
+                slot = 0;
+                for (s = 1; s < n_slots; s++) {
+                        if (slots[s] < slots[slot]) {
+                                slot = s;
+                        }
+                }
+
+                if (i > 0) {
+                        launch += spawn_msec;
+                }
+                launch = MAX (launch, slots[slot]);
+
+                slots[slot] = launch + order[i]->latency;
+                end = MAX (end, slots[slot]);
+        }
+
+        g_free (slots);
+
+        return end;
+}
+
+static int
+compare_uint (gconstpointer a,
+              gconstpointer b)
+{
+        guint x = *(const guint *) a;
+        guint y = *(const guint *) b;
+
+        return x < y ? -1 : x > y;
+}
+
+static void
+print_result (const char *name,
+              guint      *ends,
+              guint       trials)
+{
+        guint64 sum;
+        guint   i;
+
+        qsort (ends, trials, sizeof (guint), compare_uint);
+
+        sum = 0;
+        for (i = 0; i < trials; i++) {
+                sum += ends[i];
+        }
+
+        g_print ("%-14s mean: %6" G_GUINT64_FORMAT " ms  p50: %6u ms  p90: %6u ms\n",
+                 name,
+                 sum / trials,
+                 ends[trials / 2],
+                 ends[trials * 9 / 10]);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+        char             **app_ids;
+        App              **apps;
+        App              **shuffled;
+        App              **sorted;
+        CsmLatencyLaunch  *launches;
+        guint             *store_ends;
+        guint             *sorted_ends;
+        guint              concurrency = 0;
+        guint              spawn_msec = 10;
+        guint              trials = DEFAULT_TRIALS;
+        guint              n_apps;
+        guint              t;
+        guint              i;
+        int                j;
+        GRand             *rand;
+
+        if (argc >= 2 && strcmp (argv[1], "--help") == 0) {
+                g_printerr ("Usage: %s [CACHE_DIR] [CONCURRENCY] [SPAWN_MSEC] [REQUIRED_APP_ID...]\n", argv[0]);
+                return 1;
+        }
+
+        if (argc >= 2) {
+                cache_dir = g_strdup (argv[1]);
+        } else {
+                cache_dir = g_build_filename (g_get_user_cache_dir (), "cinnamon-session", NULL);
+        }
+        if (argc >= 3) {
+                concurrency = atoi (argv[2]);
+        }
+        if (argc >= 4) {
+                spawn_msec = atoi (argv[3]);
+        }
+
+        rand = g_rand_new_with_seed (0);
+
+        app_ids = csm_latency_get_app_ids ();
+        if (app_ids[0] == NULL) {
+                g_print ("No latency history in %s, using a synthetic one\n", cache_dir);
+                make_synthetic_history (rand);
+                g_strfreev (app_ids);
+                app_ids = csm_latency_get_app_ids ();
+        }
+
+        n_apps = g_strv_length (app_ids);
+        apps = g_new (App *, n_apps);
+        launches = g_new (CsmLatencyLaunch, n_apps);
+
+        for (i = 0; i < n_apps; i++) {
+                apps[i] = g_new0 (App, 1);
+                apps[i]->app_id = g_strdup (app_ids[i]);
+
+                for (j = 4; j < argc; j++) {
+                        if (strcmp (argv[j], app_ids[i]) == 0) {
+                                apps[i]->required = TRUE;
+                        }
+                }
+
+                launches[i].data = apps[i];
+                launches[i].app_id = apps[i]->app_id;
+                launches[i].required = apps[i]->required;
+        }
+        g_strfreev (app_ids);
+
+        csm_latency_sort_launch_order (launches, n_apps);
+
+        sorted = g_new (App *, n_apps);
+        for (i = 0; i < n_apps; i++) {
+                sorted[i] = launches[i].data;
+                g_print ("%3u. %-46s %6u ms%s%s\n",
+                         i + 1,
+                         sorted[i]->app_id,
+                         launches[i].msec,
+                         sorted[i]->required ? "  required" : "",
+                         csm_latency_get_misses (sorted[i]->app_id) > 0 ? "  missed" : "");
+        }
+
+        shuffled = g_new (App *, n_apps);
+        memcpy (shuffled, apps, n_apps * sizeof (App *));
+
+        g_print ("Replaying %u apps, %u trials, concurrency %u, %u ms between launches\n",
+                 n_apps, trials, concurrency, spawn_msec);
+
+        store_ends = g_new (guint, trials);
+        sorted_ends = g_new (guint, trials);
+
+        for (t = 0; t < trials; t++) {
+                /* the same latencies for both orders, drawn from each
+                 * app's own history */
+                for (i = 0; i < n_apps; i++) {
+                        if (!csm_latency_get_percentile (apps[i]->app_id,
+                                                         g_rand_int_range (rand, 1, 101),
+                                                         &apps[i]->latency)) {
+                                apps[i]->latency = 0;
+                        }
+                }
+
+                /* GHashTable iteration order is as good as random */
+                for (i = n_apps; i > 1; i--) {
+                        guint  k = g_rand_int_range (rand, 0, i);
+                        App   *tmp = shuffled[i - 1];
+
+                        shuffled[i - 1] = shuffled[k];
+                        shuffled[k] = tmp;
+                }
+
+                store_ends[t] = simulate (shuffled, n_apps, concurrency, spawn_msec);
+                sorted_ends[t] = simulate (sorted, n_apps, concurrency, spawn_msec);
+        }
+
+        print_result ("store order", store_ends, trials);
+        print_result ("manager order", sorted_ends, trials);
+
+        for (i = 0; i < n_apps; i++) {
+                g_free (apps[i]->app_id);
+                g_free (apps[i]);
+        }
+        g_free (apps);
+        g_free (launches);
+        g_free (store_ends);
+        g_free (sorted_ends);
+        g_free (shuffled);
+        g_free (sorted);
+        g_free (cache_dir);
+        g_rand_free (rand);
+
+        return 0;
+}
@@ -0,0 +1,202 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Checks the parsing of the scheduling hints of autostart apps, see
+ * load_nice(), load_ioprio() and load_cpu_affinity() */
+
+#include <config.h>
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "csm-scheduling-hints.h"
+
+#define BE(prio)   ((IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | (prio))
+#define RT(prio)   ((1 << IOPRIO_CLASS_SHIFT) | (prio))
+#define IDLE       (IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT)
+
+static const struct {
+        const char *io_class;
+        const char *priority;
+        gboolean    valid;
+        int         ioprio;
+} ioprio_cases[] = {
+        { "",            "",   TRUE,  0 },
+        { "best-effort", "",   TRUE,  BE (4) },
+        { "",            "2",  TRUE,  BE (2) },
+        { "realtime",    "0",  TRUE,  RT (0) },
+        { "realtime",    "7",  TRUE,  RT (7) },
+        { "idle",        "",   TRUE,  IDLE },
+        { "idle",        "5",  TRUE,  IDLE },
+        { "none",        "",   FALSE, 0 },
+        { "fast",        "",   FALSE, 0 },
+        { "best-effort", "8",  FALSE, 0 },
+        { "",            "-1", FALSE, 0 },
+        { "",            "1x", FALSE, 0 },
+};
+
+static const struct {
+        const char *str;
+        /* the CPUs in the mask, or NULL if @str is invalid */
+        const char *cpus;
+} cpu_affinity_cases[] = {
+        { "0",            "0" },
+        { "0-3",          "0 1 2 3" },
+        { "1,3 5",        "1 3 5" },
+        { " 2 , 4-5 ",    "2 4 5" },
+        { "63-65",        "63 64 65" },
+        { "8191",         "8191" },
+        { "3-3",          "3" },
+        { "8192",         NULL },
+        { "3-1",          NULL },
+        { "-1",           NULL },
+        { "1-",           NULL },
+        { "a",            NULL },
+        { "1 b",          NULL },
+        { "+1",           NULL },
+        { " , ",          NULL },
+};
+
+static const struct {
+        const char *str;
+        gboolean    valid;
+        int         nice;
+} nice_cases[] = {
+        { "0",   TRUE,  0 },
+        { "19",  TRUE,  19 },
+        { "-20", TRUE,  -20 },
+        { "20",  FALSE, 0 },
+        { "-21", FALSE, 0 },
+        { "5x",  FALSE, 0 },
+        { "x",   FALSE, 0 },
+};
+
+static char *
+mask_to_string (const gulong *mask,
+                gsize         mask_size)
+{
+        GString *str;
+        gsize    cpu;
+
+        str = g_string_new (NULL);
+        for (cpu = 0; cpu < mask_size * 8; cpu++) {
+                if (mask[cpu / (8 * sizeof (gulong))] & (1UL << (cpu % (8 * sizeof (gulong))))) {
+                        g_string_append_printf (str, "%s%" G_GSIZE_FORMAT, str->len > 0 ? " " : "", cpu);
+                }
+        }
+
+        return g_string_free (str, FALSE);
+}
+
+static int
+check_nice (void)
+{
+        int   failures = 0;
+        guint i;
+
+        for (i = 0; i < G_N_ELEMENTS (nice_cases); i++) {
+                gboolean valid;
+                int      nice = 0;
+
+                valid = csm_scheduling_hints_parse_nice (nice_cases[i].str, &nice);
+                if (valid != nice_cases[i].valid || (valid && nice != nice_cases[i].nice)) {
+                        g_printerr ("Nice \"%s\": got %s %d\n",
+                                    nice_cases[i].str, valid ? "valid" : "invalid", nice);
+                        failures++;
+                }
+        }
+
+        return failures;
+}
+
+static int
+check_ioprio (void)
+{
+        int   failures = 0;
+        guint i;
+
+        for (i = 0; i < G_N_ELEMENTS (ioprio_cases); i++) {
+                gboolean valid;
+                int      ioprio = -1;
+
+                valid = csm_scheduling_hints_parse_ioprio (ioprio_cases[i].io_class,
+                                                           ioprio_cases[i].priority,
+                                                           &ioprio);
+                if (valid != ioprio_cases[i].valid || (valid && ioprio != ioprio_cases[i].ioprio)) {
+                        g_printerr ("IO class \"%s\" priority \"%s\": got %s %#x\n",
+                                    ioprio_cases[i].io_class, ioprio_cases[i].priority,
+                                    valid ? "valid" : "invalid", ioprio);
+                        failures++;
+                }
+
+                if (valid && ioprio != 0
+                    && strcmp (csm_scheduling_hints_io_class_name (ioprio),
+                               ioprio_cases[i].io_class[0] != '\0' ? ioprio_cases[i].io_class : "best-effort") != 0) {
+                        g_printerr ("IO class \"%s\" priority \"%s\": named %s\n",
+                                    ioprio_cases[i].io_class, ioprio_cases[i].priority,
+                                    csm_scheduling_hints_io_class_name (ioprio));
+                        failures++;
+                }
+        }
+
+        return failures;
+}
+
+static int
+check_cpu_affinity (void)
+{
+        int   failures = 0;
+        guint i;
+
+        for (i = 0; i < G_N_ELEMENTS (cpu_affinity_cases); i++) {
+                gulong  *mask = NULL;
+                gsize    mask_size = 0;
+                char    *cpus = NULL;
+                gboolean valid;
+
+                valid = csm_scheduling_hints_parse_cpu_affinity (cpu_affinity_cases[i].str,
+                                                                 &mask, &mask_size);
+                if (valid) {
+                        cpus = mask_to_string (mask, mask_size);
+                }
+
+                if (valid != (cpu_affinity_cases[i].cpus != NULL)
+                    || (valid && strcmp (cpus, cpu_affinity_cases[i].cpus) != 0)) {
+                        g_printerr ("CPU affinity \"%s\": got %s\n",
+                                    cpu_affinity_cases[i].str, valid ? cpus : "invalid");
+                        failures++;
+                }
+
+                g_free (cpus);
+                g_free (mask);
+        }
+
+        return failures;
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+        int failures;
+
+        failures = check_nice () + check_ioprio () + check_cpu_affinity ();
+        g_print ("%d failures\n", failures);
+
+        return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,200 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Compares launching a desktop file with GDesktopAppInfo, as the session
+ * falls back to, with csm_launcher_spawn(), optionally from a process with
+ * a large heap, like a session that's been up for a while */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <gio/gdesktopappinfo.h>
+
+#include "csm-launcher.h"
+
+static GMainLoop       *loop = NULL;
+static guint            running = 0;
+static GDesktopAppInfo *app_info = NULL;
+
+static void
+child_exited (GPid     pid,
+              int      status,
+              gpointer data)
+{
+        g_spawn_close_pid (pid);
+
+        if (--running == 0) {
+                g_main_loop_quit (loop);
+        }
+}
+
+static void
+app_launched (GDesktopAppInfo *info,
+              GPid             pid,
+              gpointer         data)
+{
+        g_child_watch_add (pid, child_exited, NULL);
+}
+
+/* What autostart_app_start_spawn() does without the launcher */
+static gboolean
+spawn_desktop_app_info (char   **argv,
+                        char   **envp,
+                        GError **error)
+{
+        GAppLaunchContext *ctx;
+        gboolean           res;
+
+        ctx = g_app_launch_context_new ();
+        g_app_launch_context_setenv (ctx, "DESKTOP_AUTOSTART_ID", "test-spawn");
+
+        res = g_desktop_app_info_launch_uris_as_manager (app_info,
+                                                         NULL,
+                                                         ctx,
+                                                         G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_SEARCH_PATH,
+                                                         NULL, NULL,
+                                                         app_launched, NULL,
+                                                         error);
+        g_object_unref (ctx);
+
+        return res;
+}
+
+/* What autostart_app_spawn_direct() does */
+static gboolean
+spawn_launcher (char   **argv,
+                char   **envp,
+                GError **error)
+{
+        GPid pid;
+
+        envp = g_environ_setenv (g_strdupv (envp), "DESKTOP_AUTOSTART_ID", "test-spawn", TRUE);
+
+        if (!csm_launcher_spawn ((const char * const *) argv,
+                                 (const char * const *) envp,
+                                 NULL, &pid, error)) {
+                g_strfreev (envp);
+                return FALSE;
+        }
+
+        g_strfreev (envp);
+
+        csm_launcher_watch (pid, child_exited, NULL);
+
+        return TRUE;
+}
+
+static void
+run (const char *name,
+     gboolean  (*spawn) (char **, char **, GError **),
+     int         count)
+{
+        char   *argv[] = { "true", NULL };
+        char  **envp;
+        gint64  start;
+        gint64  spawned;
+        gint64  reaped;
+        GError *error = NULL;
+        int     i;
+
+        envp = g_get_environ ();
+
+        start = g_get_monotonic_time ();
+
+        for (i = 0; i < count; i++) {
+                if (!spawn (argv, envp, &error)) {
+                        g_warning ("%s: %s", name, error->message);
+                        g_clear_error (&error);
+                        continue;
+                }
+                running++;
+        }
+
+        spawned = g_get_monotonic_time ();
+
+        if (running > 0) {
+                g_main_loop_run (loop);
+        }
+
+        reaped = g_get_monotonic_time ();
+
+        g_print ("%-18s spawn: %8" G_GINT64_FORMAT " us (%6.1f us each)  until reaped: %8" G_GINT64_FORMAT " us\n",
+                 name,
+                 spawned - start,
+                 (double) (spawned - start) / count,
+                 reaped - start);
+
+        g_strfreev (envp);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+        int       count = 100;
+        int       heap_mb = 0;
+        char     *heap = NULL;
+        GKeyFile *keyfile;
+
+        if (argc > 3) {
+                g_printerr ("Too many arguments.\n");
+                g_printerr ("Usage: %s [COUNT] [HEAP_MB]\n", argv[0]);
+                return 1;
+        }
+
+        if (argc >= 2) {
+                int i = atoi (argv[1]);
+                if (i > 0)
+                        count = i;
+        }
+        if (argc >= 3) {
+                heap_mb = atoi (argv[2]);
+        }
+
+        if (heap_mb > 0) {
+                /* Touch every page so fork() has to copy the page tables */
+                heap = g_malloc ((gsize) heap_mb * 1024 * 1024);
+                memset (heap, 1, (gsize) heap_mb * 1024 * 1024);
+        }
+
+        g_print ("Spawning %d processes with a %d MB heap\n", count, heap_mb);
+
+        keyfile = g_key_file_new ();
+        g_key_file_set_string (keyfile, G_KEY_FILE_DESKTOP_GROUP,
+                               G_KEY_FILE_DESKTOP_KEY_TYPE, G_KEY_FILE_DESKTOP_TYPE_APPLICATION);
+        g_key_file_set_string (keyfile, G_KEY_FILE_DESKTOP_GROUP,
+                               G_KEY_FILE_DESKTOP_KEY_NAME, "test-spawn");
+        g_key_file_set_string (keyfile, G_KEY_FILE_DESKTOP_GROUP,
+                               G_KEY_FILE_DESKTOP_KEY_EXEC, "true");
+        app_info = g_desktop_app_info_new_from_keyfile (keyfile);
+        g_key_file_free (keyfile);
+
+        loop = g_main_loop_new (NULL, FALSE);
+
+        run ("GDesktopAppInfo", spawn_desktop_app_info, count);
+        run ("posix_spawn", spawn_launcher, count);
+
+        g_main_loop_unref (loop);
+        g_object_unref (app_info);
+        g_free (heap);
+
+        return 0;
+}
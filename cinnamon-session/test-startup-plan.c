@@ -0,0 +1,217 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/* Saves a startup plan and loads it back, and checks that it is thrown
+ * away once its context or any of its inputs changed, see
+ * csm_startup_plan_load() */
+
+#include <config.h>
+
+#include <stdlib.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "csm-startup-plan.h"
+#include "csm-util.h"
+
+#define SESSION "test-session"
+#define CONTEXT "autostart /etc/xdg/autostart\n"
+
+static char *cache_dir = NULL;
+static char *input_path = NULL;
+static char *missing_path = NULL;
+
+/* Stands in for the one in csm-util.c, which needs the whole session */
+const char *
+csm_util_get_cache_dir (void)
+{
+        return cache_dir;
+}
+
+static int
+check (gboolean    ok,
+       const char *what)
+{
+        g_print ("%-50s %s\n", what, ok ? "ok" : "FAILED");
+
+        return ok ? 0 : 1;
+}
+
+static GVariant *
+make_apps (void)
+{
+        GVariantBuilder  builder;
+        const char      *wm_provides[] = { "windowmanager", NULL };
+        const char      *no_provides[] = { NULL };
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sbas)"));
+        g_variant_builder_add (&builder, "(sb^as)", "/usr/share/applications/cinnamon.desktop", TRUE, wm_provides);
+        g_variant_builder_add (&builder, "(sb^as)", input_path, FALSE, no_provides);
+
+        return g_variant_builder_end (&builder);
+}
+
+static void
+write_file (const char *path,
+            const char *contents)
+{
+        GError *error = NULL;
+
+        if (!g_file_set_contents (path, contents, -1, &error)) {
+                g_printerr ("Failed to write %s: %s\n", path, error->message);
+                exit (1);
+        }
+}
+
+static void
+save_plan (void)
+{
+        CsmStartupPlan *plan;
+        GError         *error = NULL;
+
+        plan = csm_startup_plan_new (SESSION, CONTEXT);
+        csm_startup_plan_add_input (plan, input_path);
+        csm_startup_plan_add_input (plan, missing_path);
+        csm_startup_plan_set_session (plan, "cinnamon", TRUE, "X-Cinnamon");
+        csm_startup_plan_set_apps (plan, make_apps ());
+
+        if (!csm_startup_plan_save (plan, &error)) {
+                g_printerr ("Failed to save the plan: %s\n", error->message);
+                exit (1);
+        }
+
+        csm_startup_plan_free (plan);
+}
+
+static gboolean
+plan_loads (const char *context)
+{
+        CsmStartupPlan *plan;
+
+        plan = csm_startup_plan_load (SESSION, context);
+        csm_startup_plan_free (plan);
+
+        return plan != NULL;
+}
+
+static int
+check_round_trip (void)
+{
+        CsmStartupPlan *plan;
+        GVariant       *apps;
+        int             failures = 0;
+
+        save_plan ();
+
+        plan = csm_startup_plan_load (SESSION, CONTEXT);
+        failures += check (plan != NULL, "saved plan loads");
+        if (plan == NULL) {
+                return failures;
+        }
+
+        apps = g_variant_ref_sink (make_apps ());
+        failures += check (g_strcmp0 (csm_startup_plan_peek_session (plan), "cinnamon") == 0,
+                           "session");
+        failures += check (csm_startup_plan_get_is_fallback (plan),
+                           "is fallback");
+        failures += check (g_strcmp0 (csm_startup_plan_peek_desktop_name (plan), "X-Cinnamon") == 0,
+                           "desktop name");
+        failures += check (g_variant_equal (csm_startup_plan_peek_apps (plan), apps),
+                           "apps");
+        g_variant_unref (apps);
+
+        csm_startup_plan_free (plan);
+
+        return failures;
+}
+
+static int
+check_stale (void)
+{
+        char *filename;
+        char *contents;
+        gsize length;
+        int   failures = 0;
+
+        save_plan ();
+        failures += check (!plan_loads ("autostart /usr/share/autostart\n"),
+                           "another context is ignored");
+        failures += check (plan_loads (CONTEXT),
+                           "the same context still loads");
+
+        write_file (input_path, "[Desktop Entry]\nName=changed\n");
+        failures += check (!plan_loads (CONTEXT), "changed input is noticed");
+
+        save_plan ();
+        write_file (missing_path, "");
+        failures += check (!plan_loads (CONTEXT), "input that turned up is noticed");
+        g_unlink (missing_path);
+
+        save_plan ();
+        g_unlink (input_path);
+        failures += check (!plan_loads (CONTEXT), "removed input is noticed");
+        write_file (input_path, "[Desktop Entry]\n");
+
+        save_plan ();
+        filename = g_build_filename (cache_dir, "startup-plan-" SESSION, NULL);
+        if (g_file_get_contents (filename, &contents, &length, NULL)) {
+                GError *error = NULL;
+
+                if (!g_file_set_contents (filename, contents, length / 2, &error)) {
+                        g_printerr ("Failed to write %s: %s\n", filename, error->message);
+                        exit (1);
+                }
+                g_free (contents);
+        }
+        failures += check (!plan_loads (CONTEXT), "truncated plan is ignored");
+
+        g_unlink (filename);
+        failures += check (!plan_loads (CONTEXT), "no plan");
+        g_free (filename);
+
+        return failures;
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+        GError *error = NULL;
+        int     failures;
+
+        cache_dir = g_dir_make_tmp ("test-startup-plan-XXXXXX", &error);
+        if (cache_dir == NULL) {
+                g_printerr ("Failed to make a directory: %s\n", error->message);
+                return 1;
+        }
+
+        input_path = g_build_filename (cache_dir, "app.desktop", NULL);
+        missing_path = g_build_filename (cache_dir, "missing.desktop", NULL);
+        write_file (input_path, "[Desktop Entry]\n");
+
+        failures = check_round_trip () + check_stale ();
+        g_print ("%d failures\n", failures);
+
+        g_unlink (input_path);
+        g_unlink (missing_path);
+        g_rmdir (cache_dir);
+        g_free (input_path);
+        g_free (missing_path);
+        g_free (cache_dir);
+
+        return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,175 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Checks csm_substring_matcher_match() against g_strstr_len() on random
+ * input, then times both on autostart-like names */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "csm-substring-matcher.h"
+
+static char *
+random_string (GRand *rand,
+               int    max_length)
+{
+        char *str;
+        int   length;
+        int   i;
+
+        length = g_rand_int_range (rand, 0, max_length + 1);
+        str = g_malloc (length + 1);
+        for (i = 0; i < length; i++) {
+                str[i] = 'a' + g_rand_int_range (rand, 0, 3);
+        }
+        str[length] = '\0';
+
+        return str;
+}
+
+static gboolean
+match_naively (char      **patterns,
+               const char *str)
+{
+        int i;
+
+        for (i = 0; patterns[i] != NULL; i++) {
+                if (g_strstr_len (str, -1, patterns[i]) != NULL) {
+                        return TRUE;
+                }
+        }
+
+        return FALSE;
+}
+
+static int
+check (int iterations)
+{
+        GRand *rand;
+        int    failures;
+        int    i;
+
+        rand = g_rand_new_with_seed (1);
+        failures = 0;
+
+        for (i = 0; i < iterations; i++) {
+                CsmSubstringMatcher *matcher;
+                char               **patterns;
+                int                  n_patterns;
+                int                  j;
+
+                n_patterns = g_rand_int_range (rand, 0, 6);
+                patterns = g_new0 (char *, n_patterns + 1);
+                for (j = 0; j < n_patterns; j++) {
+                        patterns[j] = random_string (rand, 4);
+                }
+
+                matcher = csm_substring_matcher_new ((const char * const *) patterns);
+
+                for (j = 0; j < 20; j++) {
+                        char *str;
+
+                        str = random_string (rand, 12);
+                        if (csm_substring_matcher_match (matcher, str) != match_naively (patterns, str)) {
+                                g_printerr ("Mismatch for \"%s\"\n", str);
+                                failures++;
+                        }
+                        g_free (str);
+                }
+
+                csm_substring_matcher_free (matcher);
+                g_strfreev (patterns);
+        }
+
+        g_rand_free (rand);
+
+        return failures;
+}
+
+static void
+benchmark (int count)
+{
+        char *patterns[] = { "gnome-settings-daemon", "org.gnome.SettingsDaemon",
+                             "gnome-fallback-mount-helper", "gnome-screensaver",
+                             "mate-settings-daemon", "nautilus-autostart",
+                             "gnome-initial-setup-copy-worker", "ubuntu-mate-welcome",
+                             NULL };
+        CsmSubstringMatcher *matcher;
+        char               **names;
+        gint64               start;
+        gint64               naive;
+        gint64               compiled;
+        guint                hits;
+        int                  i;
+
+        names = g_new0 (char *, count + 1);
+        for (i = 0; i < count; i++) {
+                names[i] = g_strdup_printf ("org.example.autostart-application-%d.desktop", i);
+        }
+
+        hits = 0;
+        start = g_get_monotonic_time ();
+        for (i = 0; i < count; i++) {
+                hits += match_naively (patterns, names[i]);
+        }
+        naive = g_get_monotonic_time () - start;
+
+        start = g_get_monotonic_time ();
+        matcher = csm_substring_matcher_new ((const char * const *) patterns);
+        for (i = 0; i < count; i++) {
+                hits += csm_substring_matcher_match (matcher, names[i]);
+        }
+        compiled = g_get_monotonic_time () - start;
+        csm_substring_matcher_free (matcher);
+
+        g_print ("%d names, %u hits\n", count, hits);
+        g_print ("g_strstr_len:  %8" G_GINT64_FORMAT " us\n", naive);
+        g_print ("matcher:       %8" G_GINT64_FORMAT " us (including building it)\n", compiled);
+
+        g_strfreev (names);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+        int count = 100000;
+        int failures;
+
+        if (argc > 2) {
+                g_printerr ("Too many arguments.\n");
+                g_printerr ("Usage: %s [COUNT]\n", argv[0]);
+                return 1;
+        }
+
+        if (argc == 2) {
+                int i = atoi (argv[1]);
+                if (i > 0)
+                        count = i;
+        }
+
+        failures = check (10000);
+        g_print ("%d mismatches\n", failures);
+
+        benchmark (count);
+
+        return failures > 0 ? 1 : 0;
+}